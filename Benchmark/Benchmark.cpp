@@ -0,0 +1,522 @@
+#include "pch.h"
+#include "TerrainPresets.h"
+#include "MarchingCubes.h"
+#include "MeshOptimizer.h"
+#include "KdTree.h"
+#include "JobSystem.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// Headless benchmark of the terrain pipeline.
+// Every preset is generated at every resolution and noise scale several times, each run times
+// density generation, meshing, the KdTree build and a fixed set of rays, the same steps the game takes
+// when it generates terrain on the CPU. Results go to a CSV and a JSON file with min, median and p95
+// of every stage, so runs on different commits and machines can be compared.
+
+namespace BenchmarkConfig
+{
+	//Same settings GeometryData generates terrain with
+	const float ISO_LEVEL = 0.0f;
+	const unsigned int CHUNK_SIZE = 16;
+	const DensityFormat::Enum DENSITY_FORMAT = DensityFormat::SNORM16;
+	const BrickLayout::Enum BRICK_LAYOUT = BrickLayout::MORTON;
+
+	const unsigned int SIZES[] = { 16, 32, 64, 128, 256 };
+	//Covers the range of the noise scale slider
+	const float NOISE_SCALES[] = { 10.0f, 40.0f, 100.0f };
+	const size_t RUNS = 5;
+
+	//The ray set only depends on the seed, so hit counts can be compared between runs as well
+	const size_t RAY_COUNT = 10000;
+	const unsigned int RAY_SEED = 1234;
+	//Rays start on a sphere around the [-1,1] mesh space and aim at a point inside it
+	const float RAY_START_RADIUS = 2.0f;
+	const float RAY_RANGE = 10.0f;
+}
+
+namespace
+{
+	struct Options
+	{
+		std::vector<unsigned int> sizes;
+		std::vector<float> noiseScales;
+		std::vector<TerrainPresets::Type::Enum> presets;
+		size_t runs = BenchmarkConfig::RUNS;
+		size_t rayCount = BenchmarkConfig::RAY_COUNT;
+		size_t threads = 0;
+		std::string csvPath = "benchmark.csv";
+		std::string jsonPath = "benchmark.json";
+		std::string tracePath;
+		// Measuring the metrics adds a little to the timed stages, rays most of all
+		std::string metricsPath;
+	};
+
+	struct Result
+	{
+		TerrainPresets::Type::Enum preset;
+		unsigned int size;
+		float noiseScale;
+		const char* stage;
+		std::vector<double> times = {};
+		size_t triangles = 0;
+		size_t hits = 0;
+		// Shape of the last tree built, kdtree stage only
+		bool hasStatistics = false;
+		KdTree::Statistics statistics = {};
+		// Mean work per ray, rays stage only
+		double nodesPerRay = 0.0, trianglesPerRay = 0.0;
+	};
+
+	struct Summary
+	{
+		double min, median, p95;
+	};
+
+	Summary Summarize(std::vector<double> times)
+	{
+		std::sort(times.begin(), times.end());
+
+		//Nearest rank, with few runs the p95 is the slowest one
+		Summary summary;
+		summary.min = times.front();
+		summary.median = times.size() % 2 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) * 0.5;
+		summary.p95 = times[static_cast<size_t>(std::ceil(0.95 * times.size())) - 1];
+		return summary;
+	}
+
+	double Measure(const std::function<void()>& stage)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		stage();
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	std::vector<Ray> CreateRays(size_t count)
+	{
+		std::mt19937 random(BenchmarkConfig::RAY_SEED);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+		std::vector<Ray> rays(count);
+		for (Ray& ray : rays)
+		{
+			Vector3 start(unit(random), unit(random), unit(random));
+			Vector3 target(unit(random), unit(random), unit(random));
+			start.Normalize();
+
+			ray.position = start * BenchmarkConfig::RAY_START_RADIUS;
+			ray.direction = target - ray.position;
+			ray.direction.Normalize();
+		}
+
+		return rays;
+	}
+
+	std::vector<KdTree::Triangle*>* CreateTreeTriangles(const std::vector<MeshChunk>& chunks)
+	{
+		std::vector<KdTree::Triangle*>* triangles = new std::vector<KdTree::Triangle*>();
+		for (const MeshChunk& mesh : chunks)
+		{
+			for (size_t i = 2u; i < mesh.indices.size(); i += 3)
+			{
+				KdTree::Triangle* tri = new KdTree::Triangle();
+				tri->vertices[0] = mesh.positions[mesh.indices[i - 2]];
+				tri->vertices[1] = mesh.positions[mesh.indices[i - 1]];
+				tri->vertices[2] = mesh.positions[mesh.indices[i]];
+				tri->CalculateGreatest();
+				tri->CalculateSmallest();
+				triangles->push_back(tri);
+			}
+		}
+
+		return triangles;
+	}
+
+	// Density, meshing, KdTree and ray stages of one preset, resolution and noise scale
+	void RunVolume(TerrainPresets::Type::Enum preset, unsigned int size, float noiseScale, const Options& options, const std::vector<Ray>& rays, KdTree& tree, std::vector<Result>& results)
+	{
+		Result density = { preset, size, noiseScale, "density" };
+		Result meshing = { preset, size, noiseScale, "meshing" };
+		Result building = { preset, size, noiseScale, "kdtree" };
+		Result raycasts = { preset, size, noiseScale, "rays" };
+
+		DensityGraph graph;
+		TerrainPresets::BuildDensityGraph(graph, preset, size, size, size, noiseScale);
+
+		for (size_t run = 0u; run < options.runs; ++run)
+		{
+			SparseVolume volume(size, size, size, -1.0f, BenchmarkConfig::DENSITY_FORMAT, BenchmarkConfig::BRICK_LAYOUT);
+			density.times.push_back(Measure([&]() { graph.Fill(volume); }));
+
+			std::vector<MeshChunk> chunks;
+			meshing.times.push_back(Measure([&]()
+			{
+				chunks = MarchingCubes(volume, BenchmarkConfig::ISO_LEVEL).Polygonise(BenchmarkConfig::CHUNK_SIZE);
+				MeshOptimizer::OptimizeChunks(chunks);
+			}));
+
+			//The build reorders and marks the triangles, every run starts from fresh ones
+			std::vector<KdTree::Triangle*>* triangles = CreateTreeTriangles(chunks);
+			std::vector<KdTree::Triangle*> owned = *triangles;
+			KdTree::KdNode* root = nullptr;
+			building.times.push_back(Measure([&]() { root = KdTree::KdNode::build(triangles, 0); }));
+
+			//The whole tree goes in as one patch, the same way generated terrain is handed to the game's tree.
+			//A patch over no triangles has no bounds to test rays against, small volumes of thin presets can be empty.
+			if (owned.empty())
+			{
+				KdTree::KdNode::Release(root);
+			}
+			else
+			{
+				tree.AddPatches(owned, std::vector<KdTree::KdNode*>(1, root));
+			}
+			building.statistics = tree.GetStatistics();
+			building.hasStatistics = true;
+
+			std::vector<KdTree::RayHitStruct> hits;
+			raycasts.times.push_back(Measure([&]() { tree.HitBatch(rays, BenchmarkConfig::RAY_RANGE, hits); }));
+
+			size_t hitCount = 0u, nodesVisited = 0u, trianglesTested = 0u;
+			for (const KdTree::RayHitStruct& hit : hits)
+			{
+				hitCount += hit.hitTriangle ? 1u : 0u;
+				nodesVisited += hit.nodesVisited;
+				trianglesTested += hit.trianglesTested;
+			}
+
+			meshing.triangles = building.triangles = raycasts.triangles = owned.size();
+			raycasts.hits = hitCount;
+			raycasts.nodesPerRay = hits.empty() ? 0.0 : static_cast<double>(nodesVisited) / hits.size();
+			raycasts.trianglesPerRay = hits.empty() ? 0.0 : static_cast<double>(trianglesTested) / hits.size();
+			tree.PurgeTriangles();
+		}
+
+		results.push_back(density);
+		results.push_back(meshing);
+		results.push_back(building);
+		results.push_back(raycasts);
+	}
+
+	// Heightfields are meshed from their grid and answer rays themselves, they have no KdTree stage
+	void RunHeightfield(unsigned int size, float noiseScale, const Options& options, const std::vector<Ray>& rays, std::vector<Result>& results)
+	{
+		TerrainPresets::Type::Enum preset = TerrainPresets::Type::HEIGHT_MAP;
+		Result density = { preset, size, noiseScale, "density" };
+		Result meshing = { preset, size, noiseScale, "meshing" };
+		Result raycasts = { preset, size, noiseScale, "rays" };
+
+		for (size_t run = 0u; run < options.runs; ++run)
+		{
+			Heightfield heightfield(size, size);
+			density.times.push_back(Measure([&]() { TerrainPresets::FillHeightfield(heightfield, noiseScale); }));
+
+			MeshChunk mesh;
+			meshing.times.push_back(Measure([&]() { heightfield.Mesh(mesh); }));
+
+			std::vector<uint8_t> hits(rays.size(), 0u);
+			raycasts.times.push_back(Measure([&]()
+			{
+				ParallelFor(rays.size(), [&](size_t i)
+				{
+					float distance = 0.0f;
+					hits[i] = heightfield.Raycast(rays[i].position, rays[i].direction, BenchmarkConfig::RAY_RANGE, distance) ? 1u : 0u;
+				});
+			}));
+
+			meshing.triangles = raycasts.triangles = mesh.indices.size() / 3;
+			raycasts.hits = std::count(hits.begin(), hits.end(), 1u);
+		}
+
+		results.push_back(density);
+		results.push_back(meshing);
+		results.push_back(raycasts);
+	}
+
+	bool WriteCsv(const std::string& path, const std::vector<Result>& results)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			printf("Benchmark: could not write %s\n", path.c_str());
+			return false;
+		}
+
+		file << "preset,size,noise_scale,stage,runs,min_ms,median_ms,p95_ms,triangles,hits,sah_cost,duplication,nodes_per_ray,triangles_per_ray\n";
+		for (const Result& result : results)
+		{
+			Summary summary = Summarize(result.times);
+			file << TerrainPresets::GetName(result.preset) << ',' << result.size << ',' << result.noiseScale << ',' << result.stage << ','
+				<< result.times.size() << ',' << summary.min << ',' << summary.median << ',' << summary.p95 << ','
+				<< result.triangles << ',' << result.hits << ',' << result.statistics.sahCost << ',' << result.statistics.duplication << ','
+				<< result.nodesPerRay << ',' << result.trianglesPerRay << '\n';
+		}
+
+		return true;
+	}
+
+	bool WriteJson(const std::string& path, const std::vector<Result>& results, const Options& options)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			printf("Benchmark: could not write %s\n", path.c_str());
+			return false;
+		}
+
+		file << "{\n\t\"threads\": " << JobSystem::Get().GetThreadCount() << ",\n\t\"runs\": " << options.runs
+			<< ",\n\t\"rays\": " << options.rayCount << ",\n\t\"results\": [\n";
+		for (size_t i = 0u; i < results.size(); ++i)
+		{
+			const Result& result = results[i];
+			Summary summary = Summarize(result.times);
+			file << "\t\t{ \"preset\": \"" << TerrainPresets::GetName(result.preset) << "\", \"size\": " << result.size
+				<< ", \"noise_scale\": " << result.noiseScale << ", \"stage\": \"" << result.stage
+				<< "\", \"min_ms\": " << summary.min << ", \"median_ms\": " << summary.median << ", \"p95_ms\": " << summary.p95
+				<< ", \"triangles\": " << result.triangles << ", \"hits\": " << result.hits
+				<< ", \"nodes_per_ray\": " << result.nodesPerRay << ", \"triangles_per_ray\": " << result.trianglesPerRay;
+			if (result.hasStatistics)
+			{
+				const KdTree::Statistics& statistics = result.statistics;
+				file << ", \"tree\": { \"nodes\": " << statistics.nodes << ", \"leaves\": " << statistics.leaves
+					<< ", \"cut_leaves\": " << statistics.cutLeaves << ", \"max_depth\": " << statistics.maxDepth
+					<< ", \"average_leaf_depth\": " << statistics.averageLeafDepth << ", \"triangle_references\": " << statistics.triangleReferences
+					<< ", \"duplication\": " << statistics.duplication << ", \"sah_cost\": " << statistics.sahCost << ", \"leaf_occupancy\": [";
+				for (size_t bucket = 0u; bucket < KdTree::OCCUPANCY_BUCKETS; ++bucket)
+				{
+					file << (bucket ? ", " : "") << statistics.leafOccupancy[bucket];
+				}
+				file << "] }";
+			}
+			file << ", \"times_ms\": [";
+			for (size_t run = 0u; run < result.times.size(); ++run)
+			{
+				file << (run ? ", " : "") << result.times[run];
+			}
+			file << "] }" << (i + 1u < results.size() ? "," : "") << '\n';
+		}
+		file << "\t]\n}\n";
+
+		return true;
+	}
+
+	template<typename T>
+	bool ParseList(const char* text, std::vector<T>& output)
+	{
+		output.clear();
+		for (const char* start = text; *start; )
+		{
+			char* end = nullptr;
+			double value = std::strtod(start, &end);
+			if (end == start || value <= 0.0)
+			{
+				return false;
+			}
+
+			output.push_back(static_cast<T>(value));
+			start = *end == ',' ? end + 1 : end;
+		}
+
+		return !output.empty();
+	}
+
+	bool ParsePresets(const char* text, std::vector<TerrainPresets::Type::Enum>& output)
+	{
+		output.clear();
+		std::string names(text);
+		for (size_t start = 0u; start <= names.size(); )
+		{
+			size_t end = std::min(names.find(',', start), names.size());
+			std::string name = names.substr(start, end - start);
+
+			bool found = false;
+			for (int type = 0; type < TerrainPresets::Type::COUNT; ++type)
+			{
+				if (name == TerrainPresets::GetName(static_cast<TerrainPresets::Type::Enum>(type)))
+				{
+					output.push_back(static_cast<TerrainPresets::Type::Enum>(type));
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				return false;
+			}
+
+			start = end + 1u;
+		}
+
+		return true;
+	}
+
+	void PrintUsage()
+	{
+		printf("Usage: Benchmark [options]\n"
+			"  --presets a,b   presets to run, default all of them\n"
+			"  --sizes 16,32   volume resolutions, default 16,32,64,128,256\n"
+			"  --scales 10,40  noise scales for presets that use one, default 10,40,100\n"
+			"  --runs n        runs per configuration, default %zu\n"
+			"  --rays n        rays per run, default %zu\n"
+			"  --threads n     job system threads, default all cores\n"
+			"  --csv path      default benchmark.csv\n"
+			"  --json path     default benchmark.json\n"
+			"  --trace path    also write a Chrome trace of the newest profiler zones\n"
+			"  --metrics path  also write a JSON line of counters, gauges and latency histograms every second\n", BenchmarkConfig::RUNS, BenchmarkConfig::RAY_COUNT);
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		options.sizes.assign(std::begin(BenchmarkConfig::SIZES), std::end(BenchmarkConfig::SIZES));
+		options.noiseScales.assign(std::begin(BenchmarkConfig::NOISE_SCALES), std::end(BenchmarkConfig::NOISE_SCALES));
+		for (int type = 0; type < TerrainPresets::Type::COUNT; ++type)
+		{
+			options.presets.push_back(static_cast<TerrainPresets::Type::Enum>(type));
+		}
+
+		for (int i = 1; i < argc; ++i)
+		{
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+			bool parsed = value != nullptr;
+
+			if (parsed && !std::strcmp(argv[i], "--presets"))
+			{
+				parsed = ParsePresets(value, options.presets);
+			}
+			else if (parsed && !std::strcmp(argv[i], "--sizes"))
+			{
+				parsed = ParseList(value, options.sizes);
+			}
+			else if (parsed && !std::strcmp(argv[i], "--scales"))
+			{
+				parsed = ParseList(value, options.noiseScales);
+			}
+			else if (parsed && !std::strcmp(argv[i], "--runs"))
+			{
+				options.runs = std::strtoul(value, nullptr, 10);
+				parsed = options.runs > 0u;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--rays"))
+			{
+				options.rayCount = std::strtoul(value, nullptr, 10);
+			}
+			else if (parsed && !std::strcmp(argv[i], "--threads"))
+			{
+				options.threads = std::strtoul(value, nullptr, 10);
+			}
+			else if (parsed && !std::strcmp(argv[i], "--csv"))
+			{
+				options.csvPath = value;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--json"))
+			{
+				options.jsonPath = value;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--trace"))
+			{
+				options.tracePath = value;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--metrics"))
+			{
+				options.metricsPath = value;
+			}
+			else
+			{
+				parsed = false;
+			}
+
+			if (!parsed)
+			{
+				if (std::strcmp(argv[i], "--help"))
+				{
+					printf("Benchmark: bad argument %s\n", argv[i]);
+				}
+				return false;
+			}
+			++i;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	Profiler::Get().SetThreadName("Main");
+	JobSystem::Get().SetThreadCount(options.threads);
+	if (!options.metricsPath.empty() && !Metrics::Get().StartDump(options.metricsPath, 1.0))
+	{
+		return 1;
+	}
+	printf("Benchmark: %zu threads, %zu runs, %zu rays\n", JobSystem::Get().GetThreadCount(), options.runs, options.rayCount);
+
+	std::vector<Ray> rays = CreateRays(options.rayCount);
+	std::vector<Result> results;
+	KdTree tree;
+
+	for (TerrainPresets::Type::Enum preset : options.presets)
+	{
+		//Presets without noise would produce the same terrain for every scale
+		std::vector<float> noiseScales = TerrainPresets::UsesNoiseScale(preset) ? options.noiseScales : std::vector<float>(1, 0.0f);
+
+		for (unsigned int size : options.sizes)
+		{
+			for (float noiseScale : noiseScales)
+			{
+				size_t first = results.size();
+				if (preset == TerrainPresets::Type::HEIGHT_MAP)
+				{
+					RunHeightfield(size, noiseScale, options, rays, results);
+				}
+				else
+				{
+					RunVolume(preset, size, noiseScale, options, rays, tree, results);
+				}
+
+				for (size_t i = first; i < results.size(); ++i)
+				{
+					Summary summary = Summarize(results[i].times);
+					printf("%-12s %4u %6.1f %-8s min %9.3f ms  median %9.3f ms  p95 %9.3f ms\n", TerrainPresets::GetName(preset), size, noiseScale,
+						results[i].stage, summary.min, summary.median, summary.p95);
+
+					const Result& result = results[i];
+					if (result.hasStatistics)
+					{
+						printf("%-31s %zu nodes, %zu leaves (%zu cut), depth %zu max %.1f mean, %.2fx references, SAH cost %.1f\n", "",
+							result.statistics.nodes, result.statistics.leaves, result.statistics.cutLeaves, result.statistics.maxDepth,
+							result.statistics.averageLeafDepth, result.statistics.duplication, result.statistics.sahCost);
+					}
+					if (result.nodesPerRay > 0.0)
+					{
+						printf("%-31s %.1f nodes visited, %.1f triangles tested per ray\n", "", result.nodesPerRay, result.trianglesPerRay);
+					}
+				}
+			}
+		}
+	}
+
+	//Writes the line of the last interval
+	Metrics::Get().StopDump();
+
+	bool written = WriteCsv(options.csvPath, results);
+	written = WriteJson(options.jsonPath, results, options) && written;
+	if (!options.tracePath.empty())
+	{
+		written = Profiler::Get().WriteChromeTrace(options.tracePath) && written;
+	}
+	return written ? 0 : 1;
+}
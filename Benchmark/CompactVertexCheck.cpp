@@ -0,0 +1,168 @@
+#include "pch.h"
+#include "CompactVertex.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Round trip accuracy checks of CompactVertexEncoder, without a device.
+// Positions are encoded relative to several mesh bounds, at their corners, faces and centre and at random inside,
+// and normals along the axes, across the fold seam of the lower hemisphere and at random on the sphere. Every set has
+// to come back within the tolerance VerifyRoundTrip asserts. Returns 1 when any check fails.
+
+namespace CompactVertexCheckConfig
+{
+	const size_t RANDOM_SAMPLES = 1 << 16;
+	const unsigned int SEED = 42;
+}
+
+namespace
+{
+	struct Bounds
+	{
+		const char* name;
+		XMFLOAT3 boundsMin, boundsMax;
+	};
+
+	const Bounds BOUNDS[] = {
+		{ "unit", XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(1.0f, 1.0f, 1.0f) },
+		{ "terrain", XMFLOAT3(-512.0f, -40.0f, -512.0f), XMFLOAT3(512.0f, 160.0f, 512.0f) },
+		{ "offset", XMFLOAT3(100.0f, 200.0f, -300.0f), XMFLOAT3(164.0f, 232.0f, -236.0f) },
+		//A flat patch has no extent in y
+		{ "flat", XMFLOAT3(0.0f, 5.0f, 0.0f), XMFLOAT3(64.0f, 5.0f, 64.0f) } };
+
+	XMFLOAT3 Normalize(float x, float y, float z)
+	{
+		float length = std::sqrt(x * x + y * y + z * z);
+		return XMFLOAT3(x / length, y / length, z / length);
+	}
+
+	float Lerp(float from, float to, float t)
+	{
+		return from + (to - from) * t;
+	}
+
+	bool Check(const CompactVertexEncoder& encoder, const char* bounds, const char* set, const std::vector<XMFLOAT3>& positions, const std::vector<XMFLOAT3>& normals)
+	{
+		float maxPositionError, maxNormalError;
+		bool passed = encoder.VerifyRoundTrip(positions.data(), normals.data(), positions.size(), maxPositionError, maxNormalError);
+		printf("%-8s %-14s %6zu vertices  position error %.3g  normal error %.3g  %s\n", bounds, set, positions.size(), maxPositionError, maxNormalError, passed ? "pass" : "FAIL");
+		return passed;
+	}
+
+	// The corners, face centres and centre of the bounds
+	std::vector<XMFLOAT3> CreateBoundsPositions(const Bounds& bounds)
+	{
+		const float steps[] = { 0.0f, 0.5f, 1.0f };
+
+		std::vector<XMFLOAT3> positions;
+		for (float x : steps)
+		{
+			for (float y : steps)
+			{
+				for (float z : steps)
+				{
+					positions.push_back(XMFLOAT3(Lerp(bounds.boundsMin.x, bounds.boundsMax.x, x), Lerp(bounds.boundsMin.y, bounds.boundsMax.y, y),
+						Lerp(bounds.boundsMin.z, bounds.boundsMax.z, z)));
+				}
+			}
+		}
+		return positions;
+	}
+
+	// Along the axes, on the diagonals and around the seam where the lower hemisphere folds over them
+	std::vector<XMFLOAT3> CreateEdgeNormals()
+	{
+		const float tiny = 1e-6f;
+
+		std::vector<XMFLOAT3> normals = {
+			XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f),
+			XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, -1.0f, 0.0f),
+			XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f),
+			//The negative zeros land on the x >= 0 side of the fold
+			XMFLOAT3(-0.0f, 0.0f, -1.0f), XMFLOAT3(0.0f, -0.0f, -1.0f),
+			Normalize(tiny, tiny, -1.0f), Normalize(-tiny, -tiny, -1.0f),
+			Normalize(1.0f, 1.0f, 1.0f), Normalize(-1.0f, 1.0f, -1.0f), Normalize(1.0f, -1.0f, -1.0f), Normalize(-1.0f, -1.0f, -1.0f) };
+
+		//Just above and below the equator, and on the folded edges x = 0 and y = 0 of the lower hemisphere
+		for (int i = 0; i < 16; ++i)
+		{
+			float angle = 2.0f * 3.14159265f * i / 16;
+			float c = std::cos(angle), s = std::sin(angle);
+			normals.push_back(Normalize(c, s, tiny));
+			normals.push_back(Normalize(c, s, -tiny));
+			normals.push_back(Normalize(c, 0.0f, -std::fabs(s) - tiny));
+			normals.push_back(Normalize(0.0f, c, -std::fabs(s) - tiny));
+		}
+		return normals;
+	}
+
+	bool CheckBounds(const Bounds& bounds, std::mt19937& random)
+	{
+		CompactVertexEncoder encoder(bounds.boundsMin, bounds.boundsMax);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::normal_distribution<float> gaussian;
+
+		std::vector<XMFLOAT3> edgeNormals = CreateEdgeNormals();
+
+		//Every corner with every edge case normal
+		std::vector<XMFLOAT3> positions, normals;
+		for (const XMFLOAT3& position : CreateBoundsPositions(bounds))
+		{
+			for (const XMFLOAT3& normal : edgeNormals)
+			{
+				positions.push_back(position);
+				normals.push_back(normal);
+			}
+		}
+		bool passed = Check(encoder, bounds.name, "edges", positions, normals);
+
+		//Random positions inside with normals uniform on the sphere, and again with all of them below the equator
+		for (int lower = 0; lower < 2; ++lower)
+		{
+			positions.clear();
+			normals.clear();
+			for (size_t i = 0u; i < CompactVertexCheckConfig::RANDOM_SAMPLES; ++i)
+			{
+				positions.push_back(XMFLOAT3(Lerp(bounds.boundsMin.x, bounds.boundsMax.x, unit(random)), Lerp(bounds.boundsMin.y, bounds.boundsMax.y, unit(random)),
+					Lerp(bounds.boundsMin.z, bounds.boundsMax.z, unit(random))));
+
+				float x = gaussian(random), y = gaussian(random), z = gaussian(random);
+				normals.push_back(Normalize(x, y, lower ? -std::fabs(z) : z));
+			}
+			passed = Check(encoder, bounds.name, lower ? "random z < 0" : "random", positions, normals) && passed;
+		}
+
+		return passed;
+	}
+
+	// The box corners have to come back as the bounds themselves, the vertex shader maps them there
+	bool CheckCorners(const Bounds& bounds)
+	{
+		CompactVertexEncoder encoder(bounds.boundsMin, bounds.boundsMax);
+
+		XMFLOAT3 position, normal;
+		encoder.Decode(encoder.Encode(bounds.boundsMin, XMFLOAT3(0.0f, 1.0f, 0.0f), 7), position, normal);
+		CompactVertex vertex = encoder.Encode(bounds.boundsMax, XMFLOAT3(0.0f, 1.0f, 0.0f), 7);
+
+		bool passed = position.x == bounds.boundsMin.x && position.y == bounds.boundsMin.y && position.z == bounds.boundsMin.z;
+		passed = passed && vertex.position[0] == 65535 && vertex.position[2] == 65535 && vertex.material == 7 && vertex.padding == 0;
+		printf("%-8s %-14s %s\n", bounds.name, "corners exact", passed ? "pass" : "FAIL");
+		return passed;
+	}
+}
+
+int main()
+{
+	std::mt19937 random(CompactVertexCheckConfig::SEED);
+
+	bool passed = true;
+	for (const Bounds& bounds : BOUNDS)
+	{
+		passed = CheckBounds(bounds, random) && passed;
+		passed = CheckCorners(bounds) && passed;
+	}
+
+	printf("CompactVertexCheck: %s\n", passed ? "passed" : "FAILED");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,500 @@
+#include "pch.h"
+#include "Noise.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// Micro-benchmark and accuracy suite of the simplex noise in Noise.cpp.
+// Every noise path is timed in ns per sample on random, coherent-row and strided access patterns, and checked
+// against the double implementation the terrain has always been generated with: a table of its values, agreement
+// on every pattern and the [-1,1] range it claims. A new noise kernel has to pass here before it replaces the
+// old one, the program returns 1 when any check fails.
+
+namespace NoiseBenchmarkConfig
+{
+	const size_t SAMPLES = 1 << 16;
+	//Not a multiple of four, so the batch paths are checked on a partial last block too
+	const size_t VALIDATION_SAMPLES = (1 << 20) + 3;
+	const size_t RUNS = 9;
+	const unsigned int SEED = 42;
+
+	//Noise coordinates stay inside [-DOMAIN, DOMAIN], well past what the noise scales of the game reach
+	const float DOMAIN = 256.0f;
+	//Grid patterns walk rows of this many samples, then step in y and then in z
+	const size_t ROW_LENGTH = 256;
+	//Coherent rows step like voxels of a 256 wide volume at the largest noise scale
+	const float ROW_STEP = 100.0f / 256.0f;
+	//Strided samples skip several cells between neighbours, so they never share corners
+	const float STRIDE = 7.31f;
+
+	//The double kernel against its golden values, only leaves room for compilers rounding differently
+	const double GOLDEN_TOLERANCE = 1e-12;
+	//Single precision paths against the double kernel, coordinates near DOMAIN keep about 1e-5 of a cell
+	const double TOLERANCE = 1e-3;
+	//Noise3D jumps across some simplex faces. A float path that lands on the other side of such a face
+	//matches the reference this close by and is counted as a discontinuity instead of a failure.
+	const double DISCONTINUITY_PROBE = 1e-4;
+	//Steepest slope of the noise where it is continuous, measured at about 6 per unit on random points
+	const double NOISE_GRADIENT = 8.0;
+	//The probe is halved this often towards the larger change, a jump keeps its size while a slope shrinks with it
+	const int JUMP_BISECTIONS = 7;
+	//Only a change this many times larger than the slope allows across the halved probe is a jump
+	const double JUMP_FACTOR = 4.0;
+	//Share of the samples of a path that may be excused as discontinuities. Single precision coordinates near DOMAIN
+	//put about 3e-5 of random samples across a face, the strided pattern repeats its few coordinates on every row
+	//and lands about 1e-3 there.
+	const double MAX_DISCONTINUITY_SHARE = 2e-3;
+}
+
+namespace
+{
+	struct Golden
+	{
+		double x, y, z, noise;
+	};
+
+	//Noise3D(x, y, z) of the double implementation when this suite was written
+	const Golden GOLDEN_3D[] = {
+		{ 0.0, 0.0, 0.0, 0.0 },
+		{ 0.5, 0.5, 0.5, 0.0 },
+		{ -1.0, -1.0, -1.0, 0.0 },
+		{ 0.1, 0.2, 0.3, 0.36729772799999988 },
+		{ 1.25, -3.5, 7.75, 0.046229655349795062 },
+		{ 3.3, 4.4, 5.5, -0.58276000000000061 },
+		{ 12.3, 45.6, 78.9, 0.18599853866667629 },
+		{ -100.25, 50.5, -0.125, -0.18465475476580681 },
+		{ 255.5, -255.5, 128.25, -0.097786588541648456 },
+		{ -17.75, -33.125, -2.5, -0.1746095618212665 },
+		{ 64.2, 0.3, -8.9, -0.2491403443621307 },
+		{ 1000.1, 2000.2, -3000.3, 0.25143097599989844 } };
+
+	//Noise2D(x, y) of the double implementation when this suite was written, z is unused
+	const Golden GOLDEN_2D[] = {
+		{ 0.0, 0.0, 0.0, 0.0 },
+		{ 0.5, 0.5, 0.0, -0.30715651362721619 },
+		{ -1.0, -1.0, 0.0, 0.45254757791886041 },
+		{ 0.1, 0.2, 0.0, -0.29410756987224201 },
+		{ 1.25, -3.5, 0.0, 0.11753539787613272 },
+		{ 3.3, 4.4, 0.0, 0.16986194671871319 },
+		{ 12.3, 45.6, 0.0, 0.38750351332326904 },
+		{ -100.25, 50.5, 0.0, 0.56010809450288379 },
+		{ 255.5, -255.5, 0.0, 0.49894467707745427 },
+		{ -17.75, -33.125, 0.0, -0.037645631615821344 },
+		{ 64.2, 0.3, 0.0, -0.49594219645541776 },
+		{ 1000.1, -3000.3, 0.0, -0.40447363183985563 } };
+
+	struct Path
+	{
+		enum Enum
+		{
+			// Noise2D/3D one point per call on double coordinates, the reference every other path is checked against
+			SCALAR,
+			// Float arrays through the double kernel point by point, the way DensityGraph's leaf batch does it
+			BATCHED,
+			// Noise2DBatch/3DBatch, four points at a time in single precision
+			SIMD,
+			COUNT
+		};
+	};
+
+	const char* PATH_NAMES[Path::COUNT] = { "scalar", "batched", "simd" };
+
+	// Coordinates of one access pattern, 2D noise reads x and y
+	struct Samples
+	{
+		const char* pattern;
+		std::vector<float> x, y, z;
+		std::vector<double> xd, yd, zd;
+	};
+
+	struct Options
+	{
+		size_t samples = NoiseBenchmarkConfig::SAMPLES;
+		size_t runs = NoiseBenchmarkConfig::RUNS;
+		bool validateOnly = false;
+		std::string csvPath;
+	};
+
+	struct Timing
+	{
+		int dimensions;
+		const char* pattern;
+		Path::Enum path;
+		double minimum, median;
+	};
+
+	void FinishSamples(Samples& samples)
+	{
+		samples.xd.assign(samples.x.begin(), samples.x.end());
+		samples.yd.assign(samples.y.begin(), samples.y.end());
+		samples.zd.assign(samples.z.begin(), samples.z.end());
+	}
+
+	Samples CreateRandomSamples(size_t count)
+	{
+		std::mt19937 random(NoiseBenchmarkConfig::SEED);
+		std::uniform_real_distribution<float> coordinate(-NoiseBenchmarkConfig::DOMAIN, NoiseBenchmarkConfig::DOMAIN);
+
+		Samples samples;
+		samples.pattern = "random";
+		for (size_t i = 0u; i < count; ++i)
+		{
+			samples.x.push_back(coordinate(random));
+			samples.y.push_back(coordinate(random));
+			samples.z.push_back(coordinate(random));
+		}
+
+		FinishSamples(samples);
+		return samples;
+	}
+
+	// Rows along x, one after another in y and then in z, wrapped back into the domain
+	Samples CreateGridSamples(const char* pattern, size_t count, float step)
+	{
+		const size_t rowLength = NoiseBenchmarkConfig::ROW_LENGTH;
+		const float domain = NoiseBenchmarkConfig::DOMAIN;
+		auto wrap = [domain](float value) { return std::fmod(value, 2.0f * domain) - domain; };
+
+		Samples samples;
+		samples.pattern = pattern;
+		for (size_t i = 0u; i < count; ++i)
+		{
+			//Start off the lattice, whole coordinates are all corners
+			samples.x.push_back(wrap(0.37f + (i % rowLength) * step));
+			samples.y.push_back(wrap(0.21f + (i / rowLength % rowLength) * step));
+			samples.z.push_back(wrap(0.53f + (i / (rowLength * rowLength)) * step));
+		}
+
+		FinishSamples(samples);
+		return samples;
+	}
+
+	std::vector<Samples> CreatePatterns(size_t count)
+	{
+		std::vector<Samples> patterns;
+		patterns.push_back(CreateRandomSamples(count));
+		patterns.push_back(CreateGridSamples("rows", count, NoiseBenchmarkConfig::ROW_STEP));
+		patterns.push_back(CreateGridSamples("strided", count, NoiseBenchmarkConfig::STRIDE));
+		return patterns;
+	}
+
+	// Runs one path over all samples, the scalar path writes doubles and the others floats
+	void Run(Noise& noise, int dimensions, Path::Enum path, const Samples& samples, std::vector<double>& scalar, std::vector<float>& result)
+	{
+		size_t count = samples.x.size();
+
+		switch (path)
+		{
+		case Path::SCALAR:
+			scalar.resize(count);
+			for (size_t i = 0u; i < count; ++i)
+			{
+				scalar[i] = dimensions == 3 ? noise.Noise3D(samples.xd[i], samples.yd[i], samples.zd[i]) : noise.Noise2D(samples.xd[i], samples.yd[i]);
+			}
+			break;
+		case Path::BATCHED:
+			result.resize(count);
+			for (size_t i = 0u; i < count; ++i)
+			{
+				result[i] = static_cast<float>(dimensions == 3 ? noise.Noise3D(samples.x[i], samples.y[i], samples.z[i]) : noise.Noise2D(samples.x[i], samples.y[i]));
+			}
+			break;
+		default:
+			result.resize(count);
+			if (dimensions == 3)
+			{
+				noise.Noise3DBatch(samples.x.data(), samples.y.data(), samples.z.data(), count, result.data());
+			}
+			else
+			{
+				noise.Noise2DBatch(samples.x.data(), samples.y.data(), count, result.data());
+			}
+			break;
+		}
+	}
+
+	std::vector<double> Evaluate(Noise& noise, int dimensions, Path::Enum path, const Samples& samples)
+	{
+		std::vector<double> scalar;
+		std::vector<float> result;
+		Run(noise, dimensions, path, samples, scalar, result);
+		return path == Path::SCALAR ? scalar : std::vector<double>(result.begin(), result.end());
+	}
+
+	bool CheckGolden(Noise& noise, int dimensions)
+	{
+		const Golden* table = dimensions == 3 ? GOLDEN_3D : GOLDEN_2D;
+		size_t count = dimensions == 3 ? std::size(GOLDEN_3D) : std::size(GOLDEN_2D);
+
+		bool passed = true;
+		for (size_t i = 0u; i < count; ++i)
+		{
+			const Golden& golden = table[i];
+			double value = dimensions == 3 ? noise.Noise3D(golden.x, golden.y, golden.z) : noise.Noise2D(golden.x, golden.y);
+			if (std::fabs(value - golden.noise) > NoiseBenchmarkConfig::GOLDEN_TOLERANCE)
+			{
+				printf("NoiseBenchmark: Noise%dD(%g, %g, %g) is %.17g, golden value %.17g\n", dimensions, golden.x, golden.y, golden.z, value, golden.noise);
+				passed = false;
+			}
+		}
+
+		printf("Noise%dD golden values   %s\n", dimensions, passed ? "pass" : "FAIL");
+		return passed;
+	}
+
+	// Whether the reference jumps across the point along some axis and value matches it on one side of the jump.
+	// Without a jump the slope alone would let every sample pass a probe step away.
+	bool AtDiscontinuity(Noise& noise, int dimensions, double x, double y, double z, double value)
+	{
+		const double probe = NoiseBenchmarkConfig::DISCONTINUITY_PROBE;
+
+		for (int axis = 0; axis < dimensions; ++axis)
+		{
+			auto reference = [&](double offset)
+			{
+				double point[3] = { x, y, z };
+				point[axis] += offset;
+				return dimensions == 3 ? noise.Noise3D(point[0], point[1], point[2]) : noise.Noise2D(point[0], point[1]);
+			};
+
+			double low = -probe, high = probe;
+			double lowValue = reference(low), highValue = reference(high);
+			if (std::fabs(lowValue - value) > NoiseBenchmarkConfig::TOLERANCE && std::fabs(highValue - value) > NoiseBenchmarkConfig::TOLERANCE)
+			{
+				continue;
+			}
+
+			for (int bisection = 0; bisection < NoiseBenchmarkConfig::JUMP_BISECTIONS; ++bisection)
+			{
+				double middle = 0.5 * (low + high);
+				double middleValue = reference(middle);
+				if (std::fabs(middleValue - lowValue) > std::fabs(highValue - middleValue))
+				{
+					high = middle;
+					highValue = middleValue;
+				}
+				else
+				{
+					low = middle;
+					lowValue = middleValue;
+				}
+			}
+
+			if (std::fabs(highValue - lowValue) > NoiseBenchmarkConfig::JUMP_FACTOR * NoiseBenchmarkConfig::NOISE_GRADIENT * (high - low))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool CheckRange(int dimensions, const char* pattern, Path::Enum path, const std::vector<double>& values)
+	{
+		auto range = std::minmax_element(values.begin(), values.end());
+		bool passed = *range.first >= -1.0 && *range.second <= 1.0;
+		printf("Noise%dD %-8s %-8s range [%.6f, %.6f] %s\n", dimensions, pattern, PATH_NAMES[path], *range.first, *range.second, passed ? "pass" : "FAIL");
+		return passed;
+	}
+
+	// Every path against the scalar double kernel on one pattern, and all of them against [-1,1]
+	bool CheckPattern(Noise& noise, int dimensions, const Samples& samples)
+	{
+		std::vector<double> reference = Evaluate(noise, dimensions, Path::SCALAR, samples);
+		bool passed = CheckRange(dimensions, samples.pattern, Path::SCALAR, reference);
+
+		for (int path = Path::SCALAR + 1; path < Path::COUNT; ++path)
+		{
+			std::vector<double> values = Evaluate(noise, dimensions, static_cast<Path::Enum>(path), samples);
+
+			double maxError = 0.0;
+			size_t failures = 0u, discontinuities = 0u;
+			for (size_t i = 0u; i < values.size(); ++i)
+			{
+				double error = std::fabs(values[i] - reference[i]);
+				if (error <= NoiseBenchmarkConfig::TOLERANCE)
+				{
+					maxError = std::max(maxError, error);
+				}
+				else if (AtDiscontinuity(noise, dimensions, samples.xd[i], samples.yd[i], samples.zd[i], values[i]))
+				{
+					++discontinuities;
+				}
+				else
+				{
+					if (!failures)
+					{
+						printf("NoiseBenchmark: %s Noise%dD(%.9g, %.9g, %.9g) is %.9g, reference %.9g\n", PATH_NAMES[path], dimensions,
+							samples.x[i], samples.y[i], samples.z[i], values[i], reference[i]);
+					}
+					++failures;
+				}
+			}
+
+			//Discontinuities are rare, many of them mean the path is off everywhere and only the probe hides it
+			bool excusedMany = discontinuities > NoiseBenchmarkConfig::MAX_DISCONTINUITY_SHARE * values.size();
+			printf("Noise%dD %-8s %-8s max error %.3g, %zu over tolerance, %zu at discontinuities %s\n", dimensions, samples.pattern, PATH_NAMES[path],
+				maxError, failures, discontinuities, failures || excusedMany ? "FAIL" : "pass");
+			passed = CheckRange(dimensions, samples.pattern, static_cast<Path::Enum>(path), values) && !failures && !excusedMany && passed;
+		}
+
+		return passed;
+	}
+
+	bool Validate(Noise& noise)
+	{
+		std::vector<Samples> patterns = CreatePatterns(NoiseBenchmarkConfig::VALIDATION_SAMPLES);
+
+		bool passed = true;
+		for (int dimensions = 2; dimensions <= 3; ++dimensions)
+		{
+			passed = CheckGolden(noise, dimensions) && passed;
+			for (const Samples& samples : patterns)
+			{
+				passed = CheckPattern(noise, dimensions, samples) && passed;
+			}
+		}
+
+		return passed;
+	}
+
+	std::vector<Timing> Measure(Noise& noise, const Options& options)
+	{
+		std::vector<Samples> patterns = CreatePatterns(options.samples);
+		std::vector<Timing> timings;
+		std::vector<double> scalar;
+		std::vector<float> result;
+
+		for (int dimensions = 2; dimensions <= 3; ++dimensions)
+		{
+			for (const Samples& samples : patterns)
+			{
+				for (int path = 0; path < Path::COUNT; ++path)
+				{
+					//One untimed pass so every path starts with warm caches and sized outputs
+					Run(noise, dimensions, static_cast<Path::Enum>(path), samples, scalar, result);
+
+					std::vector<double> times;
+					for (size_t run = 0u; run < options.runs; ++run)
+					{
+						auto start = std::chrono::high_resolution_clock::now();
+						Run(noise, dimensions, static_cast<Path::Enum>(path), samples, scalar, result);
+						times.push_back(std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / samples.x.size());
+					}
+					std::sort(times.begin(), times.end());
+
+					Timing timing = { dimensions, samples.pattern, static_cast<Path::Enum>(path), times.front(), times[times.size() / 2] };
+					printf("Noise%dD %-8s %-8s min %7.2f ns  median %7.2f ns per sample\n", dimensions, samples.pattern, PATH_NAMES[path], timing.minimum, timing.median);
+					timings.push_back(timing);
+				}
+			}
+		}
+
+		return timings;
+	}
+
+	bool WriteCsv(const std::string& path, const std::vector<Timing>& timings)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			printf("NoiseBenchmark: could not write %s\n", path.c_str());
+			return false;
+		}
+
+		file << "noise,pattern,path,min_ns,median_ns\n";
+		for (const Timing& timing : timings)
+		{
+			file << timing.dimensions << "d," << timing.pattern << ',' << PATH_NAMES[timing.path] << ',' << timing.minimum << ',' << timing.median << '\n';
+		}
+
+		return true;
+	}
+
+	void PrintUsage()
+	{
+		printf("Usage: NoiseBenchmark [options]\n"
+			"  --samples n      samples per access pattern, default %zu\n"
+			"  --runs n         timed passes per path and pattern, default %zu\n"
+			"  --csv path       also write the timings to a CSV file\n"
+			"  --validate-only  only run the accuracy checks\n", NoiseBenchmarkConfig::SAMPLES, NoiseBenchmarkConfig::RUNS);
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+			if (!std::strcmp(argv[i], "--validate-only"))
+			{
+				options.validateOnly = true;
+				continue;
+			}
+
+			bool parsed = value != nullptr;
+			if (parsed && !std::strcmp(argv[i], "--samples"))
+			{
+				options.samples = std::strtoul(value, nullptr, 10);
+				parsed = options.samples > 0u;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--runs"))
+			{
+				options.runs = std::strtoul(value, nullptr, 10);
+				parsed = options.runs > 0u;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--csv"))
+			{
+				options.csvPath = value;
+			}
+			else
+			{
+				parsed = false;
+			}
+
+			if (!parsed)
+			{
+				if (std::strcmp(argv[i], "--help"))
+				{
+					printf("NoiseBenchmark: bad argument %s\n", argv[i]);
+				}
+				return false;
+			}
+			++i;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	Noise noise;
+	bool passed = Validate(noise);
+	printf("NoiseBenchmark: validation %s\n", passed ? "passed" : "FAILED");
+
+	if (!options.validateOnly)
+	{
+		std::vector<Timing> timings = Measure(noise, options);
+		if (!options.csvPath.empty())
+		{
+			passed = WriteCsv(options.csvPath, timings) && passed;
+		}
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+#include "pch.h"
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Throughput of ObjLoader in MB/s.
+// Every file is loaded several times, each load maps the file, parses it and merges its vertices. The files are in
+// the page cache after the first load, so a second column times a single pass over the mapped bytes: the most any
+// loader could reach on this machine, and what a file on a fast disk delivers. Without files a grid of the size
+// given with --generate is written and loaded, so models of millions of lines can be measured without shipping one.
+
+namespace ObjBenchmarkConfig
+{
+	const size_t RUNS = 5;
+	//About 4 lines per grid point, a 512 grid makes a 1M line file of about 30 MB
+	const unsigned int GRID_SIZE = 512;
+	const char* const GRID_PATH = "obj_benchmark_grid.obj";
+}
+
+namespace
+{
+	struct Options
+	{
+		std::vector<std::string> paths;
+		size_t runs = ObjBenchmarkConfig::RUNS;
+		size_t threads = 0;
+		unsigned int gridSize = ObjBenchmarkConfig::GRID_SIZE;
+		std::string csvPath;
+	};
+
+	struct Timing
+	{
+		std::string path;
+		double megabytes;
+		size_t lines, vertices, triangles;
+		double loadMilliseconds, scanMilliseconds;
+	};
+
+	double MedianMilliseconds(size_t runs, const std::function<void()>& run)
+	{
+		std::vector<double> times;
+		for (size_t i = 0u; i < runs; ++i)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			run();
+			times.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		}
+
+		std::sort(times.begin(), times.end());
+		return times.size() % 2 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) * 0.5;
+	}
+
+	//A wavy grid with texture coordinates and normals on every point and a quad per cell, written the way exporters do
+	bool WriteGrid(const std::string& path, unsigned int size)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			printf("ObjBenchmark: could not write %s\n", path.c_str());
+			return false;
+		}
+
+		char line[128];
+		file << "# Grid of " << size << " x " << size << " points written by ObjBenchmark\n";
+		for (unsigned int z = 0u; z < size; ++z)
+		{
+			for (unsigned int x = 0u; x < size; ++x)
+			{
+				float u = static_cast<float>(x) / (size - 1), v = static_cast<float>(z) / (size - 1);
+				file.write(line, snprintf(line, sizeof(line), "v %f %f %f\n", u * 2.0f - 1.0f, 0.1f * std::sin(u * 20.0f) * std::cos(v * 20.0f), v * 2.0f - 1.0f));
+			}
+		}
+		for (unsigned int z = 0u; z < size; ++z)
+		{
+			for (unsigned int x = 0u; x < size; ++x)
+			{
+				file.write(line, snprintf(line, sizeof(line), "vt %f %f\n", static_cast<float>(x) / (size - 1), static_cast<float>(z) / (size - 1)));
+			}
+		}
+		for (unsigned int z = 0u; z < size; ++z)
+		{
+			for (unsigned int x = 0u; x < size; ++x)
+			{
+				file.write(line, snprintf(line, sizeof(line), "vn %f %f %f\n", 0.0f, 1.0f, 0.0f));
+			}
+		}
+		file << "g grid\ns 1\n";
+		for (unsigned int z = 1u; z < size; ++z)
+		{
+			for (unsigned int x = 1u; x < size; ++x)
+			{
+				unsigned int a = (z - 1) * size + x, b = a + 1, c = b + size, d = a + size;
+				file.write(line, snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c, d, d, d));
+			}
+		}
+
+		return static_cast<bool>(file);
+	}
+
+	bool Measure(const std::string& path, size_t runs, Timing& timing)
+	{
+		std::wstring widePath = std::filesystem::path(path).wstring();
+
+		MappedFile file;
+		if (!file.Open(widePath))
+		{
+			printf("ObjBenchmark: could not open %s\n", path.c_str());
+			return false;
+		}
+
+		//One load to check the file and page it in
+		ObjLoader::Mesh mesh;
+		if (!ObjLoader::Load(widePath, mesh))
+		{
+			return false;
+		}
+
+		timing.path = path;
+		timing.megabytes = file.GetSize() / (1024.0 * 1024.0);
+		timing.lines = std::count(file.GetData(), file.GetData() + file.GetSize(), '\n');
+		timing.vertices = mesh.vertices.size();
+		timing.triangles = mesh.indices.size() / 3;
+
+		timing.loadMilliseconds = MedianMilliseconds(runs, [&]() { ObjLoader::Load(widePath, mesh); });
+
+		//Touches every byte once, as fast as a line count gets
+		size_t lines = 0u;
+		timing.scanMilliseconds = MedianMilliseconds(runs, [&]() { lines = std::count(file.GetData(), file.GetData() + file.GetSize(), '\n'); });
+		return lines == timing.lines;
+	}
+
+	bool WriteCsv(const std::string& path, const std::vector<Timing>& timings)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			printf("ObjBenchmark: could not write %s\n", path.c_str());
+			return false;
+		}
+
+		file << "file,megabytes,lines,vertices,triangles,load_ms,load_mb_per_s,scan_ms,scan_mb_per_s\n";
+		for (const Timing& timing : timings)
+		{
+			file << timing.path << ',' << timing.megabytes << ',' << timing.lines << ',' << timing.vertices << ',' << timing.triangles << ','
+				<< timing.loadMilliseconds << ',' << timing.megabytes * 1000.0 / timing.loadMilliseconds << ','
+				<< timing.scanMilliseconds << ',' << timing.megabytes * 1000.0 / timing.scanMilliseconds << '\n';
+		}
+
+		return true;
+	}
+
+	void PrintUsage()
+	{
+		printf("Usage: ObjBenchmark [options] [file.obj ...]\n"
+			"  --runs n       timed loads per file, default %zu\n"
+			"  --threads n    job system threads, default all cores\n"
+			"  --generate n   without files, write and load a grid of n x n points, default %u\n"
+			"  --csv path     also write the timings to a CSV file\n", ObjBenchmarkConfig::RUNS, ObjBenchmarkConfig::GRID_SIZE);
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+			if (std::strncmp(argv[i], "--", 2))
+			{
+				options.paths.push_back(argv[i]);
+				continue;
+			}
+
+			bool parsed = value != nullptr;
+			if (parsed && !std::strcmp(argv[i], "--runs"))
+			{
+				options.runs = std::strtoul(value, nullptr, 10);
+				parsed = options.runs > 0u;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--threads"))
+			{
+				options.threads = std::strtoul(value, nullptr, 10);
+			}
+			else if (parsed && !std::strcmp(argv[i], "--generate"))
+			{
+				options.gridSize = std::strtoul(value, nullptr, 10);
+				parsed = options.gridSize >= 2u;
+			}
+			else if (parsed && !std::strcmp(argv[i], "--csv"))
+			{
+				options.csvPath = value;
+			}
+			else
+			{
+				parsed = false;
+			}
+
+			if (!parsed)
+			{
+				if (std::strcmp(argv[i], "--help"))
+				{
+					printf("ObjBenchmark: bad argument %s\n", argv[i]);
+				}
+				return false;
+			}
+			++i;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (options.paths.empty())
+	{
+		if (!WriteGrid(ObjBenchmarkConfig::GRID_PATH, options.gridSize))
+		{
+			return 1;
+		}
+		options.paths.push_back(ObjBenchmarkConfig::GRID_PATH);
+	}
+
+	JobSystem::Get().SetThreadCount(options.threads);
+	printf("ObjBenchmark: %zu threads, %zu runs\n", JobSystem::Get().GetThreadCount(), options.runs);
+
+	bool passed = true;
+	std::vector<Timing> timings;
+	for (const std::string& path : options.paths)
+	{
+		Timing timing;
+		if (!Measure(path, options.runs, timing))
+		{
+			passed = false;
+			continue;
+		}
+
+		printf("%-28s %8.2f MB %9zu lines %9zu vertices %9zu triangles  load %9.3f ms %8.1f MB/s  scan %8.1f MB/s\n", timing.path.c_str(),
+			timing.megabytes, timing.lines, timing.vertices, timing.triangles, timing.loadMilliseconds,
+			timing.megabytes * 1000.0 / timing.loadMilliseconds, timing.megabytes * 1000.0 / timing.scanMilliseconds);
+		timings.push_back(timing);
+	}
+
+	if (!options.csvPath.empty())
+	{
+		passed = WriteCsv(options.csvPath, timings) && passed;
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "SkydomeMesh.h"
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Checks of the sky dome SkydomeMesh generates, without a device.
+// Every tessellation is checked for its vertex count, indices inside the vertex buffer, one strip cut between every
+// two bands and none anywhere else, the triangle count and vertices on the sphere. Tessellations below the minimum
+// have to come out clamped, and Get has to share one mesh per tessellation. Returns 1 when any check fails.
+
+namespace SkydomeCheckConfig
+{
+	const float RADIUS = 2.0f;
+	//Positions are built from sin and cos in single precision
+	const float RADIUS_TOLERANCE = 1e-5f;
+}
+
+namespace
+{
+	struct Tessellation
+	{
+		unsigned int rings, segments;
+	};
+
+	//The first ones are below the minimum and clamped to 1 ring and 3 segments
+	const Tessellation TESSELLATIONS[] = { { 0, 0 }, { 0, 8 }, { 4, 2 }, { 1, 3 }, { 2, 4 }, { 12, 24 }, { 40, 128 } };
+
+	bool Check(bool condition, const char* what, unsigned int rings, unsigned int segments)
+	{
+		if (!condition)
+		{
+			printf("SkydomeCheck: %u x %u %s\n", rings, segments, what);
+		}
+		return condition;
+	}
+
+	bool CheckGeometry(unsigned int rings, unsigned int segments)
+	{
+		SkydomeMesh::Geometry geometry = SkydomeMesh::Generate(rings, segments, SkydomeCheckConfig::RADIUS);
+		unsigned int clampedRings = rings < 1u ? 1u : rings;
+		unsigned int clampedSegments = segments < 3u ? 3u : segments;
+
+		bool passed = Check(geometry.positions.size() == 2u + clampedRings * clampedSegments, "has the wrong vertex count", rings, segments);
+
+		bool onSphere = true;
+		for (const DirectX::XMFLOAT3& position : geometry.positions)
+		{
+			float length = std::sqrt(position.x * position.x + position.y * position.y + position.z * position.z);
+			onSphere = onSphere && std::fabs(length - SkydomeCheckConfig::RADIUS) <= SkydomeCheckConfig::RADIUS_TOLERANCE * SkydomeCheckConfig::RADIUS;
+		}
+		passed = Check(onSphere, "has vertices off the sphere", rings, segments) && passed;
+
+		//Split the indices at the cuts, every band is a strip zigzagging once around
+		std::vector<size_t> stripLengths(1, 0u);
+		bool inRange = true;
+		for (uint32_t index : geometry.indices)
+		{
+			if (index == SkydomeMesh::STRIP_CUT)
+			{
+				stripLengths.push_back(0u);
+				continue;
+			}
+
+			inRange = inRange && index < geometry.positions.size();
+			stripLengths.back()++;
+		}
+		passed = Check(inRange, "has an index past its vertices", rings, segments) && passed;
+		passed = Check(stripLengths.size() == clampedRings + 1u, "does not cut once between every two bands", rings, segments) && passed;
+
+		bool fullBands = true;
+		for (size_t length : stripLengths)
+		{
+			fullBands = fullBands && length == 2u * (clampedSegments + 1u);
+		}
+		passed = Check(fullBands, "has a band that is not a full strip, or a cut at either end or next to another", rings, segments) && passed;
+
+		//Every strip draws two triangles per segment
+		size_t triangles = (clampedRings + 1u) * 2u * clampedSegments;
+		passed = Check(SkydomeMesh::GetTriangleCount(geometry) == triangles, "counts the wrong number of triangles", rings, segments) && passed;
+
+		return passed;
+	}
+
+	bool CheckCache()
+	{
+		std::shared_ptr<const SkydomeMesh::Geometry> first = SkydomeMesh::Get(12, 24, SkydomeCheckConfig::RADIUS);
+		std::shared_ptr<const SkydomeMesh::Geometry> second = SkydomeMesh::Get(12, 24, SkydomeCheckConfig::RADIUS);
+		std::shared_ptr<const SkydomeMesh::Geometry> other = SkydomeMesh::Get(12, 32, SkydomeCheckConfig::RADIUS);
+		std::shared_ptr<const SkydomeMesh::Geometry> larger = SkydomeMesh::Get(12, 24, 2.0f * SkydomeCheckConfig::RADIUS);
+
+		bool passed = Check(first && first == second, "is generated again by Get", 12, 24);
+		passed = Check(other && other != first && larger && larger != first, "is shared with another tessellation or radius", 12, 24) && passed;
+		//Clamped before the lookup, so both come out as the smallest dome
+		passed = Check(SkydomeMesh::Get(0, 0, SkydomeCheckConfig::RADIUS) == SkydomeMesh::Get(1, 3, SkydomeCheckConfig::RADIUS), "is not shared with the dome it is clamped to", 0, 0) && passed;
+
+		return passed;
+	}
+}
+
+int main()
+{
+	bool passed = true;
+	for (const Tessellation& tessellation : TESSELLATIONS)
+	{
+		passed = CheckGeometry(tessellation.rings, tessellation.segments) && passed;
+	}
+	passed = CheckCache() && passed;
+
+	printf("SkydomeCheck: %s\n", passed ? "passed" : "FAILED");
+	return passed ? 0 : 1;
+}
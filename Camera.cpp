@@ -96,11 +96,20 @@ Vector3 Camera::GetRotation()
 
 void Camera::DoMovement(InputCommands* input, bool blockForward, bool blockLeft, bool blockRight, bool blockBack)
 {
-	Vector3 movementDirection;
 	timer->Frame();
+	Move(input, blockForward, blockLeft, blockRight, blockBack, timer->GetFrameTime());
+}
 
+void Camera::DoMovement(InputCommands* input, bool blockForward, bool blockLeft, bool blockRight, bool blockBack, float deltaTime)
+{
+	//Keeps the timer running, live movement resumes after a replay without a jump
+	timer->Frame();
+	Move(input, blockForward, blockLeft, blockRight, blockBack, deltaTime);
+}
 
-	float deltaTime = timer->GetFrameTime();
+void Camera::Move(InputCommands* input, bool blockForward, bool blockLeft, bool blockRight, bool blockBack, float deltaTime)
+{
+	Vector3 movementDirection;
 	float cameraSpeed = 0.0025f * deltaTime;
 	float rotationSpeed = 0.1f * deltaTime;
 	viewQuaternion.Inverse(viewQuaternion);
@@ -38,11 +38,14 @@ public:
 	//float GetRotationSpeed();
 
 	void DoMovement(InputCommands*, bool blockForward, bool blockLeft, bool blockRight, bool blockBack);
+	// Moves by a fixed step of deltaTime milliseconds instead of the time since the last movement, for replays
+	void DoMovement(InputCommands*, bool blockForward, bool blockLeft, bool blockRight, bool blockBack, float deltaTime);
 
 	void Render();
 	void GetViewMatrix(XMMATRIX&);
 
 private:
+	void Move(InputCommands*, bool blockForward, bool blockLeft, bool blockRight, bool blockBack, float deltaTime);
 
 
 	ID3D11Device* device;
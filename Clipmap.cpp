@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "Clipmap.h"
+#include <cmath>
+
+namespace ClipmapConfig
+{
+	//Same bands as Heightfield::Mesh, the previous row of a band is still in the post transform cache
+	const int INDEX_BAND_WIDTH = 6;
+}
+
+namespace
+{
+	const int GRID_INDEX_COUNT = Clipmap::GRID_SIZE * Clipmap::GRID_SIZE * 6;
+	const int HOLE_SIZE = Clipmap::GRID_SIZE / 2;
+	const int RING_INDEX_COUNT = GRID_INDEX_COUNT - HOLE_SIZE * HOLE_SIZE * 6;
+
+	//Cells of the grid, leaving out the hole the finer level is drawn in when holeX is not negative
+	void AddCells(std::vector<uint16_t>& indices, int holeX, int holeZ)
+	{
+		for (int bandStart = 0; bandStart < Clipmap::GRID_SIZE; bandStart += ClipmapConfig::INDEX_BAND_WIDTH)
+		{
+			int bandEnd = std::min(bandStart + ClipmapConfig::INDEX_BAND_WIDTH, Clipmap::GRID_SIZE);
+
+			for (int z = 0; z < Clipmap::GRID_SIZE; ++z)
+			{
+				for (int x = bandStart; x < bandEnd; ++x)
+				{
+					if (holeX >= 0 && x >= holeX && x < holeX + HOLE_SIZE && z >= holeZ && z < holeZ + HOLE_SIZE)
+					{
+						continue;
+					}
+
+					uint16_t index00 = static_cast<uint16_t>(z * Clipmap::SAMPLE_COUNT + x);
+					uint16_t index10 = index00 + 1;
+					uint16_t index01 = index00 + Clipmap::SAMPLE_COUNT;
+					uint16_t index11 = index01 + 1;
+
+					//Same winding and diagonal as Heightfield::Mesh
+					indices.insert(indices.end(), { index00, index01, index11, index00, index11, index10 });
+				}
+			}
+		}
+	}
+
+	inline int FloorDivide(float value, int divisor)
+	{
+		return static_cast<int>(std::floor(value / divisor));
+	}
+
+	//Modulo that stays positive for negative sample coordinates
+	inline int Wrap(int value)
+	{
+		int wrapped = value % Clipmap::SAMPLE_COUNT;
+		return wrapped < 0 ? wrapped + Clipmap::SAMPLE_COUNT : wrapped;
+	}
+
+	//Splits [start, end) of level coordinates into at most two texel ranges that do not wrap
+	int SplitWrapped(int start, int end, int ranges[2][2])
+	{
+		int first = Wrap(start);
+		int count = end - start;
+
+		if (first + count <= Clipmap::SAMPLE_COUNT)
+		{
+			ranges[0][0] = first;
+			ranges[0][1] = count;
+			return 1;
+		}
+
+		ranges[0][0] = first;
+		ranges[0][1] = Clipmap::SAMPLE_COUNT - first;
+		ranges[1][0] = 0;
+		ranges[1][1] = count - ranges[0][1];
+		return 2;
+	}
+}
+
+Clipmap::Clipmap(const Heightfield& heightfield)
+	: m_heightfield(heightfield)
+{
+	m_spacing = XMFLOAT2(2.0f / (heightfield.GetWidth() - 1), 2.0f / (heightfield.GetDepth() - 1));
+
+	//Level l spans GRID_SIZE << l cells around the camera, one more level covers the far side of the heightfield
+	unsigned int cells = std::max(heightfield.GetWidth(), heightfield.GetDepth()) - 1;
+	unsigned int levelCount = 2;
+	while ((static_cast<unsigned int>(GRID_SIZE) << (levelCount - 2)) < cells)
+	{
+		levelCount++;
+	}
+
+	m_levels.resize(levelCount);
+	for (Level& level : m_levels)
+	{
+		level.samples.resize(SAMPLE_COUNT * SAMPLE_COUNT);
+	}
+}
+
+int Clipmap::GetHoleX(unsigned int level) const
+{
+	return m_levels[level - 1].originX / 2 - m_levels[level].originX;
+}
+
+int Clipmap::GetHoleZ(unsigned int level) const
+{
+	return m_levels[level - 1].originZ / 2 - m_levels[level].originZ;
+}
+
+void Clipmap::BuildVertices(std::vector<XMFLOAT3>& vertices)
+{
+	vertices.resize(SAMPLE_COUNT * SAMPLE_COUNT);
+
+	for (int z = 0; z < SAMPLE_COUNT; ++z)
+	{
+		for (int x = 0; x < SAMPLE_COUNT; ++x)
+		{
+			int border = std::min(std::min(x, GRID_SIZE - x), std::min(z, GRID_SIZE - z));
+			float blend = std::max(0.0f, static_cast<float>(BLEND_WIDTH - border) / BLEND_WIDTH);
+			vertices[z * SAMPLE_COUNT + x] = XMFLOAT3(static_cast<float>(x), static_cast<float>(z), blend);
+		}
+	}
+}
+
+void Clipmap::BuildIndices(std::vector<uint16_t>& indices)
+{
+	indices.clear();
+	indices.reserve(GRID_INDEX_COUNT + 4 * RING_INDEX_COUNT);
+
+	AddCells(indices, -1, -1);
+	for (int ring = 0; ring < 4; ++ring)
+	{
+		AddCells(indices, GRID_SIZE / 4 + (ring & 1), GRID_SIZE / 4 + (ring >> 1));
+	}
+}
+
+void Clipmap::GetIndexRange(unsigned int level, unsigned int& start, unsigned int& count) const
+{
+	if (level == 0)
+	{
+		start = 0u;
+		count = GRID_INDEX_COUNT;
+		return;
+	}
+
+	int ring = (GetHoleX(level) - GRID_SIZE / 4) + (GetHoleZ(level) - GRID_SIZE / 4) * 2;
+	start = GRID_INDEX_COUNT + ring * RING_INDEX_COUNT;
+	count = RING_INDEX_COUNT;
+}
+
+void Clipmap::Update(float x, float z, std::vector<Region>& regions)
+{
+	for (unsigned int l = 0u; l < m_levels.size(); ++l)
+	{
+		Level& level = m_levels[l];
+
+		//Snapped to two samples of the level, so the origin stays even and the finer level lines up with its vertices
+		int originX = 2 * FloorDivide(x, 2 << l) - GRID_SIZE / 2;
+		int originZ = 2 * FloorDivide(z, 2 << l) - GRID_SIZE / 2;
+		int moveX = originX - level.originX;
+		int moveZ = originZ - level.originZ;
+
+		if (!level.valid || std::abs(moveX) >= SAMPLE_COUNT || std::abs(moveZ) >= SAMPLE_COUNT)
+		{
+			level.originX = originX;
+			level.originZ = originZ;
+			level.valid = true;
+			Refresh(l, originX, originX + SAMPLE_COUNT, originZ, originZ + SAMPLE_COUNT, regions);
+			continue;
+		}
+
+		level.originX = originX;
+		level.originZ = originZ;
+
+		//Only the columns and rows that came into view, the samples that stay keep their texels
+		if (moveX != 0)
+		{
+			int x0 = moveX > 0 ? originX + SAMPLE_COUNT - moveX : originX;
+			Refresh(l, x0, x0 + std::abs(moveX), originZ, originZ + SAMPLE_COUNT, regions);
+		}
+
+		if (moveZ != 0)
+		{
+			int z0 = moveZ > 0 ? originZ + SAMPLE_COUNT - moveZ : originZ;
+			Refresh(l, originX, originX + SAMPLE_COUNT, z0, z0 + std::abs(moveZ), regions);
+		}
+	}
+}
+
+void Clipmap::Refresh(unsigned int level, int x0, int x1, int z0, int z1, std::vector<Region>& regions)
+{
+	std::vector<Sample>& samples = m_levels[level].samples;
+
+	for (int z = z0; z < z1; ++z)
+	{
+		Sample* row = &samples[Wrap(z) * SAMPLE_COUNT];
+		for (int x = x0; x < x1; ++x)
+		{
+			row[Wrap(x)] = ComputeSample(level, x, z);
+		}
+	}
+
+	int rangesX[2][2], rangesZ[2][2];
+	int countX = SplitWrapped(x0, x1, rangesX);
+	int countZ = SplitWrapped(z0, z1, rangesZ);
+
+	for (int i = 0; i < countZ; ++i)
+	{
+		for (int j = 0; j < countX; ++j)
+		{
+			Region region = { level, static_cast<unsigned int>(rangesX[j][0]), static_cast<unsigned int>(rangesZ[i][0]), static_cast<unsigned int>(rangesX[j][1]), static_cast<unsigned int>(rangesZ[i][1]) };
+			regions.push_back(region);
+		}
+	}
+}
+
+float Clipmap::GetHeight(unsigned int level, int x, int z) const
+{
+	//Outside of the heightfield the border samples continue
+	int maxX = static_cast<int>(m_heightfield.GetWidth()) - 1;
+	int maxZ = static_cast<int>(m_heightfield.GetDepth()) - 1;
+	int sampleX = std::max(0, std::min(x * (1 << level), maxX));
+	int sampleZ = std::max(0, std::min(z * (1 << level), maxZ));
+
+	return m_heightfield.GetSample(static_cast<unsigned int>(sampleX), static_cast<unsigned int>(sampleZ));
+}
+
+Clipmap::Sample Clipmap::ComputeSample(unsigned int level, int x, int z) const
+{
+	Sample sample;
+	sample.height = GetHeight(level, x, z);
+
+	//The coarser level has vertices on even samples, in between it interpolates along its edges or its 00-11 diagonal
+	bool oddX = (x & 1) != 0, oddZ = (z & 1) != 0;
+	if (oddX && oddZ)
+	{
+		sample.coarseHeight = (GetHeight(level, x - 1, z - 1) + GetHeight(level, x + 1, z + 1)) * 0.5f;
+	}
+	else if (oddX)
+	{
+		sample.coarseHeight = (GetHeight(level, x - 1, z) + GetHeight(level, x + 1, z)) * 0.5f;
+	}
+	else if (oddZ)
+	{
+		sample.coarseHeight = (GetHeight(level, x, z - 1) + GetHeight(level, x, z + 1)) * 0.5f;
+	}
+	else
+	{
+		sample.coarseHeight = sample.height;
+	}
+
+	//Central differences at the spacing of the level
+	float spacing = static_cast<float>(1 << level);
+	float slopeX = (GetHeight(level, x + 1, z) - GetHeight(level, x - 1, z)) / (2.0f * spacing * m_spacing.x);
+	float slopeZ = (GetHeight(level, x, z + 1) - GetHeight(level, x, z - 1)) / (2.0f * spacing * m_spacing.y);
+	float length = std::sqrt(slopeX * slopeX + 1.0f + slopeZ * slopeZ);
+
+	sample.normalX = -slopeX / length;
+	sample.normalZ = -slopeZ / length;
+	return sample;
+}
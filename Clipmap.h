@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include "Heightfield.h"
+
+// Nested square grids of heightfield samples centred on the camera (geometry clipmaps, Losasso and Hoppe 2004).
+// Level l has GRID_SIZE cells of 2^l heightfield cells each, so every level is twice as coarse as the one inside it
+// and the triangle count stays the same however large the heightfield is.
+// Samples are stored toroidally, moving a level only recomputes the rows and columns that came into view.
+// Every sample also keeps the height the next coarser level has at its position, blending towards it
+// near the edge of a level lets neighbouring levels meet without cracks.
+class Clipmap
+{
+public:
+	// Cells along the edge of a level, a multiple of 4 so the finer level always starts on an even sample
+	static const int GRID_SIZE = 64;
+	static const int SAMPLE_COUNT = GRID_SIZE + 1;
+	// Cells over which a level fades into the next coarser one
+	static const int BLEND_WIDTH = GRID_SIZE / 10;
+
+	struct Sample
+	{
+		float height;
+		float coarseHeight;
+		// x and z of the unit normal, y is always positive
+		float normalX, normalZ;
+	};
+
+	// Changed texels of one level, never wraps around the edge of the level
+	struct Region
+	{
+		unsigned int level;
+		unsigned int x, z, width, depth;
+	};
+
+	// Enough levels that the coarsest one covers the heightfield wherever the camera is
+	explicit Clipmap(const Heightfield& heightfield);
+
+	unsigned int GetLevelCount() const { return static_cast<unsigned int>(m_levels.size()); }
+	// Mesh space distance of two heightfield samples, level l places its samples 2^l times as far apart
+	XMFLOAT2 GetSpacing() const { return m_spacing; }
+
+	// Centres every level on (x, z) in heightfield samples and appends the texels that changed to regions
+	void Update(float x, float z, std::vector<Region>& regions);
+
+	// SAMPLE_COUNT x SAMPLE_COUNT samples, sample (i, j) of the level lives at texel ((origin + i) mod SAMPLE_COUNT, ...)
+	const Sample* GetSamples(unsigned int level) const { return m_levels[level].samples.data(); }
+
+	// First sample of the level in its own sample units
+	int GetOriginX(unsigned int level) const { return m_levels[level].originX; }
+	int GetOriginZ(unsigned int level) const { return m_levels[level].originZ; }
+
+	// Cell of the level the finer level starts at, GRID_SIZE / 4 or one more depending on how both are snapped
+	int GetHoleX(unsigned int level) const;
+	int GetHoleZ(unsigned int level) const;
+
+	// SAMPLE_COUNT x SAMPLE_COUNT vertices (i, j, blend) drawn for every level, blend is 1 on the edge
+	// and falls to 0 BLEND_WIDTH cells inside of it
+	static void BuildVertices(std::vector<XMFLOAT3>& vertices);
+	// The full grid for level 0, followed by one ring for every position the finer level can have inside a coarser one
+	static void BuildIndices(std::vector<uint16_t>& indices);
+	// Part of the BuildIndices buffer the level is drawn with
+	void GetIndexRange(unsigned int level, unsigned int& start, unsigned int& count) const;
+
+private:
+	struct Level
+	{
+		int originX = 0, originZ = 0;
+		bool valid = false;
+		std::vector<Sample> samples;
+	};
+
+	float GetHeight(unsigned int level, int x, int z) const;
+	Sample ComputeSample(unsigned int level, int x, int z) const;
+	// Recomputes the samples with level coordinates in [x0, x1) x [z0, z1) and records the texels as regions
+	void Refresh(unsigned int level, int x0, int x1, int z0, int z1, std::vector<Region>& regions);
+
+	const Heightfield& m_heightfield;
+	XMFLOAT2 m_spacing;
+	std::vector<Level> m_levels;
+};
@@ -0,0 +1,57 @@
+// Depth of clipmap terrain for the shadow map, places the grid vertices like Clipmap_VS
+struct VertexInput
+{
+    float3 grid : POSITION;
+};
+
+struct PixelInputType
+{
+    float4 position : SV_Position;
+    float4 fixedPointDepth : TEXTURE0;
+    float4 linearDepth : TEXCOORD1;
+};
+
+// World matrix of the terrain with the view and projection of the light
+cbuffer MatrixBuffer : register(b0)
+{
+    matrix worldMatrix;
+    matrix viewMatrix;
+    matrix projectionMatrix;
+};
+
+// Must match GeometryData::ClipmapLevelBufferType
+cbuffer LevelBuffer : register(b2)
+{
+    float2 levelOrigin;
+    float2 levelSpacing;
+    int2 slotOrigin;
+    int levelIndex;
+    int sampleCount;
+    float blendScale;
+};
+
+// height, coarse height, normal x, normal z, every level is stored toroidally
+Texture2DArray<float4> levelSamples : register(t0);
+
+PixelInputType main(VertexInput input)
+{
+    PixelInputType output;
+
+    int2 local = int2(input.grid.xy);
+    int2 slot = (slotOrigin + local) % sampleCount;
+    float4 levelSample = levelSamples.Load(int4(slot, levelIndex, 0));
+
+    float height = lerp(levelSample.x, levelSample.y, input.grid.z * blendScale);
+    float3 position = float3(levelOrigin.x + local.x * levelSpacing.x, height, levelOrigin.y + local.y * levelSpacing.y);
+
+    output.position = mul(float4(position, 1.0f), worldMatrix);
+    output.position = mul(output.position, viewMatrix);
+
+    output.linearDepth = output.position;
+
+    output.position = mul(output.position, projectionMatrix);
+
+    output.fixedPointDepth = output.position;
+
+    return output;
+}
@@ -0,0 +1,79 @@
+// Static grid shared by all clipmap levels, grid holds the local sample
+// coordinate and blend how far the vertex fades into the coarser level
+struct VertexInput
+{
+    float3 grid : POSITION;
+};
+
+struct PixelInput
+{
+    float4 position : SV_POSITION;
+    float4 worldPos : POSITION0;
+    float4 color : COLOR;
+    float4 normal : NORMAL;
+    float4 lightViewPos : TEXCOORD0;
+    float4 lightViewPosVSM : TEXCOORD1;
+};
+
+cbuffer MatrixBuffer : register(b0)
+{
+    matrix worldMatrix;
+    matrix viewMatrix;
+    matrix projectionMatrix;
+};
+
+cbuffer LightMatrixBuffer : register(b1)
+{
+    matrix lightViewMatrix;
+    matrix lightProjectionMatrix;
+};
+
+// Must match GeometryData::ClipmapLevelBufferType
+cbuffer LevelBuffer : register(b2)
+{
+    float2 levelOrigin;
+    float2 levelSpacing;
+    int2 slotOrigin;
+    int levelIndex;
+    int sampleCount;
+    float blendScale;
+};
+
+// height, coarse height, normal x, normal z, every level is stored toroidally
+Texture2DArray<float4> levelSamples : register(t0);
+
+PixelInput main(VertexInput input)
+{
+    bool useTessellation = true;
+
+    PixelInput output;
+
+    int2 local = int2(input.grid.xy);
+    int2 slot = (slotOrigin + local) % sampleCount;
+    float4 levelSample = levelSamples.Load(int4(slot, levelIndex, 0));
+
+    //Towards the edge the level takes the heights of the coarser one, so both meet without cracks
+    float height = lerp(levelSample.x, levelSample.y, input.grid.z * blendScale);
+    float3 position = float3(levelOrigin.x + local.x * levelSpacing.x, height, levelOrigin.y + local.y * levelSpacing.y);
+
+    output.position = mul(float4(position, 1.0f), worldMatrix);
+    output.worldPos = output.position;
+
+    output.position = mul(output.position, viewMatrix);
+
+    output.color = float4(1.0f, 1.0f, 1.0f, 1.0f);
+
+    float3 normal = float3(levelSample.z, sqrt(saturate(1.0f - dot(levelSample.zw, levelSample.zw))), levelSample.w);
+    output.normal = float4(normal, 0.0f);
+
+    output.lightViewPosVSM = mul(output.worldPos, lightViewMatrix);
+    output.lightViewPos = output.lightViewPosVSM;
+
+    if (!useTessellation)
+    {
+        output.position = mul(output.position, projectionMatrix);
+        output.lightViewPos = mul(output.lightViewPosVSM, lightProjectionMatrix);
+    }
+
+    return output;
+}
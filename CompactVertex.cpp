@@ -0,0 +1,162 @@
+#include "pch.h"
+#include "CompactVertex.h"
+#include <cmath>
+
+namespace CompactVertexConfig
+{
+	const float POSITION_STEPS = 65535.0f;
+	const float NORMAL_STEPS = 32767.0f;
+	// 16 bit octahedral normals stay well below this angle error
+	const float NORMAL_TOLERANCE = 0.001f;
+	const float MIN_EXTENT = 1e-6f;
+}
+
+CompactVertexEncoder::CompactVertexEncoder()
+	: m_boundsMin(-1.0f, -1.0f, -1.0f), m_extent(2.0f, 2.0f, 2.0f)
+{
+}
+
+CompactVertexEncoder::CompactVertexEncoder(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	: m_boundsMin(boundsMin)
+{
+	m_extent.x = std::max(boundsMax.x - boundsMin.x, CompactVertexConfig::MIN_EXTENT);
+	m_extent.y = std::max(boundsMax.y - boundsMin.y, CompactVertexConfig::MIN_EXTENT);
+	m_extent.z = std::max(boundsMax.z - boundsMin.z, CompactVertexConfig::MIN_EXTENT);
+}
+
+static uint16_t QuantizeUnorm(float value, float minValue, float extent)
+{
+	float normalized = (value - minValue) / extent;
+	normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+	return static_cast<uint16_t>(normalized * CompactVertexConfig::POSITION_STEPS + 0.5f);
+}
+
+static int16_t QuantizeSnorm(float value)
+{
+	value = std::min(std::max(value, -1.0f), 1.0f);
+	return static_cast<int16_t>(std::floor(value * CompactVertexConfig::NORMAL_STEPS + 0.5f));
+}
+
+static float DequantizeSnorm(int16_t value)
+{
+	// D3D snorm rule, -32768 and -32767 both map to -1
+	return std::max(static_cast<float>(value) / CompactVertexConfig::NORMAL_STEPS, -1.0f);
+}
+
+CompactVertex CompactVertexEncoder::Encode(const XMFLOAT3& position, const XMFLOAT3& normal, uint8_t material) const
+{
+	CompactVertex output;
+
+	output.position[0] = QuantizeUnorm(position.x, m_boundsMin.x, m_extent.x);
+	output.position[1] = QuantizeUnorm(position.y, m_boundsMin.y, m_extent.y);
+	output.position[2] = QuantizeUnorm(position.z, m_boundsMin.z, m_extent.z);
+	output.material = material;
+	output.padding = 0;
+	OctEncode(normal, output.normal[0], output.normal[1]);
+
+	return output;
+}
+
+void CompactVertexEncoder::Decode(const CompactVertex& vertex, XMFLOAT3& position, XMFLOAT3& normal) const
+{
+	position.x = m_boundsMin.x + (vertex.position[0] / CompactVertexConfig::POSITION_STEPS) * m_extent.x;
+	position.y = m_boundsMin.y + (vertex.position[1] / CompactVertexConfig::POSITION_STEPS) * m_extent.y;
+	position.z = m_boundsMin.z + (vertex.position[2] / CompactVertexConfig::POSITION_STEPS) * m_extent.z;
+	normal = OctDecode(vertex.normal[0], vertex.normal[1]);
+}
+
+XMMATRIX CompactVertexEncoder::GetDequantizeMatrix() const
+{
+	return XMMatrixScaling(m_extent.x, m_extent.y, m_extent.z) * XMMatrixTranslation(m_boundsMin.x, m_boundsMin.y, m_boundsMin.z);
+}
+
+XMFLOAT3 CompactVertexEncoder::GetPositionTolerance() const
+{
+	//Half a quantization step plus some slack for float rounding
+	const float factor = 0.5f / CompactVertexConfig::POSITION_STEPS * 1.01f;
+	return XMFLOAT3(m_extent.x * factor, m_extent.y * factor, m_extent.z * factor);
+}
+
+bool CompactVertexEncoder::VerifyRoundTrip(const XMFLOAT3* positions, const XMFLOAT3* normals, size_t count, float& maxPositionError, float& maxNormalError) const
+{
+	XMFLOAT3 tolerance = GetPositionTolerance();
+	bool withinTolerance = true;
+
+	maxPositionError = 0.0f;
+	maxNormalError = 0.0f;
+
+	for (size_t i = 0u; i < count; ++i)
+	{
+		XMFLOAT3 decodedPosition, decodedNormal;
+		Decode(Encode(positions[i], normals[i]), decodedPosition, decodedNormal);
+
+		float dx = std::abs(decodedPosition.x - positions[i].x);
+		float dy = std::abs(decodedPosition.y - positions[i].y);
+		float dz = std::abs(decodedPosition.z - positions[i].z);
+		maxPositionError = std::max<float>({ maxPositionError, dx, dy, dz });
+
+		if (dx > tolerance.x || dy > tolerance.y || dz > tolerance.z)
+		{
+			withinTolerance = false;
+		}
+
+		//Only compare unit length normals, degenerate ones have no meaningful direction
+		float length = std::sqrt(normals[i].x * normals[i].x + normals[i].y * normals[i].y + normals[i].z * normals[i].z);
+		if (length > 0.0f)
+		{
+			float normalError = std::max<float>({
+				std::abs(decodedNormal.x - normals[i].x / length),
+				std::abs(decodedNormal.y - normals[i].y / length),
+				std::abs(decodedNormal.z - normals[i].z / length) });
+			maxNormalError = std::max(maxNormalError, normalError);
+
+			if (normalError > CompactVertexConfig::NORMAL_TOLERANCE)
+			{
+				withinTolerance = false;
+			}
+		}
+	}
+
+	return withinTolerance;
+}
+
+void CompactVertexEncoder::OctEncode(const XMFLOAT3& normal, int16_t& outX, int16_t& outY)
+{
+	float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (sum <= 0.0f)
+	{
+		outX = 0;
+		outY = 0;
+		return;
+	}
+
+	float x = normal.x / sum;
+	float y = normal.y / sum;
+
+	//Fold the lower hemisphere over the diagonals
+	if (normal.z < 0.0f)
+	{
+		float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	outX = QuantizeSnorm(x);
+	outY = QuantizeSnorm(y);
+}
+
+XMFLOAT3 CompactVertexEncoder::OctDecode(int16_t encodedX, int16_t encodedY)
+{
+	float x = DequantizeSnorm(encodedX);
+	float y = DequantizeSnorm(encodedY);
+	float z = 1.0f - std::abs(x) - std::abs(y);
+
+	//Unfold the lower hemisphere, same as the shader does
+	float t = std::max(-z, 0.0f);
+	x += x >= 0.0f ? -t : t;
+	y += y >= 0.0f ? -t : t;
+
+	float length = std::sqrt(x * x + y * y + z * z);
+	return XMFLOAT3(x / length, y / length, z / length);
+}
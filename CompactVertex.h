@@ -0,0 +1,45 @@
+#pragma once
+#include <DirectXMath.h>
+#include <cstdint>
+
+using namespace DirectX;
+
+// 12 byte vertex for generated terrain.
+// Position is quantized to 16 bits per axis relative to the mesh bounds,
+// the normal is octahedral encoded into two 16 bit snorm values.
+// Layout matches DXGI_FORMAT_R16G16B16A16_UNORM + DXGI_FORMAT_R16G16_SNORM.
+struct CompactVertex
+{
+	uint16_t position[3];
+	uint8_t material;
+	uint8_t padding;
+	int16_t normal[2];
+};
+
+static_assert(sizeof(CompactVertex) == 12, "CompactVertex must stay 12 bytes");
+
+class CompactVertexEncoder
+{
+public:
+	CompactVertexEncoder();
+	CompactVertexEncoder(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+
+	CompactVertex Encode(const XMFLOAT3& position, const XMFLOAT3& normal, uint8_t material = 0) const;
+	void Decode(const CompactVertex& vertex, XMFLOAT3& position, XMFLOAT3& normal) const;
+
+	// Maps the unorm [0,1] positions back into mesh space, multiply before the world matrix
+	XMMATRIX GetDequantizeMatrix() const;
+
+	// Largest position error a round trip can introduce on each axis
+	XMFLOAT3 GetPositionTolerance() const;
+
+	// Encodes and decodes every vertex, returns false if any of them is outside of tolerance
+	bool VerifyRoundTrip(const XMFLOAT3* positions, const XMFLOAT3* normals, size_t count, float& maxPositionError, float& maxNormalError) const;
+
+	static void OctEncode(const XMFLOAT3& normal, int16_t& outX, int16_t& outY);
+	static XMFLOAT3 OctDecode(int16_t x, int16_t y);
+
+private:
+	XMFLOAT3 m_boundsMin;
+	XMFLOAT3 m_extent;
+};
@@ -0,0 +1,777 @@
+#include "pch.h"
+#include "DensityGraph.h"
+#include "Profiler.h"
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	//Largest gradient of the simplex noise in Noise.cpp, from the falloff and scale of its corner contributions
+	const float NOISE_3D_LIPSCHITZ = 30.0f;
+	const float NOISE_2D_LIPSCHITZ = 24.0f;
+
+	//Meshing reads corners one voxel and gradients two voxels away from a cell, blocks
+	//further than this from the surface can be replaced by their sign without changing the mesh
+	const float SURFACE_MARGIN = 2.0f;
+
+	inline XMVECTOR Load(const float* source)
+	{
+		return XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A*>(source));
+	}
+
+	inline void Store(float* destination, FXMVECTOR value)
+	{
+		XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(destination), value);
+	}
+
+	float Length(float x, float y, float z)
+	{
+		return std::sqrt(x * x + y * y + z * z);
+	}
+
+	//Polynomial smooth max, exact max once the densities are further than smoothness apart
+	float SmoothMax(float a, float b, float smoothness)
+	{
+		if (smoothness <= 0.0f)
+		{
+			return std::max(a, b);
+		}
+
+		float h = std::max(smoothness - std::fabs(a - b), 0.0f) / smoothness;
+		return std::max(a, b) + h * h * smoothness * 0.25f;
+	}
+
+	float SmoothMin(float a, float b, float smoothness)
+	{
+		return -SmoothMax(-a, -b, smoothness);
+	}
+}
+
+DensityGraph::NodeId DensityGraph::AddNode(const Node& node)
+{
+	m_nodes.push_back(node);
+	return static_cast<NodeId>(m_nodes.size() - 1);
+}
+
+DensityGraph::NodeId DensityGraph::AddLeaf(NodeType::Enum type, const XMFLOAT3& vector0, const XMFLOAT3& vector1, float parameter0, float parameter1, float parameter2, float lipschitz, float range)
+{
+	Node node = {};
+	node.type = type;
+	node.children[0] = node.children[1] = -1;
+	node.vectors[0] = vector0;
+	node.vectors[1] = vector1;
+	node.parameters[0] = parameter0;
+	node.parameters[1] = parameter1;
+	node.parameters[2] = parameter2;
+	node.lipschitz = lipschitz;
+	node.range = range;
+
+	return AddNode(node);
+}
+
+DensityGraph::NodeId DensityGraph::Sphere(const XMFLOAT3& center, float radius)
+{
+	return AddLeaf(NodeType::SPHERE, center, XMFLOAT3(0.0f, 0.0f, 0.0f), radius, 0.0f, 0.0f, 1.0f, FLT_MAX);
+}
+
+DensityGraph::NodeId DensityGraph::Box(const XMFLOAT3& center, const XMFLOAT3& halfExtents)
+{
+	return AddLeaf(NodeType::BOX, center, halfExtents, 0.0f, 0.0f, 0.0f, 1.0f, FLT_MAX);
+}
+
+DensityGraph::NodeId DensityGraph::Capsule(const XMFLOAT3& start, const XMFLOAT3& end, float radius)
+{
+	XMFLOAT3 axis(end.x - start.x, end.y - start.y, end.z - start.z);
+	float lengthSquared = axis.x * axis.x + axis.y * axis.y + axis.z * axis.z;
+
+	return AddLeaf(NodeType::CAPSULE, start, axis, radius, lengthSquared > 0.0f ? 1.0f / lengthSquared : 0.0f, 0.0f, 1.0f, FLT_MAX);
+}
+
+DensityGraph::NodeId DensityGraph::Helix(const XMFLOAT3& center, float helixRadius, float turnRate, float phase, float strandRadius)
+{
+	//Moving along y also moves the strand centre sideways
+	float lipschitz = std::sqrt(1.0f + helixRadius * turnRate * helixRadius * turnRate);
+
+	NodeId id = AddLeaf(NodeType::HELIX, center, XMFLOAT3(0.0f, 0.0f, 0.0f), helixRadius, turnRate, phase, lipschitz, FLT_MAX);
+	m_nodes[id].parameters[3] = strandRadius;
+	return id;
+}
+
+DensityGraph::NodeId DensityGraph::Plane(const XMFLOAT3& normal, float offset)
+{
+	float length = Length(normal.x, normal.y, normal.z);
+	XMFLOAT3 unitNormal(normal.x / length, normal.y / length, normal.z / length);
+
+	return AddLeaf(NodeType::PLANE, unitNormal, XMFLOAT3(0.0f, 0.0f, 0.0f), offset / length, 0.0f, 0.0f, 1.0f, FLT_MAX);
+}
+
+DensityGraph::NodeId DensityGraph::Noise3D(float frequency, float amplitude)
+{
+	float range = std::fabs(amplitude);
+	return AddLeaf(NodeType::NOISE_3D, XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), frequency, amplitude, 0.0f, range * std::fabs(frequency) * NOISE_3D_LIPSCHITZ, range);
+}
+
+DensityGraph::NodeId DensityGraph::Noise2D(float frequency, float amplitude)
+{
+	float range = std::fabs(amplitude);
+	return AddLeaf(NodeType::NOISE_2D, XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), frequency, amplitude, 0.0f, range * std::fabs(frequency) * NOISE_2D_LIPSCHITZ, range);
+}
+
+DensityGraph::NodeId DensityGraph::Wave(const XMFLOAT3& direction, float frequency, float amplitude)
+{
+	float length = Length(direction.x, direction.y, direction.z);
+	XMFLOAT3 unitDirection(direction.x / length, direction.y / length, direction.z / length);
+	float range = std::fabs(amplitude);
+
+	return AddLeaf(NodeType::WAVE, unitDirection, XMFLOAT3(0.0f, 0.0f, 0.0f), frequency, amplitude, 0.0f, range * std::fabs(frequency), range);
+}
+
+DensityGraph::NodeId DensityGraph::Union(NodeId a, NodeId b, float smoothness)
+{
+	Node node = {};
+	node.type = NodeType::UNION;
+	node.children[0] = a;
+	node.children[1] = b;
+	node.parameters[0] = smoothness;
+	return AddNode(node);
+}
+
+DensityGraph::NodeId DensityGraph::Intersection(NodeId a, NodeId b, float smoothness)
+{
+	NodeId id = Union(a, b, smoothness);
+	m_nodes[id].type = NodeType::INTERSECTION;
+	return id;
+}
+
+DensityGraph::NodeId DensityGraph::Subtraction(NodeId a, NodeId b, float smoothness)
+{
+	NodeId id = Union(a, b, smoothness);
+	m_nodes[id].type = NodeType::SUBTRACTION;
+	return id;
+}
+
+DensityGraph::NodeId DensityGraph::Add(NodeId a, NodeId b)
+{
+	NodeId id = Union(a, b);
+	m_nodes[id].type = NodeType::ADD;
+	return id;
+}
+
+DensityGraph::NodeId DensityGraph::Translate(NodeId child, const XMFLOAT3& offset)
+{
+	Node node = {};
+	node.type = NodeType::TRANSLATE;
+	node.children[0] = child;
+	node.children[1] = -1;
+	node.vectors[0] = offset;
+	return AddNode(node);
+}
+
+DensityGraph::NodeId DensityGraph::Scale(NodeId child, const XMFLOAT3& scale)
+{
+	NodeId id = Translate(child, scale);
+	m_nodes[id].type = NodeType::SCALE;
+	return id;
+}
+
+DensityGraph::NodeId DensityGraph::Taper(NodeId child, float amount)
+{
+	NodeId id = Translate(child, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	m_nodes[id].type = NodeType::TAPER;
+	m_nodes[id].parameters[0] = amount;
+	return id;
+}
+
+DensityGraph::NodeId DensityGraph::Truncate(NodeId child, float band)
+{
+	NodeId id = Translate(child, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	m_nodes[id].type = NodeType::TRUNCATE;
+	m_nodes[id].parameters[0] = band;
+	return id;
+}
+
+void DensityGraph::SetRoot(NodeId root)
+{
+	m_root = root;
+}
+
+float DensityGraph::Evaluate(const XMFLOAT3& position) const
+{
+	return m_root >= 0 ? EvaluateNode(m_root, position) : -1.0f;
+}
+
+float DensityGraph::EvaluateNode(NodeId id, const XMFLOAT3& position) const
+{
+	const Node& node = m_nodes[id];
+
+	switch (node.type)
+	{
+	case NodeType::UNION:
+		return SmoothMax(EvaluateNode(node.children[0], position), EvaluateNode(node.children[1], position), node.parameters[0]);
+	case NodeType::INTERSECTION:
+		return SmoothMin(EvaluateNode(node.children[0], position), EvaluateNode(node.children[1], position), node.parameters[0]);
+	case NodeType::SUBTRACTION:
+		return SmoothMin(EvaluateNode(node.children[0], position), -EvaluateNode(node.children[1], position), node.parameters[0]);
+	case NodeType::ADD:
+		return EvaluateNode(node.children[0], position) + EvaluateNode(node.children[1], position);
+	case NodeType::TRANSLATE:
+		return EvaluateNode(node.children[0], XMFLOAT3(position.x - node.vectors[0].x, position.y - node.vectors[0].y, position.z - node.vectors[0].z));
+	case NodeType::SCALE:
+		return EvaluateNode(node.children[0], XMFLOAT3(position.x * node.vectors[0].x, position.y * node.vectors[0].y, position.z * node.vectors[0].z));
+	case NodeType::TAPER:
+	{
+		float taper = node.parameters[0] * position.y;
+		return EvaluateNode(node.children[0], XMFLOAT3(position.x * taper, position.y, position.z * taper));
+	}
+	case NodeType::TRUNCATE:
+		return std::max(-1.0f, std::min(1.0f, EvaluateNode(node.children[0], position) / node.parameters[0]));
+	default:
+		return EvaluateLeaf(node, position);
+	}
+}
+
+float DensityGraph::EvaluateLeaf(const Node& node, const XMFLOAT3& position) const
+{
+	const XMFLOAT3& a = node.vectors[0];
+	const XMFLOAT3& b = node.vectors[1];
+	const float* parameters = node.parameters;
+
+	switch (node.type)
+	{
+	case NodeType::SPHERE:
+		return parameters[0] - Length(position.x - a.x, position.y - a.y, position.z - a.z);
+	case NodeType::BOX:
+	{
+		float qx = std::fabs(position.x - a.x) - b.x;
+		float qy = std::fabs(position.y - a.y) - b.y;
+		float qz = std::fabs(position.z - a.z) - b.z;
+		float outside = Length(std::max(qx, 0.0f), std::max(qy, 0.0f), std::max(qz, 0.0f));
+		float inside = std::min(std::max(qx, std::max(qy, qz)), 0.0f);
+		return -(outside + inside);
+	}
+	case NodeType::CAPSULE:
+	{
+		float px = position.x - a.x, py = position.y - a.y, pz = position.z - a.z;
+		float h = std::max(0.0f, std::min(1.0f, (px * b.x + py * b.y + pz * b.z) * parameters[1]));
+		return parameters[0] - Length(px - b.x * h, py - b.y * h, pz - b.z * h);
+	}
+	case NodeType::HELIX:
+	{
+		float angle = position.y * parameters[1] + parameters[2];
+		float dx = position.x - (a.x + parameters[0] * std::sin(angle));
+		float dz = position.z - (a.z + parameters[0] * std::cos(angle));
+		return parameters[3] - std::sqrt(dx * dx + dz * dz);
+	}
+	case NodeType::PLANE:
+		return parameters[0] - (position.x * a.x + position.y * a.y + position.z * a.z);
+	case NodeType::NOISE_3D:
+		return parameters[1] * static_cast<float>(m_noise.Noise3D(position.x * parameters[0], position.y * parameters[0], position.z * parameters[0]));
+	case NodeType::NOISE_2D:
+		return parameters[1] * static_cast<float>(m_noise.Noise2D(position.x * parameters[0], position.z * parameters[0]));
+	case NodeType::WAVE:
+		return parameters[1] * std::cos((position.x * a.x + position.y * a.y + position.z * a.z) * parameters[0]);
+	default:
+		return 0.0f;
+	}
+}
+
+DensityGraph::Interval DensityGraph::Bound(NodeId id, const Bounds& domain, BrickPlan& plan) const
+{
+	const Node& node = m_nodes[id];
+	Interval output;
+	plan.modes[id] = NodeMode::EVALUATE;
+
+	switch (node.type)
+	{
+	case NodeType::UNION:
+	case NodeType::INTERSECTION:
+	case NodeType::SUBTRACTION:
+	{
+		Interval a = Bound(node.children[0], domain, plan);
+		Interval b = Bound(node.children[1], domain, plan);
+		float smoothness = std::max(node.parameters[0], 0.0f);
+
+		if (node.type == NodeType::SUBTRACTION)
+		{
+			b = { -b.max, -b.min };
+		}
+
+		//A child only matters if its densities can get within smoothness of the other one
+		if (node.type == NodeType::UNION)
+		{
+			if (a.max <= b.min - smoothness)
+			{
+				plan.modes[id] = NodeMode::SECOND_ONLY;
+				output = b;
+			}
+			else if (b.max <= a.min - smoothness)
+			{
+				plan.modes[id] = NodeMode::FIRST_ONLY;
+				output = a;
+			}
+			else
+			{
+				output = { std::max(a.min, b.min), std::max(a.max, b.max) + smoothness * 0.25f };
+			}
+		}
+		else
+		{
+			if (a.min >= b.max + smoothness)
+			{
+				plan.modes[id] = NodeMode::SECOND_ONLY;
+				output = b;
+			}
+			else if (b.min >= a.max + smoothness)
+			{
+				plan.modes[id] = NodeMode::FIRST_ONLY;
+				output = a;
+			}
+			else
+			{
+				output = { std::min(a.min, b.min) - smoothness * 0.25f, std::min(a.max, b.max) };
+			}
+		}
+		break;
+	}
+	case NodeType::ADD:
+	{
+		Interval a = Bound(node.children[0], domain, plan);
+		Interval b = Bound(node.children[1], domain, plan);
+		output = { a.min + b.min, a.max + b.max };
+		break;
+	}
+	case NodeType::TRANSLATE:
+	{
+		const XMFLOAT3& offset = node.vectors[0];
+		Bounds child = { XMFLOAT3(domain.min.x - offset.x, domain.min.y - offset.y, domain.min.z - offset.z), XMFLOAT3(domain.max.x - offset.x, domain.max.y - offset.y, domain.max.z - offset.z) };
+		output = Bound(node.children[0], child, plan);
+		break;
+	}
+	case NodeType::SCALE:
+	{
+		const XMFLOAT3& scale = node.vectors[0];
+		Bounds child;
+		child.min = XMFLOAT3(std::min(domain.min.x * scale.x, domain.max.x * scale.x), std::min(domain.min.y * scale.y, domain.max.y * scale.y), std::min(domain.min.z * scale.z, domain.max.z * scale.z));
+		child.max = XMFLOAT3(std::max(domain.min.x * scale.x, domain.max.x * scale.x), std::max(domain.min.y * scale.y, domain.max.y * scale.y), std::max(domain.min.z * scale.z, domain.max.z * scale.z));
+		output = Bound(node.children[0], child, plan);
+		break;
+	}
+	case NodeType::TAPER:
+	{
+		//x * y is bilinear, so its extremes over a box are at the corners
+		Bounds child = { XMFLOAT3(FLT_MAX, domain.min.y, FLT_MAX), XMFLOAT3(-FLT_MAX, domain.max.y, -FLT_MAX) };
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			float taper = node.parameters[0] * ((corner & 2) ? domain.max.y : domain.min.y);
+			float x = ((corner & 1) ? domain.max.x : domain.min.x) * taper;
+			float z = ((corner & 4) ? domain.max.z : domain.min.z) * taper;
+
+			child.min.x = std::min(child.min.x, x);
+			child.max.x = std::max(child.max.x, x);
+			child.min.z = std::min(child.min.z, z);
+			child.max.z = std::max(child.max.z, z);
+		}
+		output = Bound(node.children[0], child, plan);
+		break;
+	}
+	case NodeType::TRUNCATE:
+	{
+		Interval child = Bound(node.children[0], domain, plan);
+		float band = node.parameters[0];
+		output = { std::max(-1.0f, std::min(1.0f, child.min / band)), std::max(-1.0f, std::min(1.0f, child.max / band)) };
+		break;
+	}
+	default:
+	{
+		//Exact within lipschitz * distance of the value at the centre of the domain
+		XMFLOAT3 center((domain.min.x + domain.max.x) * 0.5f, (domain.min.y + domain.max.y) * 0.5f, (domain.min.z + domain.max.z) * 0.5f);
+		float radius = Length(domain.max.x - center.x, domain.max.y - center.y, domain.max.z - center.z);
+		float value = EvaluateLeaf(node, center);
+		float spread = node.lipschitz * radius;
+
+		output = { std::max(value - spread, -node.range), std::min(value + spread, node.range) };
+		break;
+	}
+	}
+
+	if (output.min == output.max)
+	{
+		plan.modes[id] = NodeMode::CONSTANT;
+		plan.constants[id] = output.min;
+	}
+
+	return output;
+}
+
+void DensityGraph::EvaluateBatch(NodeId id, const Batch& points, unsigned int count, float* output, const BrickPlan& plan) const
+{
+	const Node& node = m_nodes[id];
+	NodeMode::Enum mode = plan.modes[id];
+
+	if (mode == NodeMode::CONSTANT)
+	{
+		std::fill(output, output + count, plan.constants[id]);
+		return;
+	}
+
+	switch (node.type)
+	{
+	case NodeType::UNION:
+	case NodeType::INTERSECTION:
+	case NodeType::SUBTRACTION:
+	case NodeType::ADD:
+	{
+		if (mode == NodeMode::FIRST_ONLY)
+		{
+			EvaluateBatch(node.children[0], points, count, output, plan);
+			return;
+		}
+
+		if (mode == NodeMode::SECOND_ONLY)
+		{
+			EvaluateBatch(node.children[1], points, count, output, plan);
+			if (node.type == NodeType::SUBTRACTION)
+			{
+				for (unsigned int i = 0u; i < count; i += 4)
+				{
+					Store(output + i, XMVectorNegate(Load(output + i)));
+				}
+			}
+			return;
+		}
+
+		alignas(16) float other[BATCH_SIZE];
+		EvaluateBatch(node.children[0], points, count, output, plan);
+		EvaluateBatch(node.children[1], points, count, other, plan);
+
+		float smoothness = node.parameters[0];
+		XMVECTOR k = XMVectorReplicate(smoothness);
+		XMVECTOR quarterK = XMVectorReplicate(smoothness * 0.25f);
+		XMVECTOR inverseK = XMVectorReplicate(smoothness > 0.0f ? 1.0f / smoothness : 0.0f);
+
+		for (unsigned int i = 0u; i < count; i += 4)
+		{
+			XMVECTOR a = Load(output + i);
+			XMVECTOR b = Load(other + i);
+			XMVECTOR result;
+
+			if (node.type == NodeType::ADD)
+			{
+				result = XMVectorAdd(a, b);
+			}
+			else
+			{
+				//Intersections are unions of the negated densities
+				bool isUnion = node.type == NodeType::UNION;
+				if (!isUnion)
+				{
+					a = XMVectorNegate(a);
+					b = node.type == NodeType::SUBTRACTION ? b : XMVectorNegate(b);
+				}
+
+				XMVECTOR h = XMVectorMultiply(XMVectorMax(XMVectorSubtract(k, XMVectorAbs(XMVectorSubtract(a, b))), XMVectorZero()), inverseK);
+				result = XMVectorMultiplyAdd(XMVectorMultiply(h, h), quarterK, XMVectorMax(a, b));
+				result = isUnion ? result : XMVectorNegate(result);
+			}
+
+			Store(output + i, result);
+		}
+		return;
+	}
+	case NodeType::TRANSLATE:
+	case NodeType::SCALE:
+	case NodeType::TAPER:
+	{
+		Batch transformed;
+		XMVECTOR vx = XMVectorReplicate(node.vectors[0].x);
+		XMVECTOR vy = XMVectorReplicate(node.vectors[0].y);
+		XMVECTOR vz = XMVectorReplicate(node.vectors[0].z);
+		XMVECTOR amount = XMVectorReplicate(node.parameters[0]);
+
+		for (unsigned int i = 0u; i < count; i += 4)
+		{
+			XMVECTOR x = Load(points.x + i), y = Load(points.y + i), z = Load(points.z + i);
+
+			if (node.type == NodeType::TRANSLATE)
+			{
+				x = XMVectorSubtract(x, vx);
+				y = XMVectorSubtract(y, vy);
+				z = XMVectorSubtract(z, vz);
+			}
+			else if (node.type == NodeType::SCALE)
+			{
+				x = XMVectorMultiply(x, vx);
+				y = XMVectorMultiply(y, vy);
+				z = XMVectorMultiply(z, vz);
+			}
+			else
+			{
+				XMVECTOR taper = XMVectorMultiply(amount, y);
+				x = XMVectorMultiply(x, taper);
+				z = XMVectorMultiply(z, taper);
+			}
+
+			Store(transformed.x + i, x);
+			Store(transformed.y + i, y);
+			Store(transformed.z + i, z);
+		}
+
+		EvaluateBatch(node.children[0], transformed, count, output, plan);
+		return;
+	}
+	case NodeType::TRUNCATE:
+	{
+		EvaluateBatch(node.children[0], points, count, output, plan);
+
+		XMVECTOR inverseBand = XMVectorReplicate(1.0f / node.parameters[0]);
+		XMVECTOR minusOne = XMVectorReplicate(-1.0f), one = XMVectorReplicate(1.0f);
+		for (unsigned int i = 0u; i < count; i += 4)
+		{
+			Store(output + i, XMVectorClamp(XMVectorMultiply(Load(output + i), inverseBand), minusOne, one));
+		}
+		return;
+	}
+	default:
+		EvaluateLeafBatch(node, points, count, output);
+		return;
+	}
+}
+
+void DensityGraph::EvaluateLeafBatch(const Node& node, const Batch& points, unsigned int count, float* output) const
+{
+	const XMFLOAT3& a = node.vectors[0];
+	const XMFLOAT3& b = node.vectors[1];
+	const float* parameters = node.parameters;
+
+	//Noise has no vector version, evaluate it point by point
+	if (node.type == NodeType::NOISE_3D || node.type == NodeType::NOISE_2D)
+	{
+		for (unsigned int i = 0u; i < count; ++i)
+		{
+			output[i] = EvaluateLeaf(node, XMFLOAT3(points.x[i], points.y[i], points.z[i]));
+		}
+		return;
+	}
+
+	XMVECTOR ax = XMVectorReplicate(a.x), ay = XMVectorReplicate(a.y), az = XMVectorReplicate(a.z);
+	XMVECTOR bx = XMVectorReplicate(b.x), by = XMVectorReplicate(b.y), bz = XMVectorReplicate(b.z);
+	XMVECTOR p0 = XMVectorReplicate(parameters[0]), p1 = XMVectorReplicate(parameters[1]);
+	XMVECTOR p2 = XMVectorReplicate(parameters[2]), p3 = XMVectorReplicate(parameters[3]);
+	XMVECTOR zero = XMVectorZero();
+
+	for (unsigned int i = 0u; i < count; i += 4)
+	{
+		XMVECTOR x = Load(points.x + i), y = Load(points.y + i), z = Load(points.z + i);
+		XMVECTOR result;
+
+		switch (node.type)
+		{
+		case NodeType::SPHERE:
+		{
+			XMVECTOR dx = XMVectorSubtract(x, ax), dy = XMVectorSubtract(y, ay), dz = XMVectorSubtract(z, az);
+			XMVECTOR lengthSquared = XMVectorMultiplyAdd(dx, dx, XMVectorMultiplyAdd(dy, dy, XMVectorMultiply(dz, dz)));
+			result = XMVectorSubtract(p0, XMVectorSqrt(lengthSquared));
+			break;
+		}
+		case NodeType::BOX:
+		{
+			XMVECTOR qx = XMVectorSubtract(XMVectorAbs(XMVectorSubtract(x, ax)), bx);
+			XMVECTOR qy = XMVectorSubtract(XMVectorAbs(XMVectorSubtract(y, ay)), by);
+			XMVECTOR qz = XMVectorSubtract(XMVectorAbs(XMVectorSubtract(z, az)), bz);
+			XMVECTOR ox = XMVectorMax(qx, zero), oy = XMVectorMax(qy, zero), oz = XMVectorMax(qz, zero);
+			XMVECTOR outside = XMVectorSqrt(XMVectorMultiplyAdd(ox, ox, XMVectorMultiplyAdd(oy, oy, XMVectorMultiply(oz, oz))));
+			XMVECTOR inside = XMVectorMin(XMVectorMax(qx, XMVectorMax(qy, qz)), zero);
+			result = XMVectorNegate(XMVectorAdd(outside, inside));
+			break;
+		}
+		case NodeType::CAPSULE:
+		{
+			XMVECTOR px = XMVectorSubtract(x, ax), py = XMVectorSubtract(y, ay), pz = XMVectorSubtract(z, az);
+			XMVECTOR h = XMVectorSaturate(XMVectorMultiply(XMVectorMultiplyAdd(px, bx, XMVectorMultiplyAdd(py, by, XMVectorMultiply(pz, bz))), p1));
+			XMVECTOR dx = XMVectorSubtract(px, XMVectorMultiply(bx, h));
+			XMVECTOR dy = XMVectorSubtract(py, XMVectorMultiply(by, h));
+			XMVECTOR dz = XMVectorSubtract(pz, XMVectorMultiply(bz, h));
+			result = XMVectorSubtract(p0, XMVectorSqrt(XMVectorMultiplyAdd(dx, dx, XMVectorMultiplyAdd(dy, dy, XMVectorMultiply(dz, dz)))));
+			break;
+		}
+		case NodeType::HELIX:
+		{
+			XMVECTOR sine, cosine;
+			XMVectorSinCos(&sine, &cosine, XMVectorMultiplyAdd(y, p1, p2));
+			XMVECTOR dx = XMVectorSubtract(x, XMVectorMultiplyAdd(p0, sine, ax));
+			XMVECTOR dz = XMVectorSubtract(z, XMVectorMultiplyAdd(p0, cosine, az));
+			result = XMVectorSubtract(p3, XMVectorSqrt(XMVectorMultiplyAdd(dx, dx, XMVectorMultiply(dz, dz))));
+			break;
+		}
+		case NodeType::PLANE:
+			result = XMVectorSubtract(p0, XMVectorMultiplyAdd(x, ax, XMVectorMultiplyAdd(y, ay, XMVectorMultiply(z, az))));
+			break;
+		case NodeType::WAVE:
+			result = XMVectorMultiply(p1, XMVectorCos(XMVectorMultiply(XMVectorMultiplyAdd(x, ax, XMVectorMultiplyAdd(y, ay, XMVectorMultiply(z, az))), p0)));
+			break;
+		default:
+			result = zero;
+			break;
+		}
+
+		Store(output + i, result);
+	}
+}
+
+void DensityGraph::FillBlock(const unsigned int origin[3], const unsigned int offset[3], unsigned int size, const unsigned int last[3],
+	float* values, BrickPlan& plan, Statistics& statistics) const
+{
+	const unsigned int brickSize = SparseVolume::BRICK_SIZE;
+
+	auto fillConstant = [&](float value)
+	{
+		for (unsigned int z = 0u; z < size; ++z)
+		{
+			for (unsigned int y = 0u; y < size; ++y)
+			{
+				float* row = values + ((offset[2] + z) * brickSize + offset[1] + y) * brickSize + offset[0];
+				std::fill(row, row + size, value);
+			}
+		}
+	};
+
+	//Voxels past the border repeat the last one, so the bounds only need to cover the volume
+	Bounds domain;
+	float* minimum = &domain.min.x;
+	float* maximum = &domain.max.x;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		minimum[axis] = static_cast<float>(std::min(origin[axis] + offset[axis], last[axis]));
+		maximum[axis] = static_cast<float>(std::min(origin[axis] + offset[axis] + size - 1, last[axis]));
+	}
+
+	Interval interval = Bound(m_root, domain, plan);
+	if (interval.min == interval.max)
+	{
+		fillConstant(interval.min);
+		return;
+	}
+
+	//A block can only be replaced by its sign if its surroundings have the same sign as well
+	if (interval.min > 0.0f || interval.max < 0.0f)
+	{
+		Bounds surroundings =
+		{
+			XMFLOAT3(domain.min.x - SURFACE_MARGIN, domain.min.y - SURFACE_MARGIN, domain.min.z - SURFACE_MARGIN),
+			XMFLOAT3(domain.max.x + SURFACE_MARGIN, domain.max.y + SURFACE_MARGIN, domain.max.z + SURFACE_MARGIN)
+		};
+
+		Interval outer = Bound(m_root, surroundings, plan);
+		if (outer.min > 0.0f || outer.max < 0.0f)
+		{
+			fillConstant(outer.min > 0.0f ? 1.0f : -1.0f);
+			return;
+		}
+
+		//The plan of the block itself culls more than the one of its surroundings
+		Bound(m_root, domain, plan);
+	}
+
+	if (size > MIN_BLOCK_SIZE)
+	{
+		unsigned int half = size / 2;
+		for (unsigned int octant = 0u; octant < 8u; ++octant)
+		{
+			const unsigned int child[3] =
+			{
+				offset[0] + ((octant & 1u) ? half : 0u),
+				offset[1] + ((octant & 2u) ? half : 0u),
+				offset[2] + ((octant & 4u) ? half : 0u)
+			};
+			FillBlock(origin, child, half, last, values, plan, statistics);
+		}
+		return;
+	}
+
+	statistics.culledNodes += std::count_if(plan.modes.begin(), plan.modes.end(), [](NodeMode::Enum mode) { return mode != NodeMode::EVALUATE; });
+	statistics.evaluatedVoxels += size * size * size;
+
+	Batch points;
+	unsigned int count = 0u;
+	for (unsigned int z = 0u; z < size; ++z)
+	{
+		for (unsigned int y = 0u; y < size; ++y)
+		{
+			for (unsigned int x = 0u; x < size; ++x)
+			{
+				points.x[count] = static_cast<float>(std::min(origin[0] + offset[0] + x, last[0]));
+				points.y[count] = static_cast<float>(std::min(origin[1] + offset[1] + y, last[1]));
+				points.z[count] = static_cast<float>(std::min(origin[2] + offset[2] + z, last[2]));
+				count++;
+			}
+		}
+	}
+
+	alignas(16) float block[BATCH_SIZE];
+	EvaluateBatch(m_root, points, count, block, plan);
+
+	const float* source = block;
+	for (unsigned int z = 0u; z < size; ++z)
+	{
+		for (unsigned int y = 0u; y < size; ++y)
+		{
+			float* row = values + ((offset[2] + z) * brickSize + offset[1] + y) * brickSize + offset[0];
+			std::copy(source, source + size, row);
+			source += size;
+		}
+	}
+}
+
+DensityGraph::Statistics DensityGraph::Fill(SparseVolume& volume) const
+{
+	return Fill(volume, 0u, volume.GetBrickCount());
+}
+
+DensityGraph::Statistics DensityGraph::Fill(SparseVolume& volume, size_t firstBrick, size_t brickCount) const
+{
+	Profiler::Zone zone("DensityGraph::Fill");
+
+	std::atomic<size_t> constantBricks(0), culledNodes(0), evaluatedVoxels(0), voxelCount(0);
+	const unsigned int size[3] = { volume.GetWidth(), volume.GetHeight(), volume.GetDepth() };
+	const unsigned int brickSize = SparseVolume::BRICK_SIZE;
+
+	volume.FillBricks(firstBrick, brickCount, [&](const unsigned int origin[3], float* values)
+	{
+		unsigned int last[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			last[axis] = std::min(origin[axis] + brickSize - 1, size[axis] - 1);
+		}
+		voxelCount += static_cast<size_t>(last[0] - origin[0] + 1) * (last[1] - origin[1] + 1) * (last[2] - origin[2] + 1);
+
+		if (m_root < 0)
+		{
+			std::fill(values, values + BATCH_SIZE, -1.0f);
+			return;
+		}
+
+		BrickPlan plan;
+		plan.modes.resize(m_nodes.size());
+		plan.constants.resize(m_nodes.size());
+
+		Statistics brick;
+		const unsigned int offset[3] = { 0u, 0u, 0u };
+		FillBlock(origin, offset, brickSize, last, values, plan, brick);
+
+		if (brick.evaluatedVoxels == 0u)
+		{
+			constantBricks++;
+		}
+		culledNodes += brick.culledNodes;
+		evaluatedVoxels += brick.evaluatedVoxels;
+	});
+
+	Statistics output;
+	output.brickCount = brickCount;
+	output.constantBricks = constantBricks;
+	output.culledNodes = culledNodes;
+	output.voxelCount = voxelCount;
+	output.evaluatedVoxels = evaluatedVoxels;
+	return output;
+}
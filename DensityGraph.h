@@ -0,0 +1,175 @@
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include "Noise.h"
+#include "SparseVolume.h"
+
+using namespace DirectX;
+
+// Density expression built from SDF primitives, CSG operators, domain transforms and noise.
+// Densities are positive inside the surface, so a union is a max and an intersection a min.
+// Primitives are exact distance fields, which gives every leaf a Lipschitz bound.
+// Volumes are filled a brick at a time: interval bounds over the brick decide which subtrees
+// can change the result, and the rest of the graph is evaluated four points at a time.
+// Blocks whose value or sign is proven are filled without evaluating them, mixed blocks are
+// split into octants down to MIN_BLOCK_SIZE, so the work follows the surface instead of the volume.
+class DensityGraph
+{
+public:
+	typedef int NodeId;
+
+	struct NodeType
+	{
+		enum Enum
+		{
+			SPHERE,
+			BOX,
+			CAPSULE,
+			HELIX,
+			PLANE,
+			NOISE_3D,
+			NOISE_2D,
+			WAVE,
+			UNION,
+			INTERSECTION,
+			SUBTRACTION,
+			ADD,
+			TRANSLATE,
+			SCALE,
+			TAPER,
+			TRUNCATE
+		};
+	};
+
+	struct Statistics
+	{
+		size_t brickCount = 0;
+		// Bricks filled from bounds alone, without evaluating any voxel
+		size_t constantBricks = 0;
+		// Nodes replaced by a constant or by one of their children, summed over all evaluated blocks
+		size_t culledNodes = 0;
+		size_t voxelCount = 0;
+		// Voxels the graph was evaluated for, the others were filled from bounds
+		size_t evaluatedVoxels = 0;
+
+		Statistics& operator+=(const Statistics& other)
+		{
+			brickCount += other.brickCount;
+			constantBricks += other.constantBricks;
+			culledNodes += other.culledNodes;
+			voxelCount += other.voxelCount;
+			evaluatedVoxels += other.evaluatedVoxels;
+			return *this;
+		}
+	};
+
+	// Primitives, all sizes in voxels
+	NodeId Sphere(const XMFLOAT3& center, float radius);
+	NodeId Box(const XMFLOAT3& center, const XMFLOAT3& halfExtents);
+	NodeId Capsule(const XMFLOAT3& start, const XMFLOAT3& end, float radius);
+	// Strand winding around a vertical axis through center, its angle is y * turnRate + phase
+	NodeId Helix(const XMFLOAT3& center, float helixRadius, float turnRate, float phase, float strandRadius);
+	// Solid on the side the normal points away from
+	NodeId Plane(const XMFLOAT3& normal, float offset);
+	NodeId Noise3D(float frequency, float amplitude);
+	// Noise over x and z
+	NodeId Noise2D(float frequency, float amplitude);
+	// amplitude * cos(dot(position, direction) * frequency)
+	NodeId Wave(const XMFLOAT3& direction, float frequency, float amplitude);
+
+	// Smoothness is the distance over which the two shapes are blended, 0 for a hard edge
+	NodeId Union(NodeId a, NodeId b, float smoothness = 0.0f);
+	NodeId Intersection(NodeId a, NodeId b, float smoothness = 0.0f);
+	NodeId Subtraction(NodeId a, NodeId b, float smoothness = 0.0f);
+	NodeId Add(NodeId a, NodeId b);
+
+	// Evaluate child at position - offset
+	NodeId Translate(NodeId child, const XMFLOAT3& offset);
+	// Evaluate child at position * scale
+	NodeId Scale(NodeId child, const XMFLOAT3& scale);
+	// Evaluate child with x and z multiplied by amount * y
+	NodeId Taper(NodeId child, float amount);
+	// clamp(density / band, -1, 1), far away from the surface every brick becomes uniform
+	NodeId Truncate(NodeId child, float band);
+
+	void SetRoot(NodeId root);
+
+	float Evaluate(const XMFLOAT3& position) const;
+
+	// Evaluates every voxel of the volume at its integer coordinate
+	Statistics Fill(SparseVolume& volume) const;
+	// Only fills brickCount bricks from firstBrick on, the statistics of consecutive ranges add up to those of the whole volume
+	Statistics Fill(SparseVolume& volume, size_t firstBrick, size_t brickCount) const;
+
+private:
+	static const unsigned int BATCH_SIZE = SparseVolume::BRICK_VOXELS;
+	// Smallest block edge bounds are computed for, 2^3 blocks cost more to bound than to evaluate
+	static const unsigned int MIN_BLOCK_SIZE = 4;
+
+	struct Node
+	{
+		NodeType::Enum type;
+		NodeId children[2];
+		XMFLOAT3 vectors[2];
+		float parameters[4];
+		// Only used by leaves, largest change of the density per voxel moved
+		float lipschitz;
+		// Densities of the leaf never leave [-range, range]
+		float range;
+	};
+
+	struct Interval
+	{
+		float min, max;
+	};
+
+	struct Bounds
+	{
+		XMFLOAT3 min, max;
+	};
+
+	struct NodeMode
+	{
+		enum Enum
+		{
+			EVALUATE,
+			CONSTANT,
+			FIRST_ONLY,
+			SECOND_ONLY
+		};
+	};
+
+	// What every node has to do for one brick
+	struct BrickPlan
+	{
+		std::vector<NodeMode::Enum> modes;
+		std::vector<float> constants;
+	};
+
+	// Points of one batch, structure of arrays so four lanes load at once
+	struct Batch
+	{
+		alignas(16) float x[BATCH_SIZE];
+		alignas(16) float y[BATCH_SIZE];
+		alignas(16) float z[BATCH_SIZE];
+	};
+
+	NodeId AddNode(const Node& node);
+	NodeId AddLeaf(NodeType::Enum type, const XMFLOAT3& vector0, const XMFLOAT3& vector1, float parameter0, float parameter1, float parameter2, float lipschitz, float range);
+
+	float EvaluateNode(NodeId id, const XMFLOAT3& position) const;
+	float EvaluateLeaf(const Node& node, const XMFLOAT3& position) const;
+
+	Interval Bound(NodeId id, const Bounds& domain, BrickPlan& plan) const;
+	// Fills the size^3 block of brick values starting at offset, voxels past last repeat the last one
+	void FillBlock(const unsigned int origin[3], const unsigned int offset[3], unsigned int size, const unsigned int last[3],
+		float* values, BrickPlan& plan, Statistics& statistics) const;
+	// Count has to be a multiple of four
+	void EvaluateBatch(NodeId id, const Batch& points, unsigned int count, float* output, const BrickPlan& plan) const;
+	void EvaluateLeafBatch(const Node& node, const Batch& points, unsigned int count, float* output) const;
+
+	std::vector<Node> m_nodes;
+	NodeId m_root = -1;
+	// Only reads the permutation table, so it is safe to share between threads
+	mutable Noise m_noise;
+};
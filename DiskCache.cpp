@@ -0,0 +1,294 @@
+#include "pch.h"
+#include "DiskCache.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	const char VOLUME_MAGIC[4] = { 'T', 'V', 'O', 'L' };
+	const char MESH_MAGIC[4] = { 'T', 'M', 'S', 'H' };
+	const uint32_t UNIFORM_BRICK = 0xFFFFFFFFu;
+
+	//Followed by the uniform value of every brick, the slot of every brick in the payload and the stored bricks
+	struct VolumeHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t width, height, depth;
+		uint32_t format, layout;
+		uint32_t brickCount;
+		uint32_t storedBrickCount;
+		uint32_t padding;
+	};
+
+	//Followed by one ChunkEntry per chunk, then positions, normals and indices of every chunk
+	struct MeshHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t chunkCount;
+		uint32_t padding;
+	};
+
+	struct ChunkEntry
+	{
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint64_t offset;
+	};
+
+	template<typename T>
+	void Append(std::vector<char>& output, const T* values, size_t count)
+	{
+		const char* bytes = reinterpret_cast<const char*>(values);
+		output.insert(output.end(), bytes, bytes + count * sizeof(T));
+	}
+
+	//Pointer to count values at offset, nullptr if they do not fit into the file
+	template<typename T>
+	const T* Read(const MappedFile& file, uint64_t offset, size_t count)
+	{
+		if (offset > file.GetSize() || count > (file.GetSize() - offset) / sizeof(T))
+		{
+			return nullptr;
+		}
+
+		return reinterpret_cast<const T*>(file.GetData() + offset);
+	}
+}
+
+DiskCache::DiskCache(const std::wstring& directory)
+	: m_directory(directory)
+{
+	//Fails harmlessly if it already exists, stores report the error if it could not be created
+	CreateDirectoryW(m_directory.c_str(), nullptr);
+}
+
+uint64_t DiskCache::Hash(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+
+	for (size_t i = 0u; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+std::wstring DiskCache::GetPath(uint64_t key, const wchar_t* extension) const
+{
+	wchar_t name[17];
+	swprintf(name, 17, L"%016llx", static_cast<unsigned long long>(key));
+	return m_directory + L"/" + name + extension;
+}
+
+bool DiskCache::WriteAtomically(const std::wstring& path, const std::vector<char>& contents) const
+{
+	std::wstring temporaryPath = path + L".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.write(contents.data(), contents.size()))
+		{
+			printf("Disk cache: writing %ls failed\n\r", temporaryPath.c_str());
+			return false;
+		}
+	}
+
+	if (!MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		printf("Disk cache: replacing %ls failed\n\r", path.c_str());
+		DeleteFileW(temporaryPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+std::shared_ptr<SparseVolume> DiskCache::LoadVolume(uint64_t key) const
+{
+	MappedFile file;
+	if (!file.Open(GetPath(key, L".volume")))
+	{
+		return nullptr;
+	}
+
+	const VolumeHeader* header = Read<VolumeHeader>(file, 0, 1);
+	if (!header || std::memcmp(header->magic, VOLUME_MAGIC, sizeof(VOLUME_MAGIC)) != 0 || header->version != FORMAT_VERSION || header->key != key)
+	{
+		return nullptr;
+	}
+
+	//A stale or broken file is a miss like a missing one, its enums must not reach the volume
+	if (header->format > DensityFormat::SNORM8 || header->layout > BrickLayout::MORTON)
+	{
+		printf("Disk cache: %ls has an unknown format\n\r", GetPath(key, L".volume").c_str());
+		return nullptr;
+	}
+
+	std::shared_ptr<SparseVolume> volume = std::make_shared<SparseVolume>(header->width, header->height, header->depth, -1.0f,
+		static_cast<DensityFormat::Enum>(header->format), static_cast<BrickLayout::Enum>(header->layout));
+	size_t brickBytes = SparseVolume::BRICK_VOXELS * volume->GetElementSize();
+
+	uint64_t offset = sizeof(VolumeHeader);
+	const float* uniformValues = Read<float>(file, offset, header->brickCount);
+	offset += sizeof(float) * static_cast<uint64_t>(header->brickCount);
+	const uint32_t* slots = Read<uint32_t>(file, offset, header->brickCount);
+	offset += sizeof(uint32_t) * static_cast<uint64_t>(header->brickCount);
+	const char* payload = Read<char>(file, offset, header->storedBrickCount * brickBytes);
+
+	if (!uniformValues || !slots || !payload || header->brickCount != volume->GetBrickCount())
+	{
+		return nullptr;
+	}
+
+	for (size_t brick = 0u; brick < header->brickCount; ++brick)
+	{
+		if (slots[brick] != UNIFORM_BRICK && slots[brick] >= header->storedBrickCount)
+		{
+			return nullptr;
+		}
+
+		volume->SetBrickData(brick, slots[brick] == UNIFORM_BRICK ? nullptr : payload + slots[brick] * brickBytes, uniformValues[brick]);
+	}
+
+	return volume;
+}
+
+bool DiskCache::StoreVolume(uint64_t key, const SparseVolume& volume) const
+{
+	size_t brickCount = volume.GetBrickCount();
+	size_t brickBytes = SparseVolume::BRICK_VOXELS * volume.GetElementSize();
+
+	VolumeHeader header = {};
+	std::memcpy(header.magic, VOLUME_MAGIC, sizeof(VOLUME_MAGIC));
+	header.version = FORMAT_VERSION;
+	header.key = key;
+	header.width = volume.GetWidth();
+	header.height = volume.GetHeight();
+	header.depth = volume.GetDepth();
+	header.format = volume.GetFormat();
+	header.layout = volume.GetLayout();
+	header.brickCount = static_cast<uint32_t>(brickCount);
+
+	std::vector<float> uniformValues(brickCount);
+	std::vector<uint32_t> slots(brickCount, UNIFORM_BRICK);
+	for (size_t brick = 0u; brick < brickCount; ++brick)
+	{
+		uniformValues[brick] = volume.GetUniformValue(brick);
+		if (volume.GetBrickData(brick))
+		{
+			slots[brick] = header.storedBrickCount++;
+		}
+	}
+
+	std::vector<char> contents;
+	contents.reserve(sizeof(VolumeHeader) + brickCount * (sizeof(float) + sizeof(uint32_t)) + header.storedBrickCount * brickBytes);
+	Append(contents, &header, 1);
+	Append(contents, uniformValues.data(), brickCount);
+	Append(contents, slots.data(), brickCount);
+
+	for (size_t brick = 0u; brick < brickCount; ++brick)
+	{
+		if (const char* data = volume.GetBrickData(brick))
+		{
+			Append(contents, data, brickBytes);
+		}
+	}
+
+	return WriteAtomically(GetPath(key, L".volume"), contents);
+}
+
+bool DiskCache::LoadMesh(uint64_t key, std::vector<MeshChunk>& chunks) const
+{
+	MappedFile file;
+	if (!file.Open(GetPath(key, L".mesh")))
+	{
+		return false;
+	}
+
+	const MeshHeader* header = Read<MeshHeader>(file, 0, 1);
+	if (!header || std::memcmp(header->magic, MESH_MAGIC, sizeof(MESH_MAGIC)) != 0 || header->version != FORMAT_VERSION || header->key != key)
+	{
+		return false;
+	}
+
+	const ChunkEntry* entries = Read<ChunkEntry>(file, sizeof(MeshHeader), header->chunkCount);
+	if (!entries)
+	{
+		return false;
+	}
+
+	std::vector<MeshChunk> loaded(header->chunkCount);
+	for (size_t i = 0u; i < loaded.size(); ++i)
+	{
+		const ChunkEntry& entry = entries[i];
+		uint64_t normalsOffset = entry.offset + sizeof(XMFLOAT3) * static_cast<uint64_t>(entry.vertexCount);
+		uint64_t indicesOffset = normalsOffset + sizeof(XMFLOAT3) * static_cast<uint64_t>(entry.vertexCount);
+
+		const XMFLOAT3* positions = Read<XMFLOAT3>(file, entry.offset, entry.vertexCount);
+		const XMFLOAT3* normals = Read<XMFLOAT3>(file, normalsOffset, entry.vertexCount);
+		const uint32_t* indices = Read<uint32_t>(file, indicesOffset, entry.indexCount);
+
+		if (!positions || !normals || !indices || entry.indexCount % 3u != 0u)
+		{
+			return false;
+		}
+
+		//Out of range indices would reach MeshOptimizer, the KdTree and the GPU unchecked
+		for (uint32_t index = 0u; index < entry.indexCount; ++index)
+		{
+			if (indices[index] >= entry.vertexCount)
+			{
+				printf("Disk cache: %ls has an index past the vertices of chunk %zu\n\r", GetPath(key, L".mesh").c_str(), i);
+				return false;
+			}
+		}
+
+		loaded[i].positions.assign(positions, positions + entry.vertexCount);
+		loaded[i].normals.assign(normals, normals + entry.vertexCount);
+		loaded[i].indices.assign(indices, indices + entry.indexCount);
+	}
+
+	chunks = std::move(loaded);
+	return true;
+}
+
+bool DiskCache::StoreMesh(uint64_t key, const std::vector<MeshChunk>& chunks) const
+{
+	MeshHeader header = {};
+	std::memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+	header.version = FORMAT_VERSION;
+	header.key = key;
+	header.chunkCount = static_cast<uint32_t>(chunks.size());
+
+	std::vector<ChunkEntry> entries(chunks.size());
+	uint64_t offset = sizeof(MeshHeader) + sizeof(ChunkEntry) * chunks.size();
+	for (size_t i = 0u; i < chunks.size(); ++i)
+	{
+		entries[i].vertexCount = static_cast<uint32_t>(chunks[i].positions.size());
+		entries[i].indexCount = static_cast<uint32_t>(chunks[i].indices.size());
+		entries[i].offset = offset;
+		offset += sizeof(XMFLOAT3) * 2 * chunks[i].positions.size() + sizeof(uint32_t) * chunks[i].indices.size();
+	}
+
+	std::vector<char> contents;
+	contents.reserve(static_cast<size_t>(offset));
+	Append(contents, &header, 1);
+	Append(contents, entries.data(), entries.size());
+
+	for (const MeshChunk& chunk : chunks)
+	{
+		Append(contents, chunk.positions.data(), chunk.positions.size());
+		Append(contents, chunk.normals.data(), chunk.normals.size());
+		Append(contents, chunk.indices.data(), chunk.indices.size());
+	}
+
+	return WriteAtomically(GetPath(key, L".mesh"), contents);
+}
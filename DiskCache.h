@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SparseVolume.h"
+#include "MarchingCubes.h"
+
+// Generated volumes and meshes on disk, one file each, named after a hash of everything they were generated from.
+// Files keep the arrays in the layout they have in memory behind a fixed header, so loading maps the file and
+// copies the arrays out without parsing anything. Files written by another format version, cut short or with
+// another key count as a miss and are overwritten by the next store.
+class DiskCache
+{
+public:
+	// Bumped whenever the layout of the files changes
+	static const uint32_t FORMAT_VERSION = 1;
+
+	explicit DiskCache(const std::wstring& directory);
+
+	// 64 bit FNV-1a, pass the previous result as seed to hash several values one after another
+	static uint64_t Hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+	// Returns nullptr on a miss
+	std::shared_ptr<SparseVolume> LoadVolume(uint64_t key) const;
+	bool StoreVolume(uint64_t key, const SparseVolume& volume) const;
+
+	// Chunks in the order they were stored, false on a miss
+	bool LoadMesh(uint64_t key, std::vector<MeshChunk>& chunks) const;
+	bool StoreMesh(uint64_t key, const std::vector<MeshChunk>& chunks) const;
+
+private:
+	std::wstring GetPath(uint64_t key, const wchar_t* extension) const;
+	// Writes next to the target first and renames it, so a crash never leaves a half written file behind
+	bool WriteAtomically(const std::wstring& path, const std::vector<char>& contents) const;
+
+	std::wstring m_directory;
+};
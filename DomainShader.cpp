@@ -22,11 +22,7 @@ bool DomainShader::Initialize(ID3D11Device* device, WCHAR* filename)
 	ID3DBlob* errorMessage;
 	ID3DBlob* domainShaderBuffer;
 
-	DWORD shaderflags =
-		D3DCOMPILE_ENABLE_STRICTNESS
-	|	D3DCOMPILE_DEBUG
-	|	D3DCOMPILE_SKIP_OPTIMIZATION
-	;
+	DWORD shaderflags = ShaderUtility::COMPILE_FLAGS;
 
 	errorMessage = nullptr;
 	domainShaderBuffer = nullptr;
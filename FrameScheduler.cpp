@@ -0,0 +1,80 @@
+#include "pch.h"
+#include "FrameScheduler.h"
+#include "Profiler.h"
+#include <algorithm>
+
+FrameScheduler::TaskId FrameScheduler::Add(const Step& step)
+{
+	Task task = { m_nextId++, step };
+	m_tasks.push_back(task);
+	return task.id;
+}
+
+void FrameScheduler::Cancel(TaskId id)
+{
+	auto task = std::find_if(m_tasks.begin(), m_tasks.end(), [id](const Task& stored) { return stored.id == id; });
+	if (task == m_tasks.end())
+	{
+		return;
+	}
+
+	size_t index = static_cast<size_t>(task - m_tasks.begin());
+	m_tasks.erase(task);
+
+	//Keep the turn on the task that was due
+	if (index < m_nextTask)
+	{
+		m_nextTask--;
+	}
+}
+
+void FrameScheduler::Clear()
+{
+	m_tasks.clear();
+	m_nextTask = 0;
+}
+
+void FrameScheduler::Run(double budgetMilliseconds)
+{
+	//The profiler's steady clock, so budgets never jump and line up with the zones in traces
+	uint64_t start = Profiler::Now();
+	m_lastStepCount = 0;
+	m_lastRunTime = 0.0;
+
+	if (m_tasks.empty())
+	{
+		return;
+	}
+
+	do
+	{
+		if (m_nextTask >= m_tasks.size())
+		{
+			m_nextTask = 0;
+		}
+
+		//Steps may add or cancel tasks, so the task is copied and looked up again once it returns
+		Task task = m_tasks[m_nextTask];
+		bool finished = task.step();
+		m_lastStepCount++;
+
+		auto current = std::find_if(m_tasks.begin(), m_tasks.end(), [&](const Task& stored) { return stored.id == task.id; });
+		if (current == m_tasks.end())
+		{
+			continue;
+		}
+
+		//The task after it takes the next turn
+		m_nextTask = static_cast<size_t>(current - m_tasks.begin());
+		if (finished)
+		{
+			m_tasks.erase(current);
+		}
+		else
+		{
+			m_nextTask++;
+		}
+	} while (!m_tasks.empty() && (Profiler::Now() - start) / 1000000.0 < budgetMilliseconds);
+
+	m_lastRunTime = (Profiler::Now() - start) / 1000000.0;
+}
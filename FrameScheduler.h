@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Cooperative scheduler for work that would stall a frame if it ran in one go.
+// Tasks are resumable steps: each call does a small slice of work and returns true once the task is finished.
+// Run is called once per frame and takes turns between the tasks until its millisecond budget is spent,
+// so long jobs progress side by side and the frame time only grows by the budget plus one slice.
+class FrameScheduler
+{
+public:
+	typedef std::function<bool()> Step;
+	typedef size_t TaskId;
+
+	TaskId Add(const Step& step);
+	// Drops a task that has not finished yet, unknown or finished ids are ignored
+	void Cancel(TaskId id);
+	void Clear();
+
+	// Always runs at least one step, so every task finishes even if single slices exceed the budget
+	void Run(double budgetMilliseconds);
+
+	bool IsIdle() const { return m_tasks.empty(); }
+	size_t GetTaskCount() const { return m_tasks.size(); }
+	// Steps run and time spent during the last call to Run
+	size_t GetLastStepCount() const { return m_lastStepCount; }
+	double GetLastRunTime() const { return m_lastRunTime; }
+
+private:
+	struct Task
+	{
+		TaskId id;
+		Step step;
+	};
+
+	std::vector<Task> m_tasks;
+	TaskId m_nextId = 1;
+	// Task the next step goes to, so a budget smaller than one step per task still reaches all of them
+	size_t m_nextTask = 0;
+	size_t m_lastStepCount = 0;
+	double m_lastRunTime = 0.0;
+};
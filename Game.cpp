@@ -21,6 +21,25 @@ namespace GraphicsConfig
 	const int SHADOWMAP_HEIGHT = 1024;
 }
 
+namespace SaveConfig
+{
+	//Relative to the working directory, like the disk cache
+	const wchar_t* const SAVE_DIRECTORY = L"./Saves";
+	const wchar_t* const VOLUME_FILE = L"./Saves/terrain.vol";
+	//Chrome trace of the profiler, open in chrome://tracing or ui.perfetto.dev
+	const char* const TRACE_FILE = "./Saves/trace.json";
+	//One JSON line of all counters, gauges and latency histograms per interval
+	const char* const METRICS_FILE = "./Saves/metrics.jsonl";
+	const double METRICS_INTERVAL = 1.0;
+	const wchar_t* const FLYTHROUGH_FILE = L"./Saves/flythrough.input";
+}
+
+namespace FlythroughConfig
+{
+	//Recordings take one step per frame whatever the frame rate, the vsynced rate plays back at the speed they were flown
+	const float STEP_MILLISECONDS = 1000.0f / 60.0f;
+}
+
 Game::Game() noexcept(false)
 {
     //m_deviceResources = std::make_unique<DX::DeviceResources>();
@@ -63,6 +82,8 @@ void Game::SetupPrimitiveBatch()
 // Initialize the Direct3D resources required to run.
 void Game::Initialize(HWND window, int width, int height)
 {
+	Profiler::Get().SetThreadName("Main");
+
 	currentScreenWidth = width;
 	currentScreenHeight = height;
 
@@ -119,6 +140,7 @@ void Game::Initialize(HWND window, int width, int height)
 	timer = new TimerClass();
 	timer->Initialize();
 
+	geometryCache = new GeometryCache(direct3D->GetDevice());
 	RegenerateTerrain();
 
 	shadowMap = new ShadowMap(direct3D->GetDevice(), direct3D->GetCurrentSampleCount(), direct3D->GetCurrentQualityLevel());
@@ -173,9 +195,27 @@ void Game::Initialize(HWND window, int width, int height)
 // Executes the basic game loop.
 void Game::Tick()
 {
+	Profiler::Zone zone("Game::Tick");
+
 	//take in input
 	m_input.Update();								//update the hardware
 	m_gameInputCommands = m_input.getGameInput();	//retrieve the input for our game
+
+	//Replays drive the camera instead of the keyboard, one step per frame
+	if (flythroughState == FlythroughState::LOADING) {
+		m_gameInputCommands = InputCommands();
+		if (scheduler.IsIdle()) {
+			flythroughState = FlythroughState::REPLAYING;
+			replayStart = Profiler::Now();
+		}
+	}
+	if (flythroughState == FlythroughState::REPLAYING && !inputLog.Next(m_gameInputCommands)) {
+		m_gameInputCommands = InputCommands();
+		StopReplay();
+	}
+	else if (flythroughState == FlythroughState::RECORDING) {
+		inputLog.Append(m_gameInputCommands);
+	}
 	
 	//Update all game objects
     m_timer.Tick([&]()
@@ -186,6 +226,8 @@ void Game::Tick()
 	//Render all game content. 
     Render();
 
+	Metrics::Get().EndFrame();
+
 #ifdef DXTK_AUDIO
     // Only update audio engine once per frame
     if (!m_audEngine->IsCriticalError() && m_audEngine->Update())
@@ -197,26 +239,30 @@ void Game::Tick()
 #endif
 }
 
-bool Game::CastCanMoveRay(const Ray& ray, float maxRange)
+bool Game::CastShootRay(const Ray& ray, float maxRange)
 {
+	Profiler::Zone zone("Game::CastShootRay");
+
 	float hitfloat = 0.0f;
 
 	KdTree::RayHitStruct hit1;
+	bool treeHit = tree.hit(&ray, hitfloat, maxRange, hit1);
 
-	return tree.hit(&ray, hitfloat, maxRange, hit1);
-}
-
+	//The heightfield is not part of the tree, keep whichever hit is closer
+	float groundDistance = 0.0f;
+	bool groundHit = terrainMap && terrainMap->Raycast(ray, maxRange, groundDistance);
 
-bool Game::CastShootRay(const Ray& ray, float maxRange)
-{
-	float hitfloat = 0.0f;
-
-	KdTree::RayHitStruct hit1;
-	if (tree.hit(&ray, hitfloat, maxRange, hit1))
+	if (groundHit && (!treeHit || groundDistance < hit1.hitDistance))
+	{
+		hasHit = true;
+		lastHitDistance = groundDistance;
+		lastHitPoint = ray.position + ray.direction * groundDistance;
+	}
+	else if (treeHit)
 	{
 		hasHit = true;
 		lastHitDistance = hit1.hitDistance;
-		Vector3 lastHitPoint = hit1.hitPoint;
+		lastHitPoint = hit1.hitPoint;
 	}
 	else
 	{
@@ -252,6 +298,8 @@ void Game::ToggleWireframe() {
 
 void Game::RegenerateTerrain()
 {
+	Profiler::Zone zone("Game::RegenerateTerrain");
+
 	if (terrainType == 0) {
 		currentTerrainType = "CUBE";
 	}
@@ -274,17 +322,75 @@ void Game::RegenerateTerrain()
 		currentTerrainType = "PILLAR";
 	}
 
-	tree.PurgeTriangles();
-
-	delete terrain;
 	GeometryData::TerrainType::Enum terrainSelect = static_cast<GeometryData::TerrainType::Enum>(terrainType);
-	terrain = new GeometryData(terrainCountX, terrainCountY, terrainCountZ, terrainSelect, direct3D->GetDevice(), direct3D->GetDeviceContext(), &tree, noiseScale);
-	terrain->worldMatrix = XMMatrixIdentity() * XMMatrixScaling(5.0f, 5.0f, 5.0f);
-	//terrain->DebugPrint();
 
-	delete terrainMap;
-	terrainMap = new GeometryData(64, 16, 64, GeometryData::TerrainType::HEIGHT_MAP, direct3D->GetDevice(), direct3D->GetDeviceContext(), &tree, noiseScale);
-	terrainMap->worldMatrix = XMMatrixIdentity() * XMMatrixScaling(50.0f, 10.f, 50.0f) * XMMatrixTranslation(0.0f, -5.0f, 0.0f);
+	//Only rebuild what the changed inputs reach, brush edits count as a change so a click resets them
+	bool terrainChanged = (!terrain && !pendingTerrain) || (terrain && terrain->IsEdited()) || terrainType != generatedTerrainType ||
+		terrainCountX != generatedCountX || terrainCountY != generatedCountY || terrainCountZ != generatedCountZ ||
+		gpuMarchingCubes != generatedGPUMarchingCubes ||
+		(TerrainPresets::UsesNoiseScale(terrainSelect) && noiseScale != generatedNoiseScale);
+
+	if (terrainChanged)
+	{
+		//A terrain still being built for older inputs is dropped
+		scheduler.Cancel(terrainTask);
+		delete pendingTerrain;
+
+		pendingTerrain = new GeometryData(terrainCountX, terrainCountY, terrainCountZ, terrainSelect, geometryCache, &tree, noiseScale, gpuMarchingCubes);
+		pendingTerrain->worldMatrix = XMMatrixIdentity() * XMMatrixScaling(5.0f, 5.0f, 5.0f);
+		//pendingTerrain->DebugPrint();
+
+		terrainTask = scheduler.Add([this]()
+		{
+			if (!pendingTerrain->Generate(direct3D->GetDevice(), direct3D->GetDeviceContext()))
+			{
+				return false;
+			}
+
+			//Swapped in whole, the old terrain is drawn and hit by rays until now.
+			//Only the central object has triangles in the tree, the ground answers rays from its own quadtree.
+			tree.PurgeTriangles();
+			pendingTerrain->AttachToTree();
+
+			delete terrain;
+			terrain = pendingTerrain;
+			pendingTerrain = nullptr;
+			return true;
+		});
+
+		generatedTerrainType = terrainType;
+		generatedCountX = terrainCountX;
+		generatedCountY = terrainCountY;
+		generatedCountZ = terrainCountZ;
+		generatedGPUMarchingCubes = gpuMarchingCubes;
+		generatedNoiseScale = noiseScale;
+	}
+
+	//The ground only depends on the noise scale
+	if ((!terrainMap && !pendingTerrainMap) || noiseScale != generatedMapNoiseScale)
+	{
+		scheduler.Cancel(terrainMapTask);
+		delete pendingTerrainMap;
+
+		//Large enough to be drawn as a clipmap, the ground reaches most of the way to the far plane
+		pendingTerrainMap = new GeometryData(2049, 16, 2049, GeometryData::TerrainType::HEIGHT_MAP, geometryCache, &tree, noiseScale, gpuMarchingCubes);
+		pendingTerrainMap->worldMatrix = XMMatrixIdentity() * XMMatrixScaling(400.0f, 10.f, 400.0f) * XMMatrixTranslation(0.0f, -5.0f, 0.0f);
+
+		terrainMapTask = scheduler.Add([this]()
+		{
+			if (!pendingTerrainMap->Generate(direct3D->GetDevice(), direct3D->GetDeviceContext()))
+			{
+				return false;
+			}
+
+			delete terrainMap;
+			terrainMap = pendingTerrainMap;
+			pendingTerrainMap = nullptr;
+			return true;
+		});
+
+		generatedMapNoiseScale = noiseScale;
+	}
 
 	//delete sphere;
 	//sphere = new GeometryData(16, 16, 16, GeometryData::TerrainType::CUBE, direct3D->GetDevice(), direct3D->GetDeviceContext(), &tree);
@@ -292,37 +398,49 @@ void Game::RegenerateTerrain()
 }
 
 void Game::CastCanMoveRays() {
-	// Use a single ray and move it to different directions if input keys are pressed
-	Ray ray;
-	ray.position = m_Camera.GetPosition();
+	Profiler::Zone zone("Game::CastCanMoveRays");
+
+	// One ray per pressed direction, all of them tested against the tree in one batch
 	XMMATRIX newdir;
 	m_Camera.GetViewMatrix(newdir);
+	Matrix view = Matrix(newdir).Transpose();
+
+	std::vector<Ray> rays;
+	std::vector<bool*> blocks;
+	auto addRay = [&](bool pressed, const Vector3& direction, bool& block) {
+		if (pressed) {
+			Ray ray;
+			ray.position = m_Camera.GetPosition();
+			ray.direction = direction;
+			rays.push_back(ray);
+			blocks.push_back(&block);
+		}
+	};
 
-	if (m_gameInputCommands.forward) {
-		ray.direction = Matrix(newdir).Transpose().Backward();
-		blockForward = CastCanMoveRay(ray, 1);
-	}
+	addRay(m_gameInputCommands.forward, view.Backward(), blockForward);
+	addRay(m_gameInputCommands.back, view.Forward(), blockBackward);
+	addRay(m_gameInputCommands.left, view.Left(), blockLeft);
+	addRay(m_gameInputCommands.right, view.Right(), blockRight);
 
-	if (m_gameInputCommands.back) {
-		ray.direction = Matrix(newdir).Transpose().Forward();
-		blockBackward = CastCanMoveRay(ray, 1);
-	}
+	const float maxRange = 1.0f;
+	std::vector<KdTree::RayHitStruct> hits;
+	tree.HitBatch(rays, maxRange, hits);
 
-	if (m_gameInputCommands.left) {
-		ray.direction = Matrix(newdir).Transpose().Left();
-		blockLeft = CastCanMoveRay(ray, 1);
-	}
-
-	if (m_gameInputCommands.right) {
-		ray.direction = Matrix(newdir).Transpose().Right();
-		blockRight = CastCanMoveRay(ray, 1);
+	for (size_t i = 0; i < rays.size(); ++i) {
+		float groundDistance = 0.0f;
+		*blocks[i] = hits[i].hitTriangle != nullptr || (terrainMap && terrainMap->Raycast(rays[i], maxRange, groundDistance));
 	}
 }
 
 void Game::TakeInput() {
-	m_Camera.DoMovement(&m_gameInputCommands, blockForward, blockLeft, blockRight, blockBackward);
+	if (flythroughState == FlythroughState::OFF) {
+		m_Camera.DoMovement(&m_gameInputCommands, blockForward, blockLeft, blockRight, blockBackward);
+	}
+	else {
+		m_Camera.DoMovement(&m_gameInputCommands, blockForward, blockLeft, blockRight, blockBackward, inputLog.GetSettings().stepMilliseconds);
+	}
 
-	if (m_gameInputCommands.shoot)
+	if (m_gameInputCommands.shoot || m_gameInputCommands.brush)
 	{
 		Ray ray;
 		ray.position = m_Camera.GetPosition();
@@ -330,13 +448,19 @@ void Game::TakeInput() {
 		m_Camera.GetViewMatrix(newdir);
 		ray.direction = Matrix(newdir).Transpose().Backward();
 
-		CastShootRay(ray, 10000);
+		//Held down the brush keeps editing wherever the view ray lands
+		if (CastShootRay(ray, 10000) && m_gameInputCommands.brush && terrain)
+		{
+			terrain->ApplyBrush(direct3D->GetDeviceContext(), static_cast<GeometryData::BrushMode::Enum>(brushMode), lastHitPoint, brushRadius, brushStrength);
+		}
 	}
 }
 
 // Updates the world.
 void Game::Update(DX::StepTimer const& timer)
 {
+	Profiler::Zone zone("Game::Update");
+
 	if (checkCollisions) {
 		CastCanMoveRays();
 	}
@@ -344,6 +468,8 @@ void Game::Update(DX::StepTimer const& timer)
 		blockForward = blockBackward = blockLeft = blockRight = false;
 	}
 
+	//Generation runs before the tree update, so a terrain swapped in this frame is hit by this frame's rays
+	scheduler.Run(generationBudget);
 	tree.UpdateKDTree();
 
 	TakeInput();
@@ -354,7 +480,10 @@ void Game::Update(DX::StepTimer const& timer)
 	//m_world = Matrix::Identity;
 
 	/*create our UI*/
-	SetupGUI();
+	{
+		Metrics::StageTimer stage("GUI");
+		SetupGUI();
+	}
 
 #ifdef DXTK_AUDIO
     m_audioTimerAcc -= (float)timer.GetElapsedSeconds();
@@ -397,16 +526,25 @@ bool Game::RenderShadowMap(const XMMATRIX& lightViewMatrix, const XMMATRIX& ligh
 
 	//Geometry Goes here, Shadow Map RenderPass
 	//Loop for multiple Geometry
-	if (terrain->isGeometryGenerated)
+	GeometryData* terrains[] = { terrain, terrainMap };
+	for (GeometryData* geometry : terrains)
 	{
-		terrain->SetVertexBuffer(direct3D->GetDeviceContext());
-		shadowMap->Render(direct3D->GetDeviceContext(), terrain->GetVertexCount(), terrain->worldMatrix, lightViewMatrix, lightProjectionMatrix);
-	}
+		if (!geometry || !geometry->isGeometryGenerated)
+		{
+			continue;
+		}
 
-	if (terrainMap->isGeometryGenerated)
-	{
-		terrainMap->SetVertexBuffer(direct3D->GetDeviceContext());
-		shadowMap->Render(direct3D->GetDeviceContext(), terrainMap->GetVertexCount(), terrainMap->worldMatrix, lightViewMatrix, lightProjectionMatrix);
+		//Clipmaps have no index buffer of their own, their depth shader places the grid from the level samples
+		if (geometry->HasClipmap())
+		{
+			shadowMap->PrepareClipmap(direct3D->GetDeviceContext(), geometry->worldMatrix, lightViewMatrix, lightProjectionMatrix);
+			geometry->RenderClipmapDepth(direct3D->GetDeviceContext(), m_Camera.GetPosition());
+		}
+		else if (geometry->GetIndexCount() > 0)
+		{
+			geometry->SetVertexBuffer(direct3D->GetDeviceContext());
+			shadowMap->Render(direct3D->GetDeviceContext(), geometry->GetIndexCount(), geometry->GetQuantizedWorldMatrix(), lightViewMatrix, lightProjectionMatrix);
+		}
 	}
 
 	direct3D->SetBackBufferRenderTarget();
@@ -418,17 +556,14 @@ bool Game::RenderShadowMap(const XMMATRIX& lightViewMatrix, const XMMATRIX& ligh
 // Draws the scene.
 void Game::Render()
 {
-	static float totaltime = 0.0f;
+	Profiler::Zone zone("Game::Render");
+
 	timer->Frame();
-	static float rotation = 0.0f;
 
+	//Frame times and fps come from Metrics, this only drives the animation
 	float deltaTime = timer->GetFrameTime();
-	totaltime += deltaTime;
-
-	if (totaltime > 1000)
-	{
-		//fps = 1000.0f / deltaTime;
-		totaltime = 0.0f;
+	if (flythroughState != FlythroughState::OFF) {
+		deltaTime = inputLog.GetSettings().stepMilliseconds;
 	}
 
     // Don't try to render anything before the first Update.
@@ -456,24 +591,31 @@ void Game::Render()
 	m_Light.GetProjectionMatrix(lightProjectionMatrix);
 
 	//Generate Shadow Map
-	RenderShadowMap(lightViewMatrix, lightProjectionMatrix);
+	{
+		Metrics::StageTimer stage("Shadow pass");
+		RenderShadowMap(lightViewMatrix, lightProjectionMatrix);
+	}
 
 	//clear Buffer at beginning
 	//direct3D->BeginScene(0.2f, 0.5f, 0.5f, 0.0f);
 	SetScreenBuffer(0.5f, 0.5f, 0.5f, 1.0f);
 
 	// Render Skybox
-	direct3D->TurnOffCulling();
-	direct3D->TurnZBufferOff();
-	m_world = SimpleMath::Matrix::Identity * Matrix::CreateScale(50.f) * SimpleMath::Matrix::CreateTranslation(m_Camera.GetPosition());
-	skydome->Render(direct3D->GetDeviceContext());
-	skydomeShader->Render(direct3D->GetDeviceContext(), skydome->GetIndexCount(), m_world, viewMatrix, sky_projection, skydome->GetApexColor(), skydome->GetCenterColor());
-	direct3D->TurnOnCulling();
-	direct3D->TurnZBufferOn();
+	{
+		Metrics::StageTimer stage("Skydome");
+		direct3D->TurnOffCulling();
+		direct3D->TurnZBufferOff();
+		m_world = SimpleMath::Matrix::Identity * Matrix::CreateScale(50.f) * SimpleMath::Matrix::CreateTranslation(m_Camera.GetPosition());
+		skydome->Render(direct3D->GetDeviceContext());
+		skydomeShader->Render(direct3D->GetDeviceContext(), skydome->GetIndexCount(), m_world, viewMatrix, sky_projection, skydome->GetApexColor(), skydome->GetCenterColor());
+		direct3D->TurnOnCulling();
+		direct3D->TurnZBufferOn();
+	}
 
 	//Render Geometry	
 	if (terrain)
 	{
+		Metrics::StageTimer stage("Terrain");
 		if (rotateGeometry)
 		{
 			terrain->worldMatrix *= XMMatrixRotationY(deltaTime * 0.0001f);
@@ -486,6 +628,7 @@ void Game::Render()
 	//Render Geometry	
 	if (terrainMap)
 	{
+		Metrics::StageTimer stage("Terrain map");
 		//if (rotateGeometry)
 		//{
 		//	terrainMap->worldMatrix *= XMMatrixRotationY(deltaTime * 0.0001f);
@@ -495,6 +638,7 @@ void Game::Render()
 
 	// Draw KDTree
 	if (renderKDTree) {
+		Metrics::StageTimer stage("KdTree draw");
 		basicEffect->SetWorld(XMMatrixIdentity());
 		basicEffect->SetView(viewMatrix);
 		basicEffect->SetProjection(projectionMatrix);
@@ -507,8 +651,11 @@ void Game::Render()
 	}
 
 	//render our GUI
-	ImGui::Render();
-	ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+	{
+		Metrics::StageTimer stage("GUI");
+		ImGui::Render();
+		ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+	}
 	
 
     // Show the new frame.
@@ -535,6 +682,8 @@ void Game::Render()
 
 bool Game::GenerateScreenBuffer()
 {
+	Profiler::Zone zone("Game::GenerateScreenBuffer");
+
 	D3D11_TEXTURE2D_DESC textureDesc;
 	HRESULT result;
 	D3D11_RENDER_TARGET_VIEW_DESC renderTargetViewDesc;
@@ -813,6 +962,11 @@ void Game::SetupGUI()
 	}
 	ImGui::SliderInt("TerrainType", &terrainType, 0, 6);
 	ImGui::SliderFloat("NoiseScale", &noiseScale, 10.f, 100.0f);
+	ImGui::Checkbox("GPU Marching Cubes", &gpuMarchingCubes);
+	ImGui::SliderFloat("Generation Budget (ms)", &generationBudget, 0.5f, 16.0f);
+	if (!scheduler.IsIdle()) {
+		ImGui::Text("Generating: %zu tasks, %zu steps in %.2f ms last frame", scheduler.GetTaskCount(), scheduler.GetLastStepCount(), scheduler.GetLastRunTime());
+	}
 	ImGui::Text("Terrain Cube Resolution");
 	ImGui::SliderInt("Object Resolution X", &terrainCountX, 10, 128);
 	ImGui::SliderInt("Object Resolution Y", &terrainCountY, 10, 128);
@@ -822,6 +976,31 @@ void Game::SetupGUI()
 	ImGui::Begin("Hit Detection");
 	ImGui::Text("Press Space to Shoot.");
 	ImGui::Text(hasHit ? "Has Hit!!" : "No Hit");
+	ImGui::Text("Hold B to use the brush (CPU Marching Cubes only).");
+	ImGui::RadioButton("Add", &brushMode, GeometryData::BrushMode::ADD);
+	ImGui::SameLine();
+	ImGui::RadioButton("Subtract", &brushMode, GeometryData::BrushMode::SUBTRACT);
+	ImGui::SameLine();
+	ImGui::RadioButton("Smooth", &brushMode, GeometryData::BrushMode::SMOOTH);
+	ImGui::SliderFloat("Brush Radius", &brushRadius, 0.2f, 3.0f);
+	ImGui::SliderFloat("Smooth Strength", &brushStrength, 0.0f, 1.0f);
+	if (ImGui::Button("Save Volume") && terrain) {
+		CreateDirectoryW(SaveConfig::SAVE_DIRECTORY, nullptr);
+		terrain->SaveVolume(SaveConfig::VOLUME_FILE);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Load Volume") && terrain) {
+		terrain->LoadVolume(direct3D->GetDeviceContext(), SaveConfig::VOLUME_FILE);
+	}
+	//Prints CSV lines to the console, takes a few seconds on large terrains
+	if (ImGui::Button("Measure Thread Scaling") && terrain) {
+		terrain->ReportScaling();
+	}
+	//Only the newest events of every thread are kept, older ones have been overwritten
+	if (ImGui::Button("Save Profiler Trace")) {
+		CreateDirectoryW(SaveConfig::SAVE_DIRECTORY, nullptr);
+		Profiler::Get().WriteChromeTrace(SaveConfig::TRACE_FILE);
+	}
 	if (hasHit) {
 		//ImGui::Text("Last Hit Distance:  %f", &lastHitDistance);
 		//ImGui::Text("Last Hit Point:  %f %f %f", &lastHitPoint.x, &lastHitPoint.y, &lastHitPoint.z);
@@ -835,6 +1014,33 @@ void Game::SetupGUI()
 	ImGui::Text(m_gameInputCommands.back ? (blockBackward ? "Back Blocked!!!" : "Moving Backward") : "Press S to go Backward");
 	ImGui::Text(m_gameInputCommands.left ? (blockLeft ? "Left Blocked!!!" : "Strafing Left") : "Press A to strafe Left");
 	ImGui::Text(m_gameInputCommands.right ? (blockRight ? "Right Blocked!!!" : "Strafing Right") : "Press D to strafe Right");
+	//Replays restore the terrain and camera of the recording, regenerate to compare against a changed build
+	if (flythroughState == FlythroughState::OFF) {
+		if (ImGui::Button("Record Flythrough")) {
+			StartRecording();
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Replay Flythrough")) {
+			StartReplay();
+		}
+	}
+	else if (flythroughState == FlythroughState::RECORDING) {
+		ImGui::Text("Recording: %zu steps", inputLog.GetStepCount());
+		if (ImGui::Button("Stop Recording")) {
+			StopRecording();
+		}
+	}
+	else {
+		if (flythroughState == FlythroughState::LOADING) {
+			ImGui::Text("Replay: generating terrain");
+		}
+		else {
+			ImGui::Text("Replaying step %zu of %zu", inputLog.GetReadCount(), inputLog.GetStepCount());
+		}
+		if (ImGui::Button("Stop Replay")) {
+			StopReplay();
+		}
+	}
 	ImGui::End();
 
 
@@ -844,6 +1050,33 @@ void Game::SetupGUI()
 		ToggleWireframe();
 	}
 
+	//Walks the whole tree, only while the header is open
+	if (ImGui::CollapsingHeader("Tree Statistics")) {
+		KdTree::Statistics statistics = tree.GetStatistics();
+		ImGui::Text("%zu nodes, %zu leaves, %zu cut short", statistics.nodes, statistics.leaves, statistics.cutLeaves);
+		ImGui::Text("Depth %zu max, %.1f mean over leaves", statistics.maxDepth, statistics.averageLeafDepth);
+		ImGui::Text("%zu triangles, %zu references (%.2fx)", statistics.triangles, statistics.triangleReferences, statistics.duplication);
+		ImGui::Text("SAH cost %.1f", statistics.sahCost);
+
+		//Only measured while this is open, edits keep just the counts up to date
+		Metrics& metrics = Metrics::Get();
+		metrics.SetGauge("KdTree duplication", statistics.duplication);
+		metrics.SetGauge("KdTree SAH cost", statistics.sahCost);
+
+		float occupancy[KdTree::OCCUPANCY_BUCKETS];
+		for (size_t bucket = 0u; bucket < KdTree::OCCUPANCY_BUCKETS; ++bucket) {
+			occupancy[bucket] = static_cast<float>(statistics.leafOccupancy[bucket]);
+		}
+		ImGui::PlotHistogram("Leaf triangles (1, 2-3, 4-7, ...)", occupancy, static_cast<int>(KdTree::OCCUPANCY_BUCKETS), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+		//Since the start, over every ray the brush, collisions and shooting cast
+		int64_t queries = metrics.GetCounter("KdTree ray queries");
+		if (queries > 0) {
+			ImGui::Text("%lld queries, %.1f nodes visited and %.1f triangles tested each", static_cast<long long>(queries),
+				static_cast<double>(metrics.GetCounter("KdTree nodes visited")) / queries, static_cast<double>(metrics.GetCounter("KdTree triangles tested")) / queries);
+		}
+	}
+
 	ImGui::Text("Pixel Shader Displacement");
 	ImGui::SliderFloat("Depth Factor", &depthfactor, 0.001f, 0.1f);
 	ImGui::SliderInt("Initial Steps", &steps_initial, 0, 100);
@@ -858,18 +1091,190 @@ void Game::SetupGUI()
 	ImGui::End();
 
 	ImGui::Begin("Menu");
+	ImGui::Checkbox("Show Performance", &showPerformance);
 	if (ImGui::Button("Exit Game")) {
 		ExitGame();
 	}
 	ImGui::End();
+
+	//Closing the window with its button hides it too, measuring stops with the next frame
+	Metrics::Get().SetEnabled(showPerformance);
+	if (Metrics::Get().IsEnabled()) {
+		PublishMetrics();
+	}
+	if (showPerformance) {
+		SetupPerformanceGUI();
+	}
+}
+
+void Game::StartRecording()
+{
+	//Replays start on the terrain generated from these inputs, brush edits made before the recording are not part of it
+	InputLog::Settings settings = {};
+	settings.stepMilliseconds = FlythroughConfig::STEP_MILLISECONDS;
+	settings.terrainType = generatedTerrainType;
+	settings.terrainCount[0] = generatedCountX;
+	settings.terrainCount[1] = generatedCountY;
+	settings.terrainCount[2] = generatedCountZ;
+	settings.noiseScale = generatedNoiseScale;
+	settings.gpuMarchingCubes = generatedGPUMarchingCubes;
+	settings.brushMode = brushMode;
+	settings.brushRadius = brushRadius;
+	settings.brushStrength = brushStrength;
+
+	Vector3 position = m_Camera.GetPosition();
+	Vector3 rotation = m_Camera.GetRotation();
+	settings.cameraPosition[0] = position.x;
+	settings.cameraPosition[1] = position.y;
+	settings.cameraPosition[2] = position.z;
+	settings.cameraRotation[0] = rotation.x;
+	settings.cameraRotation[1] = rotation.y;
+	settings.cameraRotation[2] = rotation.z;
+
+	inputLog.Begin(settings);
+	flythroughCheckCollisions = checkCollisions;
+	checkCollisions = true;
+	flythroughState = FlythroughState::RECORDING;
+}
+
+void Game::StopRecording()
+{
+	flythroughState = FlythroughState::OFF;
+	checkCollisions = flythroughCheckCollisions;
+
+	CreateDirectoryW(SaveConfig::SAVE_DIRECTORY, nullptr);
+	if (inputLog.Save(SaveConfig::FLYTHROUGH_FILE)) {
+		printf("Flythrough: recorded %zu steps\n\r", inputLog.GetStepCount());
+	}
+}
+
+bool Game::StartReplay()
+{
+	if (!inputLog.Load(SaveConfig::FLYTHROUGH_FILE)) {
+		return false;
+	}
+
+	//The same inputs as the recording, RegenerateTerrain keeps the terrain if it already matches them
+	const InputLog::Settings& settings = inputLog.GetSettings();
+	terrainType = settings.terrainType;
+	terrainCountX = settings.terrainCount[0];
+	terrainCountY = settings.terrainCount[1];
+	terrainCountZ = settings.terrainCount[2];
+	noiseScale = settings.noiseScale;
+	gpuMarchingCubes = settings.gpuMarchingCubes != 0u;
+	brushMode = settings.brushMode;
+	brushRadius = settings.brushRadius;
+	brushStrength = settings.brushStrength;
+	RegenerateTerrain();
+
+	m_Camera.SetPosition(settings.cameraPosition[0], settings.cameraPosition[1], settings.cameraPosition[2]);
+	m_Camera.SetRotation(settings.cameraRotation[0], settings.cameraRotation[1], settings.cameraRotation[2]);
+
+	flythroughCheckCollisions = checkCollisions;
+	checkCollisions = true;
+	flythroughState = FlythroughState::LOADING;
+	return true;
+}
+
+void Game::StopReplay()
+{
+	if (flythroughState == FlythroughState::REPLAYING) {
+		double seconds = (Profiler::Now() - replayStart) / 1000000000.0;
+		size_t steps = inputLog.GetReadCount();
+		printf("Flythrough: replayed %zu of %zu steps in %.3f s, %.3f ms per frame\n\r", steps, inputLog.GetStepCount(), seconds,
+			steps ? seconds * 1000.0 / steps : 0.0);
+	}
+
+	flythroughState = FlythroughState::OFF;
+	checkCollisions = flythroughCheckCollisions;
+}
+
+void Game::SetupPerformanceGUI()
+{
+	Metrics& metrics = Metrics::Get();
+
+	ImGui::Begin("Performance", &showPerformance);
+
+	std::vector<float> frameTimes = metrics.GetFrameTimes();
+	float p50 = metrics.GetFramePercentile(50.0f);
+	ImGui::Text("%.2f ms (%.0f fps) median over %zu frames", p50, p50 > 0.0f ? 1000.0f / p50 : 0.0f, frameTimes.size());
+	ImGui::Text("p50 %.2f ms  p95 %.2f ms  p99 %.2f ms", p50, metrics.GetFramePercentile(95.0f), metrics.GetFramePercentile(99.0f));
+	if (!frameTimes.empty()) {
+		ImGui::PlotLines("Frame (ms)", frameTimes.data(), static_cast<int>(frameTimes.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+	}
+
+	//CPU time spent issuing each stage, the GPU work runs later and shows up in the frame time
+	ImGui::Text("Stages (mean CPU ms)");
+	for (const Metrics::Stage& stage : metrics.GetStages()) {
+		ImGui::BulletText("%-12s %6.3f", stage.name, stage.meanMilliseconds);
+	}
+
+	ImGui::Text("Counters");
+	for (const Metrics::Gauge& gauge : metrics.GetGauges()) {
+		if (gauge.unit == Metrics::GaugeUnit::BYTES) {
+			ImGui::BulletText("%-28s %10.2f MB", gauge.name, gauge.value / (1024.0 * 1024.0));
+		}
+		else {
+			ImGui::BulletText("%-28s %10.0f", gauge.name, gauge.value);
+		}
+	}
+	for (const Metrics::Counter& counter : metrics.GetCounters()) {
+		ImGui::BulletText("%-28s %10lld", counter.name, static_cast<long long>(counter.value));
+	}
+
+	//Since the start, while measuring
+	ImGui::Text("Latency (ms)             count     p50     p95     p99");
+	for (const Metrics::Histogram& histogram : metrics.GetHistograms()) {
+		ImGui::BulletText("%-20s %8llu %7.3f %7.3f %7.3f", histogram.name, static_cast<unsigned long long>(histogram.count),
+			histogram.p50Milliseconds, histogram.p95Milliseconds, histogram.p99Milliseconds);
+	}
+
+	bool dumping = metrics.IsDumping();
+	if (ImGui::Checkbox("Dump to Saves/metrics.jsonl", &dumping)) {
+		if (dumping) {
+			CreateDirectoryW(SaveConfig::SAVE_DIRECTORY, nullptr);
+			metrics.StartDump(SaveConfig::METRICS_FILE, SaveConfig::METRICS_INTERVAL);
+		}
+		else {
+			metrics.StopDump();
+		}
+	}
+	ImGui::End();
+}
+
+void Game::PublishMetrics()
+{
+	//Both terrains are drawn, the counters cover them together
+	size_t triangles = 0u, densityBytes = 0u, meshBytes = 0u;
+	for (const GeometryData* geometry : { terrain, terrainMap }) {
+		if (geometry) {
+			triangles += geometry->GetTriangleCount();
+			densityBytes += geometry->GetDensityBytes();
+			meshBytes += geometry->GetMeshBytes();
+		}
+	}
+
+	Metrics& metrics = Metrics::Get();
+	metrics.SetGauge("Terrain triangles", static_cast<double>(triangles));
+	metrics.SetGauge("Density", static_cast<double>(densityBytes), Metrics::GaugeUnit::BYTES);
+	metrics.SetGauge("Mesh", static_cast<double>(meshBytes), Metrics::GaugeUnit::BYTES);
 }
 
 
 void Game::OnDeviceLost()
 {
+	scheduler.Clear();
+	delete pendingTerrain;
+	pendingTerrain = nullptr;
+	delete pendingTerrainMap;
+	pendingTerrainMap = nullptr;
 	delete shadowMap;
 	delete terrainMap;
+	terrainMap = nullptr;
 	delete terrain;
+	terrain = nullptr;
+	delete geometryCache;
+	geometryCache = nullptr;
     m_states.reset();
     m_fxFactory.reset();
     //m_sprites.reset();
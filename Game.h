@@ -9,9 +9,13 @@
 #include "StepTimer.h"
 #include "Light.h"
 #include "Input.h"
+#include "InputLog.h"
 #include "Camera.h"
 #include "RenderTexture.h"
 #include "GeometryData.h"
+#include "FrameScheduler.h"
+#include "Metrics.h"
+#include "Profiler.h"
 #include "ShadowMap.h"
 #include "SkydomeShader.h"
 #include "Skydome.h"
@@ -76,12 +80,20 @@ private:
     void CreateDeviceDependentResources();
     void CreateWindowSizeDependentResources();
 	void SetupGUI();
+	// Performance window, reads the Metrics registry which only measures while it is shown or dumped
+	void SetupPerformanceGUI();
+	// Gauges of the terrains, the KdTree publishes its own
+	void PublishMetrics();
     void RegenerateTerrain();
     void ChangeWireframing();
     void ToggleWireframe();
     bool CastShootRay(const Ray& ray, float maxRange);
+    // Flythroughs are recorded and replayed on a fixed step, with collisions on and the terrain they started on
+    void StartRecording();
+    void StopRecording();
+    bool StartReplay();
+    void StopReplay();
     void CastCanMoveRays();
-    bool CastCanMoveRay(const Ray& ray, float maxRange);
 
     // Device resources.
     //std::unique_ptr<DX::DeviceResources>    m_deviceResources;
@@ -138,6 +150,7 @@ private:
     int steps_refinement = 5;
     float depthfactor = 0.08f;
     float noiseScale = 10.f;
+    bool gpuMarchingCubes = false;
 
     int terrainCountX = 64;
     int terrainCountY = 64;
@@ -160,6 +173,32 @@ private:
     KdTree::MyBoundingBox* lastHitBox;
     Vector3 lastHitPoint;
 
+    // Brush
+    int brushMode = 0;
+    float brushRadius = 0.75f;
+    float brushStrength = 0.5f;
+
+    // Performance
+    bool showPerformance = false;
+
+    // Flythrough recording and replay
+    struct FlythroughState
+    {
+        enum Enum
+        {
+            OFF,
+            RECORDING,
+            // Waits for the terrain of the log to be generated, so every replay starts on a finished terrain
+            LOADING,
+            REPLAYING
+        };
+    };
+    FlythroughState::Enum flythroughState = FlythroughState::OFF;
+    InputLog inputLog;
+    // Collisions setting to restore, flythroughs always check them
+    bool flythroughCheckCollisions = true;
+    uint64_t replayStart = 0;
+
 
 
     // KDTree
@@ -170,6 +209,19 @@ private:
     // Marching Cubes Terrain
     GeometryData* terrain = nullptr;
     GeometryData* terrainMap = nullptr;
+    GeometryCache* geometryCache = nullptr;
+    // Inputs the current terrains were generated from, RegenerateTerrain skips the ones that did not change
+    int generatedTerrainType = -1;
+    int generatedCountX = 0, generatedCountY = 0, generatedCountZ = 0;
+    float generatedNoiseScale = 0.0f;
+    float generatedMapNoiseScale = 0.0f;
+    bool generatedGPUMarchingCubes = false;
+    // Terrains are generated a slice at a time within the frame budget and replace the drawn ones once complete
+    FrameScheduler scheduler;
+    float generationBudget = 2.0f;
+    GeometryData* pendingTerrain = nullptr;
+    GeometryData* pendingTerrainMap = nullptr;
+    FrameScheduler::TaskId terrainTask = 0, terrainMapTask = 0;
     KdTree tree;
     ShadowMap* shadowMap;
 
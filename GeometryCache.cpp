@@ -0,0 +1,282 @@
+#include "pch.h"
+#include "GeometryCache.h"
+#include "TriangleLUT.h"
+#include <algorithm>
+
+namespace GeometryCacheConfig
+{
+	//Enough to flip between a few presets and resolutions without regenerating, sparse volumes are a few MB at most
+	const size_t VOLUME_COUNT = 4;
+
+	//Relative to the working directory, like the assets
+	const wchar_t* const DISK_CACHE_DIRECTORY = L"./Cache";
+}
+
+GeometryCache::GeometryCache(ID3D11Device* device)
+	: m_diskCache(GeometryCacheConfig::DISK_CACHE_DIRECTORY)
+{
+	CreateTriangleLUT(device);
+	CreateSamplerStates(device);
+	InitializeShaders(device);
+	LoadTextures(device);
+}
+
+GeometryCache::~GeometryCache()
+{
+	m_volumes.clear();
+
+	if (m_triangleLUT)
+	{
+		m_triangleLUT->Release();
+		m_triangleLUT = nullptr;
+	}
+
+	if (m_densitySampler)
+	{
+		m_densitySampler->Release();
+		m_densitySampler = nullptr;
+	}
+
+	if (m_clampSampler)
+	{
+		m_clampSampler->Release();
+		m_clampSampler = nullptr;
+	}
+
+	if (m_wrapSampler)
+	{
+		m_wrapSampler->Release();
+		m_wrapSampler = nullptr;
+	}
+
+	for (size_t i = 0u; i < 3; ++i)
+	{
+		if (m_colorTextures[i] != nullptr)
+		{
+			m_colorTextures[i]->Shutdown();
+			delete m_colorTextures[i];
+		}
+		m_colorTextures[i] = nullptr;
+	}
+
+	delete m_marchingCubeVS;
+	m_marchingCubeVS = nullptr;
+
+	delete m_geometryVS;
+	m_geometryVS = nullptr;
+
+	delete m_clipmapVS;
+	m_clipmapVS = nullptr;
+
+	delete m_triplanarDisplacementPS;
+	m_triplanarDisplacementPS = nullptr;
+
+	delete m_hullShader;
+	m_hullShader = nullptr;
+
+	delete m_domainShader;
+	m_domainShader = nullptr;
+}
+
+std::shared_ptr<SparseVolume> GeometryCache::FindVolume(const VolumeKey& key)
+{
+	auto entry = std::find_if(m_volumes.begin(), m_volumes.end(), [&](const std::pair<VolumeKey, std::shared_ptr<SparseVolume>>& stored)
+	{
+		return stored.first == key;
+	});
+
+	if (entry == m_volumes.end())
+	{
+		return nullptr;
+	}
+
+	//Move it to the back so it is evicted last
+	std::rotate(entry, entry + 1, m_volumes.end());
+	return m_volumes.back().second;
+}
+
+void GeometryCache::StoreVolume(const VolumeKey& key, const std::shared_ptr<SparseVolume>& volume)
+{
+	m_volumes.emplace_back(key, volume);
+
+	if (m_volumes.size() > GeometryCacheConfig::VOLUME_COUNT)
+	{
+		m_volumes.erase(m_volumes.begin());
+	}
+}
+
+void GeometryCache::InitializeShaders(ID3D11Device* device)
+{
+	{
+		D3D11_INPUT_ELEMENT_DESC polygonLayout[2];
+
+		//Vertex Input Layout Description
+		//needs to mach GeometryData::MarchingCubeVertexInputType
+		polygonLayout[0].SemanticName = "SV_POSITION";
+		polygonLayout[0].SemanticIndex = 0;
+		polygonLayout[0].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+		polygonLayout[0].InputSlot = 0;
+		polygonLayout[0].AlignedByteOffset = 0;
+		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		polygonLayout[0].InstanceDataStepRate = 0;
+
+		polygonLayout[1].SemanticName = "COLOR";
+		polygonLayout[1].SemanticIndex = 0;
+		polygonLayout[1].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+		polygonLayout[1].InputSlot = 0;
+		polygonLayout[1].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
+		polygonLayout[1].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		polygonLayout[1].InstanceDataStepRate = 0;
+
+		UINT numElements = sizeof(polygonLayout) / sizeof(polygonLayout[0]);
+
+		m_marchingCubeVS = new VertexShader();
+		m_marchingCubeVS->Initialize(device, L"MarchingCube_VS.hlsl", polygonLayout, numElements);
+	}
+
+	{
+		D3D11_INPUT_ELEMENT_DESC polygonLayout[2];
+
+		//Vertex Input Layout Description
+		//needs to mach CompactVertex, the material byte ends up in the w component
+		polygonLayout[0].SemanticName = "SV_POSITION";
+		polygonLayout[0].SemanticIndex = 0;
+		polygonLayout[0].Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+		polygonLayout[0].InputSlot = 0;
+		polygonLayout[0].AlignedByteOffset = 0;
+		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		polygonLayout[0].InstanceDataStepRate = 0;
+
+		polygonLayout[1].SemanticName = "NORMAL";
+		polygonLayout[1].SemanticIndex = 0;
+		polygonLayout[1].Format = DXGI_FORMAT_R16G16_SNORM;
+		polygonLayout[1].InputSlot = 0;
+		polygonLayout[1].AlignedByteOffset = 8;
+		polygonLayout[1].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		polygonLayout[1].InstanceDataStepRate = 0;
+
+		UINT numElements = sizeof(polygonLayout) / sizeof(polygonLayout[0]);
+
+		m_geometryVS = new VertexShader();
+		m_geometryVS->Initialize(device, L"Geometry_VS.hlsl", polygonLayout, numElements);
+	}
+
+	{
+		D3D11_INPUT_ELEMENT_DESC polygonLayout[1];
+
+		//Vertex Input Layout Description
+		//needs to mach the vertices of Clipmap::BuildVertices
+		polygonLayout[0].SemanticName = "POSITION";
+		polygonLayout[0].SemanticIndex = 0;
+		polygonLayout[0].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+		polygonLayout[0].InputSlot = 0;
+		polygonLayout[0].AlignedByteOffset = 0;
+		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		polygonLayout[0].InstanceDataStepRate = 0;
+
+		m_clipmapVS = new VertexShader();
+		m_clipmapVS->Initialize(device, L"Clipmap_VS.hlsl", polygonLayout, 1);
+	}
+
+	m_triplanarDisplacementPS = new PixelShader();
+	m_triplanarDisplacementPS->Initialize(device, L"Triplanar_Displacement_PS.hlsl");
+
+	m_hullShader = new HullShader();
+	m_hullShader->Initialize(device, L"Tessellation_HS.hlsl");
+
+	m_domainShader = new DomainShader();
+	m_domainShader->Initialize(device, L"Tessellation_DS.hlsl");
+}
+
+void GeometryCache::LoadTextures(ID3D11Device* device)
+{
+	TextureClass* rock1 = new TextureClass();
+	rock1->Initialize(device, L"./Assets/rock1.dds", L"./Assets/rock1_heightmap.dds");
+
+	TextureClass* rock2 = new TextureClass();
+	rock2->Initialize(device, L"./Assets/rock2.dds", L"./Assets/rock2_heightmap.dds");
+
+	TextureClass* rock3 = new TextureClass();
+	rock3->Initialize(device, L"./Assets/rock3.dds", L"./Assets/rock3_heightmap.dds");
+
+	//TextureClass* rock3 = new TextureClass();
+	//rock3->Initialize(device, L"./Assets/Pebbles_020_basecolor.dds", L"./Assets/Pebbles_020_height.dds");
+
+	m_colorTextures[0] = rock1;
+	m_colorTextures[1] = rock2;
+	m_colorTextures[2] = rock3;
+}
+
+void GeometryCache::CreateTriangleLUT(ID3D11Device* device)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	ZeroMemory(&desc, sizeof(desc));
+	desc.Height = 256;
+	desc.Width = 16;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R32_SINT;
+	desc.SampleDesc = { 1, 0 };
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA initData;
+	ZeroMemory(&initData, sizeof(initData));
+	initData.SysMemPitch = 16 * sizeof(int);
+	initData.SysMemSlicePitch = 0;
+
+	initData.pSysMem = TriangleLUT::TriTable;
+
+	ID3D11Texture2D* texture = nullptr;
+	if (FAILED(device->CreateTexture2D(&desc, &initData, &texture)))
+	{
+		printf("Triangle LUT creation failed.\n\r");
+		return;
+	}
+
+	//The view keeps the texture alive
+	device->CreateShaderResourceView(texture, nullptr, &m_triangleLUT);
+	texture->Release();
+}
+
+void GeometryCache::CreateSamplerStates(ID3D11Device* device)
+{
+	//Linear sampler for the density data in the geometry shader
+	D3D11_SAMPLER_DESC sampDesc;
+	ZeroMemory(&sampDesc, sizeof(sampDesc));
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	sampDesc.MinLOD = 0;
+	sampDesc.MaxLOD = 0;
+
+	device->CreateSamplerState(&sampDesc, &m_densitySampler);
+
+	//Anisotropic samplers for the rock textures in the pixel shader
+	ZeroMemory(&sampDesc, sizeof(sampDesc));
+	sampDesc.Filter = D3D11_FILTER_ANISOTROPIC;
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.MipLODBias = 0.0f;
+	sampDesc.MaxAnisotropy = 16;
+	sampDesc.ComparisonFunc = D3D11_COMPARISON_ALWAYS;
+	sampDesc.BorderColor[0] = 0;
+	sampDesc.BorderColor[1] = 1;
+	sampDesc.BorderColor[2] = 0;
+	sampDesc.BorderColor[3] = 1;
+	sampDesc.MinLOD = 0;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	device->CreateSamplerState(&sampDesc, &m_wrapSampler);
+
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+
+	device->CreateSamplerState(&sampDesc, &m_clampSampler);
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <d3d11.h>
+#include <memory>
+#include <vector>
+#include "TextureClass.h"
+#include "VertexShader.h"
+#include "PixelShader.h"
+#include "HullShader.h"
+#include "DomainShader.h"
+#include "SparseVolume.h"
+#include "DiskCache.h"
+
+// Everything GeometryData instances can share instead of recreating it per terrain.
+// Shaders, rock textures, samplers and the triangle table only depend on the device and are created once.
+// Density volumes are kept for the inputs they were generated from, so regenerating a terrain
+// with inputs seen shortly before skips the density graph. Volumes and meshes also go to a DiskCache,
+// which lets the next start skip generation as well.
+class GeometryCache
+{
+public:
+	// Everything a density volume depends on. The noise uses a fixed permutation table, so there is no seed to key on.
+	struct VolumeKey
+	{
+		int type;
+		unsigned int width, height, depth;
+		float noiseScale;
+
+		bool operator==(const VolumeKey& other) const
+		{
+			return type == other.type && width == other.width && height == other.height && depth == other.depth && noiseScale == other.noiseScale;
+		}
+	};
+
+	explicit GeometryCache(ID3D11Device* device);
+	~GeometryCache();
+
+	// Returns nullptr when no volume was stored for the key. Volumes are shared with the terrains using them,
+	// so edits have to go to a copy.
+	std::shared_ptr<SparseVolume> FindVolume(const VolumeKey& key);
+	// Evicts the least recently used volume once more than GeometryCacheConfig::VOLUME_COUNT are stored
+	void StoreVolume(const VolumeKey& key, const std::shared_ptr<SparseVolume>& volume);
+
+	const DiskCache& GetDiskCache() const { return m_diskCache; }
+
+	VertexShader* GetMarchingCubeVS() const { return m_marchingCubeVS; }
+	VertexShader* GetGeometryVS() const { return m_geometryVS; }
+	VertexShader* GetClipmapVS() const { return m_clipmapVS; }
+	PixelShader* GetTriplanarDisplacementPS() const { return m_triplanarDisplacementPS; }
+	HullShader* GetHullShader() const { return m_hullShader; }
+	DomainShader* GetDomainShader() const { return m_domainShader; }
+	TextureClass* GetColorTexture(size_t index) const { return m_colorTextures[index]; }
+
+	ID3D11ShaderResourceView* GetTriangleLUT() const { return m_triangleLUT; }
+	ID3D11SamplerState* GetDensitySampler() const { return m_densitySampler; }
+	ID3D11SamplerState* GetWrapSampler() const { return m_wrapSampler; }
+	ID3D11SamplerState* GetClampSampler() const { return m_clampSampler; }
+
+private:
+	void InitializeShaders(ID3D11Device* device);
+	void LoadTextures(ID3D11Device* device);
+	void CreateTriangleLUT(ID3D11Device* device);
+	void CreateSamplerStates(ID3D11Device* device);
+
+	VertexShader* m_marchingCubeVS = nullptr, *m_geometryVS = nullptr, *m_clipmapVS = nullptr;
+	PixelShader* m_triplanarDisplacementPS = nullptr;
+	HullShader* m_hullShader = nullptr;
+	DomainShader* m_domainShader = nullptr;
+	TextureClass* m_colorTextures[3] = { nullptr };
+
+	ID3D11ShaderResourceView* m_triangleLUT = nullptr;
+	ID3D11SamplerState* m_densitySampler = nullptr, *m_wrapSampler = nullptr, *m_clampSampler = nullptr;
+
+	DiskCache m_diskCache;
+	// Most recently used last
+	std::vector<std::pair<VolumeKey, std::shared_ptr<SparseVolume>>> m_volumes;
+};
@@ -1,60 +1,327 @@
 #include "pch.h"
 #include "GeometryData.h"
 #include "TriangleLUT.h"
+#include "Metrics.h"
+#include "ParallelFor.h"
+#include "Profiler.h"
+#include <cfloat>
+#include <functional>
 
 using namespace DirectX;
 
-GeometryData::GeometryData(unsigned int width, unsigned int height, unsigned int depth, TerrainType::Enum type, ID3D11Device* device, ID3D11DeviceContext* deviceContext, KdTree* treeToUse, float noiseScale)
-	: m_width(width), m_height(height), m_depth(depth), tree(treeToUse)
+namespace MeshConfig
+{
+	//Same iso level the geometry shader uses
+	const float ISO_LEVEL = 0.0f;
+	//Cells per chunk edge, chunks are meshed and optimised in parallel
+	const unsigned int CHUNK_SIZE = 16;
+
+	//Chunks meshed or patched into the KdTree per generation step, about one per core
+	const size_t CHUNKS_PER_STEP = 8;
+
+	//The geometry shader mesh is one piece, its triangles are split into runs of this many so its KdTree patches stay as small
+	const size_t GPU_TRIANGLES_PER_CHUNK = 1024;
+
+	//Room a chunk range leaves for brushes to grow the chunk, as a share of what it holds when laid out
+	const size_t CHUNK_SPARE_PERCENT = 50;
+}
+
+namespace
+{
+	UINT GetRangeCapacity(size_t count)
+	{
+		return static_cast<UINT>(count + count * MeshConfig::CHUNK_SPARE_PERCENT / 100);
+	}
+}
+
+namespace VolumeConfig
+{
+	//All presets are truncated to [-1,1], 16 bits keep the vertex error far below a voxel
+	const DensityFormat::Enum DENSITY_FORMAT = DensityFormat::SNORM16;
+
+	//Part of the disk cache key, bump it whenever a change to the generators or meshing alters what a preset produces
+	const uint32_t GENERATOR_VERSION = 1;
+
+	//Voxel order inside a brick, MORTON keeps most cells in one cache line
+	const BrickLayout::Enum BRICK_LAYOUT = BrickLayout::MORTON;
+
+	//Bricks filled per generation step, a few per core so a step stays well inside the frame budget
+	const size_t BRICKS_PER_STEP = 256;
+}
+
+namespace HeightfieldGenerationConfig
+{
+	//Rows of heights filled per generation step, about as many samples as VolumeConfig::BRICKS_PER_STEP bricks hold
+	const unsigned int ROWS_PER_STEP = 64;
+
+	//Quadtree nodes rebuilt per generation step, merging them is far cheaper than evaluating noise
+	const size_t QUADTREE_NODES_PER_STEP = 1 << 18;
+}
+
+namespace ScalingConfig
+{
+	//Enough rays that a batch takes a few milliseconds even on all cores
+	const size_t RAY_COUNT = 100000;
+	const unsigned int RAY_SEED = 1234;
+	//Rays leave the surface by this much so they do not all hit the triangle they start on
+	const float RAY_OFFSET = 0.01f;
+	const float RAY_RANGE = 10000.0f;
+}
+
+namespace
+{
+	//Everything a volume and its mesh depend on, the disk cache names their files after its hash
+	struct GeneratorInputs
+	{
+		uint32_t version;
+		uint32_t type;
+		uint32_t width, height, depth;
+		float noiseScale;
+		float distanceBand;
+		uint32_t format, layout;
+		float isoLevel;
+		uint32_t chunkSize;
+	};
+}
+
+GeometryData::GeometryData(unsigned int width, unsigned int height, unsigned int depth, TerrainType::Enum type, GeometryCache* cache, KdTree* treeToUse, float noiseScale, bool useGPUMarchingCubes)
+	: m_cache(cache), m_type(type), m_width(width), m_height(height), m_depth(depth), m_useGPUMarchingCubes(useGPUMarchingCubes), tree(treeToUse)
 {
 
 	m_cubeSize = DirectX::XMFLOAT3(64.0f, 64.0f, 64.0f);
 	//2.0f to decrease density
 	m_cubeStep = DirectX::XMFLOAT3(2.0f / m_cubeSize.x, 2.0f / m_cubeSize.y, 2.0f / m_cubeSize.z);
 	worldMatrix = DirectX::XMMatrixIdentity();
-	m_data = new float[m_width*m_depth*m_height];
-
-	std::mt19937 generator(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count()));
-	m_noiseOffset = generator();
 
 	m_noiseScale = noiseScale;
 
-	switch (type)
+	//Heightfields are meshed straight from their grid, there is no volume for the geometry shader to march through
+	if (type == TerrainType::HEIGHT_MAP)
 	{
-	case TerrainType::CUBE:
-		GenerateCubeData();
+		m_useGPUMarchingCubes = false;
+	}
+}
+
+bool GeometryData::Generate(ID3D11Device* device, ID3D11DeviceContext* deviceContext)
+{
+	Profiler::Zone zone("GeometryData::Generate");
+
+	//Latency counts from the first step, frames between the steps included
+	if (m_generationStart == 0u)
+	{
+		m_generationStart = Profiler::Now();
+	}
+
+	switch (m_stage)
+	{
+	case GenerationStage::VOLUME:
+		if (m_type == TerrainType::HEIGHT_MAP)
+		{
+			BeginHeightfield();
+			m_stage = GenerationStage::HEIGHTFIELD;
+		}
+		else
+		{
+			m_stage = BeginVolume() ? GenerationStage::RESOURCES : GenerationStage::FILL;
+		}
 		break;
-	case TerrainType::SPHERE:
-		GenerateSphereData();
+	case GenerationStage::FILL:
+		if (FillVolumeSlice())
+		{
+			FinishVolume();
+			m_stage = GenerationStage::RESOURCES;
+		}
+		break;
+	case GenerationStage::HEIGHTFIELD:
+		if (FillHeightfieldSlice())
+		{
+			FinishHeightfield();
+			m_stage = GenerationStage::RESOURCES;
+		}
 		break;
-	case TerrainType::PILLAR:
-		GeneratePillarData();
+	case GenerationStage::RESOURCES:
+		InitializeResources(device, deviceContext);
+		m_stage = GenerationStage::MESH;
 		break;
-	case TerrainType::NOISE:
-		GenerateNoiseData();
+	case GenerationStage::MESH:
+		if (m_clipmap)
+		{
+			//Clipmap levels are filled from the heightfield as the camera moves
+			m_stage = GenerationStage::DONE;
+		}
+		else if (m_heightfield)
+		{
+			MeshHeightfield(deviceContext);
+			m_stage = GenerationStage::DONE;
+		}
+		else if (m_useGPUMarchingCubes)
+		{
+			//The pass is issued once and read back in a later step, once the GPU got through it
+			if (!m_marchingCubePassIssued)
+			{
+				MarchingCubeRenderpass(deviceContext, XMMatrixIdentity(), XMMatrixIdentity());
+				m_marchingCubePassIssued = true;
+			}
+			else if (CountGeneratedTriangles(deviceContext))
+			{
+				ReadFromGSBuffer(deviceContext);
+				m_stage = GenerationStage::TREE;
+			}
+		}
+		else if (MeshSlice())
+		{
+			FinishMesh();
+			m_stage = GenerationStage::UPLOAD;
+		}
 		break;
-	case TerrainType::BUMPY_SPHERE:
-		GenerateBumpySphere();
+	case GenerationStage::UPLOAD:
+		UploadChunks(deviceContext);
+		m_stage = GenerationStage::TREE;
 		break;
-	case TerrainType::HELIX:
-		GenerateHelixStructure();
+	case GenerationStage::TREE:
+		if (TreeSlice())
+		{
+			m_stage = GenerationStage::DONE;
+		}
 		break;
-	case TerrainType::HEIGHT_MAP:
-		GenerateHeightMapData();
+	default:
 		break;
 	}
 
-	m_texDesc = CreateTextureDesc();
-	m_subData = CreateSubresourceData();
-	m_texture3D = CreateTexture(device, m_texDesc, m_subData);
-	m_densityMap = CreateDensityShaderResource(device, m_texture3D);
-	m_triangleLUT = CreateTriangleLUTShaderResource(device);
-	m_densitySampler = CreateDensitySamplerState(device);
+	if (!isGeometryGenerated && m_stage == GenerationStage::DONE)
+	{
+		Metrics::Get().RecordLatency("Terrain generation", Profiler::Now() - m_generationStart);
+	}
+
+	isGeometryGenerated = m_stage == GenerationStage::DONE;
+	return isGeometryGenerated;
+}
+
+void GeometryData::InitializeResources(ID3D11Device* device, ID3D11DeviceContext* deviceContext)
+{
+	//Only the geometry shader path samples the density texture
+	if (m_useGPUMarchingCubes)
+	{
+		m_texDesc = CreateTextureDesc();
+		m_texture3D = CreateTexture(device, m_texDesc);
+		m_densityMap = CreateDensityShaderResource(device, m_texture3D);
+		UploadDensityTexture(deviceContext);
+	}
+	//Shaders, textures and samplers come from the cache, only the stream output buffers are per terrain
 	InitializeShaders(device);
-	LoadTextures(device);
-	CreatePSSamplerStates(device, m_wrapSampler, m_clampSampler);
 	InitializeBuffers(device);
 	GenerateDecalDescriptionBuffer(device, deviceContext);
+
+	if (m_clipmap)
+	{
+		InitializeClipmap(device);
+	}
+}
+
+void GeometryData::AttachToTree()
+{
+	std::vector<KdTree::Triangle*> triangles;
+	for (const std::vector<KdTree::Triangle*>& chunkTriangles : m_chunkTriangles)
+	{
+		triangles.insert(triangles.end(), chunkTriangles.begin(), chunkTriangles.end());
+	}
+
+	tree->AddPatches(triangles, m_treePatches);
+	m_treePatches.clear();
+	m_attachedToTree = true;
+}
+
+bool GeometryData::BeginVolume()
+{
+	Profiler::Zone zone("GeometryData::BeginVolume");
+
+	DensityFormat::Enum densityFormat = VolumeConfig::DENSITY_FORMAT;
+
+	//Presets without noise ignore the scale, so they share one entry for all of them
+	GeometryCache::VolumeKey key = { m_type, m_width, m_height, m_depth, TerrainPresets::UsesNoiseScale(m_type) ? m_noiseScale : 0.0f };
+	m_volumeKey = key;
+
+	GeneratorInputs inputs = { VolumeConfig::GENERATOR_VERSION, static_cast<uint32_t>(m_type), m_width, m_height, m_depth, key.noiseScale,
+		TerrainPresets::DISTANCE_BAND, static_cast<uint32_t>(densityFormat), static_cast<uint32_t>(VolumeConfig::BRICK_LAYOUT),
+		MeshConfig::ISO_LEVEL, MeshConfig::CHUNK_SIZE };
+	m_contentKey = DiskCache::Hash(&inputs, sizeof(inputs));
+
+	m_volume = m_cache->FindVolume(key);
+	if (m_volume)
+	{
+		printf("Density volume: reused from cache, %.2f MB\n\r", m_volume->GetMemoryUsage() / (1024.0 * 1024.0));
+		return true;
+	}
+
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	m_volume = m_cache->GetDiskCache().LoadVolume(m_contentKey);
+	if (m_volume)
+	{
+		printf("Density volume: loaded from disk cache in %.2f ms, %.2f MB\n\r",
+			std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadStart).count(),
+			m_volume->GetMemoryUsage() / (1024.0 * 1024.0));
+		m_cache->StoreVolume(key, m_volume);
+		return true;
+	}
+
+#ifdef _DEBUG
+	//Generate as floats first so the quantization error can be measured against them
+	m_volume = std::make_shared<SparseVolume>(m_width, m_height, m_depth, -1.0f, DensityFormat::FLOAT32, VolumeConfig::BRICK_LAYOUT);
+#else
+	m_volume = std::make_shared<SparseVolume>(m_width, m_height, m_depth, -1.0f, densityFormat, VolumeConfig::BRICK_LAYOUT);
+#endif
+
+	m_graph.reset(new DensityGraph());
+	TerrainPresets::BuildDensityGraph(*m_graph, m_type, m_width, m_height, m_depth, m_noiseScale);
+
+	m_graphStatistics = DensityGraph::Statistics();
+	m_filledBricks = 0u;
+	m_stageTime = 0.0;
+	return false;
+}
+
+bool GeometryData::FillVolumeSlice()
+{
+	Profiler::Zone zone("GeometryData::FillVolumeSlice");
+
+	auto sliceStart = std::chrono::high_resolution_clock::now();
+
+	size_t brickCount = std::min(VolumeConfig::BRICKS_PER_STEP, m_volume->GetBrickCount() - m_filledBricks);
+	m_graphStatistics += m_graph->Fill(*m_volume, m_filledBricks, brickCount);
+	m_filledBricks += brickCount;
+
+	m_stageTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sliceStart).count();
+	return m_filledBricks == m_volume->GetBrickCount();
+}
+
+void GeometryData::FinishVolume()
+{
+	Profiler::Zone zone("GeometryData::FinishVolume");
+
+	m_graph.reset();
+
+	//Time spent in the fill steps, not the frames in between
+	printf("Density graph: %.2f ms, %zu of %zu voxels evaluated, %zu of %zu bricks filled from bounds, %zu nodes culled\n\r",
+		m_stageTime,
+		m_graphStatistics.evaluatedVoxels, m_graphStatistics.voxelCount,
+		m_graphStatistics.constantBricks, m_graphStatistics.brickCount, m_graphStatistics.culledNodes);
+
+#ifdef _DEBUG
+	if (VolumeConfig::DENSITY_FORMAT != DensityFormat::FLOAT32)
+	{
+		std::shared_ptr<SparseVolume> reference = m_volume;
+		m_volume = std::make_shared<SparseVolume>(*reference, VolumeConfig::DENSITY_FORMAT, VolumeConfig::BRICK_LAYOUT);
+		ReportQuantizationError(*reference);
+	}
+#endif
+
+	m_cache->StoreVolume(m_volumeKey, m_volume);
+	m_cache->GetDiskCache().StoreVolume(m_contentKey, *m_volume);
+
+	printf("Density volume: %zu of %zu bricks stored, %.2f MB (dense %.2f MB)\n\r",
+		m_volume->GetAllocatedBrickCount(), m_volume->GetBrickCount(),
+		m_volume->GetMemoryUsage() / (1024.0 * 1024.0),
+		static_cast<double>(m_width) * m_height * m_depth * sizeof(float) / (1024.0 * 1024.0));
 }
 
 GeometryData::~GeometryData()
@@ -66,6 +333,18 @@ GeometryData::~GeometryData()
 		m_vertexBuffer = nullptr;
 	}
 
+	if (m_compactVertexBuffer)
+	{
+		m_compactVertexBuffer->Release();
+		m_compactVertexBuffer = nullptr;
+	}
+
+	if (m_indexBuffer)
+	{
+		m_indexBuffer->Release();
+		m_indexBuffer = nullptr;
+	}
+
 	if (m_densityMap)
 	{
 		m_densityMap->Release();
@@ -78,39 +357,42 @@ GeometryData::~GeometryData()
 		m_texture3D = nullptr;
 	}
 
-	if (m_densitySampler)
+	m_volume.reset();
+
+	delete m_clipmap;
+	m_clipmap = nullptr;
+
+	delete m_heightfield;
+	m_heightfield = nullptr;
+
+	if (m_clipmapSamples)
 	{
-		m_densitySampler->Release();
-		m_densitySampler = nullptr;
+		m_clipmapSamples->Release();
+		m_clipmapSamples = nullptr;
 	}
 
-	if (m_clampSampler)
+	if (m_clipmapTexture)
 	{
-		m_clampSampler->Release();
-		m_clampSampler = nullptr;
+		m_clipmapTexture->Release();
+		m_clipmapTexture = nullptr;
 	}
 
-	if (m_wrapSampler)
+	if (m_clipmapVertexBuffer)
 	{
-		m_wrapSampler->Release();
-		m_wrapSampler = nullptr;
+		m_clipmapVertexBuffer->Release();
+		m_clipmapVertexBuffer = nullptr;
 	}
 
-	for(size_t i = 0u; i < 3; ++i)
+	if (m_clipmapIndexBuffer)
 	{
-		if(m_colorTextures[i] != nullptr)
-		{
-			m_colorTextures[i]->Shutdown();
-		}
-		m_colorTextures[i] = nullptr;
+		m_clipmapIndexBuffer->Release();
+		m_clipmapIndexBuffer = nullptr;
 	}
 
-	delete m_data;
-
-	if (marchingCubeVS)
+	if (m_clipmapLevelBuffer)
 	{
-		delete marchingCubeVS;
-		marchingCubeVS = nullptr;
+		m_clipmapLevelBuffer->Release();
+		m_clipmapLevelBuffer = nullptr;
 	}
 
 	if (marchingCubeGSO)
@@ -119,356 +401,1093 @@ GeometryData::~GeometryData()
 		marchingCubeGSO = nullptr;
 	}
 
-	if (triplanarDisplacementPS)
+	//Terrains dropped before they were swapped in still own their triangles
+	if (!m_attachedToTree)
 	{
-		delete triplanarDisplacementPS;
-		triplanarDisplacementPS = nullptr;
+		for (KdTree::KdNode* patch : m_treePatches)
+		{
+			KdTree::KdNode::Release(patch);
+		}
+		m_treePatches.clear();
+
+		for (const std::vector<KdTree::Triangle*>& triangles : m_chunkTriangles)
+		{
+			for (KdTree::Triangle* tri : triangles)
+			{
+				delete tri;
+			}
+		}
+		m_chunkTriangles.clear();
 	}
+}
 
-	if (geometryVS)
+void GeometryData::BeginHeightfield()
+{
+	Profiler::Zone zone("GeometryData::BeginHeightfield");
+
+	//Width by depth samples over the whole footprint, the height of the volume is not needed
+	m_heightfield = new Heightfield(m_width, m_depth);
+	m_filledRows = 0u;
+	m_stageTime = 0.0;
+}
+
+bool GeometryData::FillHeightfieldSlice()
+{
+	Profiler::Zone zone("GeometryData::FillHeightfieldSlice");
+
+	auto sliceStart = std::chrono::high_resolution_clock::now();
+
+	//The quadtree is built over all rows, so it only starts once the last band is in
+	bool done = false;
+	if (m_filledRows < m_heightfield->GetDepth())
 	{
-		delete geometryVS;
-		geometryVS = nullptr;
+		unsigned int rowCount = std::min(HeightfieldGenerationConfig::ROWS_PER_STEP, m_heightfield->GetDepth() - m_filledRows);
+		TerrainPresets::FillHeightfieldRows(*m_heightfield, m_noiseScale, m_filledRows, rowCount);
+		m_filledRows += rowCount;
 	}
+	else
+	{
+		done = m_heightfield->BuildQuadtreeSlice(HeightfieldGenerationConfig::QUADTREE_NODES_PER_STEP);
+	}
+
+	m_stageTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sliceStart).count();
+	return done;
 }
 
-void GeometryData::GenerateHeightMapData()
+void GeometryData::FinishHeightfield()
 {
-	unsigned int width_offset = m_width / 4;
-	unsigned int height_offset = m_height / 4;
-	unsigned int depth_offset = m_depth / 4;
+	Profiler::Zone zone("GeometryData::FinishHeightfield");
 
-	size_t index = 0;
+	//Time spent in the fill steps, not the frames in between
+	printf("Heightfield: %.2f ms, %u x %u samples, %.2f MB\n\r",
+		m_stageTime, m_heightfield->GetWidth(), m_heightfield->GetDepth(), m_heightfield->GetMemoryUsage() / (1024.0 * 1024.0));
 
-	for (size_t z = 0u; z < m_depth; ++z)
+	//A single mesh of a large heightfield would spend most of its triangles far from the camera
+	if (m_heightfield->GetWidth() - 1 > Clipmap::GRID_SIZE || m_heightfield->GetDepth() - 1 > Clipmap::GRID_SIZE)
 	{
-		for (size_t y = 0u; y < m_height; ++y)
+		m_clipmap = new Clipmap(*m_heightfield);
+		printf("Clipmap: %u levels of %u x %u cells\n\r", m_clipmap->GetLevelCount(), Clipmap::GRID_SIZE, Clipmap::GRID_SIZE);
+	}
+}
+
+bool GeometryData::SetBufferData(ID3D11DeviceContext* context, XMMATRIX world, XMMATRIX viewMatrix, XMMATRIX projectionMatrix, XMFLOAT3 eyePos, int initialSteps, int refinementSteps, float depthfactor, Light& light)
+{
+	HRESULT result;
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	MatrixBufferType* matrixData;
+	LightingBufferType* lightData;
+	FactorBufferType* factorData;
+	LightMatrixBufferType* lightMatrixData;
+
+	//DirectX11 need matrices transposed!
+	XMMATRIX worldM = XMMatrixTranspose(world);
+	viewMatrix = XMMatrixTranspose(viewMatrix);
+	projectionMatrix = XMMatrixTranspose(projectionMatrix);
+
+	XMMATRIX lightViewMatrix;
+	light.GetViewMatrix(lightViewMatrix);
+	lightViewMatrix = XMMatrixTranspose(lightViewMatrix);
+
+	XMMATRIX lightProjectionMatrix;
+	light.GetProjectionMatrix(lightProjectionMatrix);
+	lightProjectionMatrix = XMMatrixTranspose(lightProjectionMatrix);
+
+	{
+		// ### MATRIXBUFFER ###
+		//Lock Buffer
+		result = context->Map(matrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		if (FAILED(result))
 		{
-			for (size_t x = 0u; x < m_width; ++x)
-			{
-				float valueX = (float)x / (float)m_width;
-				float valueY = (float)y / (float)m_height;
-				float valueZ = (float)z / (float)m_depth;
+			return false;
+		}
 
-				m_data[index] = -1.0f;
+		//Get pointer to data
+		matrixData = static_cast<MatrixBufferType*>(mappedResource.pData);
 
-				float NoiseVal = (float)noise.Noise2D(valueX * m_noiseScale * valueY, valueZ * m_noiseScale * valueY);
+		//Set data
+		matrixData->world = worldM;
+		matrixData->view = viewMatrix;
+		matrixData->projection = projectionMatrix;
 
-				if (
-					x >= 0 + width_offset && x <= m_width - width_offset
-					&& y >= 0 + height_offset && y <= m_height - height_offset
-					&& z >= 0 + depth_offset && z <= m_depth - depth_offset)
-				{
-					if (valueY >= 0.5f) {
-						m_data[index] = (NoiseVal);
-					}
-					else {
-						m_data[index] = 1.0f;
-					}
-				}
+		context->Unmap(matrixBuffer, 0);
+	}
+	{
+		// ### LightingBuffer ###
+		//Lock Buffer
+		result = context->Map(lightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		if (FAILED(result))
+		{
+			return false;
+		}
 
-				index++;
+		//Get pointer to data
+		lightData = static_cast<LightingBufferType*>(mappedResource.pData);
 
-			}
+		//Set data	
+		lightData->cameraPosition = eyePos;
+		lightData->lightDirection = light.GetDirection();
+		lightData->diffuseColor = light.GetDiffuseColour();
+		lightData->ambientColor = light.GetAmbientColour();
+
+		context->Unmap(lightBuffer, 0);
+	}
+	{
+		// ### FactorBuffer (Pixel Shader Displacement) ###
+		//Lock Buffer
+		result = context->Map(factorBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		if (FAILED(result))
+		{
+			return false;
+		}
+
+		//Get pointer to data
+		factorData = static_cast<FactorBufferType*>(mappedResource.pData);
+
+		//Set data
+		factorData->steps_initial = initialSteps;
+		factorData->steps_refinement = refinementSteps;
+		factorData->depth_factor = depthfactor;
+
+		context->Unmap(factorBuffer, 0);
+	}
+	{
+		// ### LIGHTMATRIXBUFFER ###
+		//Lock Buffer
+		result = context->Map(lightMatrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		if (FAILED(result))
+		{
+			return false;
 		}
+
+		//Get pointer to data
+		lightMatrixData = static_cast<LightMatrixBufferType*>(mappedResource.pData);
+
+		//Set data
+		lightMatrixData->lightViewMatrix = lightViewMatrix;
+		lightMatrixData->lightProjectionMatrix = lightProjectionMatrix;
+
+		context->Unmap(lightMatrixBuffer, 0);
 	}
+
+	return true;
 }
 
-void GeometryData::GenerateCubeData()
+void GeometryData::ReadFromGSBuffer(ID3D11DeviceContext* context)
 {
-	unsigned int width_offset = m_width / 4;
-	unsigned int height_offset = m_height / 4;
-	unsigned int depth_offset = m_depth / 4;
+	Profiler::Zone zone("GeometryData::ReadFromGSBuffer");
 
-	size_t index = 0;
+	//Reading from Buffer
+	GeometryVertexInputType* vertices;
+	D3D11_MAPPED_SUBRESOURCE mappedRessource;
+	ID3D11Buffer* readbuf = marchingCubeGSO->GetReadBuffer(context);
+
+	context->Map(readbuf, 0, D3D11_MAP_READ, 0, &mappedRessource);
+
+	vertices = static_cast<GeometryVertexInputType*>(mappedRessource.pData);
+
+	//The geometry shader emits unconnected triangles, so the indices are just a sequence
+	size_t vertexCount = static_cast<size_t>(generatedTriangleCount) * 3u;
+	MeshChunk mesh;
+	mesh.positions.resize(vertexCount);
+	mesh.normals.resize(vertexCount);
+	mesh.indices.resize(vertexCount);
+
+	for (size_t i = 0u; i < vertexCount; ++i)
+	{
+		mesh.positions[i] = XMFLOAT3(vertices[i].position.x, vertices[i].position.y, vertices[i].position.z);
+		mesh.normals[i] = XMFLOAT3(vertices[i].normal.x, vertices[i].normal.y, vertices[i].normal.z);
+		mesh.indices[i] = static_cast<uint32_t>(i);
+	}
+
+	context->Unmap(readbuf, 0);
+	Metrics::Get().Add("Triangles meshed", static_cast<int64_t>(generatedTriangleCount));
+
+	//Everything needed for drawing now lives in the compact buffers
+	marchingCubeGSO->ReleaseBuffers();
 
-	for (size_t z = 0u; z < m_depth; ++z)
+	CreateMeshBuffers(context, mesh);
+
+	std::vector<KdTree::Triangle*> triangles = CreateTreeTriangles(mesh);
+	for (size_t first = 0u; first < triangles.size(); first += MeshConfig::GPU_TRIANGLES_PER_CHUNK)
 	{
-		for (size_t y = 0u; y < m_height; ++y)
+		size_t last = std::min(first + MeshConfig::GPU_TRIANGLES_PER_CHUNK, triangles.size());
+		m_chunkTriangles.emplace_back(triangles.begin() + first, triangles.begin() + last);
+	}
+}
+
+void GeometryData::MeshHeightfield(ID3D11DeviceContext* context)
+{
+	Profiler::Zone zone("GeometryData::MeshHeightfield");
+
+	auto meshingStart = std::chrono::high_resolution_clock::now();
+
+	//The grid already shares its vertices and is indexed in cache sized bands
+	MeshChunk mesh;
+	m_heightfield->Mesh(mesh);
+	Metrics::Get().Add("Triangles meshed", static_cast<int64_t>(mesh.indices.size() / 3));
+
+	printf("Heightfield mesh: %.2f ms, %zu triangles\n\r",
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - meshingStart).count(), mesh.indices.size() / 3);
+
+	//Rays are answered by the heightfield itself, so its triangles stay out of the KdTree
+	CreateMeshBuffers(context, mesh);
+}
+
+bool GeometryData::MeshSlice()
+{
+	Profiler::Zone zone("GeometryData::MeshSlice");
+
+	auto sliceStart = std::chrono::high_resolution_clock::now();
+
+	MarchingCubes marchingCubes(*m_volume, MeshConfig::ISO_LEVEL);
+	unsigned int chunkCount[3];
+	marchingCubes.GetChunkCount(MeshConfig::CHUNK_SIZE, chunkCount);
+	size_t totalChunks = static_cast<size_t>(chunkCount[0]) * chunkCount[1] * chunkCount[2];
+
+	//Brushes address chunks by their index, a cached mesh is only usable with one entry per chunk.
+	//Edited volumes no longer match the content key, so they skip the disk cache.
+	if (m_meshedChunks == 0u)
+	{
+		m_meshFromDisk = !m_edited && m_cache->GetDiskCache().LoadMesh(m_contentKey, m_chunks) && m_chunks.size() == totalChunks;
+		if (!m_meshFromDisk)
 		{
-			for (size_t x = 0u; x < m_width; ++x)
-			{
-				float valueX = (float)x / (float)m_width;
-				float valueY = (float)y / (float)m_height;
-				float valueZ = (float)z / (float)m_depth;
+			m_chunks.clear();
+			m_chunks.resize(totalChunks);
+		}
 
-				m_data[index] = -1.0f;
+		m_chunkTriangles.clear();
+		m_chunkTriangles.resize(totalChunks);
+		m_meshStatistics = MeshOptimizer::Statistics();
+		m_stageTime = 0.0;
+	}
 
-				if (
-					x >= 0 + width_offset && x <= m_width - width_offset
-					&& y >= 0 + height_offset && y <= m_height - height_offset
-					&& z >= 0 + depth_offset && z <= m_depth - depth_offset)
-				{
-					m_data[index] = 1.0f;
-				}
+	size_t count = std::min(MeshConfig::CHUNKS_PER_STEP, totalChunks - m_meshedChunks);
+	if (!m_meshFromDisk)
+	{
+		std::vector<size_t> indices(count);
+		for (size_t i = 0u; i < count; ++i)
+		{
+			indices[i] = m_meshedChunks + i;
+		}
 
-				index++;
+		std::vector<MeshChunk> chunks = marchingCubes.Polygonise(MeshConfig::CHUNK_SIZE, indices);
+		MeshOptimizer::Statistics statistics = MeshOptimizer::OptimizeChunks(chunks);
+		Metrics::Get().Add("Triangles meshed", static_cast<int64_t>(statistics.triangleCount));
+		m_meshStatistics.triangleCount += statistics.triangleCount;
+		m_meshStatistics.cacheMissesBefore += statistics.cacheMissesBefore;
+		m_meshStatistics.cacheMissesAfter += statistics.cacheMissesAfter;
 
-			}
+		for (size_t i = 0u; i < count; ++i)
+		{
+			m_chunks[indices[i]] = std::move(chunks[i]);
 		}
 	}
 
+	//Every chunk keeps its own triangles, so a brush can swap them in the tree
+	for (size_t i = m_meshedChunks; i < m_meshedChunks + count; ++i)
+	{
+		m_chunkTriangles[i] = CreateTreeTriangles(m_chunks[i]);
+	}
+	m_meshedChunks += count;
 
+	m_stageTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sliceStart).count();
+	return m_meshedChunks == totalChunks;
 }
 
-float GeometryData::getDistance(const float& p1x, const float& p1y, const float& p1z, const float& p2x, const float& p2y, const float& p2z)
+void GeometryData::FinishMesh()
 {
-	float dx, dy, dz;
+	Profiler::Zone zone("GeometryData::FinishMesh");
+
+	if (m_meshFromDisk)
+	{
+		printf("Marching cubes: mesh loaded from disk cache in %.2f ms\n\r", m_stageTime);
+		return;
+	}
 
-	dx = p2x - p1x;
-	dy = p2y - p1y;
-	dz = p2z - p1z;
+	//Time spent in the meshing steps, optimisation included
+	printf("Marching cubes and mesh optimisation: %.2f ms, ACMR %.3f -> %.3f\n\r",
+		m_stageTime, m_meshStatistics.GetACMRBefore(), m_meshStatistics.GetACMRAfter());
 
-	return sqrt(dx * dx + dy * dy + dz * dz);
+	if (!m_edited)
+	{
+		m_cache->GetDiskCache().StoreMesh(m_contentKey, m_chunks);
+	}
 }
 
-float GeometryData::getDistance2D(const float& p1x, const float& p1y, const float& p2x, const float& p2y)
+bool GeometryData::TreeSlice()
 {
-	float dx, dy;
+	Profiler::Zone zone("GeometryData::TreeSlice");
+
+	size_t count = std::min(MeshConfig::CHUNKS_PER_STEP, m_chunkTriangles.size() - m_patchedChunks);
 
-	dx = p2x - p1x;
-	dy = p2y - p1y;
+	//Consecutive chunks are neighbours, so their patch has tight bounds
+	std::vector<KdTree::Triangle*>* triangles = new std::vector<KdTree::Triangle*>();
+	for (size_t i = m_patchedChunks; i < m_patchedChunks + count; ++i)
+	{
+		triangles->insert(triangles->end(), m_chunkTriangles[i].begin(), m_chunkTriangles[i].end());
+	}
+	m_patchedChunks += count;
+
+	//A patch over no triangles has no bounds to test rays against
+	if (triangles->empty())
+	{
+		delete triangles;
+	}
+	else
+	{
+		m_treePatches.push_back(KdTree::KdNode::build(triangles, 0));
+	}
 
-	return sqrt(dx * dx + dy * dy);
+	return m_patchedChunks == m_chunkTriangles.size();
 }
 
-void GeometryData::GenerateSphereData()
+bool GeometryData::UploadChunks(ID3D11DeviceContext* context)
 {
-	DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(m_width / 2.0f, m_height / 2.0f, m_depth / 2.0f);
+	Profiler::Zone zone("GeometryData::UploadChunks");
 
-	size_t index = 0u;
-	float maxDistance = m_width / 2.5f;
+	//Quantized over the volume instead of the mesh bounds, so a brush reaching past them leaves the other chunks valid
+	m_vertexEncoder = CompactVertexEncoder();
 
-	for (UINT z = 0; z < m_depth; z++)
+	//Chunks own their vertices, so every one gets a range of its own
+	m_chunkRanges.resize(m_chunks.size());
+	UINT vertexCount = 0, indexCount = 0;
+	m_triangleCount = 0;
+	for (size_t i = 0u; i < m_chunks.size(); ++i)
 	{
-		for (UINT y = 0; y < m_height; y++)
+		ChunkRange& range = m_chunkRanges[i];
+		range.firstVertex = vertexCount;
+		range.vertexCapacity = GetRangeCapacity(m_chunks[i].positions.size());
+		range.firstIndex = indexCount;
+		range.indexCapacity = GetRangeCapacity(m_chunks[i].indices.size() / 3) * 3;
+
+		vertexCount += range.vertexCapacity;
+		indexCount += range.indexCapacity;
+		m_triangleCount += static_cast<UINT>(m_chunks[i].indices.size() / 3);
+	}
+
+	std::vector<CompactVertex> vertices(vertexCount);
+	std::vector<uint32_t> indices(indexCount);
+	ParallelFor(m_chunks.size(), [&](size_t i)
+	{
+		EncodeChunk(m_chunks[i], m_chunkRanges[i], vertices.data() + m_chunkRanges[i].firstVertex, indices.data() + m_chunkRanges[i].firstIndex);
+	});
+
+	Profiler::Get().Counter("Terrain triangles", static_cast<double>(m_triangleCount));
+	return CreateBuffers(context, vertices, indices, D3D11_USAGE_DEFAULT);
+}
+
+bool GeometryData::UpdateChunks(ID3D11DeviceContext* context, const std::vector<size_t>& chunks)
+{
+	Profiler::Zone zone("GeometryData::UpdateChunks");
+
+	if (!m_compactVertexBuffer || m_chunkRanges.size() != m_chunks.size())
+	{
+		return UploadChunks(context);
+	}
+
+	for (size_t chunk : chunks)
+	{
+		if (m_chunks[chunk].positions.size() > m_chunkRanges[chunk].vertexCapacity || m_chunks[chunk].indices.size() > m_chunkRanges[chunk].indexCapacity)
 		{
-			for (UINT x = 0; x < m_width; x++)
-			{
-				//Take distance's complement so the nearer to the center the bigger the density
-				m_data[index] = 1.0f - (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), center.x, center.y, center.z) / maxDistance);;
+			Metrics::Get().Add("Mesh relayouts");
+			return UploadChunks(context);
+		}
+	}
 
-				index++;
-			}
+	std::vector<CompactVertex> vertices;
+	std::vector<uint32_t> indices;
+	for (size_t chunk : chunks)
+	{
+		const ChunkRange& range = m_chunkRanges[chunk];
+		vertices.resize(m_chunks[chunk].positions.size());
+		indices.resize(range.indexCapacity);
+		EncodeChunk(m_chunks[chunk], range, vertices.data(), indices.data());
+
+		//Vertices past the chunk's own are no longer referenced, only the whole index range has to be rewritten
+		if (!vertices.empty())
+		{
+			D3D11_BOX box = { static_cast<UINT>(range.firstVertex * sizeof(CompactVertex)), 0, 0, static_cast<UINT>((range.firstVertex + vertices.size()) * sizeof(CompactVertex)), 1, 1 };
+			context->UpdateSubresource(m_compactVertexBuffer, 0, &box, vertices.data(), 0, 0);
 		}
+		if (!indices.empty())
+		{
+			D3D11_BOX box = { static_cast<UINT>(range.firstIndex * sizeof(uint32_t)), 0, 0, static_cast<UINT>((range.firstIndex + indices.size()) * sizeof(uint32_t)), 1, 1 };
+			context->UpdateSubresource(m_indexBuffer, 0, &box, indices.data(), 0, 0);
+		}
+	}
+
+	m_triangleCount = 0;
+	for (const MeshChunk& chunk : m_chunks)
+	{
+		m_triangleCount += static_cast<UINT>(chunk.indices.size() / 3);
 	}
+	Profiler::Get().Counter("Terrain triangles", static_cast<double>(m_triangleCount));
+
+	return true;
 }
 
-void GeometryData::GeneratePillarData()
+void GeometryData::EncodeChunk(const MeshChunk& chunk, const ChunkRange& range, CompactVertex* vertices, uint32_t* indices) const
 {
+	for (size_t i = 0u; i < chunk.positions.size(); ++i)
+	{
+		vertices[i] = m_vertexEncoder.Encode(chunk.positions[i], chunk.normals[i]);
+	}
+
+	for (size_t i = 0u; i < chunk.indices.size(); ++i)
+	{
+		indices[i] = range.firstVertex + chunk.indices[i];
+	}
+
+	//Triangles with three equal corners have no area and are dropped before rasterisation
+	std::fill(indices + chunk.indices.size(), indices + range.indexCapacity, range.firstVertex);
+}
+
+bool GeometryData::ApplyBrush(ID3D11DeviceContext* context, BrushMode::Enum mode, const Vector3& center, float radius, float strength)
+{
+	Profiler::Zone zone("GeometryData::ApplyBrush");
+
+	//The geometry shader path keeps no chunks to patch
+	if (!m_volume || m_useGPUMarchingCubes || !isGeometryGenerated || radius <= 0.0f)
+	{
+		return false;
+	}
 
-	size_t index = 0u;
-	float maxDistance = m_width / 25.0f;
+	uint64_t brushStart = Profiler::Now();
 
-	for (UINT z = 0; z < m_depth; z++)
+	const unsigned int size[3] = { m_width, m_height, m_depth };
+	const XMFLOAT3 voxelSize(2.0f / (m_width - 1), 2.0f / (m_height - 1), 2.0f / (m_depth - 1));
+	Matrix world(worldMatrix);
+	Matrix inverseWorld = world.Invert();
+
+	//The brush keeps the distance band of the generated volumes, measured in world space voxels
+	float voxelLength = (Vector3::TransformNormal(Vector3(voxelSize.x, 0.0f, 0.0f), world).Length() +
+		Vector3::TransformNormal(Vector3(0.0f, voxelSize.y, 0.0f), world).Length() +
+		Vector3::TransformNormal(Vector3(0.0f, 0.0f, voxelSize.z), world).Length()) / 3.0f;
+	float band = TerrainPresets::DISTANCE_BAND * voxelLength;
+	float reach = mode == BrushMode::SMOOTH ? radius : radius + band;
+
+	//Voxels under the world space box around the brush
+	float low[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, high[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		Vector3 offset((corner & 1) ? reach : -reach, (corner & 2) ? reach : -reach, (corner & 4) ? reach : -reach);
+		Vector3 local = Vector3::Transform(center + offset, inverseWorld);
+		const float voxel[3] = { (local.x + 1.0f) / voxelSize.x, (local.y + 1.0f) / voxelSize.y, (local.z + 1.0f) / voxelSize.z };
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			low[axis] = std::min(low[axis], voxel[axis]);
+			high[axis] = std::max(high[axis], voxel[axis]);
+		}
+	}
+
+	unsigned int minimum[3], maximum[3];
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		for (UINT y = 0; y < m_height; y++)
+		if (high[axis] < 0.0f || low[axis] > size[axis] - 1.0f)
 		{
-			DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(m_width / 2.0f, static_cast<float>(y), m_depth / 2.0f);
+			return false;
+		}
+
+		minimum[axis] = static_cast<unsigned int>(std::max(0.0f, std::floor(low[axis])));
+		maximum[axis] = static_cast<unsigned int>(std::min(size[axis] - 1.0f, std::ceil(high[axis])));
+	}
+
+	//The volume may still be shared with the cache and other terrains, edits go to a copy of it
+	if (m_volume.use_count() > 1)
+	{
+		m_volume = std::make_shared<SparseVolume>(*m_volume, m_volume->GetFormat(), m_volume->GetLayout());
+	}
+	m_edited = true;
 
-			for (UINT x = 0; x < m_width; x++)
+	size_t brickCount = m_volume->ModifyBricks(minimum, maximum, [&](const unsigned int origin[3], float* values)
+	{
+		for (unsigned int i = 0u; i < SparseVolume::BRICK_VOXELS; ++i)
+		{
+			//Voxels past the border repeat the last one, like in FillBricks
+			unsigned int x = std::min(origin[0] + (i & SparseVolume::BRICK_MASK), m_width - 1);
+			unsigned int y = std::min(origin[1] + ((i >> SparseVolume::BRICK_SHIFT) & SparseVolume::BRICK_MASK), m_height - 1);
+			unsigned int z = std::min(origin[2] + (i >> (2 * SparseVolume::BRICK_SHIFT)), m_depth - 1);
+
+			Vector3 position = Vector3::Transform(Vector3(-1.0f + x * voxelSize.x, -1.0f + y * voxelSize.y, -1.0f + z * voxelSize.z), world);
+			float distance = Vector3::Distance(position, center);
+			if (distance >= reach)
 			{
-				//Take distance's complement so the nearer to the center the bigger the density
-				m_data[index] = 1.0f - (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), center.x, center.y, center.z) / maxDistance);
+				continue;
+			}
 
-				index++;
+			switch (mode)
+			{
+			case BrushMode::ADD:
+				//Densities grow towards the inside, so a union keeps the larger one
+				values[i] = std::max(values[i], std::max(-1.0f, std::min(1.0f, (radius - distance) / band)));
+				break;
+			case BrushMode::SUBTRACT:
+				values[i] = std::min(values[i], std::max(-1.0f, std::min(1.0f, (distance - radius) / band)));
+				break;
+			case BrushMode::SMOOTH:
+			{
+				//Average of the voxel and its six neighbours, fading out towards the edge of the brush
+				float sum = values[i] +
+					m_volume->Get(x > 0 ? x - 1 : x, y, z) + m_volume->Get(std::min(x + 1, m_width - 1), y, z) +
+					m_volume->Get(x, y > 0 ? y - 1 : y, z) + m_volume->Get(x, std::min(y + 1, m_height - 1), z) +
+					m_volume->Get(x, y, z > 0 ? z - 1 : z) + m_volume->Get(x, y, std::min(z + 1, m_depth - 1));
+				float weight = strength * (1.0f - distance / radius);
+				values[i] += (sum / 7.0f - values[i]) * weight;
+				break;
+			}
 			}
 		}
+	});
 
+	//Vertex normals use central differences, so a voxel moves vertices of the cells from three below to one above it
+	MarchingCubes marchingCubes(*m_volume, MeshConfig::ISO_LEVEL);
+	unsigned int chunkCount[3], firstChunk[3], lastChunk[3];
+	marchingCubes.GetChunkCount(MeshConfig::CHUNK_SIZE, chunkCount);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		unsigned int firstCell = minimum[axis] >= 3u ? minimum[axis] - 3u : 0u;
+		unsigned int lastCell = std::min(maximum[axis] + 1u, size[axis] - 2u);
+		firstChunk[axis] = firstCell / MeshConfig::CHUNK_SIZE;
+		lastChunk[axis] = lastCell / MeshConfig::CHUNK_SIZE;
+	}
+
+	std::vector<size_t> dirtyChunks;
+	for (unsigned int z = firstChunk[2]; z <= lastChunk[2]; ++z)
+	{
+		for (unsigned int y = firstChunk[1]; y <= lastChunk[1]; ++y)
+		{
+			for (unsigned int x = firstChunk[0]; x <= lastChunk[0]; ++x)
+			{
+				dirtyChunks.push_back((static_cast<size_t>(z) * chunkCount[1] + y) * chunkCount[0] + x);
+			}
+		}
 	}
+
+	std::vector<MeshChunk> chunks = marchingCubes.Polygonise(MeshConfig::CHUNK_SIZE, dirtyChunks);
+	MeshOptimizer::Statistics statistics = MeshOptimizer::OptimizeChunks(chunks);
+	Metrics::Get().Add("Triangles meshed", static_cast<int64_t>(statistics.triangleCount));
+
+	std::vector<KdTree::Triangle*> removedTriangles, addedTriangles;
+	for (size_t i = 0u; i < dirtyChunks.size(); ++i)
+	{
+		size_t chunk = dirtyChunks[i];
+		removedTriangles.insert(removedTriangles.end(), m_chunkTriangles[chunk].begin(), m_chunkTriangles[chunk].end());
+
+		m_chunks[chunk] = std::move(chunks[i]);
+		m_chunkTriangles[chunk] = CreateTreeTriangles(m_chunks[chunk]);
+		addedTriangles.insert(addedTriangles.end(), m_chunkTriangles[chunk].begin(), m_chunkTriangles[chunk].end());
+	}
+
+	tree->ReplaceTriangles(removedTriangles, addedTriangles);
+	UpdateChunks(context, dirtyChunks);
+
+	Metrics& metrics = Metrics::Get();
+	metrics.Add("Brush bricks rewritten", static_cast<int64_t>(brickCount));
+	metrics.Add("Brush chunks remeshed", static_cast<int64_t>(dirtyChunks.size()));
+	metrics.RecordLatency("Brush stroke", Profiler::Now() - brushStart);
+
+	return true;
 }
-void GeometryData::GenerateHelixStructure()
+
+bool GeometryData::SaveVolume(const std::wstring& path) const
 {
-	size_t index = 0u;
-	float maxDistance = m_width / 5.f;
+	if (!m_volume)
+	{
+		printf("Only volume terrain can be saved\n\r");
+		return false;
+	}
 
+	auto saveStart = std::chrono::high_resolution_clock::now();
 
-	for (UINT z = 0; z < m_depth; z++)
+	uint64_t fileSize = 0;
+	if (!VolumeFile::Write(path, *m_volume, fileSize))
 	{
-		for (UINT y = 0; y < m_height; y++)
-		{
-			DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(m_width / 2.0f, static_cast<float>(y), m_depth / 2.0f);
-			DirectX::XMFLOAT3 pillar1 = DirectX::XMFLOAT3(center.x + 10.0f * (float)sin(y / 7.0f), center.y, center.z + 10.0f * (float)cos(y / 7.0f));
-			DirectX::XMFLOAT3 pillar2 = DirectX::XMFLOAT3(center.x + 10.0f * (float)sin(y / 7.0f + DirectX::XM_PI * 0.66f), center.y, center.z + 10.0f * (float)cos(y / 7.0f + DirectX::XM_PI * 0.66f));
-			DirectX::XMFLOAT3 pillar3 = DirectX::XMFLOAT3(center.x + 10.0f * (float)sin(y / 7.0f + DirectX::XM_PI * 0.66f * 2.0f), center.y, center.z + 10.0f * (float)cos(y / 7.0f + DirectX::XM_PI * 0.66f * 2.0f));
+		return false;
+	}
 
-			for (UINT x = 0; x < m_width; x++)
-			{
-				float result = 0;
+	printf("Volume saved: %.2f ms, %llu bytes on disk for %zu bytes of bricks in memory\n\r",
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - saveStart).count(),
+		static_cast<unsigned long long>(fileSize), m_volume->GetAllocatedBrickCount() * SparseVolume::BRICK_VOXELS * m_volume->GetElementSize());
 
-				//Pilars
-				result += 1.0f / (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), pillar1.x, pillar1.y, pillar1.z) / maxDistance) - 1.0f;
-				result += 1.0f / (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), pillar2.x, pillar2.y, pillar2.z) / maxDistance) - 1.0f;
-				result += 1.0f / (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), pillar3.x, pillar3.y, pillar3.z) / maxDistance) - 1.0f;
+	return true;
+}
 
-				//Water Flow Channel
-				result -= 1.0f / (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), center.x, center.y, center.z) / maxDistance) - 1.0f;
+bool GeometryData::LoadVolume(ID3D11DeviceContext* context, const std::wstring& path)
+{
+	//The world matrix and vertex quantisation are set up for the current resolution
+	if (!m_volume || m_useGPUMarchingCubes || !isGeometryGenerated)
+	{
+		return false;
+	}
 
-				//Teraces
-				result += 2.0f * (float)cos(y);
+	auto loadStart = std::chrono::high_resolution_clock::now();
 
-				//Outer Bounds
-				result -= pow((getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), center.x, center.y, center.z) / maxDistance), 3.0f);
+	VolumeFileReader reader;
+	if (!reader.Open(path))
+	{
+		return false;
+	}
 
-				m_data[index] = result;
-				index++;
-			}
-		}
+	if (reader.GetWidth() != m_width || reader.GetHeight() != m_height || reader.GetDepth() != m_depth)
+	{
+		printf("Volume file is %ux%ux%u, the terrain is %ux%ux%u\n\r", reader.GetWidth(), reader.GetHeight(), reader.GetDepth(), m_width, m_height, m_depth);
+		return false;
+	}
+
+	//Meshing reads every voxel, so all chunks are decompressed up front
+	if (!reader.TouchAll())
+	{
+		printf("Volume file has corrupt chunks\n\r");
+		return false;
+	}
+
+	m_volume = reader.GetVolume();
+	m_edited = true;
 
+	printf("Volume loaded: %.2f ms, %zu chunks\n\r",
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadStart).count(), reader.GetChunkCount());
+
+	std::vector<KdTree::Triangle*> removedTriangles;
+	for (const std::vector<KdTree::Triangle*>& triangles : m_chunkTriangles)
+	{
+		removedTriangles.insert(removedTriangles.end(), triangles.begin(), triangles.end());
+	}
+	tree->ReplaceTriangles(removedTriangles, std::vector<KdTree::Triangle*>());
+
+	//Meshed in one go, the user asked for it
+	m_meshedChunks = 0u;
+	while (!MeshSlice())
+	{
+	}
+	FinishMesh();
+	UploadChunks(context);
+
+	std::vector<KdTree::Triangle*> addedTriangles;
+	for (const std::vector<KdTree::Triangle*>& triangles : m_chunkTriangles)
+	{
+		addedTriangles.insert(addedTriangles.end(), triangles.begin(), triangles.end());
 	}
+	tree->ReplaceTriangles(std::vector<KdTree::Triangle*>(), addedTriangles);
+
+	return true;
 }
 
-bool GeometryData::SetBufferData(ID3D11DeviceContext* context, XMMATRIX world, XMMATRIX viewMatrix, XMMATRIX projectionMatrix, XMFLOAT3 eyePos, int initialSteps, int refinementSteps, float depthfactor, Light& light)
+void GeometryData::ReportScaling()
 {
-	HRESULT result;
-	D3D11_MAPPED_SUBRESOURCE mappedResource;
-	MatrixBufferType* matrixData;
-	LightingBufferType* lightData;
-	FactorBufferType* factorData;
-	LightMatrixBufferType* lightMatrixData;
+	if (!isGeometryGenerated || !m_volume || m_chunks.empty())
+	{
+		printf("Thread scaling: only finished volume terrain meshed on the CPU can be measured\n\r");
+		return;
+	}
 
-	//DirectX11 need matrices transposed!
-	XMMATRIX worldM = XMMatrixTranspose(world);
-	viewMatrix = XMMatrixTranspose(viewMatrix);
-	projectionMatrix = XMMatrixTranspose(projectionMatrix);
+	DensityGraph graph;
+	TerrainPresets::BuildDensityGraph(graph, m_type, m_width, m_height, m_depth, m_noiseScale);
 
-	XMMATRIX lightViewMatrix;
-	light.GetViewMatrix(lightViewMatrix);
-	lightViewMatrix = XMMatrixTranspose(lightViewMatrix);
+	//Rays start at random triangles of the terrain, so most of them walk deep into the tree before they hit
+	std::vector<Ray> rays(ScalingConfig::RAY_COUNT);
+	{
+		std::vector<const MeshChunk*> meshes;
+		for (const MeshChunk& chunk : m_chunks)
+		{
+			if (!chunk.indices.empty())
+			{
+				meshes.push_back(&chunk);
+			}
+		}
+		if (meshes.empty())
+		{
+			printf("Thread scaling: the terrain has no triangles\n\r");
+			return;
+		}
 
-	XMMATRIX lightProjectionMatrix;
-	light.GetProjectionMatrix(lightProjectionMatrix);
-	lightProjectionMatrix = XMMatrixTranspose(lightProjectionMatrix);
+		std::mt19937 random(ScalingConfig::RAY_SEED);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		for (Ray& ray : rays)
+		{
+			const MeshChunk& mesh = *meshes[random() % meshes.size()];
+			Vector3 position(mesh.positions[mesh.indices[random() % mesh.indices.size()]]);
+			Vector3 direction(unit(random), unit(random), unit(random));
+			direction.Normalize();
+			ray.position = Vector3::Transform(position, worldMatrix) + direction * ScalingConfig::RAY_OFFSET;
+			ray.direction = direction;
+		}
+	}
 
+	auto measure = [](const std::function<void()>& stage)
 	{
-		// ### MATRIXBUFFER ###
-		//Lock Buffer
-		result = context->Map(matrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		if (FAILED(result))
+		auto start = std::chrono::high_resolution_clock::now();
+		stage();
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	JobSystem& jobSystem = JobSystem::Get();
+	const char* stageNames[] = { "density", "meshing", "kdtree", "rays" };
+	double singleThreaded[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+	//One CSV line per stage and thread count, ready to be pasted into a spreadsheet and plotted
+	printf("Scaling,stage,threads,ms,speedup\n\r");
+	for (size_t threads = 1u; threads <= jobSystem.GetMaxThreadCount(); ++threads)
+	{
+		jobSystem.SetThreadCount(threads);
+		double times[4];
+
+		times[0] = measure([&]()
 		{
-			return false;
+			SparseVolume volume(m_width, m_height, m_depth, -1.0f, m_volume->GetFormat(), m_volume->GetLayout());
+			graph.Fill(volume);
+		});
+
+		times[1] = measure([&]()
+		{
+			std::vector<MeshChunk> chunks = MarchingCubes(*m_volume, MeshConfig::ISO_LEVEL).Polygonise(MeshConfig::CHUNK_SIZE);
+			MeshOptimizer::OptimizeChunks(chunks);
+		});
+
+		//Fresh triangles every time, the build marks the ones it splits at
+		std::vector<KdTree::Triangle*>* triangles = new std::vector<KdTree::Triangle*>();
+		for (const MeshChunk& chunk : m_chunks)
+		{
+			std::vector<KdTree::Triangle*> chunkTriangles = CreateTreeTriangles(chunk);
+			triangles->insert(triangles->end(), chunkTriangles.begin(), chunkTriangles.end());
+		}
+		std::vector<KdTree::Triangle*> owned = *triangles;
+		KdTree::KdNode* root = nullptr;
+		times[2] = measure([&]() { root = KdTree::KdNode::build(triangles, 0); });
+		KdTree::KdNode::Release(root);
+		for (KdTree::Triangle* tri : owned)
+		{
+			delete tri;
 		}
 
-		//Get pointer to data
-		matrixData = static_cast<MatrixBufferType*>(mappedResource.pData);
+		std::vector<KdTree::RayHitStruct> hits;
+		times[3] = measure([&]() { tree->HitBatch(rays, ScalingConfig::RAY_RANGE, hits); });
+
+		for (int stage = 0; stage < 4; ++stage)
+		{
+			if (threads == 1u)
+			{
+				singleThreaded[stage] = times[stage];
+			}
+			printf("Scaling,%s,%zu,%.2f,%.2f\n\r", stageNames[stage], threads, times[stage], singleThreaded[stage] / std::max(times[stage], 1e-6));
+		}
+	}
+
+	jobSystem.SetThreadCount(0u);
+}
+
+void GeometryData::ReportQuantizationError(const SparseVolume& reference) const
+{
+	//Quantization keeps the sign of every voxel, so both meshes have the same vertices in the same order
+	std::vector<MeshChunk> referenceChunks = MarchingCubes(reference, MeshConfig::ISO_LEVEL).Polygonise(MeshConfig::CHUNK_SIZE);
+	std::vector<MeshChunk> chunks = MarchingCubes(*m_volume, MeshConfig::ISO_LEVEL).Polygonise(MeshConfig::CHUNK_SIZE);
+
+	XMFLOAT3 voxelSize(2.0f / (m_width - 1), 2.0f / (m_height - 1), 2.0f / (m_depth - 1));
+	double errorSum = 0.0;
+	float maxError = 0.0f, minNormalDot = 1.0f;
+	size_t vertexCount = 0u, mismatchedChunks = 0u;
+
+	for (size_t i = 0u; i < chunks.size(); ++i)
+	{
+		if (chunks[i].positions.size() != referenceChunks[i].positions.size())
+		{
+			mismatchedChunks++;
+			continue;
+		}
+
+		for (size_t j = 0u; j < chunks[i].positions.size(); ++j)
+		{
+			const XMFLOAT3& position = chunks[i].positions[j];
+			const XMFLOAT3& referencePosition = referenceChunks[i].positions[j];
+			const XMFLOAT3& normal = chunks[i].normals[j];
+			const XMFLOAT3& referenceNormal = referenceChunks[i].normals[j];
+
+			//Measured in voxels
+			float dx = (position.x - referencePosition.x) / voxelSize.x;
+			float dy = (position.y - referencePosition.y) / voxelSize.y;
+			float dz = (position.z - referencePosition.z) / voxelSize.z;
+			float error = sqrt(dx * dx + dy * dy + dz * dz);
+
+			errorSum += error;
+			maxError = std::max(maxError, error);
+			minNormalDot = std::min(minNormalDot, normal.x * referenceNormal.x + normal.y * referenceNormal.y + normal.z * referenceNormal.z);
+			vertexCount++;
+		}
+	}
+
+	printf("Density quantization to %zu bits: %zu vertices, position error max %.4f mean %.4f voxels, normal error max %.2f degrees, %zu mismatched chunks\n\r",
+		m_volume->GetElementSize() * 8, vertexCount, maxError, vertexCount > 0 ? errorSum / vertexCount : 0.0,
+		XMConvertToDegrees(acos(std::max(-1.0f, std::min(1.0f, minNormalDot)))), mismatchedChunks);
+}
+
+std::vector<KdTree::Triangle*> GeometryData::CreateTreeTriangles(const MeshChunk& mesh) const
+{
+	//Generating Triangles
+	std::vector<KdTree::Triangle*> triangles;
+	triangles.reserve(mesh.indices.size() / 3);
+
+	for (size_t i = 2u; i < mesh.indices.size(); i += 3)
+	{
+		KdTree::Triangle* tri = new KdTree::Triangle();
+		tri->vertices[0] = static_cast<DirectX::XMFLOAT3>(Vector3::Transform(Vector3(mesh.positions[mesh.indices[i - 2]]), worldMatrix));
+		tri->vertices[1] = static_cast<DirectX::XMFLOAT3>(Vector3::Transform(Vector3(mesh.positions[mesh.indices[i - 1]]), worldMatrix));
+		tri->vertices[2] = static_cast<DirectX::XMFLOAT3>(Vector3::Transform(Vector3(mesh.positions[mesh.indices[i]]), worldMatrix));
+		tri->CalculateGreatest();
+		tri->CalculateSmallest();
+		triangles.push_back(tri);
+	}
+
+	return triangles;
+}
+
+bool GeometryData::CreateMeshBuffers(ID3D11DeviceContext* context, const MeshChunk& mesh)
+{
+	size_t count = mesh.positions.size();
+
+	//Uploads repeat triangles meshed before, they are counted as meshed where they are generated.
+	//The size of the current mesh is the "Terrain triangles" gauge.
+	m_triangleCount = static_cast<UINT>(mesh.indices.size() / 3);
+	Profiler::Get().Counter("Terrain triangles", static_cast<double>(m_triangleCount));
+
+	//Whole meshes are never patched, so they have no chunk ranges
+	m_chunkRanges.clear();
 
-		//Set data
-		matrixData->world = worldM;
-		matrixData->view = viewMatrix;
-		matrixData->projection = projectionMatrix;
+	XMFLOAT3 boundsMin = count > 0 ? mesh.positions[0] : XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 boundsMax = boundsMin;
 
-		context->Unmap(matrixBuffer, 0);
+	for (const XMFLOAT3& position : mesh.positions)
+	{
+		boundsMin.x = std::min(boundsMin.x, position.x);
+		boundsMin.y = std::min(boundsMin.y, position.y);
+		boundsMin.z = std::min(boundsMin.z, position.z);
+		boundsMax.x = std::max(boundsMax.x, position.x);
+		boundsMax.y = std::max(boundsMax.y, position.y);
+		boundsMax.z = std::max(boundsMax.z, position.z);
 	}
+
+	m_vertexEncoder = CompactVertexEncoder(boundsMin, boundsMax);
+
+	std::vector<CompactVertex> compactVertices(count);
+	for (size_t i = 0u; i < count; ++i)
 	{
-		// ### LightingBuffer ###
-		//Lock Buffer
-		result = context->Map(lightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		if (FAILED(result))
-		{
-			return false;
-		}
+		compactVertices[i] = m_vertexEncoder.Encode(mesh.positions[i], mesh.normals[i]);
+	}
 
-		//Get pointer to data
-		lightData = static_cast<LightingBufferType*>(mappedResource.pData);
+	return CreateBuffers(context, compactVertices, mesh.indices, D3D11_USAGE_IMMUTABLE);
+}
 
-		//Set data	
-		lightData->cameraPosition = eyePos;
-		lightData->lightDirection = light.GetDirection();
-		lightData->diffuseColor = light.GetDiffuseColour();
-		lightData->ambientColor = light.GetAmbientColour();
+bool GeometryData::CreateBuffers(ID3D11DeviceContext* context, const std::vector<CompactVertex>& vertices, const std::vector<uint32_t>& indices, D3D11_USAGE usage)
+{
+	HRESULT result;
+	ID3D11Device* device = nullptr;
 
-		context->Unmap(lightBuffer, 0);
+	//A new layout replaces the buffers of the previous one
+	if (m_compactVertexBuffer)
+	{
+		m_compactVertexBuffer->Release();
+		m_compactVertexBuffer = nullptr;
 	}
+
+	if (m_indexBuffer)
 	{
-		// ### FactorBuffer (Pixel Shader Displacement) ###
-		//Lock Buffer
-		result = context->Map(factorBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		if (FAILED(result))
-		{
-			return false;
-		}
+		m_indexBuffer->Release();
+		m_indexBuffer = nullptr;
+	}
 
-		//Get pointer to data
-		factorData = static_cast<FactorBufferType*>(mappedResource.pData);
+	m_indexCount = 0;
+	m_meshBytes = 0;
 
-		//Set data
-		factorData->steps_initial = initialSteps;
-		factorData->steps_refinement = refinementSteps;
-		factorData->depth_factor = depthfactor;
+	if (vertices.empty() || indices.empty())
+	{
+		return false;
+	}
 
-		context->Unmap(factorBuffer, 0);
+	D3D11_BUFFER_DESC vertexBufferDesc;
+	vertexBufferDesc.Usage = usage;
+	vertexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(CompactVertex) * vertices.size());
+	vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vertexBufferDesc.CPUAccessFlags = 0;
+	vertexBufferDesc.MiscFlags = 0;
+	vertexBufferDesc.StructureByteStride = 0;
+
+	D3D11_SUBRESOURCE_DATA vertexData;
+	vertexData.pSysMem = vertices.data();
+	vertexData.SysMemPitch = 0;
+	vertexData.SysMemSlicePitch = 0;
+
+	D3D11_BUFFER_DESC indexBufferDesc = vertexBufferDesc;
+	indexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(uint32_t) * indices.size());
+	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA indexData = vertexData;
+	indexData.pSysMem = indices.data();
+
+	context->GetDevice(&device);
+	result = device->CreateBuffer(&vertexBufferDesc, &vertexData, &m_compactVertexBuffer);
+	if (SUCCEEDED(result))
+	{
+		result = device->CreateBuffer(&indexBufferDesc, &indexData, &m_indexBuffer);
 	}
+	device->Release();
+
+	if (FAILED(result))
 	{
-		// ### LIGHTMATRIXBUFFER ###
-		//Lock Buffer
-		result = context->Map(lightMatrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		if (FAILED(result))
-		{
-			return false;
-		}
+		printf("Mesh buffer creation failed.\n\r");
+		return false;
+	}
 
-		//Get pointer to data
-		lightMatrixData = static_cast<LightMatrixBufferType*>(mappedResource.pData);
+	m_indexCount = static_cast<UINT>(indices.size());
+	m_meshBytes = vertexBufferDesc.ByteWidth + indexBufferDesc.ByteWidth;
 
-		//Set data
-		lightMatrixData->lightViewMatrix = lightViewMatrix;
-		lightMatrixData->lightProjectionMatrix = lightProjectionMatrix;
+	return true;
+}
 
-		context->Unmap(lightMatrixBuffer, 0);
+bool GeometryData::InitializeClipmap(ID3D11Device* device)
+{
+	HRESULT result;
+
+	//Every level draws the same grid, only the index range and the level constants change
+	std::vector<XMFLOAT3> vertices;
+	std::vector<uint16_t> indices;
+	Clipmap::BuildVertices(vertices);
+	Clipmap::BuildIndices(indices);
+
+	D3D11_BUFFER_DESC vertexBufferDesc = {};
+	vertexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	vertexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(XMFLOAT3) * vertices.size());
+	vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA vertexData = {};
+	vertexData.pSysMem = vertices.data();
+
+	D3D11_BUFFER_DESC indexBufferDesc = vertexBufferDesc;
+	indexBufferDesc.ByteWidth = static_cast<UINT>(sizeof(uint16_t) * indices.size());
+	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA indexData = {};
+	indexData.pSysMem = indices.data();
+
+	D3D11_BUFFER_DESC levelBufferDesc = {};
+	levelBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	levelBufferDesc.ByteWidth = sizeof(ClipmapLevelBufferType);
+	levelBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	levelBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	//One slice per level, filled by UpdateClipmap as the camera moves
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width = Clipmap::SAMPLE_COUNT;
+	textureDesc.Height = Clipmap::SAMPLE_COUNT;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = m_clipmap->GetLevelCount();
+	textureDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	result = device->CreateBuffer(&vertexBufferDesc, &vertexData, &m_clipmapVertexBuffer);
+	if (SUCCEEDED(result))
+	{
+		result = device->CreateBuffer(&indexBufferDesc, &indexData, &m_clipmapIndexBuffer);
+	}
+	if (SUCCEEDED(result))
+	{
+		result = device->CreateBuffer(&levelBufferDesc, nullptr, &m_clipmapLevelBuffer);
+	}
+	if (SUCCEEDED(result))
+	{
+		result = device->CreateTexture2D(&textureDesc, nullptr, &m_clipmapTexture);
+	}
+	if (SUCCEEDED(result))
+	{
+		result = device->CreateShaderResourceView(m_clipmapTexture, nullptr, &m_clipmapSamples);
+	}
+
+	if (FAILED(result))
+	{
+		printf("Clipmap resource creation failed.\n\r");
+		return false;
 	}
 
 	return true;
 }
 
-void GeometryData::LoadTextures(ID3D11Device* device)
+void GeometryData::UpdateClipmap(ID3D11DeviceContext* context, XMFLOAT3 eyePos)
 {
-	TextureClass* rock1 = new TextureClass();
-	rock1->Initialize(device, L"./Assets/rock1.dds", L"./Assets/rock1_heightmap.dds");
-
-	TextureClass* rock2 = new TextureClass();
-	rock2->Initialize(device, L"./Assets/rock2.dds", L"./Assets/rock2_heightmap.dds");
+	//The camera in heightfield samples, the clipmap only follows it on x and z
+	Vector3 eye = Vector3::Transform(Vector3(eyePos), Matrix(worldMatrix).Invert());
+	XMFLOAT2 spacing = m_clipmap->GetSpacing();
 
-	TextureClass* rock3 = new TextureClass();
-	rock3->Initialize(device, L"./Assets/rock3.dds", L"./Assets/rock3_heightmap.dds");
+	m_clipmapRegions.clear();
+	m_clipmap->Update((eye.x + 1.0f) / spacing.x, (eye.z + 1.0f) / spacing.y, m_clipmapRegions);
 
-	//TextureClass* rock3 = new TextureClass();
-	//rock3->Initialize(device, L"./Assets/Pebbles_020_basecolor.dds", L"./Assets/Pebbles_020_height.dds");
+	//Only the strips that came into view are uploaded, a few rows and columns per level on a normal frame
+	for (const Clipmap::Region& region : m_clipmapRegions)
+	{
+		const Clipmap::Sample* samples = m_clipmap->GetSamples(region.level);
+		D3D11_BOX box = { region.x, region.z, 0u, region.x + region.width, region.z + region.depth, 1u };
 
-	m_colorTextures[0] = rock1;
-	m_colorTextures[1] = rock2;
-	m_colorTextures[2] = rock3;
+		context->UpdateSubresource(m_clipmapTexture, D3D11CalcSubresource(0, region.level, 1), &box,
+			&samples[region.z * Clipmap::SAMPLE_COUNT + region.x], Clipmap::SAMPLE_COUNT * sizeof(Clipmap::Sample), 0);
+	}
 }
 
-void GeometryData::ReadFromGSBuffer(ID3D11DeviceContext* context)
+void GeometryData::DrawClipmap(ID3D11DeviceContext* context)
 {
-	//Reading from Buffer
-	GeometryVertexInputType* vertices;
-	D3D11_MAPPED_SUBRESOURCE mappedRessource;
-	ID3D11Buffer* readbuf = marchingCubeGSO->GetReadBuffer(context);
+	XMFLOAT2 spacing = m_clipmap->GetSpacing();
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
 
-	context->Map(readbuf, 0, D3D11_MAP_READ, 0, &mappedRessource);
+	for (unsigned int level = 0u; level < m_clipmap->GetLevelCount(); ++level)
+	{
+		if (FAILED(context->Map(m_clipmapLevelBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource)))
+		{
+			printf("Mapping Buffer failed in clipmap level %u.\n\r", level);
+			return;
+		}
 
-	vertices = static_cast<GeometryVertexInputType*>(mappedRessource.pData);
+		float scale = static_cast<float>(1u << level);
+		int originX = m_clipmap->GetOriginX(level), originZ = m_clipmap->GetOriginZ(level);
 
-	//Generating Triangles
-	for(size_t i = 2u; i < generatedVertexCount; i+=3)
-	{
-		KdTree::Triangle* tri = new KdTree::Triangle();
-		tri->vertices[0] = static_cast<DirectX::XMFLOAT3>(Vector3::Transform(Vector3(vertices[i - 2].position.x, vertices[i - 2].position.y, vertices[i - 2].position.z), worldMatrix));
-		tri->vertices[1] = static_cast<DirectX::XMFLOAT3>(Vector3::Transform(Vector3(vertices[i - 1].position.x, vertices[i - 1].position.y, vertices[i - 1].position.z), worldMatrix));
-		tri->vertices[2] = static_cast<DirectX::XMFLOAT3>(Vector3::Transform(Vector3(vertices[i].position.x, vertices[i].position.y, vertices[i].position.z), worldMatrix));
-		tri->CalculateGreatest();
-		tri->CalculateSmallest();
-		tree->AddTriangle(tri);
+		ClipmapLevelBufferType* levelData = static_cast<ClipmapLevelBufferType*>(mappedResource.pData);
+		levelData->origin = XMFLOAT2(-1.0f + originX * scale * spacing.x, -1.0f + originZ * scale * spacing.y);
+		levelData->spacing = XMFLOAT2(scale * spacing.x, scale * spacing.y);
+		levelData->slotX = ((originX % Clipmap::SAMPLE_COUNT) + Clipmap::SAMPLE_COUNT) % Clipmap::SAMPLE_COUNT;
+		levelData->slotZ = ((originZ % Clipmap::SAMPLE_COUNT) + Clipmap::SAMPLE_COUNT) % Clipmap::SAMPLE_COUNT;
+		levelData->level = static_cast<int>(level);
+		levelData->sampleCount = Clipmap::SAMPLE_COUNT;
+		//Nothing outside of the coarsest level to blend into
+		levelData->blendScale = level + 1 < m_clipmap->GetLevelCount() ? 1.0f : 0.0f;
+
+		context->Unmap(m_clipmapLevelBuffer, 0);
+
+		UINT start, count;
+		m_clipmap->GetIndexRange(level, start, count);
+		context->DrawIndexed(count, start, 0);
 	}
+}
 
-	context->Unmap(readbuf, 0);
+void GeometryData::RenderClipmapDepth(ID3D11DeviceContext* context, XMFLOAT3 eyePos)
+{
+	//The shadow pass comes before Render, so the levels have to follow the camera here already
+	UpdateClipmap(context, eyePos);
+
+	UINT offset = 0, stride = sizeof(XMFLOAT3);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->IASetVertexBuffers(0, 1, &m_clipmapVertexBuffer, &stride, &offset);
+	context->IASetIndexBuffer(m_clipmapIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+	context->VSSetShaderResources(0, 1, &m_clipmapSamples);
+	context->VSSetConstantBuffers(2, 1, &m_clipmapLevelBuffer);
+
+	DrawClipmap(context);
 
-	tree->MarkKDTreeDirty();
+	ID3D11ShaderResourceView* pSRV = { nullptr };
+	context->VSSetShaderResources(0, 1, &pSRV);
 }
 
 void GeometryData::MarchingCubeRenderpass(ID3D11DeviceContext* deviceContext, XMMATRIX viewMatrix, XMMATRIX projectionMatrix)
 {
+	Profiler::Zone zone("GeometryData::MarchingCubeRenderpass");
+
 	HRESULT result;
 	D3D11_MAPPED_SUBRESOURCE mappedResource;
 	MatrixBufferType* matrixData;
@@ -499,7 +1518,7 @@ void GeometryData::MarchingCubeRenderpass(ID3D11DeviceContext* deviceContext, XM
 	UINT offset = 0, stride = sizeof(MarchingCubeVertexInputType);
 	deviceContext->SOSetTargets(1, &marchingCubeGSO->outputBuffer, &offset);
 
-	marchingCubeVS->Set(deviceContext);
+	m_cache->GetMarchingCubeVS()->Set(deviceContext);
 	marchingCubeGSO->Set(deviceContext);
 
 	// Set the vertex buffer to active in the input assembler so it can be rendered.
@@ -509,10 +1528,12 @@ void GeometryData::MarchingCubeRenderpass(ID3D11DeviceContext* deviceContext, XM
 	deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
 
 	//Density Map to use
+	ID3D11ShaderResourceView* triangleLUT = m_cache->GetTriangleLUT();
+	ID3D11SamplerState* densitySampler = m_cache->GetDensitySampler();
 	deviceContext->GSSetShaderResources(0, 1, &m_densityMap);
-	deviceContext->GSSetShaderResources(1, 1, &m_triangleLUT);
+	deviceContext->GSSetShaderResources(1, 1, &triangleLUT);
 	//Set point sampler to use in the geometry shader
-	deviceContext->GSSetSamplers(0, 1, &m_densitySampler);
+	deviceContext->GSSetSamplers(0, 1, &densitySampler);
 	deviceContext->GSSetConstantBuffers(1, 1, &m_decalDescriptionBuffer);
 
 	deviceContext->GSSetConstantBuffers(0, 1, &matrixBuffer);
@@ -522,126 +1543,62 @@ void GeometryData::MarchingCubeRenderpass(ID3D11DeviceContext* deviceContext, XM
 	deviceContext->End(statsQuery);
 
 	deviceContext->SOSetTargets(0, nullptr, nullptr);
-	isGeometryGenerated = true;
 	deviceContext->GSSetShader(nullptr, nullptr, 0);
-
-	CountGeneratedTriangles(deviceContext);
-	ReadFromGSBuffer(deviceContext);
 }
 
-void GeometryData::CountGeneratedTriangles(ID3D11DeviceContext* context)
+bool GeometryData::CountGeneratedTriangles(ID3D11DeviceContext* context)
 {
-	D3D11_QUERY_DATA_PIPELINE_STATISTICS stats;
-	while(S_OK != context->GetData(statsQuery, &stats, sizeof(stats), 0))
+	//Polled from the generation steps instead of sleeping until the GPU is done
+	D3D11_QUERY_DATA_SO_STATISTICS stats;
+	if (context->GetData(statsQuery, &stats, sizeof(stats), 0) != S_OK)
 	{
-		Sleep(1);
+		return false;
 	}
 
-	generatedVertexCount = stats.VSInvocations;
-	printf("%llu\n\r", generatedVertexCount);
+	//Points culled before the pass emit nothing and others emit up to five triangles, only the stream output knows the count
+	if (stats.NumPrimitivesWritten < stats.PrimitivesStorageNeeded)
+	{
+		printf("Marching cube stream output full, %llu of %llu triangles written\n\r", stats.NumPrimitivesWritten, stats.PrimitivesStorageNeeded);
+	}
+	generatedTriangleCount = stats.NumPrimitivesWritten;
+	Metrics::Get().SetGauge("GPU marching cubes triangles", static_cast<double>(generatedTriangleCount));
+	return true;
 }
 
 ID3D11Buffer* GeometryData::GetGeometryVertexBuffer()
 {
-	return marchingCubeGSO->outputBuffer;
+	return m_compactVertexBuffer;
 }
 
 void GeometryData::SetVertexBuffer(ID3D11DeviceContext* context)
 {
 	UINT stride, offset;
 	offset = 0;
-	stride = sizeof(GeometryVertexInputType);
+	stride = sizeof(CompactVertex);
 
 	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	context->IASetVertexBuffers(0, 1, &marchingCubeGSO->outputBuffer, &stride, &offset);
+	context->IASetVertexBuffers(0, 1, &m_compactVertexBuffer, &stride, &offset);
+	context->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R32_UINT, 0);
 }
 
 UINT GeometryData::GetGeometryVertexBufferStride()
 {
-	return sizeof(GeometryVertexInputType);
-}
-
-void GeometryData::GenerateNoiseData()
-{
-	size_t index = 0u;
-
-	unsigned int width_offset = m_width / 4;
-	unsigned int height_offset = m_height / 4;
-	unsigned int depth_offset = m_depth / 4;
-
-
-	for (UINT z = 0; z < m_depth; z++)
-	{
-		for (UINT y = 0; y < m_height; y++)
-		{
-			for (UINT x = 0; x < m_width; x++)
-			{
-				float valueX = (float)x / (float)m_width;
-				float valueY = (float)y / (float)m_height;
-				float valueZ = (float)z / (float)m_depth;
-
-				float noiseValue = -1.0f;
-
-				if (
-					x >= 0 + width_offset && x <= m_width - width_offset
-					&& y >= 0 + height_offset && y <= m_height - height_offset
-					&& z >= 0 + depth_offset && z <= m_depth - depth_offset)
-				{
-					noiseValue = (float)noise.Noise3D((valueX)*m_noiseScale, (valueY)*m_noiseScale, (valueZ)*m_noiseScale);
-					if (noiseValue < 0) {
-						noiseValue = -1.0f;
-					}
-				}
-
-
-				m_data[index] = noiseValue;
-
-				index++;
-			}
-		}
-
-	}
-}
-
-void GeometryData::GenerateBumpySphere()
-{
-	DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(m_width / 2.0f, m_height / 2.0f, m_depth / 2.0f);
-
-	size_t index = 0u;
-	float maxDistance = m_width / 2.5f; // Keep it slightly smaller than cube step count
-
-	for (UINT z = 0; z < m_depth; z++)
-	{
-		for (UINT y = 0; y < m_height; y++)
-		{
-			for (UINT x = 0; x < m_width; x++)
-			{
-				float valueX = (float)x / (float)m_width;
-				float valueY = (float)y / (float)m_height;
-				float valueZ = (float)z / (float)m_depth;
-
-				float result = -1.0f;
-				if (getDistance(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z), center.x, center.y, center.z) - maxDistance < 0) {
-					float noiseValue = (float)noise.Noise3D((valueX)*m_noiseScale, (valueY)*m_noiseScale, (valueZ)*m_noiseScale);
-					result = noiseValue > 0.0 ? -1.0 : 1.0f;
-				}
-
-
-				//result -= noiseVal;
-
-				m_data[index] = result;
-
-				index++;
-			}
-		}
-	}
+	return sizeof(CompactVertex);
 }
 
 int GeometryData::GetVertices(MarchingCubeVertexInputType** outVertices)
 {
 	int size = int(2.0f / m_cubeStep.x);
 	size = size * size * size;
-	m_vertexCount = size;
+
+	//Texels a cube starting at position reads with linear filtering
+	auto getTexelRange = [](float position, float step, unsigned int texels, unsigned int& first, unsigned int& last)
+	{
+		float start = (position + 1.0f) * 0.5f * texels - 0.5f;
+		float end = (position + step + 1.0f) * 0.5f * texels - 0.5f;
+		first = static_cast<unsigned int>(std::max(0.0f, std::floor(start)));
+		last = std::min(static_cast<unsigned int>(std::max(0.0f, std::floor(end))) + 1, texels - 1);
+	};
 
 	(*outVertices) = new MarchingCubeVertexInputType[size];
 	int idx = 0;
@@ -651,6 +1608,17 @@ int GeometryData::GetVertices(MarchingCubeVertexInputType** outVertices)
 		{
 			for (float x = -1; x < 1.0f; x += m_cubeStep.x)
 			{
+				//Cubes inside uniform bricks never emit triangles, leave them out of the point grid
+				unsigned int first[3], last[3];
+				getTexelRange(x, m_cubeStep.x, m_width, first[0], last[0]);
+				getTexelRange(y, m_cubeStep.y, m_height, first[1], last[1]);
+				getTexelRange(z, m_cubeStep.z, m_depth, first[2], last[2]);
+
+				if (!m_volume->MayContainSurface(first, last, MeshConfig::ISO_LEVEL))
+				{
+					continue;
+				}
+
 				(*outVertices)[idx].position = DirectX::XMFLOAT3(x, y, z);
 				(*outVertices)[idx].color = DirectX::XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 
@@ -659,7 +1627,8 @@ int GeometryData::GetVertices(MarchingCubeVertexInputType** outVertices)
 		}
 	}
 
-	return size;
+	m_vertexCount = idx;
+	return idx;
 }
 
 
@@ -671,12 +1640,14 @@ bool GeometryData::InitializeBuffers(ID3D11Device* device)
 	D3D11_BUFFER_DESC vertexBufferDesc;
 	D3D11_SUBRESOURCE_DATA vertexData;
 
-	// Set the number of vertices in the vertex array.
-	m_vertexCount = GetVertices(&vertices);
+	m_vertexCount = 0;
 
-	// VertexBuffer
+	// VertexBuffer, the point grid is only needed by the geometry shader path
+	if (m_useGPUMarchingCubes)
 	{
-		
+		// Set the number of vertices in the vertex array.
+		m_vertexCount = GetVertices(&vertices);
+
 		// Set up the description of the static vertex buffer.
 		vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
 		vertexBufferDesc.ByteWidth = sizeof(MarchingCubeVertexInputType) * m_vertexCount;
@@ -773,7 +1744,7 @@ bool GeometryData::InitializeBuffers(ID3D11Device* device)
 	//Query
 	{
 		D3D11_QUERY_DESC queryDesc;
-		queryDesc.Query = D3D11_QUERY_PIPELINE_STATISTICS;
+		queryDesc.Query = D3D11_QUERY_SO_STATISTICS;
 		queryDesc.MiscFlags = 0;
 		result = device->CreateQuery(&queryDesc, &statsQuery);
 		if(FAILED(result))
@@ -789,79 +1760,8 @@ bool GeometryData::InitializeBuffers(ID3D11Device* device)
 
 bool GeometryData::InitializeShaders(ID3D11Device* device)
 {
-	{
-		D3D11_INPUT_ELEMENT_DESC polygonLayout[2];
-
-		//Vertex Input Layout Description
-		//needs to mach MarchingCubeVertexInputType
-		polygonLayout[0].SemanticName = "SV_POSITION";
-		polygonLayout[0].SemanticIndex = 0;
-		polygonLayout[0].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		polygonLayout[0].InputSlot = 0;
-		polygonLayout[0].AlignedByteOffset = 0;
-		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		polygonLayout[0].InstanceDataStepRate = 0;
-
-		polygonLayout[1].SemanticName = "COLOR";
-		polygonLayout[1].SemanticIndex = 0;
-		polygonLayout[1].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		polygonLayout[1].InputSlot = 0;
-		polygonLayout[1].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-		polygonLayout[1].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		polygonLayout[1].InstanceDataStepRate = 0;
-
-		UINT numElements = sizeof(polygonLayout) / sizeof(polygonLayout[0]);
-
-		marchingCubeVS = new VertexShader();
-		marchingCubeVS->Initialize(device, L"MarchingCube_VS.hlsl", polygonLayout, numElements);
-	}
-
-	{
-		D3D11_INPUT_ELEMENT_DESC polygonLayout[4];
-
-		//Vertex Input Layout Description
-		//needs to mach GeometryVertexInputType
-		polygonLayout[0].SemanticName = "SV_POSITION";
-		polygonLayout[0].SemanticIndex = 0;
-		polygonLayout[0].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		polygonLayout[0].InputSlot = 0;
-		polygonLayout[0].AlignedByteOffset = 0;
-		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		polygonLayout[0].InstanceDataStepRate = 0;
-
-		polygonLayout[1].SemanticName = "POSITION";
-		polygonLayout[1].SemanticIndex = 0;
-		polygonLayout[1].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		polygonLayout[1].InputSlot = 0;
-		polygonLayout[1].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-		polygonLayout[1].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		polygonLayout[1].InstanceDataStepRate = 0;
-
-		polygonLayout[2].SemanticName = "COLOR";
-		polygonLayout[2].SemanticIndex = 0;
-		polygonLayout[2].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		polygonLayout[2].InputSlot = 0;
-		polygonLayout[2].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-		polygonLayout[2].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		polygonLayout[2].InstanceDataStepRate = 0;
-
-		polygonLayout[3].SemanticName = "NORMAL";
-		polygonLayout[3].SemanticIndex = 0;
-		polygonLayout[3].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		polygonLayout[3].InputSlot = 0;
-		polygonLayout[3].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
-		polygonLayout[3].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		polygonLayout[3].InstanceDataStepRate = 0;
-
-		UINT numElements = sizeof(polygonLayout) / sizeof(polygonLayout[0]);
-
-		geometryVS = new VertexShader();
-		geometryVS->Initialize(device, L"Geometry_VS.hlsl", polygonLayout, numElements);
-	}
-
-	triplanarDisplacementPS = new PixelShader();
-	triplanarDisplacementPS->Initialize(device, L"Triplanar_Displacement_PS.hlsl");
-
+	//Stream output buffers are only needed by the geometry shader path
+	if (m_useGPUMarchingCubes)
 	{
 		D3D11_BUFFER_DESC bufferDesc = {};
 
@@ -908,16 +1808,6 @@ bool GeometryData::InitializeShaders(ID3D11Device* device)
 		marchingCubeGSO->Initialize(device, L"MarchingCube_GS.hlsl", bufferDesc, declarationEntry, numElements);
 	}
 
-	{
-		hullShader = new HullShader();
-		hullShader->Initialize(device, L"Tessellation_HS.hlsl");
-	}
-
-	{
-		domainShader = new DomainShader();
-		domainShader->Initialize(device, L"Tessellation_DS.hlsl");
-	}
-
 	return true;
 }
 
@@ -929,7 +1819,18 @@ D3D11_TEXTURE3D_DESC GeometryData::CreateTextureDesc() const
 	output.Height = m_height;
 	output.Depth = m_depth;
 	output.MipLevels = 1;
-	output.Format = DXGI_FORMAT_R32_FLOAT;
+	switch (m_volume->GetFormat())
+	{
+	case DensityFormat::SNORM16:
+		output.Format = DXGI_FORMAT_R16_SNORM;
+		break;
+	case DensityFormat::SNORM8:
+		output.Format = DXGI_FORMAT_R8_SNORM;
+		break;
+	default:
+		output.Format = DXGI_FORMAT_R32_FLOAT;
+		break;
+	}
 	output.Usage = D3D11_USAGE_DEFAULT;
 	output.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 	output.CPUAccessFlags = 0;
@@ -938,31 +1839,31 @@ D3D11_TEXTURE3D_DESC GeometryData::CreateTextureDesc() const
 	return output;
 }
 
-D3D11_SUBRESOURCE_DATA GeometryData::CreateSubresourceData() const
+ID3D11Texture3D* GeometryData::CreateTexture(ID3D11Device* device, const D3D11_TEXTURE3D_DESC texDesc) const
 {
-	D3D11_SUBRESOURCE_DATA output;
-
-	ZeroMemory(&output, sizeof(output));
-
-	//Size of a 1d line. Eg. distance between adjacent values
-	output.SysMemPitch = m_width * sizeof(float);
-
-	//Size of a 2D slice
-	output.SysMemSlicePitch = m_width * m_height * sizeof(float);
+	ID3D11Texture3D* output;
 
-	//The actual data
-	output.pSysMem = m_data;
+	//Filled slab by slab in UploadDensityTexture
+	device->CreateTexture3D(&texDesc, nullptr, &output);
 
 	return output;
 }
 
-ID3D11Texture3D* GeometryData::CreateTexture(ID3D11Device* device, const D3D11_TEXTURE3D_DESC texDesc, const D3D11_SUBRESOURCE_DATA subData) const
+void GeometryData::UploadDensityTexture(ID3D11DeviceContext* deviceContext) const
 {
-	ID3D11Texture3D* output;
+	//Expand one brick deep slab at a time instead of the whole volume
+	const unsigned int slabDepth = SparseVolume::BRICK_SIZE;
+	const size_t elementSize = m_volume->GetElementSize();
+	std::vector<char> slab(static_cast<size_t>(m_width) * m_height * slabDepth * elementSize);
 
-	device->CreateTexture3D(&texDesc, &subData, &output);
+	for (unsigned int z = 0u; z < m_depth; z += slabDepth)
+	{
+		unsigned int zEnd = std::min(z + slabDepth, m_depth);
+		m_volume->CopySlices(z, zEnd, slab.data());
 
-	return output;
+		D3D11_BOX box = { 0u, 0u, z, m_width, m_height, zEnd };
+		deviceContext->UpdateSubresource(m_texture3D, 0, &box, slab.data(), static_cast<UINT>(m_width * elementSize), static_cast<UINT>(m_width * m_height * elementSize));
+	}
 }
 
 ID3D11ShaderResourceView* GeometryData::CreateDensityShaderResource(ID3D11Device* device, ID3D11Texture3D* texture3D) const
@@ -974,90 +1875,10 @@ ID3D11ShaderResourceView* GeometryData::CreateDensityShaderResource(ID3D11Device
 	return output;
 }
 
-ID3D11ShaderResourceView* GeometryData::CreateTriangleLUTShaderResource(ID3D11Device* device) const
-{
-	ID3D11ShaderResourceView* output;
-
-	D3D11_TEXTURE2D_DESC desc;
-	ZeroMemory(&desc, sizeof(desc));
-	desc.Height = 256;
-	desc.Width = 16;
-	desc.MipLevels = 1;
-	desc.ArraySize = 1;
-	desc.Format = DXGI_FORMAT_R32_SINT;
-	desc.SampleDesc = { 1, 0 };
-	desc.Usage = D3D11_USAGE_DEFAULT;
-	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	desc.CPUAccessFlags = 0;
-	desc.MiscFlags = 0;
-
-	D3D11_SUBRESOURCE_DATA initData;
-	ZeroMemory(&initData, sizeof(initData));
-	initData.SysMemPitch = 16 * sizeof(int);
-	initData.SysMemSlicePitch = 0;
-
-	initData.pSysMem = TriangleLUT::TriTable;
-
-	ID3D11Texture2D* texture = nullptr;
-	device->CreateTexture2D(&desc, &initData, &texture);
-	device->CreateShaderResourceView(texture, nullptr, &output);
-
-	return output;
-}
-
-ID3D11SamplerState* GeometryData::CreateDensitySamplerState(ID3D11Device* device) const
-{
-	ID3D11SamplerState* output;
-
-	//Create a basic point sampler for sampling our density data in the gpu
-	//should refactor this elsewhere
-	D3D11_SAMPLER_DESC sampDesc;
-	ZeroMemory(&sampDesc, sizeof(sampDesc));
-	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
-	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
-	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-	sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-	sampDesc.MinLOD = 0;
-	sampDesc.MaxLOD = 0;
-
-	device->CreateSamplerState(&sampDesc, &output);
-
-	return output;
-}
-
-void GeometryData::CreatePSSamplerStates(ID3D11Device* device, ID3D11SamplerState* wrapSampler, ID3D11SamplerState* clampSampler)
-{
-	//Create a basic point sampler for sampling our density data in the gpu
-	//should refactor this elsewhere
-	D3D11_SAMPLER_DESC sampDesc;
-	ZeroMemory(&sampDesc, sizeof(sampDesc));
-	sampDesc.Filter = D3D11_FILTER_ANISOTROPIC;
-	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-	sampDesc.MipLODBias = 0.0f;
-	sampDesc.MaxAnisotropy = 16;
-	sampDesc.ComparisonFunc = D3D11_COMPARISON_ALWAYS;
-	sampDesc.BorderColor[0] = 0;
-	sampDesc.BorderColor[1] = 1;
-	sampDesc.BorderColor[2] = 0;
-	sampDesc.BorderColor[3] = 1;
-	sampDesc.MinLOD = 0;
-	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
-
-	device->CreateSamplerState(&sampDesc, &m_wrapSampler);
-
-	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
-	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
-	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-
-	device->CreateSamplerState(&sampDesc, &m_clampSampler);
-
-}
-
 void GeometryData::GenerateDecalDescriptionBuffer(ID3D11Device* device, ID3D11DeviceContext* deviceContext)
 {
+	Profiler::Zone zone("GeometryData::GenerateDecalDescriptionBuffer");
+
 	D3D11_BUFFER_DESC bd;
 	ZeroMemory(&bd, sizeof(bd));
 	bd.Usage = D3D11_USAGE_DEFAULT;
@@ -1093,8 +1914,12 @@ GeometryData::DecalDescription GeometryData::GetDecals() const
 
 void GeometryData::DebugPrint()
 {
+	if (!m_volume)
+	{
+		return;
+	}
+
 	char* output = new char[m_width + 1];
-	size_t index = 0;
 
 	for (size_t i = 0u; i < m_depth; ++i)
 	{
@@ -1102,7 +1927,7 @@ void GeometryData::DebugPrint()
 		{
 			for (size_t k = 0u; k < m_width; ++k)
 			{
-				if (m_data[index] == -1)
+				if (m_volume->Get(static_cast<unsigned int>(k), static_cast<unsigned int>(j), static_cast<unsigned int>(i)) == -1)
 				{
 					output[k] = '0';
 				}
@@ -1110,8 +1935,6 @@ void GeometryData::DebugPrint()
 				{
 					output[k] = '1';
 				}
-
-				index++;
 			}
 			output[m_width] = '\0';
 			printf("%s\n", output);
@@ -1125,38 +1948,63 @@ void GeometryData::Render(ID3D11DeviceContext* deviceContext, XMMATRIX viewMatri
 {
 	bool useTessellation = true;
 
+	//Nothing to draw until Generate is done
 	if (!isGeometryGenerated)
 	{
-		MarchingCubeRenderpass(deviceContext, viewMatrix, projectionMatrix);
+		return;
+	}
+
+	if (m_clipmap)
+	{
+		UpdateClipmap(deviceContext, eyePos);
 	}
 
-	SetBufferData(deviceContext, worldMatrix, viewMatrix, projectionMatrix, eyePos, initialSteps, refinementSteps, depthfactor, light);
-	UINT offset = 0, stride = sizeof(GeometryVertexInputType);
+	//Clipmap vertices are placed in mesh space by the shader, only compact vertices need dequantizing
+	SetBufferData(deviceContext, m_clipmap ? worldMatrix : GetQuantizedWorldMatrix(), viewMatrix, projectionMatrix, eyePos, initialSteps, refinementSteps, depthfactor, light);
+	UINT offset = 0, stride = sizeof(CompactVertex);
 
 	//Set Shaders
-	geometryVS->Set(deviceContext);
-	triplanarDisplacementPS->Set(deviceContext);
+	if (m_clipmap)
+	{
+		m_cache->GetClipmapVS()->Set(deviceContext);
+	}
+	else
+	{
+		m_cache->GetGeometryVS()->Set(deviceContext);
+	}
+	m_cache->GetTriplanarDisplacementPS()->Set(deviceContext);
 
 	if(useTessellation)
 	{
-		hullShader->Set(deviceContext);
-		domainShader->Set(deviceContext);
+		m_cache->GetHullShader()->Set(deviceContext);
+		m_cache->GetDomainShader()->Set(deviceContext);
 		deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
 	} else
 	{
 		deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	}
 
-	deviceContext->IASetVertexBuffers(0, 1, &marchingCubeGSO->outputBuffer, &stride, &offset);
+	if (m_clipmap)
+	{
+		stride = sizeof(XMFLOAT3);
+		deviceContext->IASetVertexBuffers(0, 1, &m_clipmapVertexBuffer, &stride, &offset);
+		deviceContext->IASetIndexBuffer(m_clipmapIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+		deviceContext->VSSetShaderResources(0, 1, &m_clipmapSamples);
+		deviceContext->VSSetConstantBuffers(2, 1, &m_clipmapLevelBuffer);
+	}
+	else
+	{
+		deviceContext->IASetVertexBuffers(0, 1, &m_compactVertexBuffer, &stride, &offset);
+		deviceContext->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	}
 
-	deviceContext->PSSetShaderResources(0, 2, m_colorTextures[0]->GetTextureViewArray());
-	deviceContext->PSSetShaderResources(2, 2, m_colorTextures[1]->GetTextureViewArray());
-	deviceContext->PSSetShaderResources(4, 2, m_colorTextures[2]->GetTextureViewArray());
+	deviceContext->PSSetShaderResources(0, 2, m_cache->GetColorTexture(0)->GetTextureViewArray());
+	deviceContext->PSSetShaderResources(2, 2, m_cache->GetColorTexture(1)->GetTextureViewArray());
+	deviceContext->PSSetShaderResources(4, 2, m_cache->GetColorTexture(2)->GetTextureViewArray());
 	deviceContext->PSSetShaderResources(6, 1, &shadowMap);
 
-
-	deviceContext->PSSetSamplers(0, 1, &m_wrapSampler);
-	deviceContext->PSSetSamplers(1, 1, &m_clampSampler);
+	ID3D11SamplerState* samplers[2] = { m_cache->GetWrapSampler(), m_cache->GetClampSampler() };
+	deviceContext->PSSetSamplers(0, 2, samplers);
 
 	//Set constant buffer
 	deviceContext->VSSetConstantBuffers(0, 1, &matrixBuffer);
@@ -1169,10 +2017,18 @@ void GeometryData::Render(ID3D11DeviceContext* deviceContext, XMMATRIX viewMatri
 
 	//DrawAuto no longer needed as we know the number of vertices generated.
 	//deviceContext->DrawAuto();
-	deviceContext->Draw(static_cast<UINT>(generatedVertexCount), 0);
+	if (m_clipmap)
+	{
+		DrawClipmap(deviceContext);
+	}
+	else
+	{
+		deviceContext->DrawIndexed(m_indexCount, 0, 0);
+	}
 
 	ID3D11ShaderResourceView* pSRV = { nullptr };
 	deviceContext->PSSetShaderResources(6, 1, &pSRV);
+	deviceContext->VSSetShaderResources(0, 1, &pSRV);
 	deviceContext->HSSetShader(nullptr, nullptr, 0);
 	deviceContext->DSSetShader(nullptr, nullptr, 0);
 }
@@ -1181,3 +2037,44 @@ unsigned GeometryData::GetVertexCount()
 {
 	return m_vertexCount;
 }
+
+unsigned int GeometryData::GetIndexCount() const
+{
+	return m_indexCount;
+}
+
+size_t GeometryData::GetDensityBytes() const
+{
+	if (m_volume)
+	{
+		return m_volume->GetMemoryUsage();
+	}
+
+	return m_heightfield ? m_heightfield->GetMemoryUsage() : 0u;
+}
+
+size_t GeometryData::GetMeshBytes() const
+{
+	return m_meshBytes;
+}
+
+bool GeometryData::Raycast(const Ray& ray, float maxRange, float& distance) const
+{
+	if (!m_heightfield)
+	{
+		return false;
+	}
+
+	//Affine transforms keep the ray parameter, so distances stay in multiples of the world direction
+	Matrix inverseWorld = Matrix(worldMatrix).Invert();
+	Vector3 origin = Vector3::Transform(ray.position, inverseWorld);
+	Vector3 direction = Vector3::TransformNormal(ray.direction, inverseWorld);
+
+	return m_heightfield->Raycast(origin, direction, maxRange, distance);
+}
+
+XMMATRIX GeometryData::GetQuantizedWorldMatrix() const
+{
+	//Compact vertices are stored in [0,1], scale them back into mesh space first
+	return m_vertexEncoder.GetDequantizeMatrix() * worldMatrix;
+}
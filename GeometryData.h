@@ -15,36 +15,82 @@ using namespace DirectX;
 #include "Light.h"	
 #include "HullShader.h"
 #include "DomainShader.h"
+#include "CompactVertex.h"
+#include "SparseVolume.h"
+#include "DensityGraph.h"
+#include "TerrainPresets.h"
+#include "Heightfield.h"
+#include "Clipmap.h"
+#include "MarchingCubes.h"
+#include "MeshOptimizer.h"
+#include "GeometryCache.h"
+#include "VolumeFile.h"
+#include <memory>
 
 class GeometryData
 {
 public:
 
-	struct TerrainType
+	typedef TerrainPresets::Type TerrainType;
+
+	struct BrushMode
 	{
 		enum Enum
 		{
-			CUBE,
-			NOISE,
-			SPHERE,
-			BUMPY_SPHERE,
-			HEIGHT_MAP,
-			HELIX,
-			PILLAR
+			ADD,
+			SUBTRACT,
+			SMOOTH
 		};
 	};
 
-	GeometryData(unsigned int width, unsigned int height, unsigned int depth, TerrainType::Enum type, ID3D11Device* device, ID3D11DeviceContext* deviceContext, KdTree* treeToUse, float noiseScale);
+	// Only records the inputs, the terrain is built by calling Generate until it returns true
+	GeometryData(unsigned int width, unsigned int height, unsigned int depth, TerrainType::Enum type, GeometryCache* cache, KdTree* treeToUse, float noiseScale, bool useGPUMarchingCubes);
 	~GeometryData();
 
+	// Runs the next slice of generation and returns true once the terrain can be drawn.
+	// The volume is filled a few bricks per call, heightfields a band of rows and then a share of their quadtree per call,
+	// and the mesh and its KdTree patches are built a few chunks per call, so a FrameScheduler can spread them over
+	// frames. GPU resources take one call.
+	bool Generate(ID3D11Device* device, ID3D11DeviceContext* deviceContext);
+	// Hands the triangles and patches of the finished mesh to the KdTree, once the terrain replaces the one drawn before it
+	void AttachToTree();
+
 	void DebugPrint();
 	void Render(ID3D11DeviceContext* deviceContext, XMMATRIX viewMatrix, XMMATRIX projectionMatrix, XMFLOAT3 eyePos, int initialSteps, int refinementSteps, float depthfactor, Light& light, ID3D11ShaderResourceView* shadowMap);
 	unsigned int GetVertexCount();
+	// Indices the mesh is drawn with, the degenerate triangles that pad the chunk ranges included
+	unsigned int GetIndexCount() const;
+	unsigned int GetTriangleCount() const { return m_triangleCount; }
+	// Memory of the density volume or heightfield on the CPU
+	size_t GetDensityBytes() const;
+	// Size of the vertex and index buffers the mesh is drawn from
+	size_t GetMeshBytes() const;
 	void MarchingCubeRenderpass(ID3D11DeviceContext* deviceContext, XMMATRIX viewMatrix, XMMATRIX projectionMatrix);
-	void CountGeneratedTriangles(ID3D11DeviceContext* context);
+	// False while the statistics of the marching cube pass are not available yet, never waits for the GPU
+	bool CountGeneratedTriangles(ID3D11DeviceContext* context);
 	ID3D11Buffer* GetGeometryVertexBuffer();
 	void SetVertexBuffer(ID3D11DeviceContext* context);
 	UINT GetGeometryVertexBufferStride();
+	XMMATRIX GetQuantizedWorldMatrix() const;
+	// Heightfields too large for one mesh are drawn as a clipmap, which has no index buffer GetIndexCount could count
+	bool HasClipmap() const { return m_clipmap != nullptr; }
+	// Follows the camera and draws every clipmap level with the shaders already set, such as those of ShadowMap::PrepareClipmap
+	void RenderClipmapDepth(ID3D11DeviceContext* context, XMFLOAT3 eyePos);
+	// Rays against heightfield terrain in world space, volume terrain goes through the KdTree instead
+	bool Raycast(const Ray& ray, float maxRange, float& distance) const;
+	// Edits the density volume inside a world space sphere, then remeshes and patches only the chunks it touched.
+	// Strength is the share of a smoothing step applied at the centre, it does not affect ADD and SUBTRACT.
+	// Only meshes generated on the CPU can be edited.
+	bool ApplyBrush(ID3D11DeviceContext* context, BrushMode::Enum mode, const Vector3& center, float radius, float strength);
+	// Writes the density volume to a chunked VolumeFile
+	bool SaveVolume(const std::wstring& path) const;
+	// Replaces the density volume with one saved at the same resolution and remeshes it. CPU meshes only, like brushes.
+	bool LoadVolume(ID3D11DeviceContext* context, const std::wstring& path);
+	// Set once a brush changed or a file replaced the volume, the terrain no longer matches the inputs it was generated from
+	bool IsEdited() const { return m_edited; }
+	// Times density generation, meshing, KdTree building and batch ray queries on 1 to all cores of the JobSystem
+	// and prints one CSV line per stage and thread count, so the scaling of each stage can be plotted
+	void ReportScaling();
 
 	XMMATRIX worldMatrix;
 
@@ -97,65 +143,152 @@ private:
 		XMFLOAT4 color;
 	};
 
+	struct ClipmapLevelBufferType
+	{
+		XMFLOAT2 origin;
+		XMFLOAT2 spacing;
+		int slotX, slotZ;
+		int level;
+		int sampleCount;
+		float blendScale;
+		XMFLOAT3 padding;
+	};
+
 	struct DecalDescription
 	{
 		XMFLOAT4 decal[8];
 		XMFLOAT4 dataStep;
 	};
 
-	void GenerateCubeData();
-	float getDistance(const float& p1x, const float& p1y, const float& p1z, const float& p2x, const float& p2y, const float& p2z);
-	float getDistance2D(const float& p1x, const float& p1y, const float& p2x, const float& p2y);
-	void GenerateSphereData();
-	void GeneratePillarData();
-	void GenerateNoiseData();
-	void GenerateBumpySphere();
-	void GenerateHelixStructure();
-	void GenerateHeightMapData();
+	// Where the vertices and indices of a CPU chunk sit in the mesh buffers. Ranges leave room for the chunk to grow,
+	// so brushes rewrite the chunks they remesh in place. Indices past the chunk's own are degenerate triangles.
+	struct ChunkRange
+	{
+		UINT firstVertex, vertexCapacity;
+		UINT firstIndex, indexCapacity;
+	};
+
+	struct GenerationStage
+	{
+		enum Enum
+		{
+			VOLUME,
+			FILL,
+			HEIGHTFIELD,
+			RESOURCES,
+			MESH,
+			UPLOAD,
+			TREE,
+			DONE
+		};
+	};
+
+	// Takes the volume from one of the caches or prepares the density graph, false if it still has to be filled
+	bool BeginVolume();
+	// Fills the next VolumeConfig::BRICKS_PER_STEP bricks, true once the volume is complete
+	bool FillVolumeSlice();
+	void FinishVolume();
+	void InitializeResources(ID3D11Device* device, ID3D11DeviceContext* deviceContext);
+	// Meshes the next MeshConfig::CHUNKS_PER_STEP chunks along with their KdTree triangles, true once all are done
+	bool MeshSlice();
+	void FinishMesh();
+	// Builds a KdTree patch over the triangles of the next MeshConfig::CHUNKS_PER_STEP chunks, true once all are covered
+	bool TreeSlice();
+	void BeginHeightfield();
+	// Fills the next HeightfieldGenerationConfig::ROWS_PER_STEP rows, then rebuilds the quadtree a share at a time,
+	// true once it is complete
+	bool FillHeightfieldSlice();
+	// Sets up a clipmap for heightfields too large to draw as one mesh
+	void FinishHeightfield();
 
 	bool SetBufferData(ID3D11DeviceContext* context, XMMATRIX worldMatrix, XMMATRIX viewMatrix, XMMATRIX projectionMatrix, XMFLOAT3 eyePos, int initialSteps, int refinementSteps, float depthfactor, Light& light);
 	int GetVertices(MarchingCubeVertexInputType** outVertices);
 	bool InitializeBuffers(ID3D11Device* device);
 	bool InitializeShaders(ID3D11Device* device);
 	D3D11_TEXTURE3D_DESC CreateTextureDesc() const;
-	D3D11_SUBRESOURCE_DATA CreateSubresourceData() const;
-	ID3D11Texture3D* CreateTexture(ID3D11Device* device, D3D11_TEXTURE3D_DESC texDesc, D3D11_SUBRESOURCE_DATA subData) const;
+	ID3D11Texture3D* CreateTexture(ID3D11Device* device, D3D11_TEXTURE3D_DESC texDesc) const;
+	void UploadDensityTexture(ID3D11DeviceContext* deviceContext) const;
 	ID3D11ShaderResourceView* CreateDensityShaderResource(ID3D11Device* device, ID3D11Texture3D* texture3D) const;
-	ID3D11ShaderResourceView* CreateTriangleLUTShaderResource(ID3D11Device* device) const;
-	ID3D11SamplerState* CreateDensitySamplerState(ID3D11Device* device) const;
-	void CreatePSSamplerStates(ID3D11Device* device, ID3D11SamplerState* wrapSampler, ID3D11SamplerState* clampSampler);
 	void GenerateDecalDescriptionBuffer(ID3D11Device* device, ID3D11DeviceContext* deviceContext);
 	DecalDescription GetDecals() const;
-	void LoadTextures(ID3D11Device* device);
 	void ReadFromGSBuffer(ID3D11DeviceContext* context);
+	void MeshHeightfield(ID3D11DeviceContext* context);
+	void ReportQuantizationError(const SparseVolume& reference) const;
+	std::vector<KdTree::Triangle*> CreateTreeTriangles(const MeshChunk& mesh) const;
+	// Encodes a whole mesh relative to its bounds into immutable buffers
+	bool CreateMeshBuffers(ID3D11DeviceContext* context, const MeshChunk& mesh);
+	// Replaces the mesh buffers, DEFAULT usage keeps them writable for UpdateChunks
+	bool CreateBuffers(ID3D11DeviceContext* context, const std::vector<CompactVertex>& vertices, const std::vector<uint32_t>& indices, D3D11_USAGE usage);
+	// Lays out all chunks in new buffers, each with room to grow
+	bool UploadChunks(ID3D11DeviceContext* context);
+	// Rewrites the ranges of the given chunks, or lays out all of them again once one outgrew its range
+	bool UpdateChunks(ID3D11DeviceContext* context, const std::vector<size_t>& chunks);
+	// Compact vertices of the chunk and its indices moved to its range, padded to the capacity of the range
+	void EncodeChunk(const MeshChunk& chunk, const ChunkRange& range, CompactVertex* vertices, uint32_t* indices) const;
+	bool InitializeClipmap(ID3D11Device* device);
+	void UpdateClipmap(ID3D11DeviceContext* context, XMFLOAT3 eyePos);
+	void DrawClipmap(ID3D11DeviceContext* context);
 
 	D3D11_TEXTURE3D_DESC m_texDesc;
-	D3D11_SUBRESOURCE_DATA m_subData;
-	ID3D11Texture3D* m_texture3D;
-	ID3D11ShaderResourceView* m_densityMap;
-	ID3D11ShaderResourceView* m_triangleLUT;
-	ID3D11SamplerState *m_densitySampler, *m_wrapSampler, *m_clampSampler;
+	ID3D11Texture3D* m_texture3D = nullptr;
+	ID3D11ShaderResourceView* m_densityMap = nullptr;
 	ID3D11Buffer *m_vertexBuffer = nullptr;
+	ID3D11Buffer *m_compactVertexBuffer = nullptr;
+	ID3D11Buffer *m_indexBuffer = nullptr;
 	ID3D11Buffer* m_decalDescriptionBuffer = nullptr;
 	ID3D11Buffer* matrixBuffer, *lightBuffer, *factorBuffer, *lightMatrixBuffer;
 	ID3D11Query* statsQuery;
 
-	VertexShader* marchingCubeVS, *geometryVS;
-	PixelShader* triplanarDisplacementPS;
-	GeometryOutputShader* marchingCubeGSO;
-	HullShader* hullShader;
-	DomainShader* domainShader;
-
-	//Textures
-	TextureClass* m_colorTextures[3] = {nullptr};
+	// Shaders, textures and samplers shared by all terrains, owned by the Game
+	GeometryCache* m_cache;
+	GeometryOutputShader* marchingCubeGSO = nullptr;
 
-	float* m_data;
+	// Shared with the cache until a brush edits it
+	std::shared_ptr<SparseVolume> m_volume;
+	bool m_edited = false;
+	// Hash of the generator inputs, names the volume and mesh files in the disk cache
+	uint64_t m_contentKey = 0;
+	// Progress of Generate, the graph and statistics only live while the volume is being filled
+	TerrainType::Enum m_type;
+	GenerationStage::Enum m_stage = GenerationStage::VOLUME;
+	GeometryCache::VolumeKey m_volumeKey;
+	std::unique_ptr<DensityGraph> m_graph;
+	DensityGraph::Statistics m_graphStatistics;
+	MeshOptimizer::Statistics m_meshStatistics;
+	size_t m_filledBricks = 0, m_meshedChunks = 0, m_patchedChunks = 0;
+	unsigned int m_filledRows = 0;
+	double m_stageTime = 0.0;
+	// Profiler::Now of the first Generate call
+	uint64_t m_generationStart = 0;
+	bool m_meshFromDisk = false;
+	bool m_marchingCubePassIssued = false;
+	// Patches over the triangles of consecutive chunks, owned by the KdTree once attached
+	std::vector<KdTree::KdNode*> m_treePatches;
+	bool m_attachedToTree = false;
+	// Meshes of the CPU path stay around per chunk, so brushes only remesh the chunks they touch
+	std::vector<MeshChunk> m_chunks;
+	std::vector<std::vector<KdTree::Triangle*>> m_chunkTriangles;
+	std::vector<ChunkRange> m_chunkRanges;
+	// Only set for HEIGHT_MAP terrain, which has no volume
+	Heightfield* m_heightfield = nullptr;
+	// Heightfields larger than one clipmap level are drawn as a clipmap instead of a single mesh
+	Clipmap* m_clipmap = nullptr;
+	std::vector<Clipmap::Region> m_clipmapRegions;
+	ID3D11Texture2D* m_clipmapTexture = nullptr;
+	ID3D11ShaderResourceView* m_clipmapSamples = nullptr;
+	ID3D11Buffer* m_clipmapVertexBuffer = nullptr;
+	ID3D11Buffer* m_clipmapIndexBuffer = nullptr;
+	ID3D11Buffer* m_clipmapLevelBuffer = nullptr;
 	unsigned int m_width, m_height, m_depth;
+	bool m_useGPUMarchingCubes;
 	unsigned int m_vertexCount;
 	XMFLOAT3 m_cubeSize;
 	XMFLOAT3 m_cubeStep;
-	Noise noise;
-	double m_noiseOffset;
-	UINT64 generatedVertexCount = 0;
+	// Triangles the marching cube pass wrote to stream output, unconnected with three vertices each
+	UINT64 generatedTriangleCount = 0;
+	UINT m_indexCount = 0;
+	UINT m_triangleCount = 0;
+	size_t m_meshBytes = 0;
+	CompactVertexEncoder m_vertexEncoder;
 	KdTree* tree;
 };
@@ -35,11 +35,7 @@ bool GeometryOutputShader::Initialize(ID3D11Device* device, WCHAR* filename, D3D
 	ID3DBlob* errorMessage;
 	ID3DBlob* geometryShaderBuffer;
 
-	DWORD shaderflags =
-		D3DCOMPILE_ENABLE_STRICTNESS
-	|	D3DCOMPILE_DEBUG
-	|	D3DCOMPILE_SKIP_OPTIMIZATION
-	;
+	DWORD shaderflags = ShaderUtility::COMPILE_FLAGS;
 
 	errorMessage = nullptr;
 	geometryShaderBuffer = nullptr;
@@ -114,3 +110,17 @@ ID3D11Buffer* GeometryOutputShader::GetReadBuffer(ID3D11DeviceContext* context)
 	context->CopyResource(readBuffer, outputBuffer);
 	return readBuffer;
 }
+
+void GeometryOutputShader::ReleaseBuffers()
+{
+	if (outputBuffer)
+	{
+		outputBuffer->Release();
+		outputBuffer = nullptr;
+	}
+	if (readBuffer)
+	{
+		readBuffer->Release();
+		readBuffer = nullptr;
+	}
+}
@@ -12,6 +12,8 @@ public:
 	bool Initialize(ID3D11Device* device, WCHAR* filename, D3D11_BUFFER_DESC bufferDesc, D3D11_SO_DECLARATION_ENTRY* declarationEntry, UINT declarationEntryCount);
 	void Set(ID3D11DeviceContext* context);
 	ID3D11Buffer* GetReadBuffer(ID3D11DeviceContext* context);
+	// Frees the stream output and staging buffers once their content has been read back
+	void ReleaseBuffers();
 
 	ID3D11GeometryShader* geometryShader;
 	ID3D11Buffer *outputBuffer;
@@ -1,9 +1,9 @@
+// Matches CompactVertex, positions are unorm relative to the mesh bounds
+// and the normal is octahedral encoded
 struct VertexInput
 {
     float4 position : SV_POSITION;
-    float4 worldPos : POSITION;
-    float4 color : COLOR;
-    float4 normal : NORMAL;
+    float2 normal : NORMAL;
 };
 
 struct PixelInput
@@ -29,20 +29,29 @@ cbuffer LightMatrixBuffer : register(b1)
     matrix lightProjectionMatrix;
 };
 
+float3 OctDecode(float2 encoded)
+{
+    float3 normal = float3(encoded.x, encoded.y, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float t = saturate(-normal.z);
+    normal.xy += normal.xy >= 0.0f ? -t : t;
+    return normalize(normal);
+}
+
 PixelInput main(VertexInput input)
 {
     bool useTessellation = true;
 
     PixelInput output;
 
-    output.position = mul(input.position, worldMatrix);
+    //w holds the material byte, the dequantize scale lives in worldMatrix
+    output.position = mul(float4(input.position.xyz, 1.0f), worldMatrix);
     output.worldPos = output.position;
 
     output.position = mul(output.position, viewMatrix);
 
-    output.color = input.color;
+    output.color = float4(1.0f, 1.0f, 1.0f, 1.0f);
 
-    output.normal = input.normal;
+    output.normal = float4(OctDecode(input.normal), 0.0f);
 
     output.lightViewPosVSM = mul(output.worldPos, lightViewMatrix);
     output.lightViewPos = output.lightViewPosVSM;
@@ -0,0 +1,358 @@
+#include "pch.h"
+#include "Heightfield.h"
+#include "Profiler.h"
+#include <cmath>
+#include <cstdint>
+
+namespace HeightfieldConfig
+{
+	//Cells per index band, 7 vertices of the previous row and 7 of the current one fit the 16 entry FIFO MeshOptimizer targets.
+	//A band of 7 fills it exactly and the rows start evicting each other.
+	const unsigned int INDEX_BAND_WIDTH = 6;
+
+	//Slack on node bounds so rays through a shared edge are not clipped by both neighbours
+	const float BOUNDS_EPSILON = 1e-5f;
+}
+
+namespace
+{
+	//Narrows [t0, t1] to the part of the ray between min and max on one axis
+	bool ClipSlab(float origin, float direction, float min, float max, float& t0, float& t1)
+	{
+		if (direction == 0.0f)
+		{
+			return origin >= min && origin <= max;
+		}
+
+		float inverse = 1.0f / direction;
+		float a = (min - origin) * inverse;
+		float b = (max - origin) * inverse;
+		if (a > b)
+		{
+			std::swap(a, b);
+		}
+
+		t0 = std::max(t0, a);
+		t1 = std::min(t1, b);
+		return t0 <= t1;
+	}
+
+	XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	//Two sided ray triangle test (Moller and Trumbore 1997)
+	bool IntersectTriangle(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, float& distance)
+	{
+		XMFLOAT3 edge1 = Subtract(b, a), edge2 = Subtract(c, a);
+		XMFLOAT3 p = Cross(direction, edge2);
+		float determinant = Dot(edge1, p);
+
+		if (determinant == 0.0f)
+		{
+			return false;
+		}
+
+		float inverse = 1.0f / determinant;
+		XMFLOAT3 s = Subtract(origin, a);
+		float u = Dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+		{
+			return false;
+		}
+
+		XMFLOAT3 q = Cross(s, edge1);
+		float v = Dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+		{
+			return false;
+		}
+
+		distance = Dot(edge2, q) * inverse;
+		return true;
+	}
+}
+
+Heightfield::Heightfield(unsigned int width, unsigned int depth)
+	: m_width(std::max(width, 2u)), m_depth(std::max(depth, 2u))
+{
+	m_spacing = XMFLOAT2(2.0f / (m_width - 1), 2.0f / (m_depth - 1));
+	m_heights.resize(static_cast<size_t>(m_width) * m_depth, 0.0f);
+
+	//Level 0 has a node per cell, every level above merges 2x2 nodes until one is left.
+	//Levels are only reserved, they are filled a band at a time as the quadtree is built.
+	unsigned int levelWidth = m_width - 1, levelDepth = m_depth - 1;
+	while (true)
+	{
+		m_levels.emplace_back();
+		m_levels.back().reserve(static_cast<size_t>(levelWidth) * levelDepth);
+		m_levelWidths.push_back(levelWidth);
+		m_levelDepths.push_back(levelDepth);
+		if (levelWidth == 1 && levelDepth == 1)
+		{
+			break;
+		}
+
+		levelWidth = (levelWidth + 1) / 2;
+		levelDepth = (levelDepth + 1) / 2;
+	}
+}
+
+void Heightfield::BuildQuadtree()
+{
+	m_buildLevel = 0;
+	m_buildRow = 0;
+	while (!BuildQuadtreeSlice(SIZE_MAX))
+	{
+	}
+}
+
+bool Heightfield::BuildQuadtreeSlice(size_t nodeBudget)
+{
+	//Rays miss until the new quadtree is complete
+	if (m_buildLevel == 0u && m_buildRow == 0u)
+	{
+		for (std::vector<Range>& level : m_levels)
+		{
+			level.clear();
+		}
+	}
+
+	//Every level only reads the one below it, so a level is done row by row before the next one starts
+	size_t nodes = 0;
+	while (m_buildLevel < m_levels.size() && nodes < nodeBudget)
+	{
+		unsigned int width = m_levelWidths[m_buildLevel], depth = m_levelDepths[m_buildLevel];
+		size_t rows = std::max<size_t>(1u, (nodeBudget - nodes) / width);
+		unsigned int rowCount = static_cast<unsigned int>(std::min<size_t>(rows, depth - m_buildRow));
+
+		BuildQuadtreeRows(m_buildLevel, m_buildRow, rowCount);
+		nodes += static_cast<size_t>(rowCount) * width;
+		m_buildRow += rowCount;
+
+		if (m_buildRow == depth)
+		{
+			m_buildLevel++;
+			m_buildRow = 0;
+		}
+	}
+
+	if (m_buildLevel < m_levels.size())
+	{
+		return false;
+	}
+
+	m_buildLevel = 0;
+	return true;
+}
+
+void Heightfield::BuildQuadtreeRows(size_t level, unsigned int firstRow, unsigned int rowCount)
+{
+	unsigned int width = m_levelWidths[level];
+	m_levels[level].resize(static_cast<size_t>(firstRow + rowCount) * width);
+
+	if (level == 0u)
+	{
+		ParallelFor(rowCount, [&](size_t i)
+		{
+			size_t z = firstRow + i;
+			Range* row = &m_levels[0][z * width];
+			const float* heights = &m_heights[z * m_width];
+			const float* nextHeights = heights + m_width;
+
+			for (unsigned int x = 0u; x < width; ++x)
+			{
+				row[x].min = std::min(std::min(heights[x], heights[x + 1]), std::min(nextHeights[x], nextHeights[x + 1]));
+				row[x].max = std::max(std::max(heights[x], heights[x + 1]), std::max(nextHeights[x], nextHeights[x + 1]));
+			}
+		});
+		return;
+	}
+
+	const std::vector<Range>& children = m_levels[level - 1];
+	unsigned int childWidth = m_levelWidths[level - 1], childDepth = m_levelDepths[level - 1];
+	std::vector<Range>& parents = m_levels[level];
+
+	ParallelFor(rowCount, [&](size_t i)
+	{
+		unsigned int z = firstRow + static_cast<unsigned int>(i);
+		for (unsigned int x = 0u; x < width; ++x)
+		{
+			Range range = children[static_cast<size_t>(z * 2) * childWidth + x * 2];
+			for (unsigned int child = 1u; child < 4u; ++child)
+			{
+				unsigned int childX = x * 2 + (child & 1u), childZ = z * 2 + (child >> 1);
+				if (childX < childWidth && childZ < childDepth)
+				{
+					const Range& other = children[static_cast<size_t>(childZ) * childWidth + childX];
+					range.min = std::min(range.min, other.min);
+					range.max = std::max(range.max, other.max);
+				}
+			}
+			parents[static_cast<size_t>(z) * width + x] = range;
+		}
+	});
+}
+
+bool Heightfield::Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, float& distance) const
+{
+	if (m_levels.back().empty())
+	{
+		return false;
+	}
+
+	RayData ray = { origin, direction, maxDistance };
+	return RaycastNode(m_levels.size() - 1, 0u, 0u, ray, distance);
+}
+
+bool Heightfield::RaycastNode(size_t level, unsigned int x, unsigned int z, const RayData& ray, float& distance) const
+{
+	const float epsilon = HeightfieldConfig::BOUNDS_EPSILON;
+	const Range& range = m_levels[level][static_cast<size_t>(z) * m_levelWidths[level] + x];
+
+	//Cells covered by the node, nodes on the far border of a level can cover fewer
+	unsigned int cellX0 = x << level, cellX1 = std::min((x + 1) << level, m_width - 1);
+	unsigned int cellZ0 = z << level, cellZ1 = std::min((z + 1) << level, m_depth - 1);
+
+	float t0 = 0.0f, t1 = ray.maxDistance;
+	if (!ClipSlab(ray.origin.x, ray.direction.x, -1.0f + cellX0 * m_spacing.x - epsilon, -1.0f + cellX1 * m_spacing.x + epsilon, t0, t1) ||
+		!ClipSlab(ray.origin.z, ray.direction.z, -1.0f + cellZ0 * m_spacing.y - epsilon, -1.0f + cellZ1 * m_spacing.y + epsilon, t0, t1))
+	{
+		return false;
+	}
+
+	//The ray has to pass through the height range of the node while it is over it
+	float y0 = ray.origin.y + ray.direction.y * t0;
+	float y1 = ray.origin.y + ray.direction.y * t1;
+	if (std::max(y0, y1) < range.min - epsilon || std::min(y0, y1) > range.max + epsilon)
+	{
+		return false;
+	}
+
+	if (level == 0)
+	{
+		return RaycastCell(x, z, ray, distance);
+	}
+
+	//Children in the order the ray enters them, a straight ray never crosses both of the side children
+	unsigned int nearX = ray.direction.x < 0.0f ? 1u : 0u;
+	unsigned int nearZ = ray.direction.z < 0.0f ? 1u : 0u;
+	const unsigned int order[4][2] = { { nearX, nearZ }, { 1u - nearX, nearZ }, { nearX, 1u - nearZ }, { 1u - nearX, 1u - nearZ } };
+
+	for (int child = 0; child < 4; ++child)
+	{
+		unsigned int childX = x * 2 + order[child][0], childZ = z * 2 + order[child][1];
+		if (childX < m_levelWidths[level - 1] && childZ < m_levelDepths[level - 1] && RaycastNode(level - 1, childX, childZ, ray, distance))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Heightfield::RaycastCell(unsigned int x, unsigned int z, const RayData& ray, float& distance) const
+{
+	float x0 = -1.0f + x * m_spacing.x, x1 = x0 + m_spacing.x;
+	float z0 = -1.0f + z * m_spacing.y, z1 = z0 + m_spacing.y;
+
+	XMFLOAT3 corner00(x0, GetSample(x, z), z0);
+	XMFLOAT3 corner10(x1, GetSample(x + 1, z), z0);
+	XMFLOAT3 corner01(x0, GetSample(x, z + 1), z1);
+	XMFLOAT3 corner11(x1, GetSample(x + 1, z + 1), z1);
+
+	//Same split as Mesh
+	float closest = ray.maxDistance, hit;
+	bool found = false;
+
+	if (IntersectTriangle(ray.origin, ray.direction, corner00, corner01, corner11, hit) && hit >= 0.0f && hit <= closest)
+	{
+		closest = hit;
+		found = true;
+	}
+
+	if (IntersectTriangle(ray.origin, ray.direction, corner00, corner11, corner10, hit) && hit >= 0.0f && hit <= closest)
+	{
+		closest = hit;
+		found = true;
+	}
+
+	if (found)
+	{
+		distance = closest;
+	}
+
+	return found;
+}
+
+void Heightfield::Mesh(MeshChunk& output) const
+{
+	Profiler::Zone zone("Heightfield::Mesh");
+
+	size_t vertexCount = static_cast<size_t>(m_width) * m_depth;
+	output.positions.resize(vertexCount);
+	output.normals.resize(vertexCount);
+
+	ParallelFor(m_depth, [&](size_t row)
+	{
+		unsigned int z = static_cast<unsigned int>(row);
+		unsigned int z0 = z > 0 ? z - 1 : z, z1 = z + 1 < m_depth ? z + 1 : z;
+
+		for (unsigned int x = 0u; x < m_width; ++x)
+		{
+			size_t index = row * m_width + x;
+			output.positions[index] = XMFLOAT3(-1.0f + x * m_spacing.x, GetSample(x, z), -1.0f + z * m_spacing.y);
+
+			//Central differences, one sided on the border of the grid
+			unsigned int x0 = x > 0 ? x - 1 : x, x1 = x + 1 < m_width ? x + 1 : x;
+			float slopeX = (GetSample(x1, z) - GetSample(x0, z)) / ((x1 - x0) * m_spacing.x);
+			float slopeZ = (GetSample(x, z1) - GetSample(x, z0)) / ((z1 - z0) * m_spacing.y);
+
+			float length = std::sqrt(slopeX * slopeX + 1.0f + slopeZ * slopeZ);
+			output.normals[index] = XMFLOAT3(-slopeX / length, 1.0f / length, -slopeZ / length);
+		}
+	});
+
+	output.indices.clear();
+	output.indices.reserve(static_cast<size_t>(m_width - 1) * (m_depth - 1) * 6);
+
+	for (unsigned int bandStart = 0u; bandStart < m_width - 1; bandStart += HeightfieldConfig::INDEX_BAND_WIDTH)
+	{
+		unsigned int bandEnd = std::min(bandStart + HeightfieldConfig::INDEX_BAND_WIDTH, m_width - 1);
+
+		for (unsigned int z = 0u; z < m_depth - 1; ++z)
+		{
+			for (unsigned int x = bandStart; x < bandEnd; ++x)
+			{
+				uint32_t index00 = z * m_width + x;
+				uint32_t index10 = index00 + 1;
+				uint32_t index01 = index00 + m_width;
+				uint32_t index11 = index01 + 1;
+
+				//Clockwise seen from above, like the marching cubes triangles seen from outside
+				output.indices.insert(output.indices.end(), { index00, index01, index11, index00, index11, index10 });
+			}
+		}
+	}
+}
+
+size_t Heightfield::GetMemoryUsage() const
+{
+	size_t size = m_heights.size() * sizeof(float);
+	for (const std::vector<Range>& level : m_levels)
+	{
+		size += level.size() * sizeof(Range);
+	}
+	return size;
+}
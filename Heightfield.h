@@ -0,0 +1,92 @@
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include "MarchingCubes.h"
+#include "ParallelFor.h"
+
+using namespace DirectX;
+
+// Terrain with a single surface height per column, stored as a 2D grid instead of a density volume.
+// The grid spans [-1,1] on x and z like the marching cubes meshes and heights are in the same space.
+// Every cell is split along the same diagonal for meshing and ray queries, so hits match what is drawn.
+// Rays walk a quadtree of min/max heights over the cells instead of a triangle KdTree.
+class Heightfield
+{
+public:
+	// All heights start at 0, rays miss until Fill, BuildQuadtree or BuildQuadtreeSlice built the quadtree
+	Heightfield(unsigned int width, unsigned int depth);
+
+	unsigned int GetWidth() const { return m_width; }
+	unsigned int GetDepth() const { return m_depth; }
+
+	// Evaluates height(x, z) for every sample, one row per task, then rebuilds the quadtree
+	template<typename Function>
+	void Fill(const Function& height)
+	{
+		FillRows(0u, m_depth, height);
+		BuildQuadtree();
+	}
+
+	// Evaluates height(x, z) for the rows [firstRow, firstRow + rowCount) only, so a large heightfield can be filled
+	// a band at a time. Rays need the quadtree rebuilt once all rows are in.
+	template<typename Function>
+	void FillRows(unsigned int firstRow, unsigned int rowCount, const Function& height)
+	{
+		ParallelFor(rowCount, [&](size_t i)
+		{
+			unsigned int z = firstRow + static_cast<unsigned int>(i);
+			float* row = &m_heights[static_cast<size_t>(z) * m_width];
+			for (unsigned int x = 0u; x < m_width; ++x)
+			{
+				row[x] = height(x, z);
+			}
+		});
+	}
+
+	// Rebuilds the quadtree over the current heights
+	void BuildQuadtree();
+	// Rebuilds the next rows of quadtree nodes, the cells first and then every coarser level, stopping once about
+	// nodeBudget nodes are done. True once the root is, the next call starts over.
+	bool BuildQuadtreeSlice(size_t nodeBudget);
+
+	inline float GetSample(unsigned int x, unsigned int z) const
+	{
+		return m_heights[static_cast<size_t>(z) * m_width + x];
+	}
+
+	// Finds the first hit at origin + direction * distance with distance in [0, maxDistance].
+	// Direction does not have to be normalized, so rays can be transformed into mesh space as they are.
+	bool Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, float& distance) const;
+
+	// One vertex per sample. Cells are indexed in bands so the previous row of a band is still in the post transform cache.
+	void Mesh(MeshChunk& output) const;
+
+	size_t GetMemoryUsage() const;
+
+private:
+	struct Range
+	{
+		float min, max;
+	};
+
+	struct RayData
+	{
+		XMFLOAT3 origin, direction;
+		float maxDistance;
+	};
+
+	// Builds the nodes of rows [firstRow, firstRow + rowCount) of the level from the heights or the level below
+	void BuildQuadtreeRows(size_t level, unsigned int firstRow, unsigned int rowCount);
+	bool RaycastNode(size_t level, unsigned int x, unsigned int z, const RayData& ray, float& distance) const;
+	bool RaycastCell(unsigned int x, unsigned int z, const RayData& ray, float& distance) const;
+
+	unsigned int m_width, m_depth;
+	XMFLOAT2 m_spacing;
+	std::vector<float> m_heights;
+	// Level 0 holds the height range of every cell, every level above merges 2x2 nodes until one is left
+	std::vector<std::vector<Range>> m_levels;
+	std::vector<unsigned int> m_levelWidths, m_levelDepths;
+	// Progress of BuildQuadtreeSlice
+	size_t m_buildLevel = 0;
+	unsigned int m_buildRow = 0;
+};
@@ -22,11 +22,7 @@ bool HullShader::Initialize(ID3D11Device* device, WCHAR* filename)
 	ID3DBlob* errorMessage;
 	ID3DBlob* hullShaderBuffer;
 
-	DWORD shaderflags =
-		D3DCOMPILE_ENABLE_STRICTNESS
-	|	D3DCOMPILE_DEBUG
-	|	D3DCOMPILE_SKIP_OPTIMIZATION
-	;
+	DWORD shaderflags = ShaderUtility::COMPILE_FLAGS;
 
 	errorMessage = nullptr;
 	hullShaderBuffer = nullptr;
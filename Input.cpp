@@ -73,6 +73,10 @@ void Input::Update()
 	if (kb.Space) m_GameInput.shoot = true;
 	else		m_GameInput.shoot = false;
 
+	//brush
+	if (kb.B) m_GameInput.brush = true;
+	else		m_GameInput.brush = false;
+
 	////random
 	//if (kb.LeftControl) m_GameInput.randomGenerate = true;
 	//else		m_GameInput.randomGenerate = false;
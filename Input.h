@@ -15,6 +15,7 @@ struct InputCommands
 	bool rotRight;
 	bool rotLeft;
 	bool shoot;
+	bool brush;
 	//bool randomGenerate;
 	//bool addRanGenerate;
 	//bool smoothen;
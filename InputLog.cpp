@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "InputLog.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	const char MAGIC[4] = { 'I', 'N', 'P', 'T' };
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t runCount;
+		uint32_t padding;
+		uint64_t stepCount;
+		InputLog::Settings settings;
+	};
+
+	//Bits in the order of the members of InputCommands
+	uint16_t Pack(const InputCommands& commands)
+	{
+		const bool keys[] = { commands.forward, commands.back, commands.right, commands.left, commands.rotUp, commands.rotDown,
+			commands.rotRight, commands.rotLeft, commands.shoot, commands.brush };
+
+		uint16_t bits = 0u;
+		for (size_t i = 0u; i < sizeof(keys) / sizeof(keys[0]); ++i)
+		{
+			bits |= keys[i] ? uint16_t(1u << i) : uint16_t(0u);
+		}
+		return bits;
+	}
+
+	InputCommands Unpack(uint16_t bits)
+	{
+		InputCommands commands;
+		bool* keys[] = { &commands.forward, &commands.back, &commands.right, &commands.left, &commands.rotUp, &commands.rotDown,
+			&commands.rotRight, &commands.rotLeft, &commands.shoot, &commands.brush };
+
+		for (size_t i = 0u; i < sizeof(keys) / sizeof(keys[0]); ++i)
+		{
+			*keys[i] = (bits & (1u << i)) != 0u;
+		}
+		return commands;
+	}
+}
+
+void InputLog::Begin(const Settings& settings)
+{
+	m_settings = settings;
+	m_runs.clear();
+	m_stepCount = 0;
+	Rewind();
+}
+
+void InputLog::Append(const InputCommands& commands)
+{
+	uint16_t bits = Pack(commands);
+	if (!m_runs.empty() && m_runs.back().commands == bits && m_runs.back().count < UINT16_MAX)
+	{
+		m_runs.back().count++;
+	}
+	else
+	{
+		Run run = { bits, 1u };
+		m_runs.push_back(run);
+	}
+	m_stepCount++;
+}
+
+void InputLog::Rewind()
+{
+	m_readRun = 0;
+	m_readInRun = 0;
+	m_readCount = 0;
+}
+
+bool InputLog::Next(InputCommands& commands)
+{
+	if (m_readRun == m_runs.size())
+	{
+		return false;
+	}
+
+	commands = Unpack(m_runs[m_readRun].commands);
+	if (++m_readInRun == m_runs[m_readRun].count)
+	{
+		m_readRun++;
+		m_readInRun = 0;
+	}
+	m_readCount++;
+	return true;
+}
+
+bool InputLog::Save(const std::wstring& path) const
+{
+	Header header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = FORMAT_VERSION;
+	header.runCount = static_cast<uint32_t>(m_runs.size());
+	header.stepCount = m_stepCount;
+	header.settings = m_settings;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_runs.data()), m_runs.size() * sizeof(Run));
+
+	if (!file)
+	{
+		printf("Writing input log %ls failed\n\r", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool InputLog::Load(const std::wstring& path)
+{
+	MappedFile file;
+	if (!file.Open(path) || file.GetSize() < sizeof(Header))
+	{
+		printf("Input log %ls could not be opened\n\r", path.c_str());
+		return false;
+	}
+
+	Header header;
+	std::memcpy(&header, file.GetData(), sizeof(Header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION || !(header.settings.stepMilliseconds > 0.0f))
+	{
+		printf("Input log %ls has an unknown format\n\r", path.c_str());
+		return false;
+	}
+
+	if ((file.GetSize() - sizeof(Header)) / sizeof(Run) < header.runCount)
+	{
+		printf("Input log %ls is cut short\n\r", path.c_str());
+		return false;
+	}
+
+	std::vector<Run> runs(header.runCount);
+	if (!runs.empty())
+	{
+		std::memcpy(runs.data(), file.GetData() + sizeof(Header), runs.size() * sizeof(Run));
+	}
+
+	//The step count is only a check, the runs are what gets replayed. Record never writes an empty run and Next
+	//would never leave one
+	uint64_t stepCount = 0u;
+	for (const Run& run : runs)
+	{
+		if (run.count == 0u)
+		{
+			printf("Input log %ls has an empty run\n\r", path.c_str());
+			return false;
+		}
+		stepCount += run.count;
+	}
+	if (stepCount != header.stepCount)
+	{
+		printf("Input log %ls has a broken header\n\r", path.c_str());
+		return false;
+	}
+
+	m_settings = header.settings;
+	m_runs.swap(runs);
+	m_stepCount = static_cast<size_t>(stepCount);
+	Rewind();
+	return true;
+}
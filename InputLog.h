@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Input.h"
+
+// Input commands of a flythrough, one per fixed step, with the terrain and camera it started from.
+// Replaying the steps on the same fixed timestep flies the same path through the same terrain, so the frame times
+// of a replay are a workload that can be compared between builds.
+// Commands are stored as bit masks, run length encoded: held keys repeat the same commands for many steps.
+class InputLog
+{
+public:
+	// Bumped whenever the layout of the file changes
+	static const uint32_t FORMAT_VERSION = 1;
+
+	// Everything a replay has to restore before the first step
+	struct Settings
+	{
+		float stepMilliseconds;
+		int32_t terrainType;
+		int32_t terrainCount[3];
+		float noiseScale;
+		uint32_t gpuMarchingCubes;
+		int32_t brushMode;
+		float brushRadius;
+		float brushStrength;
+		float cameraPosition[3];
+		float cameraRotation[3];
+	};
+
+	// Drops the steps of an earlier recording
+	void Begin(const Settings& settings);
+	void Append(const InputCommands& commands);
+
+	// Starts reading from the first step
+	void Rewind();
+	// False once every step has been read
+	bool Next(InputCommands& commands);
+
+	const Settings& GetSettings() const { return m_settings; }
+	size_t GetStepCount() const { return m_stepCount; }
+	// Steps read since Rewind
+	size_t GetReadCount() const { return m_readCount; }
+
+	bool Save(const std::wstring& path) const;
+	bool Load(const std::wstring& path);
+
+private:
+	struct Run
+	{
+		uint16_t commands;
+		uint16_t count;
+	};
+
+	Settings m_settings = {};
+	std::vector<Run> m_runs;
+	size_t m_stepCount = 0;
+	// Replay position
+	size_t m_readRun = 0, m_readInRun = 0, m_readCount = 0;
+};
@@ -0,0 +1,197 @@
+#include "pch.h"
+#include "JobSystem.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include <algorithm>
+
+namespace
+{
+	//Queue of the worker running on this thread, 0 on threads the job system did not start
+	thread_local size_t t_queueIndex = 0u;
+}
+
+JobSystem& JobSystem::Get()
+{
+	static JobSystem jobSystem(std::max(1u, std::thread::hardware_concurrency()) - 1u);
+	return jobSystem;
+}
+
+JobSystem::JobSystem(size_t workerCount)
+	: m_queuedJobs(0u), m_threadLimit(workerCount + 1u), m_running(true)
+{
+	//Workers record into the profiler and metrics until they are joined, created first they are destroyed after them
+	Profiler::Get();
+	Metrics::Get();
+
+	for (size_t i = 0u; i <= workerCount; ++i)
+	{
+		m_queues.emplace_back(new Queue());
+	}
+
+	for (size_t i = 1u; i <= workerCount; ++i)
+	{
+		m_workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_running = false;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void JobSystem::Run(const std::function<void()>& job, Counter* counter, Counter* dependency)
+{
+	if (counter)
+	{
+		counter->m_value++;
+	}
+
+	Job queued = { job, counter };
+
+	if (dependency)
+	{
+		//The counter only hands its continuations out once, after it reached zero under the lock
+		std::lock_guard<std::mutex> lock(dependency->m_mutex);
+		if (!dependency->IsDone())
+		{
+			dependency->m_continuations.push_back(std::move(queued));
+			return;
+		}
+	}
+
+	Push(std::move(queued));
+}
+
+void JobSystem::Wait(Counter& counter)
+{
+	size_t index = GetQueueIndex();
+
+	while (!counter.IsDone())
+	{
+		Job job;
+		if (Take(index, job))
+		{
+			Execute(job);
+		}
+		else
+		{
+			//The last jobs are running on other threads
+			std::this_thread::yield();
+		}
+	}
+
+	//The last job may still hold the lock it decremented the counter under, the counter must outlive it
+	std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+void JobSystem::SetThreadCount(size_t count)
+{
+	m_threadLimit = count == 0u ? GetMaxThreadCount() : std::min(count, GetMaxThreadCount());
+	m_wake.notify_all();
+}
+
+void JobSystem::WorkerLoop(size_t index)
+{
+	t_queueIndex = index;
+	Profiler::Get().SetThreadName("Worker " + std::to_string(index));
+
+	while (m_running)
+	{
+		Job job;
+		if (index < m_threadLimit && Take(index, job))
+		{
+			Execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wake.wait(lock, [&]() { return !m_running || (index < m_threadLimit && m_queuedJobs > 0u); });
+	}
+}
+
+void JobSystem::Push(Job job)
+{
+	Queue& queue = *m_queues[GetQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	m_queuedJobs++;
+
+	//Taking the lock orders the wake up after a worker that is about to sleep checked the count
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+	}
+	m_wake.notify_one();
+}
+
+bool JobSystem::Take(size_t index, Job& job)
+{
+	{
+		Queue& own = *m_queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty())
+		{
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			m_queuedJobs--;
+			return true;
+		}
+	}
+
+	//Start with the next queue, so thieves spread over the victims
+	for (size_t offset = 1u; offset < m_queues.size(); ++offset)
+	{
+		Queue& victim = *m_queues[(index + offset) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			m_queuedJobs--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void JobSystem::Execute(Job& job)
+{
+	job.function();
+
+	Counter* counter = job.counter;
+	if (!counter)
+	{
+		return;
+	}
+
+	std::vector<Job> continuations;
+	{
+		//Decremented under the lock, so Run either sees the counter done or queues behind it
+		std::lock_guard<std::mutex> lock(counter->m_mutex);
+		if (--counter->m_value == 0u)
+		{
+			continuations.swap(counter->m_continuations);
+		}
+	}
+
+	for (Job& continuation : continuations)
+	{
+		Push(std::move(continuation));
+	}
+}
+
+size_t JobSystem::GetQueueIndex() const
+{
+	return t_queueIndex;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job scheduler shared by everything that runs in parallel.
+// One worker per core but one runs jobs, every thread has its own deque: jobs started on a thread go to the back
+// of its deque and are taken from there again, idle threads steal the oldest job from the front of another one.
+// Nested jobs therefore stay on the thread that started them while there is nothing else to do,
+// and threads waiting on a counter run jobs until it reaches zero, so waiting never blocks a core.
+class JobSystem
+{
+public:
+	class Counter;
+
+private:
+	struct Job
+	{
+		std::function<void()> function;
+		Counter* counter;
+	};
+
+public:
+	// Counts the unfinished jobs started with it. Jobs can depend on a counter, they start once it reaches zero.
+	class Counter
+	{
+	public:
+		Counter() : m_value(0u) {}
+
+		bool IsDone() const { return m_value.load() == 0u; }
+
+	private:
+		friend class JobSystem;
+
+		std::atomic<size_t> m_value;
+		std::mutex m_mutex;
+		// Jobs that depend on the counter, queued once it reaches zero
+		std::vector<Job> m_continuations;
+	};
+
+	// Started on first use with a worker for every hardware thread but the calling one
+	static JobSystem& Get();
+
+	explicit JobSystem(size_t workerCount);
+	~JobSystem();
+
+	// Queues job on the calling thread. The counter, if any, is decremented once the job finished,
+	// with a dependency the job is only queued once that counter reached zero.
+	void Run(const std::function<void()>& job, Counter* counter = nullptr, Counter* dependency = nullptr);
+
+	// Runs queued jobs on the calling thread until the counter reaches zero
+	void Wait(Counter& counter);
+
+	// Threads taking jobs, the calling thread included
+	size_t GetThreadCount() const { return m_threadLimit.load(); }
+	size_t GetMaxThreadCount() const { return m_workers.size() + 1u; }
+	// Parks the workers past limit - 1, so stages can be measured on fewer cores. 0 enables all of them again.
+	void SetThreadCount(size_t count);
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void WorkerLoop(size_t index);
+	void Push(Job job);
+	// Newest job of the thread's own queue, otherwise the oldest job of another one
+	bool Take(size_t index, Job& job);
+	void Execute(Job& job);
+	size_t GetQueueIndex() const;
+
+	// Queue 0 belongs to the threads that are not workers, the main thread foremost
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_workers;
+	std::atomic<size_t> m_queuedJobs;
+	std::atomic<size_t> m_threadLimit;
+	std::atomic<bool> m_running;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+};
@@ -1,10 +1,32 @@
 #include "pch.h"
 #include "KdTree.h"
-#include <iostream>
+#include "Metrics.h"
+#include "ParallelFor.h"
+#include "Profiler.h"
 #include <algorithm>
 
-KdTree::Triangle::Triangle()
+namespace KdTreeConfig
 {
+	//Rebuild once the patches hold this share of all triangles, rays test every patch on top of the tree
+	const float PATCH_REBUILD_RATIO = 0.25f;
+
+	//Smaller subtrees are built on the thread that split them, a job costs more than sorting a few thousand triangles
+	const size_t PARALLEL_BUILD_SIZE = 4096;
+
+	//Nodes over fewer triangles are leaves
+	const size_t LEAF_TRIANGLES = 100;
+
+	//Surface area heuristic costs of stepping into a node and of testing a triangle
+	const double SAH_TRAVERSAL_COST = 1.0;
+	const double SAH_TRIANGLE_COST = 1.5;
+}
+
+namespace
+{
+	float SurfaceArea(const KdTree::MyBoundingBox& box)
+	{
+		return 8.0f * (box.Extents.x * box.Extents.y + box.Extents.y * box.Extents.z + box.Extents.z * box.Extents.x);
+	}
 }
 
 void KdTree::Triangle::CalculateSmallest()
@@ -24,13 +46,83 @@ void KdTree::Triangle::CalculateGreatest()
 void KdTree::AddTriangles(const std::vector<Triangle*> newTriangles)
 {
 	treeTriangles->insert(treeTriangles->end(), newTriangles.begin(), newTriangles.end());
-	std::cout << treeTriangles->size() << std::endl;
+	PublishMetrics();
 }
 
 void KdTree::AddTriangle(Triangle* tri)
 {
 	treeTriangles->push_back(tri);
 }
+
+void KdTree::ReplaceTriangles(const std::vector<Triangle*>& removed, const std::vector<Triangle*>& added)
+{
+	Profiler::Zone zone("KdTree::ReplaceTriangles");
+
+	for (Triangle* tri : removed)
+	{
+		tri->removed = true;
+	}
+
+	//Nodes still point at removed triangles, they are only freed with the next rebuild
+	removedTriangles.insert(removedTriangles.end(), removed.begin(), removed.end());
+	treeTriangles->erase(std::remove_if(treeTriangles->begin(), treeTriangles->end(), [](const Triangle* tri) { return tri->removed; }), treeTriangles->end());
+	treeTriangles->insert(treeTriangles->end(), added.begin(), added.end());
+
+	if (!added.empty())
+	{
+		patches.push_back(KdNode::build(new std::vector<Triangle*>(added), 0));
+		patchedTriangleCount += added.size();
+		KdNode::Count(patches.back(), 0, nodeCount, leafCount, depth);
+	}
+	PublishMetrics();
+
+	if (patchedTriangleCount > treeTriangles->size() * KdTreeConfig::PATCH_REBUILD_RATIO)
+	{
+		MarkKDTreeDirty();
+	}
+}
+
+void KdTree::AddPatches(const std::vector<Triangle*>& triangles, const std::vector<KdNode*>& newPatches)
+{
+	treeTriangles->insert(treeTriangles->end(), triangles.begin(), triangles.end());
+	patches.insert(patches.end(), newPatches.begin(), newPatches.end());
+	for (const KdNode* patch : newPatches)
+	{
+		KdNode::Count(patch, 0, nodeCount, leafCount, depth);
+	}
+	PublishMetrics();
+	Profiler::Get().Counter("KdTree patches", static_cast<double>(patches.size()));
+}
+
+void KdTree::HitBatch(const std::vector<Ray>& rays, float maxRange, std::vector<RayHitStruct>& hits)
+{
+	Profiler::Zone zone("KdTree::HitBatch");
+
+	hits.assign(rays.size(), RayHitStruct());
+
+	//Queries only read the tree, every ray keeps its own range and result
+	ParallelFor(rays.size(), [&](size_t i)
+	{
+		float t = 0.0f, tmin = maxRange;
+		if (!hitTreeAndPatches(&rays[i], t, tmin, hits[i]))
+		{
+			hits[i].hitTriangle = nullptr;
+		}
+	});
+
+	size_t nodesVisited = 0, trianglesTested = 0;
+	for (const RayHitStruct& rayhit : hits)
+	{
+		nodesVisited += rayhit.nodesVisited;
+		trianglesTested += rayhit.trianglesTested;
+	}
+
+	Metrics& metrics = Metrics::Get();
+	metrics.Add("KdTree ray queries", static_cast<int64_t>(rays.size()));
+	metrics.Add("KdTree nodes visited", static_cast<int64_t>(nodesVisited));
+	metrics.Add("KdTree triangles tested", static_cast<int64_t>(trianglesTested));
+}
+
 bool KdTree::hitCheckAll(const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit)
 {
 	if (tree)
@@ -43,12 +135,43 @@ bool KdTree::hitCheckAll(const Ray* ray, float& t, float& tmin, RayHitStruct& ra
 
 bool KdTree::hit(const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit)
 {
-	if (tree)
+	//The struct may carry the counts of an earlier query
+	size_t nodesVisited = rayhit.nodesVisited;
+	size_t trianglesTested = rayhit.trianglesTested;
+	bool hitSomething = hitTreeAndPatches(ray, t, tmin, rayhit);
+
+	//Every FindSlot hashes and compares the name, too much for each ray while nobody looks
+	Metrics& metrics = Metrics::Get();
+	if (metrics.IsEnabled())
 	{
-		return tree->hit(tree, ray, t, tmin, rayhit);
+		metrics.Add("KdTree ray queries");
+		metrics.Add("KdTree nodes visited", static_cast<int64_t>(rayhit.nodesVisited - nodesVisited));
+		metrics.Add("KdTree triangles tested", static_cast<int64_t>(rayhit.trianglesTested - trianglesTested));
 	}
 
-	return false;
+	return hitSomething;
+}
+
+bool KdTree::hitTreeAndPatches(const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit)
+{
+	Metrics::LatencyTimer timer("KdTree ray query");
+	bool hitSomething = false;
+
+	//A tree built from no triangles has no bounds, brushes can carve everything away
+	if (tree && tree->bbox)
+	{
+		hitSomething = tree->hit(tree, ray, t, tmin, rayhit);
+	}
+
+	for (KdNode* patch : patches)
+	{
+		if (KdNode::hit(patch, ray, t, tmin, rayhit))
+		{
+			hitSomething = true;
+		}
+	}
+
+	return hitSomething;
 }
 
 void KdTree::MarkKDTreeDirty()
@@ -58,11 +181,22 @@ void KdTree::MarkKDTreeDirty()
 
 void KdTree::UpdateKDTree()
 {
+	Profiler::Zone zone("KdTree::UpdateKDTree");
+
 	if (isDirty)
 	{
-		printf("Updating KD-Tree\n\r");
-		delete tree;
+		Metrics::LatencyTimer timer("KdTree build");
+		ReleaseNodes();
+
+		for (Triangle* tri : removedTriangles)
+		{
+			delete tri;
+		}
+		removedTriangles.clear();
+
 		tree = KdNode::build(treeTriangles, 0);
+		KdNode::Count(tree, 0, nodeCount, leafCount, depth);
+		PublishMetrics();
 		isDirty = false;
 	}
 }
@@ -117,8 +251,6 @@ bool KdTree::MyBoundingBox::GreatestZ(const KdTree::Triangle* t1, const KdTree::
 
 KdTree::MyBoundingBox::MyBoundingBox(const std::vector<KdTree::Triangle*>& tris)
 {
-	size_t size = tris.size();
-
 	auto xExtremes = std::minmax_element(tris.begin(), tris.end(), SmallestX);
 	auto yExtremes = std::minmax_element(tris.begin(), tris.end(), SmallestY);
 	auto zExtremes = std::minmax_element(tris.begin(), tris.end(), SmallestZ);
@@ -140,6 +272,7 @@ KdTree::MyBoundingBox::MyBoundingBox(const std::vector<KdTree::Triangle*>& tris)
 	Extents.z = greatest.z - Center.z;
 }
 
+#ifndef HEADLESS
 void KdTree::MyBoundingBox::Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, DirectX::XMVECTORF32 color)
 {
 	std::vector<DirectX::SimpleMath::Vector3> corners;
@@ -163,6 +296,7 @@ void KdTree::MyBoundingBox::Draw(DirectX::PrimitiveBatch<DirectX::VertexPosition
 		batch->DrawLine(DirectX::VertexPositionColor(corners[3], color), DirectX::VertexPositionColor(corners[7], color));
 	}
 }
+#endif
 
 int KdTree::MyBoundingBox::GetLongestAxis() const
 {
@@ -216,6 +350,12 @@ KdTree::KdNode::KdNode()
 }
 
 KdTree::KdNode* KdTree::KdNode::build(std::vector<KdTree::Triangle*>* tris, int depth)
+{
+	std::vector<const Triangle*> splits;
+	return build(tris, depth, splits);
+}
+
+KdTree::KdNode* KdTree::KdNode::build(std::vector<KdTree::Triangle*>* tris, int depth, std::vector<const Triangle*>& splits)
 {
 	KdNode* node = new KdNode();
 	node->triangles = tris;
@@ -228,7 +368,7 @@ KdTree::KdNode* KdTree::KdNode::build(std::vector<KdTree::Triangle*>* tris, int
 		return node;
 	}
 
-	if (tris->size() <= 100)
+	if (tris->size() <= KdTreeConfig::LEAF_TRIANGLES)
 	{
 		node->bbox = new MyBoundingBox(*tris);
 		node->left = new KdNode();
@@ -240,8 +380,6 @@ KdTree::KdNode* KdTree::KdNode::build(std::vector<KdTree::Triangle*>* tris, int
 
 	node->bbox = new MyBoundingBox(*tris);
 
-	std::vector<KdTree::Triangle*>* leftTris = new std::vector<KdTree::Triangle*>();
-	std::vector<KdTree::Triangle*>* rightTris = new std::vector<KdTree::Triangle*>();;
 	KdTree::Triangle* medTri = nullptr;
 	float axisBaryCenter = 0.0f;
 	int axis = node->bbox->GetLongestAxis();
@@ -262,17 +400,19 @@ KdTree::KdNode* KdTree::KdNode::build(std::vector<KdTree::Triangle*>* tris, int
 		axisBaryCenter = medTri->getBarycenter().z;
 	}
 
-	if (medTri->alreadyCut) {
-		node->bbox = new MyBoundingBox(*tris);
+	//Only the ancestors count, a flag on the triangle would be raced for by sibling subtrees and change the tree between runs
+	if (std::find(splits.begin(), splits.end(), medTri) != splits.end()) {
 		node->left = new KdNode();
 		node->right = new KdNode();
 		node->left->triangles = new std::vector<KdTree::Triangle*>();
 		node->right->triangles = new std::vector<KdTree::Triangle*>();
 		return node;
 	}
-	medTri->alreadyCut = true;
 
-	for (int i = 0; i < tris->size(); ++i)
+	std::vector<KdTree::Triangle*>* leftTris = new std::vector<KdTree::Triangle*>();
+	std::vector<KdTree::Triangle*>* rightTris = new std::vector<KdTree::Triangle*>();
+
+	for (size_t i = 0; i < tris->size(); ++i)
 	{
 		switch (axis)
 		{
@@ -310,15 +450,114 @@ KdTree::KdNode* KdTree::KdNode::build(std::vector<KdTree::Triangle*>* tris, int
 		}
 	}
 
-	node->left = build(leftTris, depth + 1);
-	node->right = build(rightTris, depth + 1);
+	splits.push_back(medTri);
+
+	//The sides have their own triangle lists and split paths, so they can be split at the same time
+	if (leftTris->size() + rightTris->size() > KdTreeConfig::PARALLEL_BUILD_SIZE)
+	{
+		std::vector<const Triangle*> leftSplits = splits;
+		JobSystem::Counter counter;
+		JobSystem::Get().Run([&]()
+		{
+			Profiler::Zone zone("KdTree::build subtree");
+			node->left = build(leftTris, depth + 1, leftSplits);
+		}, &counter);
+		node->right = build(rightTris, depth + 1, splits);
+		JobSystem::Get().Wait(counter);
+	}
+	else
+	{
+		node->left = build(leftTris, depth + 1, splits);
+		node->right = build(rightTris, depth + 1, splits);
+	}
 
+	splits.pop_back();
 	return node;
 }
 
+void KdTree::KdNode::Release(KdNode* node)
+{
+	if (!node)
+	{
+		return;
+	}
+
+	Release(node->left);
+	Release(node->right);
+	delete node->bbox;
+	delete node->triangles;
+	delete node;
+}
+
+void KdTree::KdNode::Count(const KdNode* node, size_t depth, size_t& nodes, size_t& leaves, size_t& maxDepth)
+{
+	//Empty nodes only close off branches, rays never visit them
+	if (!node || !node->triangles || node->triangles->empty())
+	{
+		return;
+	}
+
+	nodes++;
+	maxDepth = std::max(maxDepth, depth);
+
+	//Same test as hit, a node whose children are both empty tests its own triangles
+	if (!node->left || (node->left->triangles->empty() && node->right->triangles->empty()))
+	{
+		leaves++;
+		return;
+	}
+
+	Count(node->left, depth + 1, nodes, leaves, maxDepth);
+	Count(node->right, depth + 1, nodes, leaves, maxDepth);
+}
+
+void KdTree::KdNode::Measure(const KdNode* node, size_t depth, float rootArea, Statistics& statistics, size_t& leafDepthSum)
+{
+	//Empty nodes only close off branches, rays never visit them
+	if (!node || !node->triangles || node->triangles->empty() || !node->bbox)
+	{
+		return;
+	}
+
+	statistics.nodes++;
+	statistics.maxDepth = std::max(statistics.maxDepth, depth);
+
+	//A ray through the root passes through the node with the share of its surface area
+	double hitProbability = rootArea > 0.0f ? SurfaceArea(*node->bbox) / rootArea : 1.0;
+
+	//Same test as hit, a node whose children are both empty tests its own triangles
+	if (!node->left || (node->left->triangles->empty() && node->right->triangles->empty()))
+	{
+		size_t triangles = node->triangles->size();
+		statistics.leaves++;
+		statistics.triangleReferences += triangles;
+		statistics.sahCost += hitProbability * KdTreeConfig::SAH_TRIANGLE_COST * triangles;
+		leafDepthSum += depth;
+
+		if (triangles > KdTreeConfig::LEAF_TRIANGLES)
+		{
+			statistics.cutLeaves++;
+		}
+
+		size_t bucket = 0;
+		while (triangles > 1 && bucket + 1 < OCCUPANCY_BUCKETS)
+		{
+			triangles >>= 1;
+			bucket++;
+		}
+		statistics.leafOccupancy[bucket]++;
+		return;
+	}
+
+	statistics.sahCost += hitProbability * KdTreeConfig::SAH_TRAVERSAL_COST;
+	Measure(node->left, depth + 1, rootArea, statistics, leafDepthSum);
+	Measure(node->right, depth + 1, rootArea, statistics, leafDepthSum);
+}
+
 bool KdTree::KdNode::hit(KdNode* node, const DirectX::SimpleMath::Ray* ray, float& t, float& tmin, KdTree::RayHitStruct& rayhit)
 {
 	float f;
+	rayhit.nodesVisited++;
 	if (ray->Intersects(*node->bbox, f))
 	{
 		if (node->left->triangles->size() > 0 || node->right->triangles->size() > 0)
@@ -349,6 +588,12 @@ bool KdTree::KdNode::hit(KdNode* node, const DirectX::SimpleMath::Ray* ray, floa
 			bool hitBool = false;
 			for (const auto tri : *node->triangles)
 			{
+				if (tri->removed)
+				{
+					continue;
+				}
+
+				rayhit.trianglesTested++;
 				if (ray->Intersects(tri->vertices[0], tri->vertices[1], tri->vertices[2], t))
 				{
 					if (t < tmin)
@@ -377,6 +622,12 @@ bool KdTree::KdNode::hitCheckAll(KdNode* node, const DirectX::SimpleMath::Ray* r
 	bool hitSomething = false;
 	for (const auto tri : *(node->triangles))
 	{
+		if (tri->removed)
+		{
+			continue;
+		}
+
+		rayhit.trianglesTested++;
 		if (ray->Intersects(tri->vertices[0], tri->vertices[1], tri->vertices[2], t))
 		{
 			if (t < tmin)
@@ -395,6 +646,7 @@ bool KdTree::KdNode::hitCheckAll(KdNode* node, const DirectX::SimpleMath::Ray* r
 	return hitSomething;
 }
 
+#ifndef HEADLESS
 void KdTree::KdNode::Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, DirectX::XMVECTORF32 color)
 {
 	if (this->bbox != nullptr)
@@ -417,7 +669,12 @@ void KdTree::Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch,
 		tree->Draw(batch, color);
 	}
 
+	for (KdNode* patch : patches)
+	{
+		patch->Draw(batch, color);
+	}
 }
+#endif
 
 void KdTree::PurgeTriangles()
 {
@@ -427,4 +684,73 @@ void KdTree::PurgeTriangles()
 	}
 
 	treeTriangles->clear();
+
+	for (Triangle* tri : removedTriangles)
+	{
+		delete tri;
+	}
+	removedTriangles.clear();
+
+	//The tree and its patches only point at triangles that are gone now
+	ReleaseNodes();
+}
+
+void KdTree::ReleaseNodes()
+{
+	//The root was built over treeTriangles itself, which outlives it
+	if (tree)
+	{
+		tree->triangles = nullptr;
+	}
+	KdNode::Release(tree);
+	tree = nullptr;
+
+	for (KdNode* patch : patches)
+	{
+		KdNode::Release(patch);
+	}
+	patches.clear();
+	patchedTriangleCount = 0;
+	nodeCount = 0;
+	leafCount = 0;
+	depth = 0;
+	PublishMetrics();
+}
+
+KdTree::Statistics KdTree::GetStatistics() const
+{
+	Statistics statistics;
+	size_t leafDepthSum = 0;
+
+	std::vector<const KdNode*> roots(patches.begin(), patches.end());
+	roots.push_back(tree);
+	for (const KdNode* root : roots)
+	{
+		if (root && root->bbox)
+		{
+			KdNode::Measure(root, 0, SurfaceArea(*root->bbox), statistics, leafDepthSum);
+		}
+	}
+
+	//Removed triangles stay in the leaves until the next rebuild
+	statistics.triangles = treeTriangles->size() + removedTriangles.size();
+	if (statistics.leaves > 0)
+	{
+		statistics.averageLeafDepth = static_cast<double>(leafDepthSum) / statistics.leaves;
+	}
+	if (statistics.triangles > 0)
+	{
+		statistics.duplication = static_cast<double>(statistics.triangleReferences) / statistics.triangles;
+	}
+
+	return statistics;
+}
+
+void KdTree::PublishMetrics() const
+{
+	Metrics& metrics = Metrics::Get();
+	metrics.SetGauge("KdTree triangles", static_cast<double>(treeTriangles->size()));
+	metrics.SetGauge("KdTree nodes", static_cast<double>(nodeCount));
+	metrics.SetGauge("KdTree leaves", static_cast<double>(leafCount));
+	metrics.SetGauge("KdTree depth", static_cast<double>(depth));
 }
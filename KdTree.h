@@ -1,13 +1,17 @@
 #pragma once
 #include <string>
-#include <d3d11.h>
 #include <unordered_map>
-#include <directxmath.h>
-#include <SimpleMath.h>
+#include <vector>
+#include <DirectXMath.h>
+#ifndef HEADLESS
+#include <d3d11.h>
 #include <PrimitiveBatch.h>
 #include <VertexTypes.h>
+#endif
+#include <SimpleMath.h>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 
 using namespace DirectX::SimpleMath;
 
@@ -17,8 +21,6 @@ public:
 	class Triangle
 	{
 	public:
-		Triangle();
-
 		inline Vector3 getBarycenter() const
 		{
 			return Vector3((vertices[0].x + vertices[1].x + vertices[2].x) / 3.0f, (vertices[0].y + vertices[1].y + vertices[2].y) / 3.0f, (vertices[0].z + vertices[1].z + vertices[2].z) / 3.0f);
@@ -29,7 +31,8 @@ public:
 
 		DirectX::XMFLOAT3 vertices[3];
 		Vector3 smallest, greatest;
-		bool alreadyCut = false;
+		// Set by ReplaceTriangles, nodes built before skip it until the next rebuild frees it
+		bool removed = false;
 	};
 
 	class MyBoundingBox : public DirectX::BoundingBox
@@ -47,7 +50,9 @@ public:
 		Vector3 smallest;
 		Vector3 greatest;
 
+#ifndef HEADLESS
 		void Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, DirectX::XMVECTORF32 color);
+#endif
 		int GetLongestAxis() const;
 	};
 
@@ -58,6 +63,31 @@ public:
 		Ray hitray;
 		MyBoundingBox* hitBox = nullptr;
 		Vector3 hitPoint = Vector3::Zero;
+		// Work of the query, added to by every node and triangle it tests
+		size_t nodesVisited = 0;
+		size_t trianglesTested = 0;
+	};
+
+	// Leaves with 1, 2-3, 4-7, ... triangles, the last bucket also takes all larger ones
+	static const size_t OCCUPANCY_BUCKETS = 12;
+
+	// Shape of the tree and all patches, nodes without triangles only close off branches and are not counted
+	struct Statistics
+	{
+		size_t nodes = 0;
+		size_t leaves = 0;
+		// Leaves over KdTreeConfig::LEAF_TRIANGLES triangles, left where the median triangle already split an ancestor
+		size_t cutLeaves = 0;
+		// Levels below the deepest root, a tree with just a root has depth 0
+		size_t maxDepth = 0;
+		double averageLeafDepth = 0.0;
+		// Triangles straddling a split are referenced by the leaves on both sides of it
+		size_t triangles = 0;
+		size_t triangleReferences = 0;
+		double duplication = 0.0;
+		size_t leafOccupancy[OCCUPANCY_BUCKETS] = {};
+		// Expected cost of a ray through every root by the surface area heuristic, in triangle tests
+		double sahCost = 0.0;
 	};
 
 	class KdNode
@@ -68,12 +98,26 @@ public:
 		static bool SmallestZ(const Triangle* t1, const Triangle* t2);
 
 		KdNode();
+		// Subtrees over more than KdTreeConfig::PARALLEL_BUILD_SIZE triangles are built on the JobSystem.
+		// The tree only depends on the triangles, not on how the subtrees were scheduled.
 		static KdNode* build(std::vector<Triangle*>* tris, int depth);
+		// splits holds the median triangles of the ancestors, a node whose median is among them stays a leaf
+		static KdNode* build(std::vector<Triangle*>* tris, int depth, std::vector<const Triangle*>& splits);
+		// Frees the node, everything below it and all their triangle lists, but not the triangles
+		static void Release(KdNode* node);
+		// Adds the nodes below and including node that hold triangles and the leaves among them,
+		// and raises maxDepth to the depth of the deepest of them, node being at depth
+		static void Count(const KdNode* node, size_t depth, size_t& nodes, size_t& leaves, size_t& maxDepth);
+		// Adds node and everything below it to statistics, node being at depth below a root of surface area rootArea.
+		// Leaf depths are summed to leafDepthSum for the average.
+		static void Measure(const KdNode* node, size_t depth, float rootArea, Statistics& statistics, size_t& leafDepthSum);
 
 		static bool hit(KdNode* node, const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit);
 		static bool hitCheckAll(KdNode* node, const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit);
 
+#ifndef HEADLESS
 		void Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, DirectX::XMVECTORF32 color);
+#endif
 
 		MyBoundingBox* bbox;
 		KdNode *left, *right;
@@ -81,16 +125,49 @@ public:
 	};
 
 	bool hitCheckAll(const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit);
+	// Adds its work to the Metrics counters only while they are shown or dumped
 	bool hit(const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit);
+	// Tests all rays on the JobSystem, hits has one entry per ray and hitTriangle stays nullptr for misses within maxRange.
+	// The work of all rays is added to the Metrics counters once per batch.
+	void HitBatch(const std::vector<Ray>& rays, float maxRange, std::vector<RayHitStruct>& hits);
 	void MarkKDTreeDirty();
 	void UpdateKDTree();
 	void AddTriangles(const std::vector<Triangle*> newTriangles);
 	void AddTriangle(Triangle* tri);
+	// Swaps the triangles of an edited region without rebuilding the whole tree.
+	// Removed triangles are skipped, added ones get a small tree of their own until enough
+	// have been patched in that a full rebuild is cheaper than testing all the patches.
+	void ReplaceTriangles(const std::vector<Triangle*>& removed, const std::vector<Triangle*>& added);
+	// Adds triangles along with patches already built over them, so a large mesh can be built a part at a time
+	// and swapped in without a rebuild. They do not count towards the rebuild ratio, the patches are the tree.
+	void AddPatches(const std::vector<Triangle*>& triangles, const std::vector<KdNode*>& newPatches);
+#ifndef HEADLESS
 	void Draw(DirectX::PrimitiveBatch<DirectX::VertexPositionColor>* batch, DirectX::XMVECTORF32 color);
+#endif
 	void PurgeTriangles();
+	// Of the tree and all patches, kept up to date as they are built and released
+	size_t GetNodeCount() const { return nodeCount; }
+	size_t GetLeafCount() const { return leafCount; }
+	// Levels below the deepest root, a tree with just a root has depth 0
+	size_t GetDepth() const { return depth; }
+	// Walks the tree and all patches, as long as a leaf test per leaf, so only for reports and not on every edit
+	Statistics GetStatistics() const;
 
 private:
+	// Frees the nodes of the tree and all patches, the triangles stay
+	void ReleaseNodes();
+	// Sets the gauges of the shared Metrics registry to the current counts
+	void PublishMetrics() const;
+	// Tests the tree and all patches and adds its work to rayhit, without touching the Metrics counters
+	bool hitTreeAndPatches(const Ray* ray, float& t, float& tmin, RayHitStruct& rayhit);
+
 	std::vector<Triangle*>* treeTriangles = new std::vector<Triangle*>();
 	KdNode*	tree = nullptr;
 	bool isDirty = false;
+	std::vector<KdNode*> patches;
+	std::vector<Triangle*> removedTriangles;
+	size_t patchedTriangleCount = 0;
+	size_t nodeCount = 0;
+	size_t leafCount = 0;
+	size_t depth = 0;
 };
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read only view of a whole file. Nothing is read up front, the OS pages the file in as it is touched
+// and can drop clean pages again under memory pressure.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// False if the file does not exist or is empty, empty files cannot be mapped
+	bool Open(const std::wstring& path);
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+	const char* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+
+private:
+	// Win32 handles, kept as void* so windows.h stays out of the header. Unused outside of Windows.
+	void* m_file;
+	void* m_mapping;
+	const char* m_data;
+	size_t m_size;
+};
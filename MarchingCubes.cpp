@@ -0,0 +1,231 @@
+#include "pch.h"
+#include "MarchingCubes.h"
+#include "ParallelFor.h"
+#include "Profiler.h"
+#include "TriangleLUT.h"
+#include <cmath>
+
+namespace
+{
+	//Every edge as its lower corner offset and the axis it runs along
+	const unsigned int EdgeOffsets[12][4] =
+	{
+		{ 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+		{ 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+		{ 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 }
+	};
+
+	const uint32_t NO_VERTEX = 0xFFFFFFFFu;
+}
+
+MarchingCubes::MarchingCubes(const SparseVolume& volume, float isoLevel)
+	: m_volume(volume), m_width(volume.GetWidth()), m_height(volume.GetHeight()), m_depth(volume.GetDepth()), m_isoLevel(isoLevel)
+{
+	m_spacing = XMFLOAT3(2.0f / (m_width - 1), 2.0f / (m_height - 1), 2.0f / (m_depth - 1));
+}
+
+void MarchingCubes::GetChunkCount(unsigned int chunkSize, unsigned int count[3]) const
+{
+	count[0] = (m_width - 1 + chunkSize - 1) / chunkSize;
+	count[1] = (m_height - 1 + chunkSize - 1) / chunkSize;
+	count[2] = (m_depth - 1 + chunkSize - 1) / chunkSize;
+}
+
+std::vector<MeshChunk> MarchingCubes::Polygonise(unsigned int chunkSize) const
+{
+	unsigned int chunks[3];
+	GetChunkCount(chunkSize, chunks);
+
+	std::vector<size_t> indices(static_cast<size_t>(chunks[0]) * chunks[1] * chunks[2]);
+	for (size_t i = 0u; i < indices.size(); ++i)
+	{
+		indices[i] = i;
+	}
+
+	return Polygonise(chunkSize, indices);
+}
+
+std::vector<MeshChunk> MarchingCubes::Polygonise(unsigned int chunkSize, const std::vector<size_t>& indices) const
+{
+	Profiler::Zone zone("MarchingCubes::Polygonise");
+
+	const unsigned int cells[3] = { m_width - 1, m_height - 1, m_depth - 1 };
+	unsigned int chunks[3];
+	GetChunkCount(chunkSize, chunks);
+
+	std::vector<MeshChunk> output(indices.size());
+
+	ParallelFor(output.size(), [&](size_t i)
+	{
+		size_t index = indices[i];
+		const unsigned int chunk[3] =
+		{
+			static_cast<unsigned int>(index % chunks[0]),
+			static_cast<unsigned int>((index / chunks[0]) % chunks[1]),
+			static_cast<unsigned int>(index / (chunks[0] * chunks[1]))
+		};
+
+		unsigned int start[3], end[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			start[axis] = chunk[axis] * chunkSize;
+			end[axis] = std::min(start[axis] + chunkSize, cells[axis]);
+		}
+
+		PolygoniseChunk(start, end, output[i]);
+	});
+
+	return output;
+}
+
+void MarchingCubes::PolygoniseChunk(const unsigned int start[3], const unsigned int end[3], MeshChunk& output) const
+{
+	//Corners of the chunk, edges on its border are duplicated in the neighbouring chunk
+	const unsigned int size[3] = { end[0] - start[0] + 1, end[1] - start[1] + 1, end[2] - start[2] + 1 };
+	std::vector<uint32_t> edgeVertices(size[0] * size[1] * size[2] * 3, NO_VERTEX);
+
+	const unsigned int brickSize = SparseVolume::BRICK_SIZE;
+
+	for (unsigned int blockZ = start[2]; blockZ < end[2]; blockZ += brickSize)
+	{
+		for (unsigned int blockY = start[1]; blockY < end[1]; blockY += brickSize)
+		{
+			for (unsigned int blockX = start[0]; blockX < end[0]; blockX += brickSize)
+			{
+				//Corners touched by this block of cells, skip it if they are all on one side of the surface
+				const unsigned int blockStart[3] = { blockX, blockY, blockZ };
+				const unsigned int blockEnd[3] =
+				{
+					std::min(blockX + brickSize, end[0]),
+					std::min(blockY + brickSize, end[1]),
+					std::min(blockZ + brickSize, end[2])
+				};
+
+				if (!m_volume.MayContainSurface(blockStart, blockEnd, m_isoLevel))
+				{
+					continue;
+				}
+
+				switch (m_volume.GetFormat())
+				{
+				case DensityFormat::SNORM16:
+					PolygoniseBlock<int16_t>(start, size, blockStart, blockEnd, edgeVertices, output);
+					break;
+				case DensityFormat::SNORM8:
+					PolygoniseBlock<int8_t>(start, size, blockStart, blockEnd, edgeVertices, output);
+					break;
+				default:
+					PolygoniseBlock<float>(start, size, blockStart, blockEnd, edgeVertices, output);
+					break;
+				}
+			}
+		}
+	}
+}
+
+template<typename T>
+void MarchingCubes::PolygoniseBlock(const unsigned int chunkStart[3], const unsigned int chunkSize[3], const unsigned int start[3], const unsigned int end[3],
+	std::vector<uint32_t>& edgeVertices, MeshChunk& output) const
+{
+	for (unsigned int z = start[2]; z < end[2]; ++z)
+	{
+		for (unsigned int y = start[1]; y < end[1]; ++y)
+		{
+			for (unsigned int x = start[0]; x < end[0]; ++x)
+			{
+				float corners[8];
+				m_volume.GetCellCorners<T>(x, y, z, corners);
+
+				int cubeIndex = 0;
+				for (int i = 0; i < 8; ++i)
+				{
+					if (corners[i] < m_isoLevel)
+					{
+						cubeIndex |= 1 << i;
+					}
+				}
+
+				if (cubeIndex == 0 || cubeIndex == 255)
+				{
+					continue;
+				}
+
+				for (int i = 0; TriangleLUT::TriTable[cubeIndex][i] != -1; ++i)
+				{
+					const unsigned int* edge = EdgeOffsets[TriangleLUT::TriTable[cubeIndex][i]];
+					unsigned int cornerX = x + edge[0], cornerY = y + edge[1], cornerZ = z + edge[2];
+
+					size_t slot = ((static_cast<size_t>(cornerZ - chunkStart[2]) * chunkSize[1] + (cornerY - chunkStart[1])) * chunkSize[0] + (cornerX - chunkStart[0])) * 3 + edge[3];
+					if (edgeVertices[slot] == NO_VERTEX)
+					{
+						edgeVertices[slot] = AddEdgeVertex(cornerX, cornerY, cornerZ, edge[3], output);
+					}
+
+					output.indices.push_back(edgeVertices[slot]);
+				}
+			}
+		}
+	}
+}
+
+float MarchingCubes::GetValue(unsigned int x, unsigned int y, unsigned int z) const
+{
+	return m_volume.Get(x, y, z);
+}
+
+XMFLOAT3 MarchingCubes::GetPosition(unsigned int x, unsigned int y, unsigned int z) const
+{
+	return XMFLOAT3(-1.0f + x * m_spacing.x, -1.0f + y * m_spacing.y, -1.0f + z * m_spacing.z);
+}
+
+XMFLOAT3 MarchingCubes::GetGradient(unsigned int x, unsigned int y, unsigned int z) const
+{
+	//Central differences, one sided on the border of the grid
+	unsigned int x0 = x > 0 ? x - 1 : x, x1 = x + 1 < m_width ? x + 1 : x;
+	unsigned int y0 = y > 0 ? y - 1 : y, y1 = y + 1 < m_height ? y + 1 : y;
+	unsigned int z0 = z > 0 ? z - 1 : z, z1 = z + 1 < m_depth ? z + 1 : z;
+
+	return XMFLOAT3(
+		(GetValue(x1, y, z) - GetValue(x0, y, z)) / ((x1 - x0) * m_spacing.x),
+		(GetValue(x, y1, z) - GetValue(x, y0, z)) / ((y1 - y0) * m_spacing.y),
+		(GetValue(x, y, z1) - GetValue(x, y, z0)) / ((z1 - z0) * m_spacing.z));
+}
+
+uint32_t MarchingCubes::AddEdgeVertex(unsigned int x, unsigned int y, unsigned int z, int axis, MeshChunk& output) const
+{
+	unsigned int other[3] = { x, y, z };
+	other[axis] += 1;
+
+	float value0 = GetValue(x, y, z);
+	float value1 = GetValue(other[0], other[1], other[2]);
+	float lerper = (m_isoLevel - value0) / (value1 - value0);
+
+	XMFLOAT3 position0 = GetPosition(x, y, z), position1 = GetPosition(other[0], other[1], other[2]);
+	XMFLOAT3 gradient0 = GetGradient(x, y, z), gradient1 = GetGradient(other[0], other[1], other[2]);
+
+	XMFLOAT3 position(
+		position0.x + (position1.x - position0.x) * lerper,
+		position0.y + (position1.y - position0.y) * lerper,
+		position0.z + (position1.z - position0.z) * lerper);
+
+	//Density grows towards the inside, so the normal points down the gradient
+	XMFLOAT3 normal(
+		-(gradient0.x + (gradient1.x - gradient0.x) * lerper),
+		-(gradient0.y + (gradient1.y - gradient0.y) * lerper),
+		-(gradient0.z + (gradient1.z - gradient0.z) * lerper));
+
+	float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+	if (length > 0.0f)
+	{
+		normal = XMFLOAT3(normal.x / length, normal.y / length, normal.z / length);
+	}
+	else
+	{
+		normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+	}
+
+	output.positions.push_back(position);
+	output.normals.push_back(normal);
+
+	return static_cast<uint32_t>(output.positions.size() - 1);
+}
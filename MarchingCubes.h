@@ -0,0 +1,53 @@
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include <cstdint>
+#include "SparseVolume.h"
+
+using namespace DirectX;
+
+// Indexed triangle list for one block of cells.
+// Vertices on edges shared by neighbouring cells are only stored once.
+struct MeshChunk
+{
+	std::vector<XMFLOAT3> positions;
+	std::vector<XMFLOAT3> normals;
+	std::vector<uint32_t> indices;
+};
+
+// CPU marching cubes over a density grid, same corner/edge order and
+// triangle table as MarchingCube_GS.hlsl.
+// The grid is mapped onto [-1,1] on every axis, blocks of uniform bricks are skipped.
+class MarchingCubes
+{
+public:
+	MarchingCubes(const SparseVolume& volume, float isoLevel);
+
+	// Splits the cells into blocks of chunkSize^3 and polygonises them in parallel
+	std::vector<MeshChunk> Polygonise(unsigned int chunkSize) const;
+
+	// Polygonises only the listed blocks of the same split, indices run x fastest and output[i] belongs to indices[i]
+	std::vector<MeshChunk> Polygonise(unsigned int chunkSize, const std::vector<size_t>& indices) const;
+
+	// Blocks along every axis for a chunk size
+	void GetChunkCount(unsigned int chunkSize, unsigned int count[3]) const;
+
+	// Polygonises the cells in [start, end) of every axis
+	void PolygoniseChunk(const unsigned int start[3], const unsigned int end[3], MeshChunk& output) const;
+
+private:
+	// Polygonises the cells in [start, end), edge vertices are shared through the chunk wide cache.
+	// T is the storage type of the volume so corner values are decoded inline.
+	template<typename T>
+	void PolygoniseBlock(const unsigned int chunkStart[3], const unsigned int chunkSize[3], const unsigned int start[3], const unsigned int end[3],
+		std::vector<uint32_t>& edgeVertices, MeshChunk& output) const;
+	float GetValue(unsigned int x, unsigned int y, unsigned int z) const;
+	XMFLOAT3 GetPosition(unsigned int x, unsigned int y, unsigned int z) const;
+	XMFLOAT3 GetGradient(unsigned int x, unsigned int y, unsigned int z) const;
+	uint32_t AddEdgeVertex(unsigned int x, unsigned int y, unsigned int z, int axis, MeshChunk& output) const;
+
+	const SparseVolume& m_volume;
+	unsigned int m_width, m_height, m_depth;
+	float m_isoLevel;
+	XMFLOAT3 m_spacing;
+};
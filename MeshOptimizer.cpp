@@ -0,0 +1,338 @@
+#include "pch.h"
+#include "MeshOptimizer.h"
+#include "ParallelFor.h"
+#include "Profiler.h"
+#include <cmath>
+
+namespace MeshOptimizerConfig
+{
+	//Cache size Tipsify optimises for, also the FIFO size the ACMR is measured with
+	const unsigned int CACHE_SIZE = 16;
+
+	//Overdraw sorting may cost at most 5% of the cache efficiency
+	const float OVERDRAW_THRESHOLD = 1.05f;
+}
+
+namespace
+{
+	const uint32_t NO_INDEX = 0xFFFFFFFFu;
+}
+
+MeshOptimizer::Statistics MeshOptimizer::OptimizeChunks(std::vector<MeshChunk>& chunks)
+{
+	Profiler::Zone zone("MeshOptimizer::OptimizeChunks");
+
+	std::vector<Statistics> chunkStatistics(chunks.size());
+
+	ParallelFor(chunks.size(), [&](size_t index)
+	{
+		MeshChunk& chunk = chunks[index];
+		Statistics& statistics = chunkStatistics[index];
+
+		statistics.triangleCount = chunk.indices.size() / 3;
+		statistics.cacheMissesBefore = CountCacheMisses(chunk.indices, chunk.positions.size(), MeshOptimizerConfig::CACHE_SIZE);
+
+		OptimizeVertexCache(chunk.indices, chunk.positions.size());
+		//Renumbering vertices for fetch order does not change the cache behaviour
+		statistics.cacheMissesAfter = OptimizeOverdraw(chunk.indices, chunk.positions, MeshOptimizerConfig::OVERDRAW_THRESHOLD);
+		OptimizeVertexFetch(chunk);
+	});
+
+	Statistics output;
+	for (const Statistics& statistics : chunkStatistics)
+	{
+		output.triangleCount += statistics.triangleCount;
+		output.cacheMissesBefore += statistics.cacheMissesBefore;
+		output.cacheMissesAfter += statistics.cacheMissesAfter;
+	}
+
+	return output;
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	const unsigned int cacheSize = MeshOptimizerConfig::CACHE_SIZE;
+
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	//Triangles using each vertex and how many of them are still waiting to be emitted
+	std::vector<uint32_t> liveTriangles(vertexCount, 0u);
+	for (uint32_t index : indices)
+	{
+		liveTriangles[index]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0u);
+	for (size_t i = 0u; i < vertexCount; ++i)
+	{
+		adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0u; i < indices.size(); ++i)
+	{
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<unsigned int> cacheTimestamps(vertexCount, 0u);
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	deadEnds.reserve(indices.size());
+	output.reserve(indices.size());
+
+	unsigned int timestamp = cacheSize + 1;
+	uint32_t fanningVertex = indices[0];
+	uint32_t inputCursor = 0u;
+
+	while (fanningVertex != NO_INDEX)
+	{
+		candidates.clear();
+
+		//Emit every triangle around the fanning vertex
+		for (uint32_t i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex + 1]; ++i)
+		{
+			uint32_t triangle = adjacency[i];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+
+			for (int j = 0; j < 3; ++j)
+			{
+				uint32_t vertex = indices[triangle * 3 + j];
+				output.push_back(vertex);
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+
+				if (timestamp - cacheTimestamps[vertex] > cacheSize)
+				{
+					cacheTimestamps[vertex] = timestamp++;
+				}
+			}
+
+			emitted[triangle] = 1;
+		}
+
+		//Continue with the candidate that stays in the cache the longest while its fan is emitted
+		fanningVertex = NO_INDEX;
+		unsigned int bestPriority = 0u;
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+			{
+				continue;
+			}
+
+			unsigned int priority = 0u;
+			if (timestamp - cacheTimestamps[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+			{
+				priority = timestamp - cacheTimestamps[vertex];
+			}
+
+			if (fanningVertex == NO_INDEX || priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanningVertex = vertex;
+			}
+		}
+
+		//Dead end, go back to a recently used vertex or carry on in input order
+		while (fanningVertex == NO_INDEX && !deadEnds.empty())
+		{
+			uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+
+			if (liveTriangles[vertex] > 0)
+			{
+				fanningVertex = vertex;
+			}
+		}
+
+		while (fanningVertex == NO_INDEX && inputCursor < indices.size())
+		{
+			uint32_t vertex = indices[inputCursor++];
+
+			if (liveTriangles[vertex] > 0)
+			{
+				fanningVertex = vertex;
+			}
+		}
+	}
+
+	indices.swap(output);
+}
+
+size_t MeshOptimizer::OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<XMFLOAT3>& positions, float threshold)
+{
+	size_t triangleCount = indices.size() / 3;
+	size_t missesBefore = 0u;
+
+	//Split wherever the cache runs dry, reordering whole clusters keeps most of the reuse
+	std::vector<size_t> clusterStarts;
+	{
+		std::vector<unsigned int> timestamps(positions.size(), 0u);
+		unsigned int timestamp = MeshOptimizerConfig::CACHE_SIZE + 1;
+
+		for (size_t i = 0u; i < triangleCount; ++i)
+		{
+			int misses = 0;
+			for (int j = 0; j < 3; ++j)
+			{
+				uint32_t vertex = indices[i * 3 + j];
+				if (timestamp - timestamps[vertex] > MeshOptimizerConfig::CACHE_SIZE)
+				{
+					timestamps[vertex] = timestamp++;
+					misses++;
+				}
+			}
+
+			if (misses == 3)
+			{
+				clusterStarts.push_back(i);
+			}
+			missesBefore += misses;
+		}
+	}
+
+	if (clusterStarts.size() < 2)
+	{
+		return missesBefore;
+	}
+	clusterStarts.push_back(triangleCount);
+
+	//Area weighted centroid and normal of every cluster
+	size_t clusterCount = clusterStarts.size() - 1;
+	std::vector<XMFLOAT3> clusterCentroids(clusterCount), clusterNormals(clusterCount);
+	XMFLOAT3 meshCentroid(0.0f, 0.0f, 0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t c = 0u; c < clusterCount; ++c)
+	{
+		XMFLOAT3 centroid(0.0f, 0.0f, 0.0f), normal(0.0f, 0.0f, 0.0f);
+		float clusterArea = 0.0f;
+
+		for (size_t i = clusterStarts[c]; i < clusterStarts[c + 1]; ++i)
+		{
+			const XMFLOAT3& a = positions[indices[i * 3]];
+			const XMFLOAT3& b = positions[indices[i * 3 + 1]];
+			const XMFLOAT3& d = positions[indices[i * 3 + 2]];
+
+			XMFLOAT3 ab(b.x - a.x, b.y - a.y, b.z - a.z), ad(d.x - a.x, d.y - a.y, d.z - a.z);
+			XMFLOAT3 cross(ab.y * ad.z - ab.z * ad.y, ab.z * ad.x - ab.x * ad.z, ab.x * ad.y - ab.y * ad.x);
+			float area = std::sqrt(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+
+			centroid.x += (a.x + b.x + d.x) * area / 3.0f;
+			centroid.y += (a.y + b.y + d.y) * area / 3.0f;
+			centroid.z += (a.z + b.z + d.z) * area / 3.0f;
+			normal.x += cross.x;
+			normal.y += cross.y;
+			normal.z += cross.z;
+			clusterArea += area;
+		}
+
+		meshCentroid.x += centroid.x;
+		meshCentroid.y += centroid.y;
+		meshCentroid.z += centroid.z;
+		meshArea += clusterArea;
+
+		float invArea = clusterArea > 0.0f ? 1.0f / clusterArea : 0.0f;
+		clusterCentroids[c] = XMFLOAT3(centroid.x * invArea, centroid.y * invArea, centroid.z * invArea);
+
+		float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+		clusterNormals[c] = XMFLOAT3(normal.x * invLength, normal.y * invLength, normal.z * invLength);
+	}
+
+	if (meshArea <= 0.0f)
+	{
+		return missesBefore;
+	}
+	meshCentroid = XMFLOAT3(meshCentroid.x / meshArea, meshCentroid.y / meshArea, meshCentroid.z / meshArea);
+
+	//Clusters facing away from the centre are likely occluders, draw them first
+	std::vector<float> sortKeys(clusterCount);
+	std::vector<size_t> order(clusterCount);
+	for (size_t c = 0u; c < clusterCount; ++c)
+	{
+		sortKeys[c] =
+			(clusterCentroids[c].x - meshCentroid.x) * clusterNormals[c].x +
+			(clusterCentroids[c].y - meshCentroid.y) * clusterNormals[c].y +
+			(clusterCentroids[c].z - meshCentroid.z) * clusterNormals[c].z;
+		order[c] = c;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (size_t c : order)
+	{
+		output.insert(output.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+	}
+
+	size_t missesAfter = CountCacheMisses(output, positions.size(), MeshOptimizerConfig::CACHE_SIZE);
+
+	if (missesAfter > missesBefore * threshold)
+	{
+		return missesBefore;
+	}
+
+	indices.swap(output);
+	return missesAfter;
+}
+
+void MeshOptimizer::OptimizeVertexFetch(MeshChunk& chunk)
+{
+	std::vector<uint32_t> remap(chunk.positions.size(), NO_INDEX);
+	uint32_t nextVertex = 0u;
+
+	for (uint32_t& index : chunk.indices)
+	{
+		if (remap[index] == NO_INDEX)
+		{
+			remap[index] = nextVertex++;
+		}
+		index = remap[index];
+	}
+
+	//Unreferenced vertices are dropped
+	std::vector<XMFLOAT3> positions(nextVertex), normals(nextVertex);
+	for (size_t i = 0u; i < remap.size(); ++i)
+	{
+		if (remap[i] != NO_INDEX)
+		{
+			positions[remap[i]] = chunk.positions[i];
+			normals[remap[i]] = chunk.normals[i];
+		}
+	}
+
+	chunk.positions.swap(positions);
+	chunk.normals.swap(normals);
+}
+
+size_t MeshOptimizer::CountCacheMisses(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned int cacheSize)
+{
+	std::vector<unsigned int> timestamps(vertexCount, 0u);
+	unsigned int timestamp = cacheSize + 1;
+	size_t misses = 0u;
+
+	for (uint32_t index : indices)
+	{
+		//A vertex is still in the FIFO if fewer than cacheSize misses happened since it was added
+		if (timestamp - timestamps[index] > cacheSize)
+		{
+			timestamps[index] = timestamp++;
+			misses++;
+		}
+	}
+
+	return misses;
+}
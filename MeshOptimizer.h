@@ -0,0 +1,35 @@
+#pragma once
+#include "MarchingCubes.h"
+
+// Reorders generated index and vertex buffers so they are cheaper to draw.
+// Marching cubes emits triangles in scan order which gives poor post transform cache reuse.
+class MeshOptimizer
+{
+public:
+	struct Statistics
+	{
+		size_t triangleCount = 0;
+		size_t cacheMissesBefore = 0;
+		size_t cacheMissesAfter = 0;
+
+		// Average cache miss ratio, transformed vertices per triangle
+		float GetACMRBefore() const { return triangleCount > 0 ? static_cast<float>(cacheMissesBefore) / triangleCount : 0.0f; }
+		float GetACMRAfter() const { return triangleCount > 0 ? static_cast<float>(cacheMissesAfter) / triangleCount : 0.0f; }
+	};
+
+	// Runs the whole optimisation on every chunk in parallel
+	static Statistics OptimizeChunks(std::vector<MeshChunk>& chunks);
+
+	// Tipsify vertex cache optimisation (Sander, Nehab and Barczak 2007)
+	static void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+	// Sorts clusters of cache optimised triangles so outward facing ones are drawn first.
+	// Keeps the old order if the ACMR gets worse by more than threshold, returns the cache misses of the result.
+	static size_t OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<XMFLOAT3>& positions, float threshold);
+
+	// Stores vertices in the order they are first used by the index buffer
+	static void OptimizeVertexFetch(MeshChunk& chunk);
+
+	// Simulates a FIFO post transform cache
+	static size_t CountCacheMisses(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned int cacheSize);
+};
@@ -0,0 +1,689 @@
+#include "pch.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace MetricsConfig
+{
+	//Counters, gauges and histograms together, a power of two for the hash table
+	const size_t MAX_METRICS = 128;
+	const size_t MAX_HISTOGRAMS = 32;
+	//Threads past this share the last shard, their adds still count but contend
+	const size_t MAX_SHARDS = 64;
+	//Eight buckets per power of two
+	const unsigned int SUB_BUCKET_BITS = 3;
+	const uint64_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+	//Latencies from 2^40 ns, about 18 minutes, share the last bucket
+	const unsigned int MAX_EXPONENT = 40;
+	const size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+}
+
+//Name is set last, once the slot can be read. Claiming marks a slot another thread is filling in.
+struct Metrics::Slot
+{
+	std::atomic<const char*> name;
+	Kind::Enum kind;
+	std::atomic<int> unit;
+	// Gauges only, the bits of a double
+	std::atomic<uint64_t> gauge;
+	// Histograms only
+	size_t histogram;
+};
+
+struct Metrics::Shard
+{
+	// Indexed by slot
+	std::atomic<int64_t> counters[MetricsConfig::MAX_METRICS];
+	std::atomic<uint64_t> buckets[MetricsConfig::MAX_HISTOGRAMS][MetricsConfig::BUCKET_COUNT];
+	std::atomic<uint64_t> sums[MetricsConfig::MAX_HISTOGRAMS];
+};
+
+const size_t Metrics::HISTORY_SIZE;
+thread_local Metrics::Shard* Metrics::t_shard = nullptr;
+
+namespace
+{
+	const char CLAIMING[] = "";
+
+	size_t HashName(const char* name)
+	{
+		//FNV-1a, literals of the same text may have different addresses in different translation units
+		size_t hash = 2166136261u;
+		for (; *name; ++name)
+		{
+			hash = (hash ^ static_cast<unsigned char>(*name)) * 16777619u;
+		}
+		return hash;
+	}
+
+	unsigned int FloorLog2(uint64_t value)
+	{
+#if defined(_MSC_VER) && defined(_WIN64)
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return index;
+#elif defined(_MSC_VER)
+		unsigned long index;
+		if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32)))
+		{
+			return index + 32u;
+		}
+		_BitScanReverse(&index, static_cast<unsigned long>(value));
+		return index;
+#else
+		return 63u - __builtin_clzll(value);
+#endif
+	}
+
+	size_t BucketIndex(uint64_t nanoseconds)
+	{
+		using namespace MetricsConfig;
+
+		//Below SUB_BUCKETS every value has a bucket of its own
+		if (nanoseconds < SUB_BUCKETS)
+		{
+			return static_cast<size_t>(nanoseconds);
+		}
+
+		unsigned int exponent = FloorLog2(nanoseconds);
+		if (exponent > MAX_EXPONENT)
+		{
+			return BUCKET_COUNT - 1u;
+		}
+
+		size_t subBucket = static_cast<size_t>((nanoseconds >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1u));
+		return (exponent - SUB_BUCKET_BITS + 1u) * SUB_BUCKETS + subBucket;
+	}
+
+	//Middle of the values falling into bucket
+	double BucketValue(size_t bucket)
+	{
+		using namespace MetricsConfig;
+
+		if (bucket < SUB_BUCKETS)
+		{
+			return static_cast<double>(bucket);
+		}
+
+		unsigned int shift = static_cast<unsigned int>(bucket / SUB_BUCKETS) - 1u;
+		double lower = static_cast<double>((SUB_BUCKETS + bucket % SUB_BUCKETS) << shift);
+		return lower + ((uint64_t(1) << shift) - 1u) * 0.5;
+	}
+
+	double ToMilliseconds(double nanoseconds)
+	{
+		return nanoseconds / 1000000.0;
+	}
+
+	void WriteJsonString(std::ostream& file, const char* text)
+	{
+		file << '"';
+		for (; *text; ++text)
+		{
+			if (*text == '"' || *text == '\\')
+			{
+				file << '\\';
+			}
+			file << *text;
+		}
+		file << '"';
+	}
+
+	template<typename T> bool ByName(const T& first, const T& second)
+	{
+		return std::strcmp(first.name, second.name) < 0;
+	}
+}
+
+Metrics::StageTimer::StageTimer(const char* stage)
+	: m_zone(stage), m_stage(stage), m_measuring(Get().IsEnabled())
+{
+	m_start = m_measuring ? Profiler::Now() : 0u;
+}
+
+Metrics::StageTimer::~StageTimer()
+{
+	if (m_measuring)
+	{
+		Get().AddStageTime(m_stage, (Profiler::Now() - m_start) / 1000000.0f);
+	}
+}
+
+Metrics::LatencyTimer::LatencyTimer(const char* histogram)
+	: m_histogram(histogram), m_measuring(Get().IsEnabled())
+{
+	m_start = m_measuring ? Profiler::Now() : 0u;
+}
+
+Metrics::LatencyTimer::~LatencyTimer()
+{
+	if (m_measuring)
+	{
+		Get().RecordLatency(m_histogram, Profiler::Now() - m_start);
+	}
+}
+
+Metrics& Metrics::Get()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Metrics::Metrics()
+	: m_enabled(0u), m_origin(Profiler::Now()), m_slots(new Slot[MetricsConfig::MAX_METRICS]), m_histogramCount(0u),
+	m_shards(new std::atomic<Shard*>[MetricsConfig::MAX_SHARDS]), m_shardCount(0u), m_frameTimes(HISTORY_SIZE, 0.0f)
+{
+	for (size_t i = 0u; i < MetricsConfig::MAX_METRICS; ++i)
+	{
+		m_slots[i].name = nullptr;
+	}
+
+	for (size_t i = 0u; i < MetricsConfig::MAX_SHARDS; ++i)
+	{
+		m_shards[i] = nullptr;
+	}
+}
+
+Metrics::~Metrics()
+{
+	StopDump();
+
+	//Shards outlive their threads, the registry is only destroyed at exit
+	for (size_t i = 0u; i < MetricsConfig::MAX_SHARDS; ++i)
+	{
+		delete m_shards[i].load();
+	}
+}
+
+void Metrics::SetEnabled(bool enabled)
+{
+	if (enabled == ((m_enabled.load() & OVERLAY) != 0u))
+	{
+		return;
+	}
+
+	if (enabled)
+	{
+		m_stages.clear();
+		m_framesWritten = 0;
+		m_lastFrameEnd = 0;
+		m_enabled |= OVERLAY;
+	}
+	else
+	{
+		m_enabled &= ~OVERLAY;
+	}
+}
+
+Metrics::Slot* Metrics::FindSlot(const char* name, Kind::Enum kind, bool insert)
+{
+	size_t mask = MetricsConfig::MAX_METRICS - 1u;
+	size_t start = HashName(name) & mask;
+
+	for (size_t probe = 0u; probe < MetricsConfig::MAX_METRICS; ++probe)
+	{
+		Slot& slot = m_slots[(start + probe) & mask];
+		const char* slotName = slot.name.load(std::memory_order_acquire);
+
+		if (!slotName)
+		{
+			if (!insert)
+			{
+				return nullptr;
+			}
+
+			//Fails if another thread claimed it first, slotName then holds what it registers
+			if (slot.name.compare_exchange_strong(slotName, CLAIMING, std::memory_order_acq_rel))
+			{
+				slot.kind = kind;
+				slot.unit = GaugeUnit::COUNT;
+				slot.gauge = 0u;
+				slot.histogram = kind == Kind::HISTOGRAM ? m_histogramCount.fetch_add(1u) : 0u;
+				if (kind == Kind::HISTOGRAM && slot.histogram >= MetricsConfig::MAX_HISTOGRAMS)
+				{
+					printf("Metrics: no room for histogram %s\n\r", name);
+				}
+				slot.name.store(name, std::memory_order_release);
+				slotName = name;
+			}
+		}
+
+		//The claiming thread is about to publish the slot, it may be the metric looked for
+		while (slotName == CLAIMING)
+		{
+			std::this_thread::yield();
+			slotName = slot.name.load(std::memory_order_acquire);
+		}
+
+		if (slotName == name || !std::strcmp(slotName, name))
+		{
+			if (slot.kind != kind || (kind == Kind::HISTOGRAM && slot.histogram >= MetricsConfig::MAX_HISTOGRAMS))
+			{
+				return nullptr;
+			}
+			return &slot;
+		}
+	}
+
+	//The table is full, the metric is dropped
+	return nullptr;
+}
+
+Metrics::Shard& Metrics::GetShard()
+{
+	if (!t_shard)
+	{
+		size_t index = m_shardCount.fetch_add(1u);
+		if (index < MetricsConfig::MAX_SHARDS)
+		{
+			//Value initialisation zeroes every counter and bucket
+			m_shards[index].store(new Shard(), std::memory_order_release);
+		}
+		else
+		{
+			index = MetricsConfig::MAX_SHARDS - 1u;
+			//The last thread to get a shard of its own may not have stored it yet
+			while (!m_shards[index].load(std::memory_order_acquire))
+			{
+				std::this_thread::yield();
+			}
+		}
+		t_shard = m_shards[index].load(std::memory_order_acquire);
+	}
+
+	return *t_shard;
+}
+
+void Metrics::Add(const char* counter, int64_t delta)
+{
+	Slot* slot = FindSlot(counter, Kind::COUNTER, true);
+	if (slot)
+	{
+		GetShard().counters[slot - m_slots.get()].fetch_add(delta, std::memory_order_relaxed);
+	}
+}
+
+void Metrics::SetGauge(const char* name, double value, GaugeUnit::Enum unit)
+{
+	Slot* slot = FindSlot(name, Kind::GAUGE, true);
+	if (slot)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		slot->unit.store(unit, std::memory_order_relaxed);
+		slot->gauge.store(bits, std::memory_order_relaxed);
+	}
+}
+
+void Metrics::RecordLatency(const char* histogram, uint64_t nanoseconds)
+{
+	Slot* slot = FindSlot(histogram, Kind::HISTOGRAM, true);
+	if (slot)
+	{
+		Shard& shard = GetShard();
+		shard.buckets[slot->histogram][BucketIndex(nanoseconds)].fetch_add(1u, std::memory_order_relaxed);
+		shard.sums[slot->histogram].fetch_add(nanoseconds, std::memory_order_relaxed);
+	}
+}
+
+void Metrics::AddStageTime(const char* stage, float milliseconds)
+{
+	//Names are literals, the same stage always has the same pointer
+	auto found = std::find_if(m_stages.begin(), m_stages.end(), [stage](const StageHistory& history) { return history.name == stage; });
+	if (found == m_stages.end())
+	{
+		//Frames before the stage was first timed did not spend time in it
+		StageHistory history = { stage, 0.0f, std::vector<float>(HISTORY_SIZE, 0.0f) };
+		m_stages.push_back(history);
+		found = m_stages.end() - 1;
+	}
+
+	found->frameMilliseconds += milliseconds;
+}
+
+void Metrics::EndFrame()
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	uint64_t now = Profiler::Now();
+
+	//The first frame after enabling has no start, its stage times are dropped with it
+	if (m_lastFrameEnd != 0u)
+	{
+		size_t index = m_framesWritten % HISTORY_SIZE;
+		m_frameTimes[index] = (now - m_lastFrameEnd) / 1000000.0f;
+		RecordLatency("Frame", now - m_lastFrameEnd);
+
+		for (StageHistory& stage : m_stages)
+		{
+			stage.milliseconds[index] = stage.frameMilliseconds;
+			RecordLatency(stage.name, static_cast<uint64_t>(stage.frameMilliseconds * 1000000.0f));
+		}
+		m_framesWritten++;
+	}
+
+	for (StageHistory& stage : m_stages)
+	{
+		stage.frameMilliseconds = 0.0f;
+	}
+	m_lastFrameEnd = now;
+}
+
+std::vector<Metrics::Counter> Metrics::GetCounters() const
+{
+	size_t shardCount = std::min(m_shardCount.load(), MetricsConfig::MAX_SHARDS);
+
+	std::vector<Counter> counters;
+	for (size_t i = 0u; i < MetricsConfig::MAX_METRICS; ++i)
+	{
+		const char* name = m_slots[i].name.load(std::memory_order_acquire);
+		if (!name || name == CLAIMING || m_slots[i].kind != Kind::COUNTER)
+		{
+			continue;
+		}
+
+		Counter counter = { name, 0 };
+		for (size_t shard = 0u; shard < shardCount; ++shard)
+		{
+			//Null while a new thread is still allocating its shard
+			const Shard* stored = m_shards[shard].load(std::memory_order_acquire);
+			counter.value += stored ? stored->counters[i].load(std::memory_order_relaxed) : 0;
+		}
+		counters.push_back(counter);
+	}
+
+	std::sort(counters.begin(), counters.end(), ByName<Counter>);
+	return counters;
+}
+
+int64_t Metrics::GetCounter(const char* name) const
+{
+	for (const Counter& counter : GetCounters())
+	{
+		if (!std::strcmp(counter.name, name))
+		{
+			return counter.value;
+		}
+	}
+
+	return 0;
+}
+
+std::vector<Metrics::Gauge> Metrics::GetGauges() const
+{
+	std::vector<Gauge> gauges;
+	for (size_t i = 0u; i < MetricsConfig::MAX_METRICS; ++i)
+	{
+		const Slot& slot = m_slots[i];
+		const char* name = slot.name.load(std::memory_order_acquire);
+		if (!name || name == CLAIMING || slot.kind != Kind::GAUGE)
+		{
+			continue;
+		}
+
+		uint64_t bits = slot.gauge.load(std::memory_order_relaxed);
+		Gauge gauge = { name, static_cast<GaugeUnit::Enum>(slot.unit.load(std::memory_order_relaxed)), 0.0 };
+		std::memcpy(&gauge.value, &bits, sizeof(bits));
+		gauges.push_back(gauge);
+	}
+
+	std::sort(gauges.begin(), gauges.end(), ByName<Gauge>);
+	return gauges;
+}
+
+void Metrics::SumHistogram(const Slot& slot, std::vector<uint64_t>& buckets, uint64_t& sum) const
+{
+	size_t shardCount = std::min(m_shardCount.load(), MetricsConfig::MAX_SHARDS);
+
+	buckets.assign(MetricsConfig::BUCKET_COUNT, 0u);
+	sum = 0u;
+	for (size_t i = 0u; i < shardCount; ++i)
+	{
+		const Shard* shard = m_shards[i].load(std::memory_order_acquire);
+		if (!shard)
+		{
+			continue;
+		}
+
+		for (size_t bucket = 0u; bucket < MetricsConfig::BUCKET_COUNT; ++bucket)
+		{
+			buckets[bucket] += shard->buckets[slot.histogram][bucket].load(std::memory_order_relaxed);
+		}
+		sum += shard->sums[slot.histogram].load(std::memory_order_relaxed);
+	}
+}
+
+Metrics::Histogram Metrics::Summarize(const char* name, const std::vector<uint64_t>& buckets, uint64_t sum) const
+{
+	Histogram histogram = { name, 0u, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	for (uint64_t count : buckets)
+	{
+		histogram.count += count;
+	}
+
+	if (histogram.count == 0u)
+	{
+		return histogram;
+	}
+
+	histogram.meanMilliseconds = ToMilliseconds(static_cast<double>(sum) / histogram.count);
+
+	//Nearest rank, walking the buckets once for all three
+	const double percentiles[3] = { 50.0, 95.0, 99.0 };
+	double* results[3] = { &histogram.p50Milliseconds, &histogram.p95Milliseconds, &histogram.p99Milliseconds };
+	size_t next = 0u;
+	uint64_t seen = 0u;
+	for (size_t bucket = 0u; bucket < buckets.size(); ++bucket)
+	{
+		if (buckets[bucket] == 0u)
+		{
+			continue;
+		}
+
+		seen += buckets[bucket];
+		while (next < 3u && seen >= std::ceil(percentiles[next] / 100.0 * histogram.count))
+		{
+			*results[next++] = ToMilliseconds(BucketValue(bucket));
+		}
+		histogram.maxMilliseconds = ToMilliseconds(BucketValue(bucket));
+	}
+
+	return histogram;
+}
+
+std::vector<Metrics::Histogram> Metrics::GetHistograms() const
+{
+	std::vector<Histogram> histograms;
+	std::vector<uint64_t> buckets;
+	for (size_t i = 0u; i < MetricsConfig::MAX_METRICS; ++i)
+	{
+		const Slot& slot = m_slots[i];
+		const char* name = slot.name.load(std::memory_order_acquire);
+		if (!name || name == CLAIMING || slot.kind != Kind::HISTOGRAM || slot.histogram >= MetricsConfig::MAX_HISTOGRAMS)
+		{
+			continue;
+		}
+
+		uint64_t sum;
+		SumHistogram(slot, buckets, sum);
+		histograms.push_back(Summarize(name, buckets, sum));
+	}
+
+	std::sort(histograms.begin(), histograms.end(), ByName<Histogram>);
+	return histograms;
+}
+
+std::vector<float> Metrics::GetFrameTimes() const
+{
+	size_t count = GetFrameCount();
+	std::vector<float> frameTimes(count);
+	for (size_t i = 0u; i < count; ++i)
+	{
+		frameTimes[i] = m_frameTimes[(m_framesWritten - count + i) % HISTORY_SIZE];
+	}
+
+	return frameTimes;
+}
+
+float Metrics::GetFramePercentile(float percentile) const
+{
+	std::vector<float> frameTimes = GetFrameTimes();
+	if (frameTimes.empty())
+	{
+		return 0.0f;
+	}
+
+	size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0f * frameTimes.size()));
+	size_t index = std::min(std::max(rank, size_t(1)), frameTimes.size()) - 1u;
+	std::nth_element(frameTimes.begin(), frameTimes.begin() + index, frameTimes.end());
+	return frameTimes[index];
+}
+
+std::vector<Metrics::Stage> Metrics::GetStages() const
+{
+	size_t count = GetFrameCount();
+	std::vector<Stage> stages;
+	for (const StageHistory& history : m_stages)
+	{
+		//Slots past the written frames are still zero, the sum over the whole ring is the sum over the history
+		float sum = 0.0f;
+		for (float milliseconds : history.milliseconds)
+		{
+			sum += milliseconds;
+		}
+
+		Stage stage = { history.name, count ? sum / count : 0.0f };
+		stages.push_back(stage);
+	}
+
+	return stages;
+}
+
+size_t Metrics::GetFrameCount() const
+{
+	return std::min(m_framesWritten, HISTORY_SIZE);
+}
+
+bool Metrics::StartDump(const std::string& path, double intervalSeconds)
+{
+	StopDump();
+
+	std::unique_ptr<std::ostream> file(new std::ofstream(path));
+	if (!*file)
+	{
+		printf("Metrics: could not write %s\n\r", path.c_str());
+		return false;
+	}
+
+	m_stopDump = false;
+	m_enabled |= DUMP;
+	m_dumpThread = std::thread(&Metrics::DumpLoop, this, std::move(file), intervalSeconds);
+	return true;
+}
+
+void Metrics::StopDump()
+{
+	if (!m_dumpThread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_dumpMutex);
+		m_stopDump = true;
+	}
+	m_dumpWake.notify_one();
+	m_dumpThread.join();
+	m_enabled &= ~DUMP;
+}
+
+void Metrics::DumpLoop(std::unique_ptr<std::ostream> file, double intervalSeconds)
+{
+	std::vector<std::vector<uint64_t>> previousBuckets(MetricsConfig::MAX_HISTOGRAMS);
+	std::vector<uint64_t> previousSums(MetricsConfig::MAX_HISTOGRAMS, 0u);
+	auto interval = std::chrono::duration<double>(intervalSeconds);
+
+	std::unique_lock<std::mutex> lock(m_dumpMutex);
+	while (!m_dumpWake.wait_for(lock, interval, [this]() { return m_stopDump; }))
+	{
+		WriteJsonLine(*file, previousBuckets, previousSums);
+	}
+
+	//What was recorded since the last line
+	WriteJsonLine(*file, previousBuckets, previousSums);
+}
+
+void Metrics::WriteJsonLine(std::ostream& file, std::vector<std::vector<uint64_t>>& previousBuckets, std::vector<uint64_t>& previousSums) const
+{
+	file << std::fixed << std::setprecision(3);
+	file << "{\"time_s\":" << (Profiler::Now() - m_origin) / 1000000000.0;
+
+	file << ",\"counters\":{";
+	std::vector<Counter> counters = GetCounters();
+	for (size_t i = 0u; i < counters.size(); ++i)
+	{
+		file << (i ? "," : "");
+		WriteJsonString(file, counters[i].name);
+		file << ':' << counters[i].value;
+	}
+
+	file << "},\"gauges\":{";
+	std::vector<Gauge> gauges = GetGauges();
+	for (size_t i = 0u; i < gauges.size(); ++i)
+	{
+		file << (i ? "," : "");
+		WriteJsonString(file, gauges[i].name);
+		file << ':' << gauges[i].value;
+	}
+
+	//Percentiles over the interval only, the counts since the start are of little use after a few minutes
+	file << "},\"histograms\":{";
+	std::vector<Histogram> histograms;
+	std::vector<uint64_t> buckets;
+	for (size_t i = 0u; i < MetricsConfig::MAX_METRICS; ++i)
+	{
+		const Slot& slot = m_slots[i];
+		const char* name = slot.name.load(std::memory_order_acquire);
+		if (!name || name == CLAIMING || slot.kind != Kind::HISTOGRAM || slot.histogram >= MetricsConfig::MAX_HISTOGRAMS)
+		{
+			continue;
+		}
+
+		uint64_t sum;
+		SumHistogram(slot, buckets, sum);
+
+		std::vector<uint64_t>& previous = previousBuckets[slot.histogram];
+		previous.resize(MetricsConfig::BUCKET_COUNT, 0u);
+		std::vector<uint64_t> interval(MetricsConfig::BUCKET_COUNT);
+		for (size_t bucket = 0u; bucket < MetricsConfig::BUCKET_COUNT; ++bucket)
+		{
+			interval[bucket] = buckets[bucket] - previous[bucket];
+		}
+		histograms.push_back(Summarize(name, interval, sum - previousSums[slot.histogram]));
+
+		previous = buckets;
+		previousSums[slot.histogram] = sum;
+	}
+
+	std::sort(histograms.begin(), histograms.end(), ByName<Histogram>);
+	for (size_t i = 0u; i < histograms.size(); ++i)
+	{
+		const Histogram& histogram = histograms[i];
+		file << (i ? "," : "");
+		WriteJsonString(file, histogram.name);
+		file << ":{\"count\":" << histogram.count << ",\"mean_ms\":" << histogram.meanMilliseconds
+			<< ",\"p50_ms\":" << histogram.p50Milliseconds << ",\"p95_ms\":" << histogram.p95Milliseconds
+			<< ",\"p99_ms\":" << histogram.p99Milliseconds << ",\"max_ms\":" << histogram.maxMilliseconds << '}';
+	}
+	file << "}}" << std::endl;
+}
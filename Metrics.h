@@ -0,0 +1,205 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Profiler.h"
+
+// Shared registry of counters, gauges and latency histograms, and of the frame and stage times the performance
+// overlay draws.
+// Counters and histograms are sharded per thread: every thread adds to its own shard and readers sum the shards,
+// so recording never takes a lock and threads never write the same cache line. Histograms have HDR-style
+// log-linear buckets, eight per power of two, so every recorded latency keeps about 12% precision.
+// Metrics are registered by their first use in a fixed table without locks. Names are not copied, like profiler
+// names they have to be string literals.
+// Timers only measure while the overlay is shown or metrics are dumped, otherwise they cost one relaxed load.
+class Metrics
+{
+public:
+	// Adds the time of the scope it is declared in to a stage of the current frame and records a profiler zone of
+	// the same name. A stage may be timed several times per frame, its times are summed. Main thread only.
+	class StageTimer
+	{
+	public:
+		explicit StageTimer(const char* stage);
+		~StageTimer();
+
+		StageTimer(const StageTimer&) = delete;
+		StageTimer& operator=(const StageTimer&) = delete;
+
+	private:
+		Profiler::Zone m_zone;
+		const char* m_stage;
+		uint64_t m_start;
+		bool m_measuring;
+	};
+
+	// Records the time of the scope it is declared in to a latency histogram, on any thread
+	class LatencyTimer
+	{
+	public:
+		explicit LatencyTimer(const char* histogram);
+		~LatencyTimer();
+
+		LatencyTimer(const LatencyTimer&) = delete;
+		LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+	private:
+		const char* m_histogram;
+		uint64_t m_start;
+		bool m_measuring;
+	};
+
+	struct GaugeUnit
+	{
+		enum Enum
+		{
+			COUNT,
+			BYTES
+		};
+	};
+
+	struct Counter
+	{
+		const char* name;
+		int64_t value;
+	};
+
+	struct Gauge
+	{
+		const char* name;
+		GaugeUnit::Enum unit;
+		double value;
+	};
+
+	struct Histogram
+	{
+		const char* name;
+		uint64_t count;
+		// Percentiles and the maximum are the middle of their bucket
+		double meanMilliseconds, p50Milliseconds, p95Milliseconds, p99Milliseconds, maxMilliseconds;
+	};
+
+	struct Stage
+	{
+		const char* name;
+		// Mean over the frames in the history
+		float meanMilliseconds;
+	};
+
+	// Frames the histories hold, four seconds at 60 fps
+	static const size_t HISTORY_SIZE = 240;
+
+	static Metrics& Get();
+	~Metrics();
+
+	// Shows or hides the overlay. The frame histories start over when it is shown, so they never span a time it was hidden.
+	void SetEnabled(bool enabled);
+	// True while the overlay is shown or metrics are dumped
+	bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed) != 0u; }
+
+	// Counters always count, they cost an uncontended atomic add
+	void Add(const char* counter, int64_t delta = 1);
+	// Gauges keep the last value set from any thread
+	void SetGauge(const char* name, double value, GaugeUnit::Enum unit = GaugeUnit::COUNT);
+	void RecordLatency(const char* histogram, uint64_t nanoseconds);
+
+	// Stage and frame times, main thread only
+	void AddStageTime(const char* stage, float milliseconds);
+	// Closes the current frame, called once per frame at the same point. Its time is measured from the previous call
+	// and recorded to the "Frame" histogram, the time of every stage to a histogram of the stage's name.
+	void EndFrame();
+
+	// Sums of all shards, sorted by name
+	std::vector<Counter> GetCounters() const;
+	// Of one counter, 0 until it is first added to
+	int64_t GetCounter(const char* name) const;
+	std::vector<Gauge> GetGauges() const;
+	// Everything recorded since the start
+	std::vector<Histogram> GetHistograms() const;
+
+	// Oldest first, main thread only like the rest of the frame history
+	std::vector<float> GetFrameTimes() const;
+	// Nearest rank percentile of the frame times in the history, 0 while it is empty
+	float GetFramePercentile(float percentile) const;
+	// In the order the stages were first timed
+	std::vector<Stage> GetStages() const;
+
+	// Writes a JSON line with all counters, gauges and the histograms of the interval to path every interval from a
+	// thread of its own, and enables measuring meanwhile. The file is replaced.
+	bool StartDump(const std::string& path, double intervalSeconds);
+	// Writes the last line and closes the file
+	void StopDump();
+	bool IsDumping() const { return m_dumpThread.joinable(); }
+
+private:
+	struct Kind
+	{
+		enum Enum
+		{
+			COUNTER,
+			GAUGE,
+			HISTOGRAM
+		};
+	};
+
+	struct Slot;
+	struct Shard;
+
+	struct StageHistory
+	{
+		const char* name;
+		// Time added since the last EndFrame
+		float frameMilliseconds;
+		// Ring of HISTORY_SIZE frames written at the same index as the frame times
+		std::vector<float> milliseconds;
+	};
+
+	// Sources that need measuring, any of them enables it
+	static const unsigned int OVERLAY = 1u;
+	static const unsigned int DUMP = 2u;
+
+	Metrics();
+
+	// Slot of name, registered as kind on first use. Null once the table is full or if name has another kind.
+	Slot* FindSlot(const char* name, Kind::Enum kind, bool insert);
+	Shard& GetShard();
+	// Buckets and nanosecond sum of a histogram over all shards
+	void SumHistogram(const Slot& slot, std::vector<uint64_t>& buckets, uint64_t& sum) const;
+	Histogram Summarize(const char* name, const std::vector<uint64_t>& buckets, uint64_t sum) const;
+	// Histogram buckets of the previous line are kept to write only what was recorded since
+	void WriteJsonLine(std::ostream& file, std::vector<std::vector<uint64_t>>& previousBuckets, std::vector<uint64_t>& previousSums) const;
+	void DumpLoop(std::unique_ptr<std::ostream> file, double intervalSeconds);
+	// Valid frames in the histories
+	size_t GetFrameCount() const;
+
+	// Shard of the calling thread, created with its first record
+	static thread_local Shard* t_shard;
+
+	std::atomic<unsigned int> m_enabled;
+	uint64_t m_origin;
+	std::unique_ptr<Slot[]> m_slots;
+	std::atomic<size_t> m_histogramCount;
+	std::unique_ptr<std::atomic<Shard*>[]> m_shards;
+	std::atomic<size_t> m_shardCount;
+
+	// Frame history, main thread only
+	std::vector<StageHistory> m_stages;
+	std::vector<float> m_frameTimes;
+	// Frames ever closed, the newest is at (m_framesWritten - 1) % HISTORY_SIZE
+	size_t m_framesWritten = 0;
+	// Profiler::Now of the last EndFrame, 0 until the first frame after enabling
+	uint64_t m_lastFrameEnd = 0;
+
+	// Only wakes the dump thread early when it has to stop, never guards any metric
+	std::thread m_dumpThread;
+	std::mutex m_dumpMutex;
+	std::condition_variable m_dumpWake;
+	bool m_stopDump = false;
+};
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "Noise.h"
+#include <cstring>
 
 using namespace DirectX::SimpleMath;
 
@@ -7,6 +8,7 @@ Noise::Noise() {
     // Generate PermMap
     for (int i = 0; i < 512; i++) {
         permMap[i] = p[i & 255];
+        permMod12[i] = permMap[i] % 12;
     }
 }
 // Simplex Noise Generation
@@ -163,4 +165,180 @@ double Noise::Dot(int g[], double x, double y) {
 
 double Noise::Dot(int g[], double x, double y, double z) {
     return g[0] * x + g[1] * y + g[2] * z;
+}
+
+namespace
+{
+	//FastFloor for four values, including its step down at whole non positive numbers
+	inline XMVECTOR VectorFastFloor(FXMVECTOR x) {
+		return XMVectorSubtract(XMVectorTruncate(x), XMVectorSelect(XMVectorSplatOne(), XMVectorZero(), XMVectorGreater(x, XMVectorZero())));
+	}
+
+	//Corner contribution (max(t, 0))^4 * dot(gradient, offset)
+	inline XMVECTOR Contribution(FXMVECTOR t, FXMVECTOR dot) {
+		XMVECTOR squared = XMVectorMax(t, XMVectorZero());
+		squared = XMVectorMultiply(squared, squared);
+		return XMVectorMultiply(XMVectorMultiply(squared, squared), dot);
+	}
+
+	//Four floats from a possibly unaligned array, padded with zeros past count
+	inline XMVECTOR LoadLanes(const float* source, size_t count) {
+		if (count >= 4) {
+			return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(source));
+		}
+		XMFLOAT4 lanes(0.0f, 0.0f, 0.0f, 0.0f);
+		memcpy(&lanes, source, count * sizeof(float));
+		return XMLoadFloat4(&lanes);
+	}
+
+	inline void StoreLanes(float* destination, size_t count, FXMVECTOR value) {
+		if (count >= 4) {
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(destination), value);
+			return;
+		}
+		XMFLOAT4 lanes;
+		XMStoreFloat4(&lanes, value);
+		memcpy(destination, &lanes, count * sizeof(float));
+	}
+}
+
+void Noise::Noise2DBatch(const float* x, const float* y, size_t count, float* output) const {
+	for (size_t i = 0; i < count; i += 4) {
+		size_t lanes = count - i;
+		StoreLanes(output + i, lanes, SimplexNoise2D(LoadLanes(x + i, lanes), LoadLanes(y + i, lanes)));
+	}
+}
+
+void Noise::Noise3DBatch(const float* x, const float* y, const float* z, size_t count, float* output) const {
+	for (size_t i = 0; i < count; i += 4) {
+		size_t lanes = count - i;
+		StoreLanes(output + i, lanes, SimplexNoise3D(LoadLanes(x + i, lanes), LoadLanes(y + i, lanes), LoadLanes(z + i, lanes)));
+	}
+}
+
+// Noise2D on four points, the skewing and corner falloffs run on vectors and only the hashing is done per lane
+XMVECTOR Noise::SimplexNoise2D(FXMVECTOR x, FXMVECTOR y) const {
+	const XMVECTOR one = XMVectorSplatOne();
+	const float G2 = static_cast<float>((3.0 - sqrt(3.0)) / 6.0);
+	XMVECTOR s = XMVectorMultiply(XMVectorAdd(x, y), XMVectorReplicate(static_cast<float>(0.5 * (sqrt(3.0) - 1.0))));
+	XMVECTOR i = VectorFastFloor(XMVectorAdd(x, s));
+	XMVECTOR j = VectorFastFloor(XMVectorAdd(y, s));
+	XMVECTOR t = XMVectorMultiply(XMVectorAdd(i, j), XMVectorReplicate(G2));
+	XMVECTOR x0 = XMVectorSubtract(x, XMVectorSubtract(i, t));
+	XMVECTOR y0 = XMVectorSubtract(y, XMVectorSubtract(j, t));
+	// Lower triangle where x0 > y0, upper one otherwise
+	XMVECTOR lower = XMVectorGreater(x0, y0);
+	XMVECTOR i1 = XMVectorAndInt(lower, one);
+	XMVECTOR j1 = XMVectorAndCInt(one, lower);
+	XMVECTOR x1 = XMVectorAdd(XMVectorSubtract(x0, i1), XMVectorReplicate(G2));
+	XMVECTOR y1 = XMVectorAdd(XMVectorSubtract(y0, j1), XMVectorReplicate(G2));
+	XMVECTOR x2 = XMVectorAdd(x0, XMVectorReplicate(2.0f * G2 - 1.0f));
+	XMVECTOR y2 = XMVectorAdd(y0, XMVectorReplicate(2.0f * G2 - 1.0f));
+
+	// Hash the corners of every lane and gather their gradients
+	XMVECTORF32 cell[2], offset;
+	cell[0].v = i;
+	cell[1].v = j;
+	offset.v = i1;
+	XMVECTORF32 gradient[3][2];
+	for (int lane = 0; lane < 4; lane++) {
+		int ii = static_cast<int>(cell[0].f[lane]) & 255;
+		int jj = static_cast<int>(cell[1].f[lane]) & 255;
+		int lower1 = static_cast<int>(offset.f[lane]);
+		int gi[3] = {
+			permMod12[ii + permMap[jj]],
+			permMod12[ii + lower1 + permMap[jj + 1 - lower1]],
+			permMod12[ii + 1 + permMap[jj + 1]] };
+		for (int corner = 0; corner < 3; corner++) {
+			gradient[corner][0].f[lane] = static_cast<float>(gradient3map[gi[corner]][0]);
+			gradient[corner][1].f[lane] = static_cast<float>(gradient3map[gi[corner]][1]);
+		}
+	}
+
+	const XMVECTOR falloff = XMVectorReplicate(0.5f);
+	XMVECTOR n0 = Contribution(XMVectorSubtract(falloff, XMVectorMultiplyAdd(x0, x0, XMVectorMultiply(y0, y0))),
+		XMVectorMultiplyAdd(gradient[0][0], x0, XMVectorMultiply(gradient[0][1], y0)));
+	XMVECTOR n1 = Contribution(XMVectorSubtract(falloff, XMVectorMultiplyAdd(x1, x1, XMVectorMultiply(y1, y1))),
+		XMVectorMultiplyAdd(gradient[1][0], x1, XMVectorMultiply(gradient[1][1], y1)));
+	XMVECTOR n2 = Contribution(XMVectorSubtract(falloff, XMVectorMultiplyAdd(x2, x2, XMVectorMultiply(y2, y2))),
+		XMVectorMultiplyAdd(gradient[2][0], x2, XMVectorMultiply(gradient[2][1], y2)));
+	return XMVectorMultiply(XMVectorReplicate(70.0f), XMVectorAdd(XMVectorAdd(n0, n1), n2));
+}
+
+// Noise3D on four points, the simplex ordering is picked with comparison masks instead of branches
+XMVECTOR Noise::SimplexNoise3D(FXMVECTOR x, FXMVECTOR y, FXMVECTOR z) const {
+	const XMVECTOR one = XMVectorSplatOne();
+	const XMVECTOR G3 = XMVectorReplicate(1.0f / 6.0f);
+	XMVECTOR s = XMVectorMultiply(XMVectorAdd(XMVectorAdd(x, y), z), XMVectorReplicate(1.0f / 3.0f));
+	XMVECTOR i = VectorFastFloor(XMVectorAdd(x, s));
+	XMVECTOR j = VectorFastFloor(XMVectorAdd(y, s));
+	XMVECTOR k = VectorFastFloor(XMVectorAdd(z, s));
+	XMVECTOR t = XMVectorMultiply(XMVectorAdd(XMVectorAdd(i, j), k), G3);
+	XMVECTOR x0 = XMVectorSubtract(x, XMVectorSubtract(i, t));
+	XMVECTOR y0 = XMVectorSubtract(y, XMVectorSubtract(j, t));
+	XMVECTOR z0 = XMVectorSubtract(z, XMVectorSubtract(k, t));
+	// The six orderings of Noise3D, with the same tie breaking
+	XMVECTOR xy = XMVectorGreaterOrEqual(x0, y0);
+	XMVECTOR yz = XMVectorGreaterOrEqual(y0, z0);
+	XMVECTOR xz = XMVectorGreaterOrEqual(x0, z0);
+	XMVECTOR i1 = XMVectorAndInt(XMVectorAndInt(xy, xz), one);
+	XMVECTOR j1 = XMVectorAndInt(XMVectorAndCInt(yz, xy), one);
+	XMVECTOR k1 = XMVectorAndCInt(one, XMVectorOrInt(xz, yz));
+	XMVECTOR i2 = XMVectorAndInt(XMVectorOrInt(xy, xz), one);
+	XMVECTOR j2 = XMVectorSubtract(one, XMVectorAndInt(XMVectorAndCInt(xy, yz), one));
+	XMVECTOR k2 = XMVectorAndCInt(one, XMVectorAndInt(xz, yz));
+	XMVECTOR x1 = XMVectorAdd(XMVectorSubtract(x0, i1), G3);
+	XMVECTOR y1 = XMVectorAdd(XMVectorSubtract(y0, j1), G3);
+	XMVECTOR z1 = XMVectorAdd(XMVectorSubtract(z0, k1), G3);
+	XMVECTOR x2 = XMVectorAdd(XMVectorSubtract(x0, i2), XMVectorReplicate(2.0f / 6.0f));
+	XMVECTOR y2 = XMVectorAdd(XMVectorSubtract(y0, j2), XMVectorReplicate(2.0f / 6.0f));
+	XMVECTOR z2 = XMVectorAdd(XMVectorSubtract(z0, k2), XMVectorReplicate(2.0f / 6.0f));
+	XMVECTOR x3 = XMVectorAdd(x0, XMVectorReplicate(-0.5f));
+	XMVECTOR y3 = XMVectorAdd(y0, XMVectorReplicate(-0.5f));
+	XMVECTOR z3 = XMVectorAdd(z0, XMVectorReplicate(-0.5f));
+
+	// Hash the corners of every lane and gather their gradients
+	XMVECTORF32 cell[3], offset[6];
+	cell[0].v = i;
+	cell[1].v = j;
+	cell[2].v = k;
+	offset[0].v = i1;
+	offset[1].v = j1;
+	offset[2].v = k1;
+	offset[3].v = i2;
+	offset[4].v = j2;
+	offset[5].v = k2;
+	XMVECTORF32 gradient[4][3];
+	for (int lane = 0; lane < 4; lane++) {
+		int ii = static_cast<int>(cell[0].f[lane]) & 255;
+		int jj = static_cast<int>(cell[1].f[lane]) & 255;
+		int kk = static_cast<int>(cell[2].f[lane]) & 255;
+		int o[6];
+		for (int n = 0; n < 6; n++) {
+			o[n] = static_cast<int>(offset[n].f[lane]);
+		}
+		int gi[4] = {
+			permMod12[ii + permMap[jj + permMap[kk]]],
+			permMod12[ii + o[0] + permMap[jj + o[1] + permMap[kk + o[2]]]],
+			permMod12[ii + o[3] + permMap[jj + o[4] + permMap[kk + o[5]]]],
+			permMod12[ii + 1 + permMap[jj + 1 + permMap[kk + 1]]] };
+		for (int corner = 0; corner < 4; corner++) {
+			for (int axis = 0; axis < 3; axis++) {
+				gradient[corner][axis].f[lane] = static_cast<float>(gradient3map[gi[corner]][axis]);
+			}
+		}
+	}
+
+	const XMVECTOR* corners[4][3] = { { &x0, &y0, &z0 }, { &x1, &y1, &z1 }, { &x2, &y2, &z2 }, { &x3, &y3, &z3 } };
+	XMVECTOR sum = XMVectorZero();
+	for (int corner = 0; corner < 4; corner++) {
+		XMVECTOR cx = *corners[corner][0], cy = *corners[corner][1], cz = *corners[corner][2];
+		// Noise3D lets the first corner fall off over 0.5 and the others over 0.6, kept as is
+		XMVECTOR falloff = XMVectorReplicate(corner == 0 ? 0.5f : 0.6f);
+		XMVECTOR lengthSquared = XMVectorMultiplyAdd(cx, cx, XMVectorMultiplyAdd(cy, cy, XMVectorMultiply(cz, cz)));
+		XMVECTOR dot = XMVectorMultiplyAdd(gradient[corner][0], cx,
+			XMVectorMultiplyAdd(gradient[corner][1], cy, XMVectorMultiply(gradient[corner][2], cz)));
+		sum = XMVectorAdd(sum, Contribution(XMVectorSubtract(falloff, lengthSquared), dot));
+	}
+	return XMVectorMultiply(XMVectorReplicate(32.0f), sum);
 }
\ No newline at end of file
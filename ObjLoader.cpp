@@ -0,0 +1,627 @@
+#include "pch.h"
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include "Profiler.h"
+#include <cmath>
+#include <cstring>
+
+namespace ObjLoaderConfig
+{
+	//Large enough that splitting and merging the chunks is noise next to parsing them
+	const size_t CHUNK_BYTES = 1 << 20;
+
+	//Corners are merged in this many partitions per thread, stealing evens out partitions of busier positions
+	const size_t PARTITIONS_PER_THREAD = 4;
+}
+
+namespace
+{
+	//Index of an attribute a corner does not have
+	const uint32_t MISSING = 0xFFFFFFFFu;
+
+	struct Attribute
+	{
+		enum Enum
+		{
+			POSITION,
+			TEXTURE,
+			NORMAL,
+			COUNT
+		};
+	};
+
+	//0 based indices of the position, texture coordinate and normal of a triangle corner
+	struct Corner
+	{
+		uint32_t index[Attribute::COUNT];
+	};
+
+	//Negative OBJ indices count back from the last attribute read so far, which is only known relative to the chunk
+	//until the chunks before it are counted. local is the index from the start of the chunk and may be negative.
+	struct Fixup
+	{
+		size_t corner;
+		Attribute::Enum attribute;
+		int64_t local;
+	};
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<DirectX::XMFLOAT3> positions;
+		std::vector<DirectX::XMFLOAT2> textures;
+		std::vector<DirectX::XMFLOAT3> normals;
+		//Three per triangle
+		std::vector<Corner> corners;
+		std::vector<Fixup> fixups;
+		//Start of the first line that could not be parsed
+		const char* error = nullptr;
+		//Attributes in the chunks before this one
+		size_t base[Attribute::COUNT];
+		//Corners in the chunks before this one
+		size_t firstCorner;
+	};
+
+	//A corner and where it is among the corners of the whole file
+	struct NumberedCorner
+	{
+		Corner corner;
+		uint32_t id;
+	};
+
+	//First use of a corner in a partition, chained to the other corners at the same position
+	struct FirstCorner
+	{
+		Corner corner;
+		uint32_t id;
+		uint32_t next;
+	};
+
+	//Corner of a face while it is read, before it is copied to the triangles of its fan
+	struct FaceCorner
+	{
+		Corner corner;
+		bool local[Attribute::COUNT];
+		int64_t localIndex[Attribute::COUNT];
+	};
+
+	//Every power of ten a double holds exactly
+	const double POWERS_OF_TEN[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const int MAX_EXACT_POWER = 22;
+	//Mantissas of up to 15 digits stay below 2^53 and convert to a double exactly, later digits cannot change a float
+	const int MAX_DIGITS = 15;
+
+	bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	void SkipSpaces(const char*& p, const char* end)
+	{
+		while (p < end && IsSpace(*p))
+		{
+			++p;
+		}
+	}
+
+	//Decimal with an optional sign, fraction and exponent. Up to 15 significant digits and powers of ten up to 22 are
+	//rounded once to a double, so the float is within an ulp of strtof; exporters write far fewer digits than that.
+	bool ParseFloat(const char*& p, const char* end, float& value)
+	{
+		SkipSpaces(p, end);
+
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			++p;
+		}
+
+		uint64_t mantissa = 0;
+		int exponent = 0, digits = 0;
+		bool anyDigits = false;
+		for (; p < end && IsDigit(*p); ++p)
+		{
+			if (digits < MAX_DIGITS)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa > 0 ? 1 : 0;
+			}
+			else
+			{
+				exponent++;
+			}
+			anyDigits = true;
+		}
+
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && IsDigit(*p); ++p)
+			{
+				if (digits < MAX_DIGITS)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					digits += mantissa > 0 ? 1 : 0;
+					exponent--;
+				}
+				anyDigits = true;
+			}
+		}
+
+		if (!anyDigits)
+		{
+			return false;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			++p;
+			bool negativeExponent = p < end && *p == '-';
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				++p;
+			}
+
+			int written = 0;
+			bool anyExponentDigits = false;
+			for (; p < end && IsDigit(*p); ++p)
+			{
+				//Anything this large is out of range for a float already
+				written = written < 10000 ? written * 10 + (*p - '0') : written;
+				anyExponentDigits = true;
+			}
+
+			if (!anyExponentDigits)
+			{
+				return false;
+			}
+			exponent += negativeExponent ? -written : written;
+		}
+
+		double result = static_cast<double>(mantissa);
+		if (exponent < 0)
+		{
+			result /= -exponent <= MAX_EXACT_POWER ? POWERS_OF_TEN[-exponent] : std::pow(10.0, -exponent);
+		}
+		else if (exponent > 0)
+		{
+			result *= exponent <= MAX_EXACT_POWER ? POWERS_OF_TEN[exponent] : std::pow(10.0, exponent);
+		}
+
+		value = static_cast<float>(negative ? -result : result);
+		return true;
+	}
+
+	bool ParseIndex(const char*& p, const char* end, int64_t& value)
+	{
+		bool negative = p < end && *p == '-';
+		if (negative)
+		{
+			++p;
+		}
+
+		if (p == end || !IsDigit(*p))
+		{
+			return false;
+		}
+
+		value = 0;
+		for (; p < end && IsDigit(*p); ++p)
+		{
+			//Anything this large is out of range of every attribute list
+			value = value < (int64_t(1) << 40) ? value * 10 + (*p - '0') : value;
+		}
+
+		value = negative ? -value : value;
+		return true;
+	}
+
+	//OBJ indices start at 1, negative ones count back from the last attribute so far and 0 is invalid
+	bool ResolveIndex(int64_t value, Attribute::Enum attribute, size_t readSoFar, FaceCorner& corner)
+	{
+		if (value > 0 && value <= MISSING)
+		{
+			corner.corner.index[attribute] = static_cast<uint32_t>(value - 1);
+			return true;
+		}
+
+		if (value < 0)
+		{
+			corner.local[attribute] = true;
+			corner.localIndex[attribute] = static_cast<int64_t>(readSoFar) + value;
+			return true;
+		}
+
+		return false;
+	}
+
+	void AddCorner(Chunk& chunk, const FaceCorner& corner)
+	{
+		for (int attribute = 0; attribute < Attribute::COUNT; ++attribute)
+		{
+			if (corner.local[attribute])
+			{
+				Fixup fixup = { chunk.corners.size(), static_cast<Attribute::Enum>(attribute), corner.localIndex[attribute] };
+				chunk.fixups.push_back(fixup);
+			}
+		}
+		chunk.corners.push_back(corner.corner);
+	}
+
+	//Corners are position, position/texture, position//normal or position/texture/normal
+	bool ParseFace(const char* p, const char* end, Chunk& chunk)
+	{
+		FaceCorner first = {}, previous = {};
+		size_t count = 0;
+
+		for (SkipSpaces(p, end); p < end; SkipSpaces(p, end))
+		{
+			FaceCorner corner = {};
+			corner.corner.index[Attribute::TEXTURE] = MISSING;
+			corner.corner.index[Attribute::NORMAL] = MISSING;
+
+			int64_t value = 0;
+			if (!ParseIndex(p, end, value) || !ResolveIndex(value, Attribute::POSITION, chunk.positions.size(), corner))
+			{
+				return false;
+			}
+
+			if (p < end && *p == '/')
+			{
+				++p;
+				if (p < end && *p != '/' && (!ParseIndex(p, end, value) || !ResolveIndex(value, Attribute::TEXTURE, chunk.textures.size(), corner)))
+				{
+					return false;
+				}
+
+				if (p < end && *p == '/')
+				{
+					++p;
+					if (!ParseIndex(p, end, value) || !ResolveIndex(value, Attribute::NORMAL, chunk.normals.size(), corner))
+					{
+						return false;
+					}
+				}
+			}
+
+			if (p < end && !IsSpace(*p))
+			{
+				return false;
+			}
+
+			//Fan around the first corner
+			if (count == 0)
+			{
+				first = corner;
+			}
+			else if (count >= 2)
+			{
+				AddCorner(chunk, first);
+				AddCorner(chunk, previous);
+				AddCorner(chunk, corner);
+			}
+			previous = corner;
+			count++;
+		}
+
+		return count >= 3;
+	}
+
+	bool ParseLine(const char* p, const char* end, Chunk& chunk)
+	{
+		SkipSpaces(p, end);
+		if (end - p < 2)
+		{
+			return true;
+		}
+
+		if (p[0] == 'v' && IsSpace(p[1]))
+		{
+			DirectX::XMFLOAT3 position;
+			p += 2;
+			bool parsed = ParseFloat(p, end, position.x) && ParseFloat(p, end, position.y) && ParseFloat(p, end, position.z);
+			chunk.positions.push_back(position);
+			return parsed;
+		}
+
+		if (p[0] == 'v' && p[1] == 't' && end - p > 2 && IsSpace(p[2]))
+		{
+			//The v coordinate is optional
+			DirectX::XMFLOAT2 texture(0.0f, 0.0f);
+			p += 3;
+			bool parsed = ParseFloat(p, end, texture.x);
+			SkipSpaces(p, end);
+			if (parsed && p < end)
+			{
+				parsed = ParseFloat(p, end, texture.y);
+			}
+			chunk.textures.push_back(texture);
+			return parsed;
+		}
+
+		if (p[0] == 'v' && p[1] == 'n' && end - p > 2 && IsSpace(p[2]))
+		{
+			DirectX::XMFLOAT3 normal;
+			p += 3;
+			bool parsed = ParseFloat(p, end, normal.x) && ParseFloat(p, end, normal.y) && ParseFloat(p, end, normal.z);
+			chunk.normals.push_back(normal);
+			return parsed;
+		}
+
+		if (p[0] == 'f' && IsSpace(p[1]))
+		{
+			return ParseFace(p + 2, end, chunk);
+		}
+
+		//Comments, groups, smoothing groups, materials and other statements
+		return true;
+	}
+
+	void ParseChunk(Chunk& chunk)
+	{
+		for (const char* line = chunk.begin; line < chunk.end; )
+		{
+			const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', chunk.end - line));
+			lineEnd = lineEnd ? lineEnd : chunk.end;
+
+			if (!ParseLine(line, lineEnd, chunk))
+			{
+				chunk.error = line;
+				return;
+			}
+			line = lineEnd + 1;
+		}
+	}
+
+	bool SameCorner(const Corner& a, const Corner& b)
+	{
+		return a.index[0] == b.index[0] && a.index[1] == b.index[1] && a.index[2] == b.index[2];
+	}
+}
+
+bool ObjLoader::Load(const std::wstring& path, Mesh& mesh)
+{
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		printf("OBJ model %ls could not be opened\n\r", path.c_str());
+		return false;
+	}
+
+	if (!Parse(file.GetData(), file.GetSize(), mesh))
+	{
+		printf("OBJ model %ls could not be parsed\n\r", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool ObjLoader::Parse(const char* data, size_t size, Mesh& mesh)
+{
+	Profiler::Zone zone("ObjLoader::Parse");
+
+	mesh.vertices.clear();
+	mesh.indices.clear();
+
+	//Chunks end after the first line break past their share of the text
+	size_t chunkCount = std::max<size_t>(1u, size / ObjLoaderConfig::CHUNK_BYTES);
+	std::vector<Chunk> chunks(chunkCount);
+	const char* end = data + size;
+	const char* begin = data;
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		const char* chunkEnd = i + 1 == chunkCount ? end : data + size / chunkCount * (i + 1);
+		chunkEnd = std::max(chunkEnd, begin);
+		const char* lineBreak = static_cast<const char*>(std::memchr(chunkEnd, '\n', end - chunkEnd));
+		chunkEnd = lineBreak ? lineBreak + 1 : end;
+
+		chunks[i].begin = begin;
+		chunks[i].end = chunkEnd;
+		begin = chunkEnd;
+	}
+
+	ParallelFor(chunkCount, [&](size_t i) { ParseChunk(chunks[i]); });
+
+	size_t totals[Attribute::COUNT] = {};
+	size_t cornerCount = 0;
+	for (Chunk& chunk : chunks)
+	{
+		if (chunk.error)
+		{
+			const char* lineEnd = static_cast<const char*>(std::memchr(chunk.error, '\n', chunk.end - chunk.error));
+			int length = static_cast<int>(std::min<ptrdiff_t>((lineEnd ? lineEnd : chunk.end) - chunk.error, 80));
+			printf("OBJ line at byte %zu could not be parsed: %.*s\n\r", static_cast<size_t>(chunk.error - data), length, chunk.error);
+			return false;
+		}
+
+		chunk.base[Attribute::POSITION] = totals[Attribute::POSITION];
+		chunk.base[Attribute::TEXTURE] = totals[Attribute::TEXTURE];
+		chunk.base[Attribute::NORMAL] = totals[Attribute::NORMAL];
+		totals[Attribute::POSITION] += chunk.positions.size();
+		totals[Attribute::TEXTURE] += chunk.textures.size();
+		totals[Attribute::NORMAL] += chunk.normals.size();
+		chunk.firstCorner = cornerCount;
+		cornerCount += chunk.corners.size();
+	}
+
+	std::vector<DirectX::XMFLOAT3> positions(totals[Attribute::POSITION]);
+	std::vector<DirectX::XMFLOAT2> textures(totals[Attribute::TEXTURE]);
+	std::vector<DirectX::XMFLOAT3> normals(totals[Attribute::NORMAL]);
+	std::vector<uint8_t> badFixups(chunkCount, 0u);
+	ParallelFor(chunkCount, [&](size_t i)
+	{
+		Chunk& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.base[Attribute::POSITION]);
+		std::copy(chunk.textures.begin(), chunk.textures.end(), textures.begin() + chunk.base[Attribute::TEXTURE]);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.base[Attribute::NORMAL]);
+
+		for (const Fixup& fixup : chunk.fixups)
+		{
+			int64_t index = static_cast<int64_t>(chunk.base[fixup.attribute]) + fixup.local;
+			badFixups[i] |= index < 0 ? 1u : 0u;
+			chunk.corners[fixup.corner].index[fixup.attribute] = index < 0 ? MISSING : static_cast<uint32_t>(index);
+		}
+	});
+
+	if (std::find(badFixups.begin(), badFixups.end(), 1u) != badFixups.end())
+	{
+		printf("OBJ face refers back past the first attribute\n\r");
+		return false;
+	}
+
+	//Every corner becomes a vertex where the faces first use it and an index of that vertex after. Corners are split
+	//into partitions by position, partitions never share a vertex, so they find the first uses of their corners in
+	//parallel. Faces share most corners with their neighbours, there are far fewer vertices than corners.
+	Profiler::Zone mergeZone("ObjLoader merge");
+	size_t partitionCount = std::max<size_t>(1u, std::min(JobSystem::Get().GetThreadCount() * ObjLoaderConfig::PARTITIONS_PER_THREAD, positions.size()));
+	size_t positionsPerPartition = std::max<size_t>(1u, (positions.size() + partitionCount - 1) / partitionCount);
+
+	std::vector<size_t> cursors(chunkCount * partitionCount, 0u);
+	std::vector<uint8_t> badCorners(chunkCount, 0u);
+	ParallelFor(chunkCount, [&](size_t i)
+	{
+		size_t* counts = &cursors[i * partitionCount];
+		for (const Corner& corner : chunks[i].corners)
+		{
+			uint32_t texture = corner.index[Attribute::TEXTURE];
+			uint32_t normal = corner.index[Attribute::NORMAL];
+			if (corner.index[Attribute::POSITION] >= positions.size() || (texture != MISSING && texture >= textures.size()) || (normal != MISSING && normal >= normals.size()))
+			{
+				badCorners[i] = 1u;
+				return;
+			}
+			counts[corner.index[Attribute::POSITION] / positionsPerPartition]++;
+		}
+	});
+
+	if (std::find(badCorners.begin(), badCorners.end(), 1u) != badCorners.end())
+	{
+		printf("OBJ face refers to a missing attribute\n\r");
+		return false;
+	}
+
+	//Partitions take the corners of every chunk in turn, so they keep the order of the faces
+	std::vector<size_t> partitionStarts(partitionCount + 1);
+	size_t offset = 0;
+	for (size_t partition = 0; partition < partitionCount; ++partition)
+	{
+		partitionStarts[partition] = offset;
+		for (size_t i = 0; i < chunkCount; ++i)
+		{
+			size_t count = cursors[i * partitionCount + partition];
+			cursors[i * partitionCount + partition] = offset;
+			offset += count;
+		}
+	}
+	partitionStarts[partitionCount] = offset;
+
+	std::vector<NumberedCorner> partitioned(cornerCount);
+	ParallelFor(chunkCount, [&](size_t i)
+	{
+		size_t* chunkCursors = &cursors[i * partitionCount];
+		uint32_t id = static_cast<uint32_t>(chunks[i].firstCorner);
+		for (const Corner& corner : chunks[i].corners)
+		{
+			NumberedCorner& numbered = partitioned[chunkCursors[corner.index[Attribute::POSITION] / positionsPerPartition]++];
+			numbered.corner = corner;
+			numbered.id = id++;
+		}
+	});
+
+	//The first corner equal to every corner, itself where it is the first
+	std::vector<uint32_t> firstUses(cornerCount);
+	ParallelFor(partitionCount, [&](size_t partition)
+	{
+		size_t positionBegin = partition * positionsPerPartition;
+		size_t positionEnd = std::min(positionBegin + positionsPerPartition, positions.size());
+		std::vector<uint32_t> heads(positionEnd > positionBegin ? positionEnd - positionBegin : 0u, MISSING);
+		std::vector<FirstCorner> firsts;
+
+		for (size_t i = partitionStarts[partition]; i < partitionStarts[partition + 1]; ++i)
+		{
+			const NumberedCorner& numbered = partitioned[i];
+			uint32_t& head = heads[numbered.corner.index[Attribute::POSITION] - positionBegin];
+
+			uint32_t found = head;
+			while (found != MISSING && !SameCorner(firsts[found].corner, numbered.corner))
+			{
+				found = firsts[found].next;
+			}
+
+			if (found == MISSING)
+			{
+				FirstCorner first = { numbered.corner, numbered.id, head };
+				head = static_cast<uint32_t>(firsts.size());
+				firsts.push_back(first);
+				firstUses[numbered.id] = numbered.id;
+			}
+			else
+			{
+				firstUses[numbered.id] = firsts[found].id;
+			}
+		}
+	});
+
+	//Vertices are numbered in the order of their first use, chunk by chunk
+	std::vector<size_t> vertexStarts(chunkCount + 1, 0u);
+	ParallelFor(chunkCount, [&](size_t i)
+	{
+		size_t firstCorner = chunks[i].firstCorner;
+		for (size_t corner = firstCorner; corner < firstCorner + chunks[i].corners.size(); ++corner)
+		{
+			vertexStarts[i + 1] += firstUses[corner] == corner ? 1u : 0u;
+		}
+	});
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		vertexStarts[i + 1] += vertexStarts[i];
+	}
+
+	mesh.vertices.resize(vertexStarts[chunkCount]);
+	mesh.indices.resize(cornerCount);
+	ParallelFor(chunkCount, [&](size_t i)
+	{
+		uint32_t vertex = static_cast<uint32_t>(vertexStarts[i]);
+		size_t firstCorner = chunks[i].firstCorner;
+		for (size_t j = 0; j < chunks[i].corners.size(); ++j)
+		{
+			if (firstUses[firstCorner + j] != firstCorner + j)
+			{
+				continue;
+			}
+
+			const Corner& corner = chunks[i].corners[j];
+			uint32_t texture = corner.index[Attribute::TEXTURE];
+			uint32_t normal = corner.index[Attribute::NORMAL];
+
+			Vertex& added = mesh.vertices[vertex];
+			added.position = positions[corner.index[Attribute::POSITION]];
+			added.normal = normal != MISSING ? normals[normal] : DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+			added.texture = texture != MISSING ? textures[texture] : DirectX::XMFLOAT2(0.0f, 0.0f);
+			mesh.indices[firstCorner + j] = vertex++;
+		}
+	});
+
+	//Only reads the indices of first uses, which are all written now
+	ParallelFor(chunkCount, [&](size_t i)
+	{
+		size_t firstCorner = chunks[i].firstCorner;
+		for (size_t corner = firstCorner; corner < firstCorner + chunks[i].corners.size(); ++corner)
+		{
+			if (firstUses[corner] != corner)
+			{
+				mesh.indices[corner] = mesh.indices[firstUses[corner]];
+			}
+		}
+	});
+
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+
+// Loads Wavefront OBJ models such as drone.obj into an indexed triangle mesh.
+// The file is mapped and split into chunks at line breaks, the chunks are parsed in parallel on the JobSystem with
+// hand-written number parsers, and the v/vt/vn triples of the faces are merged into one vertex each, in the order the
+// faces first use them. The merge splits the corners into partitions by position index, so partitions never share a
+// vertex; each finds the first use of its corners in parallel by chaining the corners at every position. Polygons are
+// split into triangle fans. Only positions, texture coordinates, normals and faces are read; groups, smoothing groups
+// and materials are skipped.
+class ObjLoader
+{
+public:
+	// Same layout as DirectX::VertexPositionNormalTexture, so the vertices can be uploaded as they are
+	struct Vertex
+	{
+		DirectX::XMFLOAT3 position;
+		DirectX::XMFLOAT3 normal;
+		DirectX::XMFLOAT2 texture;
+	};
+
+	struct Mesh
+	{
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+	};
+
+	// Maps the file and parses it, false if it cannot be opened or is malformed
+	static bool Load(const std::wstring& path, Mesh& mesh);
+	// Parses OBJ text in memory, it does not have to end with a line break or a null
+	static bool Parse(const char* data, size_t size, Mesh& mesh);
+};
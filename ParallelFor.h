@@ -0,0 +1,103 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include "JobSystem.h"
+
+namespace ParallelForConfig
+{
+	// Ranges are split until every thread has this many pieces to take, stealing evens out uneven pieces
+	const size_t PIECES_PER_THREAD = 8;
+}
+
+// Runs function(i) for every i in [0, count) on the JobSystem and returns once all are done.
+// The range is split in halves, the upper half goes to the queue where idle threads can steal it,
+// and the calling thread keeps splitting the lower one until pieces are small enough.
+template<typename Function>
+void ParallelFor(size_t count, const Function& function)
+{
+	JobSystem& jobSystem = JobSystem::Get();
+	if (count <= 1u || jobSystem.GetThreadCount() == 1u)
+	{
+		for (size_t i = 0u; i < count; ++i)
+		{
+			function(i);
+		}
+		return;
+	}
+
+	size_t grain = std::max<size_t>(1u, count / (jobSystem.GetThreadCount() * ParallelForConfig::PIECES_PER_THREAD));
+	JobSystem::Counter counter;
+
+	std::function<void(size_t, size_t)> run = [&](size_t begin, size_t end)
+	{
+		while (end - begin > grain)
+		{
+			size_t middle = begin + (end - begin) / 2u;
+			jobSystem.Run([&run, middle, end]() { run(middle, end); }, &counter);
+			end = middle;
+		}
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			function(i);
+		}
+	};
+
+	run(0u, count);
+	jobSystem.Wait(counter);
+}
+
+// Runs function(x, y, z) for every cell of a count[0] x count[1] x count[2] grid.
+// Boxes are split along their longest axis, so every piece covers a compact block of neighbouring cells.
+template<typename Function>
+void ParallelFor3D(const unsigned int count[3], const Function& function)
+{
+	struct Box
+	{
+		unsigned int begin[3], end[3];
+
+		size_t GetSize() const { return static_cast<size_t>(end[0] - begin[0]) * (end[1] - begin[1]) * (end[2] - begin[2]); }
+	};
+
+	JobSystem& jobSystem = JobSystem::Get();
+	Box whole = { { 0u, 0u, 0u }, { count[0], count[1], count[2] } };
+	size_t grain = std::max<size_t>(1u, whole.GetSize() / (jobSystem.GetThreadCount() * ParallelForConfig::PIECES_PER_THREAD));
+	JobSystem::Counter counter;
+
+	std::function<void(Box)> run = [&](Box box)
+	{
+		while (box.GetSize() > grain)
+		{
+			int axis = 0;
+			for (int i = 1; i < 3; ++i)
+			{
+				if (box.end[i] - box.begin[i] > box.end[axis] - box.begin[axis])
+				{
+					axis = i;
+				}
+			}
+
+			Box upper = box;
+			upper.begin[axis] = box.begin[axis] + (box.end[axis] - box.begin[axis]) / 2u;
+			box.end[axis] = upper.begin[axis];
+			jobSystem.Run([&run, upper]() { run(upper); }, &counter);
+		}
+
+		for (unsigned int z = box.begin[2]; z < box.end[2]; ++z)
+		{
+			for (unsigned int y = box.begin[1]; y < box.end[1]; ++y)
+			{
+				for (unsigned int x = box.begin[0]; x < box.end[0]; ++x)
+				{
+					function(x, y, z);
+				}
+			}
+		}
+	};
+
+	if (whole.GetSize() > 0u)
+	{
+		run(whole);
+	}
+	jobSystem.Wait(counter);
+}
@@ -21,11 +21,7 @@ bool PixelShader::Initialize(ID3D11Device* device, WCHAR* filename)
 	ID3DBlob* errorMessage;
 	ID3DBlob* pixelShaderBuffer;
 
-	DWORD shaderflags =
-		D3DCOMPILE_ENABLE_STRICTNESS
-	|	D3DCOMPILE_DEBUG
-	|	D3DCOMPILE_SKIP_OPTIMIZATION
-	;
+	DWORD shaderflags = ShaderUtility::COMPILE_FLAGS;
 
 	errorMessage = nullptr;
 	pixelShaderBuffer = nullptr;
@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "Profiler.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+namespace ProfilerConfig
+{
+	//Power of two, about 1.3 MB per thread. A frame records a few hundred zones, regenerating terrain a few thousand.
+	const uint64_t EVENTS_PER_THREAD = 1u << 15;
+}
+
+thread_local Profiler::ThreadBuffer* Profiler::t_buffer = nullptr;
+
+namespace
+{
+	//Names are literals, only quotes and backslashes need escaping
+	void WriteJsonString(std::ofstream& file, const std::string& text)
+	{
+		file << '"';
+		for (char character : text)
+		{
+			if (character == '"' || character == '\\')
+			{
+				file << '\\';
+			}
+			file << character;
+		}
+		file << '"';
+	}
+
+	//Trace timestamps are microseconds
+	double ToMicroseconds(uint64_t nanoseconds)
+	{
+		return nanoseconds / 1000.0;
+	}
+}
+
+Profiler::Zone::Zone(const char* name)
+	: m_name(name), m_recording(Get().IsEnabled())
+{
+	m_start = m_recording ? Now() : 0u;
+}
+
+Profiler::Zone::~Zone()
+{
+	if (m_recording)
+	{
+		Event event = { m_name, EventType::ZONE, m_start, Now(), 0.0 };
+		Get().Record(event);
+	}
+}
+
+Profiler& Profiler::Get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler()
+	: m_origin(Now()), m_enabled(true)
+{
+}
+
+uint64_t Profiler::Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::SetThreadName(const std::string& name)
+{
+	ThreadBuffer& buffer = GetThreadBuffer();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	buffer.name = name;
+}
+
+void Profiler::Counter(const char* name, double value)
+{
+	if (IsEnabled())
+	{
+		Event event = { name, EventType::COUNTER, Now(), 0u, value };
+		Record(event);
+	}
+}
+
+Profiler::ThreadBuffer& Profiler::GetThreadBuffer()
+{
+	if (!t_buffer)
+	{
+		std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+		buffer->events.reset(new Event[ProfilerConfig::EVENTS_PER_THREAD]);
+		buffer->written = 0u;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		buffer->name = "Thread " + std::to_string(m_buffers.size());
+		t_buffer = buffer.get();
+		//Buffers outlive their threads, so traces still show work of threads that have finished
+		m_buffers.push_back(std::move(buffer));
+	}
+
+	return *t_buffer;
+}
+
+void Profiler::Record(const Event& event)
+{
+	ThreadBuffer& buffer = GetThreadBuffer();
+
+	//Only this thread writes the buffer, the release store publishes the event to WriteChromeTrace
+	uint64_t index = buffer.written.load(std::memory_order_relaxed);
+	buffer.events[index & (ProfilerConfig::EVENTS_PER_THREAD - 1u)] = event;
+	buffer.written.store(index + 1u, std::memory_order_release);
+}
+
+bool Profiler::WriteChromeTrace(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		printf("Profiler: could not write %s\n\r", path.c_str());
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	//Nanosecond resolution, the default six digits would round timestamps to milliseconds after a few seconds
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (size_t thread = 0u; thread < m_buffers.size(); ++thread)
+	{
+		const ThreadBuffer& buffer = *m_buffers[thread];
+
+		file << (thread ? ",\n" : "") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":";
+		WriteJsonString(file, buffer.name);
+		file << "}}";
+
+		//Copy the newest events while the thread keeps recording, then drop the ones it may have overwritten meanwhile
+		uint64_t end = buffer.written.load(std::memory_order_acquire);
+		uint64_t begin = end > ProfilerConfig::EVENTS_PER_THREAD ? end - ProfilerConfig::EVENTS_PER_THREAD : 0u;
+		std::vector<Event> events;
+		for (uint64_t i = begin; i < end; ++i)
+		{
+			events.push_back(buffer.events[i & (ProfilerConfig::EVENTS_PER_THREAD - 1u)]);
+		}
+
+		//The thread may be writing event number written right now, into the slot of written - EVENTS_PER_THREAD
+		uint64_t written = buffer.written.load(std::memory_order_acquire);
+		uint64_t overwritten = written >= ProfilerConfig::EVENTS_PER_THREAD ? written - ProfilerConfig::EVENTS_PER_THREAD + 1u : 0u;
+		size_t skipped = static_cast<size_t>(std::min(std::max(overwritten, begin) - begin, end - begin));
+
+		for (size_t i = skipped; i < events.size(); ++i)
+		{
+			const Event& event = events[i];
+			uint64_t start = event.start - m_origin;
+
+			file << ",\n{\"name\":";
+			WriteJsonString(file, event.name);
+			if (event.type == EventType::ZONE)
+			{
+				file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread << ",\"ts\":" << ToMicroseconds(start)
+					<< ",\"dur\":" << ToMicroseconds(event.end - event.start) << '}';
+			}
+			else
+			{
+				file << ",\"ph\":\"C\",\"pid\":1,\"tid\":" << thread << ",\"ts\":" << ToMicroseconds(start) << ",\"args\":{\"value\":" << event.value << "}}";
+			}
+		}
+	}
+	file << "\n]}\n";
+
+	return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped-zone CPU profiler.
+// Every thread records into its own ring buffer that no other thread writes, so recording takes no lock and old
+// events are overwritten once a buffer is full. The newest events of all threads can be written out as a Chrome
+// trace, which chrome://tracing and ui.perfetto.dev open. Zones nest by time on their thread.
+// Zone and counter names are not copied, they have to outlive the profiler, string literals in practice.
+class Profiler
+{
+public:
+	// Times the scope it is declared in
+	class Zone
+	{
+	public:
+		explicit Zone(const char* name);
+		~Zone();
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+	private:
+		const char* m_name;
+		uint64_t m_start;
+		bool m_recording;
+	};
+
+	static Profiler& Get();
+
+	// Nanoseconds of a steady clock, the same on Windows and Linux
+	static uint64_t Now();
+
+	// Names the calling thread in traces, threads without a name show up by number
+	void SetThreadName(const std::string& name);
+
+	// Records value under name at the current time, traces draw every counter as a graph
+	void Counter(const char* name, double value);
+
+	// Zones and counters are skipped while disabled, recording is on from the start
+	void SetEnabled(bool enabled) { m_enabled = enabled; }
+	bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+	bool WriteChromeTrace(const std::string& path) const;
+
+private:
+	struct EventType
+	{
+		enum Enum
+		{
+			ZONE,
+			COUNTER
+		};
+	};
+
+	struct Event
+	{
+		const char* name;
+		EventType::Enum type;
+		uint64_t start;
+		// Zones only
+		uint64_t end;
+		// Counters only
+		double value;
+	};
+
+	struct ThreadBuffer
+	{
+		std::string name;
+		std::unique_ptr<Event[]> events;
+		// Events ever written, the newest is at (written - 1) % capacity
+		std::atomic<uint64_t> written;
+	};
+
+	Profiler();
+
+	ThreadBuffer& GetThreadBuffer();
+	void Record(const Event& event);
+
+	// Buffer of the calling thread, created with its first event
+	static thread_local ThreadBuffer* t_buffer;
+
+	// Time traces count from
+	uint64_t m_origin;
+	std::atomic<bool> m_enabled;
+	// Guards the buffer list and thread names, never the events
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+};
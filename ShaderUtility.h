@@ -1,9 +1,21 @@
 #pragma once
 #include <d3d11shader.h>
+#include <d3dcompiler.h>
 #include <fstream>
 
 namespace ShaderUtility
 {
+	// Debug builds keep shaders steppable, release builds let the compiler optimise them
+	static const DWORD COMPILE_FLAGS =
+		D3DCOMPILE_ENABLE_STRICTNESS
+#ifdef _DEBUG
+	|	D3DCOMPILE_DEBUG
+	|	D3DCOMPILE_SKIP_OPTIMIZATION
+#else
+	|	D3DCOMPILE_OPTIMIZATION_LEVEL3
+#endif
+	;
+
 	static void OutputShaderErrorMessage(ID3D10Blob* errorMessage, WCHAR* shaderFilename)
 	{
 		char* compileErrors;
@@ -33,7 +33,7 @@ void ShadowMap::Prepare(ID3D11DeviceContext* deviceContext)
 	shadowMapTexture->ClearRenderTarget(deviceContext, 0.0f, 0.0f, 0.0f, 1.0f);
 }
 
-void ShadowMap::Render(ID3D11DeviceContext* deviceContext, const UINT& vertexCount, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix)
+void ShadowMap::Render(ID3D11DeviceContext* deviceContext, const UINT& indexCount, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix)
 {
 	SetBufferData(deviceContext, worldMatrix, lightViewMatrix, lightProjectionMatrix);
 
@@ -44,7 +44,18 @@ void ShadowMap::Render(ID3D11DeviceContext* deviceContext, const UINT& vertexCou
 	deviceContext->VSSetConstantBuffers(0, 1, &matrixBuffer);
 
 	//Render indices
-	deviceContext->Draw(vertexCount, 0);
+	deviceContext->DrawIndexed(indexCount, 0, 0);
+}
+
+void ShadowMap::PrepareClipmap(ID3D11DeviceContext* deviceContext, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix)
+{
+	SetBufferData(deviceContext, worldMatrix, lightViewMatrix, lightProjectionMatrix);
+
+	//Set Shaders
+	clipmapVS->Set(deviceContext);
+	ps->Set(deviceContext);
+
+	deviceContext->VSSetConstantBuffers(0, 1, &matrixBuffer);
 }
 
 ID3D11ShaderResourceView* ShadowMap::GetShaderResourceView()
@@ -93,10 +104,10 @@ bool ShadowMap::InitializeShaders(ID3D11Device* device)
 		D3D11_INPUT_ELEMENT_DESC polygonLayout[1];
 
 		//Vertex Input Layout Description
-		//needs to machShadowVertexInputType
+		//needs to mach the position of CompactVertex
 		polygonLayout[0].SemanticName = "SV_POSITION";
 		polygonLayout[0].SemanticIndex = 0;
-		polygonLayout[0].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		polygonLayout[0].Format = DXGI_FORMAT_R16G16B16A16_UNORM;
 		polygonLayout[0].InputSlot = 0;
 		polygonLayout[0].AlignedByteOffset = 0;
 		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
@@ -108,6 +119,23 @@ bool ShadowMap::InitializeShaders(ID3D11Device* device)
 		vs->Initialize(device, L"Depth_VS.hlsl", polygonLayout, numElements);
 	}
 
+	{
+		D3D11_INPUT_ELEMENT_DESC polygonLayout[1];
+
+		//Vertex Input Layout Description
+		//needs to mach the vertices of Clipmap::BuildVertices
+		polygonLayout[0].SemanticName = "POSITION";
+		polygonLayout[0].SemanticIndex = 0;
+		polygonLayout[0].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+		polygonLayout[0].InputSlot = 0;
+		polygonLayout[0].AlignedByteOffset = 0;
+		polygonLayout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		polygonLayout[0].InstanceDataStepRate = 0;
+
+		clipmapVS = new VertexShader();
+		clipmapVS->Initialize(device, L"Clipmap_Depth_VS.hlsl", polygonLayout, 1);
+	}
+
 	ps = new PixelShader();
 	ps->Initialize(device, L"Depth_PS.hlsl");
 
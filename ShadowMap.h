@@ -13,7 +13,9 @@ public:
 	~ShadowMap();
 
 	void Prepare(ID3D11DeviceContext* deviceContext);
-	void Render(ID3D11DeviceContext* deviceContext, const UINT& vertexCount, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix);
+	void Render(ID3D11DeviceContext* deviceContext, const UINT& indexCount, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix);
+	// Sets the depth shaders for clipmap terrain, which then draws its levels with GeometryData::RenderClipmapDepth
+	void PrepareClipmap(ID3D11DeviceContext* deviceContext, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix);
 	ID3D11ShaderResourceView* GetShaderResourceView();
 
 private:
@@ -35,6 +37,7 @@ private:
 	bool SetBufferData(ID3D11DeviceContext* context, const XMMATRIX& worldMatrix, const XMMATRIX& lightViewMatrix, const XMMATRIX& lightProjectionMatrix);
 
 	VertexShader* vs;
+	VertexShader* clipmapVS;
 	PixelShader* ps;
 	RenderTextureClass*	shadowMapTexture;
 	XMMATRIX lightViewMatrix, lightProjectionMatrix;
@@ -1,9 +1,19 @@
 #include "pch.h"
 #include "Skydome.h"
+#include "Metrics.h"
+
+namespace SkydomeConfig
+{
+	//Tessellation of the upper hemisphere, the lower half is one band whatever these are
+	const unsigned int RINGS = 12;
+	const unsigned int SEGMENTS = 24;
+
+	//The sky shader takes the gradient height from the unscaled position, the radius of the old model keeps its colours
+	const float RADIUS = 2.0f;
+}
 
 Skydome::Skydome()
 {
-	m_model = 0;
 	m_vertexBuffer = 0;
 	m_indexBuffer = 0;
 }
@@ -20,16 +30,19 @@ Skydome::~Skydome()
 
 
 bool Skydome::Initialize(ID3D11Device* device)
+{
+	return Initialize(device, SkydomeConfig::RINGS, SkydomeConfig::SEGMENTS);
+}
+
+
+bool Skydome::Initialize(ID3D11Device* device, unsigned int rings, unsigned int segments)
 {
 	bool result;
 
 
-	// Load in the sky dome model.
-	result = LoadSkyDomeModel("Assets/skydome.txt");
-	if (!result)
-	{
-		return false;
-	}
+	// Generate the sky dome, or reuse it if it was generated with the same tessellation before.
+	m_geometry = SkydomeMesh::Get(rings, segments, SkydomeConfig::RADIUS);
+	Metrics::Get().SetGauge("Skydome triangles", static_cast<double>(SkydomeMesh::GetTriangleCount(*m_geometry)));
 
 	// Load the sky dome into a vertex and index buffer for rendering.
 	result = InitializeBuffers(device);
@@ -53,8 +66,8 @@ void Skydome::Shutdown()
 	// Release the vertex and index buffer that were used for rendering the sky dome.
 	ReleaseBuffers();
 
-	// Release the sky dome model.
-	ReleaseSkyDomeModel();
+	// Let go of the generated sky dome, the cache keeps it for the next initialize.
+	m_geometry.reset();
 
 	return;
 }
@@ -87,108 +100,17 @@ Vector4 Skydome::GetCenterColor()
 }
 
 
-bool Skydome::LoadSkyDomeModel(char* filename)
-{
-	ifstream fin;
-	char input;
-	int i;
-
-
-	// Open the model file.
-	fin.open(filename);
-
-	// If it could not open the file then exit.
-	if (fin.fail())
-	{
-		return false;
-	}
-
-	// Read up to the value of vertex count.
-	fin.get(input);
-	while (input != ':')
-	{
-		fin.get(input);
-	}
-
-	// Read in the vertex count.
-	fin >> m_vertexCount;
-
-	// Set the number of indices to be the same as the vertex count.
-	m_indexCount = m_vertexCount;
-
-	// Create the model using the vertex count that was read in.
-	m_model = new ModelType[m_vertexCount];
-	if (!m_model)
-	{
-		return false;
-	}
-
-	// Read up to the beginning of the data.
-	fin.get(input);
-	while (input != ':')
-	{
-		fin.get(input);
-	}
-	fin.get(input);
-	fin.get(input);
-
-	// Read in the vertex data.
-	for (i = 0; i < m_vertexCount; i++)
-	{
-		fin >> m_model[i].x >> m_model[i].y >> m_model[i].z;
-		fin >> m_model[i].tu >> m_model[i].tv;
-		fin >> m_model[i].nx >> m_model[i].ny >> m_model[i].nz;
-	}
-
-	// Close the model file.
-	fin.close();
-
-	return true;
-}
-
-
-void Skydome::ReleaseSkyDomeModel()
-{
-	if (m_model)
-	{
-		delete[] m_model;
-		m_model = 0;
-	}
-
-	return;
-}
-
-
 bool Skydome::InitializeBuffers(ID3D11Device* device)
 {
-	VertexType* vertices;
-	unsigned long* indices;
 	D3D11_BUFFER_DESC vertexBufferDesc, indexBufferDesc;
 	D3D11_SUBRESOURCE_DATA vertexData, indexData;
 	HRESULT result;
-	int i;
 
 
-	// Create the vertex array.
-	vertices = new VertexType[m_vertexCount];
-	if (!vertices)
-	{
-		return false;
-	}
-
-	// Create the index array.
-	indices = new unsigned long[m_indexCount];
-	if (!indices)
-	{
-		return false;
-	}
-
-	// Load the vertex array and index array with data.
-	for (i = 0; i < m_vertexCount; i++)
-	{
-		vertices[i].position = Vector3(m_model[i].x, m_model[i].y, m_model[i].z);
-		indices[i] = i;
-	}
+	// The generated mesh is already laid out as the buffers are.
+	static_assert(sizeof(VertexType) == sizeof(XMFLOAT3), "Skydome vertices have to match the generated mesh");
+	m_vertexCount = static_cast<int>(m_geometry->positions.size());
+	m_indexCount = static_cast<int>(m_geometry->indices.size());
 
 	// Set up the description of the vertex buffer.
 	vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
@@ -199,7 +121,7 @@ bool Skydome::InitializeBuffers(ID3D11Device* device)
 	vertexBufferDesc.StructureByteStride = 0;
 
 	// Give the subresource structure a pointer to the vertex data.
-	vertexData.pSysMem = vertices;
+	vertexData.pSysMem = m_geometry->positions.data();
 	vertexData.SysMemPitch = 0;
 	vertexData.SysMemSlicePitch = 0;
 
@@ -212,14 +134,14 @@ bool Skydome::InitializeBuffers(ID3D11Device* device)
 
 	// Set up the description of the index buffer.
 	indexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	indexBufferDesc.ByteWidth = sizeof(unsigned long) * m_indexCount;
+	indexBufferDesc.ByteWidth = sizeof(uint32_t) * m_indexCount;
 	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
 	indexBufferDesc.CPUAccessFlags = 0;
 	indexBufferDesc.MiscFlags = 0;
 	indexBufferDesc.StructureByteStride = 0;
 
 	// Give the subresource structure a pointer to the index data.
-	indexData.pSysMem = indices;
+	indexData.pSysMem = m_geometry->indices.data();
 	indexData.SysMemPitch = 0;
 	indexData.SysMemSlicePitch = 0;
 
@@ -230,13 +152,6 @@ bool Skydome::InitializeBuffers(ID3D11Device* device)
 		return false;
 	}
 
-	// Release the arrays now that the vertex and index buffers have been created and loaded.
-	delete[] vertices;
-	vertices = 0;
-
-	delete[] indices;
-	indices = 0;
-
 	return true;
 }
 
@@ -277,8 +192,8 @@ void Skydome::RenderBuffers(ID3D11DeviceContext* deviceContext)
 	// Set the index buffer to active in the input assembler so it can be rendered.
 	deviceContext->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R32_UINT, 0);
 
-	// Set the type of primitive that should be rendered from this vertex buffer, in this case triangles.
-	deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	// Set the type of primitive that should be rendered from this vertex buffer, in this case strips cut at SkydomeMesh::STRIP_CUT.
+	deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
 
 	return;
 }
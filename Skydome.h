@@ -2,6 +2,7 @@
 #define _SKYDOME_H_
 #include "pch.h"
 #include <fstream>
+#include "SkydomeMesh.h"
 using namespace std;
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
@@ -9,13 +10,6 @@ using namespace DirectX::SimpleMath;
 class Skydome
 {
 private:
-	struct ModelType
-	{
-		float x, y, z;
-		float tu, tv;
-		float nx, ny, nz;
-	};
-
 	struct VertexType
 	{
 		Vector3 position;
@@ -27,6 +21,8 @@ public:
 	~Skydome();
 
 	bool Initialize(ID3D11Device*);
+	// Rings between apex and horizon and segments around, the triangle budget of the sky
+	bool Initialize(ID3D11Device*, unsigned int, unsigned int);
 	void Shutdown();
 	void Render(ID3D11DeviceContext*);
 
@@ -35,15 +31,12 @@ public:
 	Vector4 GetCenterColor();
 
 private:
-	bool LoadSkyDomeModel(char*);
-	void ReleaseSkyDomeModel();
-
 	bool InitializeBuffers(ID3D11Device*);
 	void ReleaseBuffers();
 	void RenderBuffers(ID3D11DeviceContext*);
 
 private:
-	ModelType* m_model;
+	std::shared_ptr<const SkydomeMesh::Geometry> m_geometry;
 	int m_vertexCount, m_indexCount;
 	ID3D11Buffer* m_vertexBuffer, * m_indexBuffer;
 	Vector4 m_apexColor, m_centerColor;
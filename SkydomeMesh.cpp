@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "SkydomeMesh.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+
+	//Vertex of a ring around the segment, ring 0 is the apex and the ring after the horizon the bottom pole
+	uint32_t GetIndex(unsigned int ring, unsigned int segment, unsigned int rings, unsigned int segments)
+	{
+		if (ring == 0)
+		{
+			return 0;
+		}
+		if (ring > rings)
+		{
+			return 1 + rings * segments;
+		}
+
+		return 1 + (ring - 1) * segments + segment % segments;
+	}
+}
+
+const uint32_t SkydomeMesh::STRIP_CUT;
+
+SkydomeMesh::Geometry SkydomeMesh::Generate(unsigned int rings, unsigned int segments, float radius)
+{
+	rings = std::max(rings, 1u);
+	segments = std::max(segments, 3u);
+
+	Geometry geometry;
+	geometry.positions.reserve(2 + rings * segments);
+	geometry.positions.push_back(DirectX::XMFLOAT3(0.0f, radius, 0.0f));
+
+	//The last ring lies on the horizon
+	for (unsigned int ring = 1; ring <= rings; ++ring)
+	{
+		float polar = 0.5f * PI * ring / rings;
+		float ringRadius = radius * std::sin(polar);
+		float height = ring == rings ? 0.0f : radius * std::cos(polar);
+
+		for (unsigned int segment = 0; segment < segments; ++segment)
+		{
+			float azimuth = 2.0f * PI * segment / segments;
+			geometry.positions.push_back(DirectX::XMFLOAT3(ringRadius * std::cos(azimuth), height, ringRadius * std::sin(azimuth)));
+		}
+	}
+	geometry.positions.push_back(DirectX::XMFLOAT3(0.0f, -radius, 0.0f));
+
+	//A strip down each band zigzags between its upper and lower ring and wraps back to the first segment,
+	//bands at a pole repeat the pole, which makes every other triangle degenerate
+	geometry.indices.reserve((rings + 1) * (2 * segments + 3));
+	for (unsigned int ring = 0; ring <= rings; ++ring)
+	{
+		if (ring > 0)
+		{
+			geometry.indices.push_back(STRIP_CUT);
+		}
+
+		for (unsigned int segment = 0; segment <= segments; ++segment)
+		{
+			geometry.indices.push_back(GetIndex(ring, segment, rings, segments));
+			geometry.indices.push_back(GetIndex(ring + 1, segment, rings, segments));
+		}
+	}
+
+	return geometry;
+}
+
+std::shared_ptr<const SkydomeMesh::Geometry> SkydomeMesh::Get(unsigned int rings, unsigned int segments, float radius)
+{
+	static std::mutex mutex;
+	static std::map<std::tuple<unsigned int, unsigned int, float>, std::shared_ptr<const Geometry>> cache;
+
+	rings = std::max(rings, 1u);
+	segments = std::max(segments, 3u);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<const Geometry>& geometry = cache[std::make_tuple(rings, segments, radius)];
+	if (!geometry)
+	{
+		geometry = std::make_shared<const Geometry>(Generate(rings, segments, radius));
+	}
+
+	return geometry;
+}
+
+size_t SkydomeMesh::GetTriangleCount(const Geometry& geometry)
+{
+	//Every strip of n indices draws n - 2 triangles
+	size_t triangles = 0;
+	size_t stripLength = 0;
+	for (uint32_t index : geometry.indices)
+	{
+		if (index == STRIP_CUT)
+		{
+			triangles += stripLength > 2 ? stripLength - 2 : 0;
+			stripLength = 0;
+		}
+		else
+		{
+			stripLength++;
+		}
+	}
+
+	return triangles + (stripLength > 2 ? stripLength - 2 : 0);
+}
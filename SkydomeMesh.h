@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <DirectXMath.h>
+
+// Sky dome generated in code as an indexed triangle strip, without a device so it can be built and checked anywhere.
+// The upper hemisphere is split into rings from the apex down to the horizon and segments around it. Below the
+// horizon the sky shader draws the centre colour everywhere, so the lower half is closed by a single band to the
+// bottom pole, it only has to cover the screen where the terrain does not.
+class SkydomeMesh
+{
+public:
+	// Index that restarts a triangle strip, D3D11 always cuts 32 bit index strips at it
+	static const uint32_t STRIP_CUT = 0xFFFFFFFFu;
+
+	struct Geometry
+	{
+		std::vector<DirectX::XMFLOAT3> positions;
+		// One strip per band, separated by STRIP_CUT
+		std::vector<uint32_t> indices;
+	};
+
+	// rings of at least 1 between apex and horizon, segments of at least 3 around, both are clamped
+	static Geometry Generate(unsigned int rings, unsigned int segments, float radius);
+	// Generated on the first call for every tessellation and radius, later calls share it
+	static std::shared_ptr<const Geometry> Get(unsigned int rings, unsigned int segments, float radius);
+
+	// Triangles the strips draw, degenerate ones at the poles included
+	static size_t GetTriangleCount(const Geometry& geometry);
+};
@@ -0,0 +1,219 @@
+#include "pch.h"
+#include "SparseVolume.h"
+
+SparseVolume::SparseVolume(unsigned int width, unsigned int height, unsigned int depth, float uniformValue, DensityFormat::Enum format, BrickLayout::Enum layout)
+	: m_width(width), m_height(height), m_depth(depth), m_format(format), m_layout(layout)
+{
+	for (unsigned int i = 0u; i < BRICK_SIZE; ++i)
+	{
+		if (m_layout == BrickLayout::MORTON)
+		{
+			//Spread the bits of i three apart, y and z are shifted on top
+			unsigned int spread = 0u;
+			for (unsigned int bit = 0u; bit < BRICK_SHIFT; ++bit)
+			{
+				spread |= ((i >> bit) & 1u) << (bit * 3);
+			}
+
+			m_voxelOffsets[0][i] = spread;
+			m_voxelOffsets[1][i] = spread << 1;
+			m_voxelOffsets[2][i] = spread << 2;
+		}
+		else
+		{
+			m_voxelOffsets[0][i] = i;
+			m_voxelOffsets[1][i] = i << BRICK_SHIFT;
+			m_voxelOffsets[2][i] = i << (2 * BRICK_SHIFT);
+		}
+	}
+
+	m_brickCount[0] = (width + BRICK_MASK) >> BRICK_SHIFT;
+	m_brickCount[1] = (height + BRICK_MASK) >> BRICK_SHIFT;
+	m_brickCount[2] = (depth + BRICK_MASK) >> BRICK_SHIFT;
+
+	size_t brickCount = static_cast<size_t>(m_brickCount[0]) * m_brickCount[1] * m_brickCount[2];
+
+	//Uniform values hold what a stored voxel would decode to
+	float values[BRICK_VOXELS];
+	std::fill(values, values + BRICK_VOXELS, uniformValue);
+
+	m_uniformValues.resize(brickCount);
+	m_brickData.resize(brickCount);
+	SetBrick(0, values);
+	std::fill(m_uniformValues.begin(), m_uniformValues.end(), m_uniformValues[0]);
+}
+
+SparseVolume::SparseVolume(const SparseVolume& source, DensityFormat::Enum format, BrickLayout::Enum layout)
+	: SparseVolume(source.m_width, source.m_height, source.m_depth, 0.0f, format, layout)
+{
+	ParallelFor(m_uniformValues.size(), [&](size_t brick)
+	{
+		float values[BRICK_VOXELS];
+		source.GetBrick(brick, values);
+		SetBrick(brick, values);
+	});
+}
+
+void SparseVolume::GetBrick(size_t brick, float* values) const
+{
+	if (!m_brickData[brick])
+	{
+		std::fill(values, values + BRICK_VOXELS, m_uniformValues[brick]);
+		return;
+	}
+
+	unsigned int brickX = static_cast<unsigned int>(brick % m_brickCount[0]) * BRICK_SIZE;
+	unsigned int brickY = static_cast<unsigned int>((brick / m_brickCount[0]) % m_brickCount[1]) * BRICK_SIZE;
+	unsigned int brickZ = static_cast<unsigned int>(brick / (m_brickCount[0] * m_brickCount[1])) * BRICK_SIZE;
+
+	for (unsigned int i = 0u; i < BRICK_VOXELS; ++i)
+	{
+		values[i] = Get(brickX + (i & BRICK_MASK), brickY + ((i >> BRICK_SHIFT) & BRICK_MASK), brickZ + (i >> (2 * BRICK_SHIFT)));
+	}
+}
+
+size_t SparseVolume::GetElementSize() const
+{
+	switch (m_format)
+	{
+	case DensityFormat::SNORM16:
+		return sizeof(int16_t);
+	case DensityFormat::SNORM8:
+		return sizeof(int8_t);
+	default:
+		return sizeof(float);
+	}
+}
+
+void SparseVolume::SetBrick(size_t brick, const float* values)
+{
+	switch (m_format)
+	{
+	case DensityFormat::SNORM16:
+		SetBrickAs<int16_t>(brick, values);
+		break;
+	case DensityFormat::SNORM8:
+		SetBrickAs<int8_t>(brick, values);
+		break;
+	default:
+		SetBrickAs<float>(brick, values);
+		break;
+	}
+}
+
+void SparseVolume::SetBrickData(size_t brick, const char* data, float uniformValue)
+{
+	m_uniformValues[brick] = uniformValue;
+
+	if (data == nullptr)
+	{
+		m_brickData[brick].reset();
+		return;
+	}
+
+	size_t size = BRICK_VOXELS * GetElementSize();
+	if (!m_brickData[brick])
+	{
+		m_brickData[brick].reset(new char[size]);
+	}
+	std::copy(data, data + size, m_brickData[brick].get());
+}
+
+template<typename T>
+void SparseVolume::SetBrickAs(size_t brick, const float* values)
+{
+	//Values arrive x fastest, scatter them into the brick layout
+	T encoded[BRICK_VOXELS];
+	for (unsigned int i = 0u; i < BRICK_VOXELS; ++i)
+	{
+		encoded[GetVoxelIndex(i & BRICK_MASK, (i >> BRICK_SHIFT) & BRICK_MASK, i >> (2 * BRICK_SHIFT))] = DensityCodec<T>::Encode(values[i]);
+	}
+
+	bool uniform = std::all_of(encoded, encoded + BRICK_VOXELS, [&encoded](T value) { return value == encoded[0]; });
+
+	m_uniformValues[brick] = DensityCodec<T>::Decode(encoded[0]);
+
+	if (uniform)
+	{
+		m_brickData[brick].reset();
+		return;
+	}
+
+	if (!m_brickData[brick])
+	{
+		m_brickData[brick].reset(new char[BRICK_VOXELS * sizeof(T)]);
+	}
+	std::copy(encoded, encoded + BRICK_VOXELS, reinterpret_cast<T*>(m_brickData[brick].get()));
+}
+
+bool SparseVolume::MayContainSurface(const unsigned int min[3], const unsigned int max[3], float isoLevel) const
+{
+	unsigned int brickMin[3], brickMax[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		brickMin[axis] = min[axis] >> BRICK_SHIFT;
+		brickMax[axis] = std::min(max[axis] >> BRICK_SHIFT, m_brickCount[axis] - 1);
+	}
+
+	bool firstBelow = m_uniformValues[GetBrickIndex(brickMin[0], brickMin[1], brickMin[2])] < isoLevel;
+
+	for (unsigned int z = brickMin[2]; z <= brickMax[2]; ++z)
+	{
+		for (unsigned int y = brickMin[1]; y <= brickMax[1]; ++y)
+		{
+			for (unsigned int x = brickMin[0]; x <= brickMax[0]; ++x)
+			{
+				size_t brick = GetBrickIndex(x, y, z);
+
+				if (m_brickData[brick] || (m_uniformValues[brick] < isoLevel) != firstBelow)
+				{
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+void SparseVolume::CopySlices(unsigned int zStart, unsigned int zEnd, void* output) const
+{
+	switch (m_format)
+	{
+	case DensityFormat::SNORM16:
+		CopySlicesAs(zStart, zEnd, static_cast<int16_t*>(output));
+		break;
+	case DensityFormat::SNORM8:
+		CopySlicesAs(zStart, zEnd, static_cast<int8_t*>(output));
+		break;
+	default:
+		CopySlicesAs(zStart, zEnd, static_cast<float*>(output));
+		break;
+	}
+}
+
+template<typename T>
+void SparseVolume::CopySlicesAs(unsigned int zStart, unsigned int zEnd, T* output) const
+{
+	//Encoding a decoded value gives back the stored one
+	for (unsigned int z = zStart; z < zEnd; ++z)
+	{
+		for (unsigned int y = 0u; y < m_height; ++y)
+		{
+			for (unsigned int x = 0u; x < m_width; ++x)
+			{
+				*output++ = DensityCodec<T>::Encode(GetAs<T>(x, y, z));
+			}
+		}
+	}
+}
+
+size_t SparseVolume::GetAllocatedBrickCount() const
+{
+	return std::count_if(m_brickData.begin(), m_brickData.end(), [](const std::unique_ptr<char[]>& data) { return data != nullptr; });
+}
+
+size_t SparseVolume::GetMemoryUsage() const
+{
+	return m_uniformValues.size() * (sizeof(float) + sizeof(std::unique_ptr<char[]>)) + GetAllocatedBrickCount() * BRICK_VOXELS * GetElementSize();
+}
@@ -0,0 +1,314 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "ParallelFor.h"
+
+struct DensityFormat
+{
+	enum Enum
+	{
+		FLOAT32,
+		SNORM16,
+		SNORM8
+	};
+};
+
+struct BrickLayout
+{
+	enum Enum
+	{
+		// x fastest inside a brick, cell corners are 1, 8 and 64 voxels apart
+		LINEAR,
+		// Z-order inside a brick, the corners of a cell at even coordinates are 8 consecutive voxels
+		MORTON
+	};
+};
+
+// Rounds a density in the [-1,1] band to a signed normalized integer.
+// Values that would round to zero keep their sign, so cells classify the same as with floats at an iso level of 0.
+inline int QuantizeSnorm(float value, float scale)
+{
+	float clamped = std::max(-1.0f, std::min(1.0f, value));
+	int quantized = static_cast<int>(std::lround(clamped * scale));
+
+	if (quantized == 0 && value < 0.0f)
+	{
+		quantized = -1;
+	}
+
+	return quantized;
+}
+
+// Conversion between densities and the stored representation.
+// Quantized formats decode the same way as the matching SNORM texture formats.
+template<typename T>
+struct DensityCodec;
+
+template<>
+struct DensityCodec<float>
+{
+	static inline float Encode(float value) { return value; }
+	static inline float Decode(float value) { return value; }
+};
+
+template<>
+struct DensityCodec<int16_t>
+{
+	static inline int16_t Encode(float value) { return static_cast<int16_t>(QuantizeSnorm(value, 32767.0f)); }
+	static inline float Decode(int16_t value) { return value * (1.0f / 32767.0f); }
+};
+
+template<>
+struct DensityCodec<int8_t>
+{
+	static inline int8_t Encode(float value) { return static_cast<int8_t>(QuantizeSnorm(value, 127.0f)); }
+	static inline float Decode(int8_t value) { return value * (1.0f / 127.0f); }
+};
+
+// Density volume stored as 8^3 bricks.
+// Bricks where every voxel has the same value only keep that value,
+// so only the bricks around the surface shell take up memory.
+// Quantized formats clamp densities to the [-1,1] band of a truncated signed distance field.
+// Bricks are always filled and meshed in brick order, the layout only changes the voxel order inside them.
+class SparseVolume
+{
+public:
+	static const unsigned int BRICK_SHIFT = 3;
+	static const unsigned int BRICK_SIZE = 1u << BRICK_SHIFT;
+	static const unsigned int BRICK_MASK = BRICK_SIZE - 1;
+	static const unsigned int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+	SparseVolume(unsigned int width, unsigned int height, unsigned int depth, float uniformValue,
+		DensityFormat::Enum format = DensityFormat::FLOAT32, BrickLayout::Enum layout = BrickLayout::MORTON);
+	// Copies source into a volume of another format and layout
+	SparseVolume(const SparseVolume& source, DensityFormat::Enum format, BrickLayout::Enum layout);
+
+	unsigned int GetWidth() const { return m_width; }
+	unsigned int GetHeight() const { return m_height; }
+	unsigned int GetDepth() const { return m_depth; }
+	DensityFormat::Enum GetFormat() const { return m_format; }
+	BrickLayout::Enum GetLayout() const { return m_layout; }
+	size_t GetElementSize() const;
+
+	// Lookup for a known storage type, T has to match the format of the volume
+	template<typename T>
+	inline float GetAs(unsigned int x, unsigned int y, unsigned int z) const
+	{
+		size_t brick = GetBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT);
+		const char* data = m_brickData[brick].get();
+
+		if (data == nullptr)
+		{
+			return m_uniformValues[brick];
+		}
+
+		return DensityCodec<T>::Decode(reinterpret_cast<const T*>(data)[GetVoxelIndex(x, y, z)]);
+	}
+
+	// Corner values of the cell at (x, y, z) in triangle table order.
+	// Cells inside a single brick only look the brick up once.
+	template<typename T>
+	inline void GetCellCorners(unsigned int x, unsigned int y, unsigned int z, float corners[8]) const
+	{
+		if ((x & BRICK_MASK) == BRICK_MASK || (y & BRICK_MASK) == BRICK_MASK || (z & BRICK_MASK) == BRICK_MASK)
+		{
+			corners[0] = GetAs<T>(x, y, z);
+			corners[1] = GetAs<T>(x + 1, y, z);
+			corners[2] = GetAs<T>(x + 1, y + 1, z);
+			corners[3] = GetAs<T>(x, y + 1, z);
+			corners[4] = GetAs<T>(x, y, z + 1);
+			corners[5] = GetAs<T>(x + 1, y, z + 1);
+			corners[6] = GetAs<T>(x + 1, y + 1, z + 1);
+			corners[7] = GetAs<T>(x, y + 1, z + 1);
+			return;
+		}
+
+		size_t brick = GetBrickIndex(x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT);
+		const T* data = reinterpret_cast<const T*>(m_brickData[brick].get());
+
+		if (data == nullptr)
+		{
+			std::fill(corners, corners + 8, m_uniformValues[brick]);
+			return;
+		}
+
+		const unsigned int* offsetsX = m_voxelOffsets[0];
+		const unsigned int* offsetsY = m_voxelOffsets[1];
+		const unsigned int* offsetsZ = m_voxelOffsets[2];
+		unsigned int x0 = x & BRICK_MASK, y0 = y & BRICK_MASK, z0 = z & BRICK_MASK;
+
+		corners[0] = DensityCodec<T>::Decode(data[offsetsX[x0] | offsetsY[y0] | offsetsZ[z0]]);
+		corners[1] = DensityCodec<T>::Decode(data[offsetsX[x0 + 1] | offsetsY[y0] | offsetsZ[z0]]);
+		corners[2] = DensityCodec<T>::Decode(data[offsetsX[x0 + 1] | offsetsY[y0 + 1] | offsetsZ[z0]]);
+		corners[3] = DensityCodec<T>::Decode(data[offsetsX[x0] | offsetsY[y0 + 1] | offsetsZ[z0]]);
+		corners[4] = DensityCodec<T>::Decode(data[offsetsX[x0] | offsetsY[y0] | offsetsZ[z0 + 1]]);
+		corners[5] = DensityCodec<T>::Decode(data[offsetsX[x0 + 1] | offsetsY[y0] | offsetsZ[z0 + 1]]);
+		corners[6] = DensityCodec<T>::Decode(data[offsetsX[x0 + 1] | offsetsY[y0 + 1] | offsetsZ[z0 + 1]]);
+		corners[7] = DensityCodec<T>::Decode(data[offsetsX[x0] | offsetsY[y0 + 1] | offsetsZ[z0 + 1]]);
+	}
+
+	inline float Get(unsigned int x, unsigned int y, unsigned int z) const
+	{
+		switch (m_format)
+		{
+		case DensityFormat::SNORM16:
+			return GetAs<int16_t>(x, y, z);
+		case DensityFormat::SNORM8:
+			return GetAs<int8_t>(x, y, z);
+		default:
+			return GetAs<float>(x, y, z);
+		}
+	}
+
+	// Calls fillBrick(origin, values) for every brick in parallel, origin is the voxel coordinate of its first voxel.
+	// Values are written x fastest into a 16 byte aligned array, voxels outside of the volume should repeat the last valid voxel.
+	// Neighbouring bricks are filled by the same thread, which keeps shared noise and graph data in its cache.
+	template<typename Function>
+	void FillBricks(const Function& fillBrick)
+	{
+		ParallelFor3D(m_brickCount, [&](unsigned int x, unsigned int y, unsigned int z)
+		{
+			const unsigned int origin[3] = { x * BRICK_SIZE, y * BRICK_SIZE, z * BRICK_SIZE };
+
+			alignas(16) float values[BRICK_VOXELS];
+			fillBrick(origin, values);
+			SetBrick(GetBrickIndex(x, y, z), values);
+		});
+	}
+
+	// Same for brickCount bricks from firstBrick on in brick order, so a fill can be spread over several calls
+	template<typename Function>
+	void FillBricks(size_t firstBrick, size_t brickCount, const Function& fillBrick)
+	{
+		ParallelFor(brickCount, [&](size_t i)
+		{
+			size_t brick = firstBrick + i;
+			const unsigned int origin[3] =
+			{
+				static_cast<unsigned int>(brick % m_brickCount[0]) * BRICK_SIZE,
+				static_cast<unsigned int>((brick / m_brickCount[0]) % m_brickCount[1]) * BRICK_SIZE,
+				static_cast<unsigned int>(brick / (m_brickCount[0] * m_brickCount[1])) * BRICK_SIZE
+			};
+
+			alignas(16) float values[BRICK_VOXELS];
+			fillBrick(origin, values);
+			SetBrick(brick, values);
+		});
+	}
+
+	// Evaluates density(x, y, z) for every voxel, one brick per task
+	template<typename Function>
+	void Fill(const Function& density)
+	{
+		FillBricks([&](const unsigned int origin[3], float* values)
+		{
+			for (unsigned int z = 0u; z < BRICK_SIZE; ++z)
+			{
+				for (unsigned int y = 0u; y < BRICK_SIZE; ++y)
+				{
+					for (unsigned int x = 0u; x < BRICK_SIZE; ++x)
+					{
+						*values++ = density(
+							std::min(origin[0] + x, m_width - 1),
+							std::min(origin[1] + y, m_height - 1),
+							std::min(origin[2] + z, m_depth - 1));
+					}
+				}
+			}
+		});
+	}
+
+	// Stores a whole brick, collapses it into a single value if all voxels match after encoding
+	void SetBrick(size_t brick, const float* values);
+
+	// Decodes a whole brick x fastest, the same order SetBrick takes
+	void GetBrick(size_t brick, float* values) const;
+
+	// Stored voxels of a brick in the format and layout of the volume, nullptr if the brick is uniform
+	const char* GetBrickData(size_t brick) const { return m_brickData[brick].get(); }
+	float GetUniformValue(size_t brick) const { return m_uniformValues[brick]; }
+
+	// Restores a brick from GetBrickData and GetUniformValue of a volume with the same format and layout.
+	// Data is copied as it is, nullptr makes the brick uniform.
+	void SetBrickData(size_t brick, const char* data, float uniformValue);
+
+	// Calls modifyBrick(origin, values) for every brick overlapping the voxels in [min, max] and stores the result.
+	// All bricks are decoded and modified before any is written back, so modifyBrick may read other voxels through Get.
+	// Returns the number of bricks rewritten.
+	template<typename Function>
+	size_t ModifyBricks(const unsigned int min[3], const unsigned int max[3], const Function& modifyBrick)
+	{
+		unsigned int first[3], count[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			first[axis] = min[axis] >> BRICK_SHIFT;
+			count[axis] = (max[axis] >> BRICK_SHIFT) - first[axis] + 1;
+		}
+
+		size_t brickCount = static_cast<size_t>(count[0]) * count[1] * count[2];
+		std::vector<float> values(brickCount * BRICK_VOXELS);
+		std::vector<size_t> bricks(brickCount);
+
+		ParallelFor(brickCount, [&](size_t i)
+		{
+			const unsigned int brick[3] =
+			{
+				first[0] + static_cast<unsigned int>(i % count[0]),
+				first[1] + static_cast<unsigned int>((i / count[0]) % count[1]),
+				first[2] + static_cast<unsigned int>(i / (count[0] * count[1]))
+			};
+			const unsigned int origin[3] = { brick[0] * BRICK_SIZE, brick[1] * BRICK_SIZE, brick[2] * BRICK_SIZE };
+
+			bricks[i] = GetBrickIndex(brick[0], brick[1], brick[2]);
+			GetBrick(bricks[i], &values[i * BRICK_VOXELS]);
+			modifyBrick(origin, &values[i * BRICK_VOXELS]);
+		});
+
+		ParallelFor(brickCount, [&](size_t i)
+		{
+			SetBrick(bricks[i], &values[i * BRICK_VOXELS]);
+		});
+
+		return brickCount;
+	}
+
+	// False if every voxel in [min, max] lies in uniform bricks on the same side of the iso level
+	bool MayContainSurface(const unsigned int min[3], const unsigned int max[3], float isoLevel) const;
+
+	// Writes the z slices [zStart, zEnd) x fastest into output, in the storage format of the volume
+	void CopySlices(unsigned int zStart, unsigned int zEnd, void* output) const;
+
+	size_t GetBrickCount() const { return m_uniformValues.size(); }
+	size_t GetAllocatedBrickCount() const;
+	size_t GetMemoryUsage() const;
+
+private:
+	template<typename T>
+	void SetBrickAs(size_t brick, const float* values);
+
+	template<typename T>
+	void CopySlicesAs(unsigned int zStart, unsigned int zEnd, T* output) const;
+
+	inline size_t GetBrickIndex(unsigned int brickX, unsigned int brickY, unsigned int brickZ) const
+	{
+		return (static_cast<size_t>(brickZ) * m_brickCount[1] + brickY) * m_brickCount[0] + brickX;
+	}
+
+	// Offsets of every axis use disjoint bits, so they combine with an or
+	inline size_t GetVoxelIndex(unsigned int x, unsigned int y, unsigned int z) const
+	{
+		return m_voxelOffsets[0][x & BRICK_MASK] | m_voxelOffsets[1][y & BRICK_MASK] | m_voxelOffsets[2][z & BRICK_MASK];
+	}
+
+	unsigned int m_width, m_height, m_depth;
+	unsigned int m_brickCount[3];
+	DensityFormat::Enum m_format;
+	BrickLayout::Enum m_layout;
+	unsigned int m_voxelOffsets[3][BRICK_SIZE];
+	// Decoded value of every brick, only used when the brick is uniform
+	std::vector<float> m_uniformValues;
+	std::vector<std::unique_ptr<char[]>> m_brickData;
+};
@@ -0,0 +1,168 @@
+#include "pch.h"
+#include "TerrainPresets.h"
+#include "Noise.h"
+
+namespace HeightMapConfig
+{
+	//Largest distance of the ground from the middle of the volume, in mesh space
+	const float AMPLITUDE = 0.25f;
+}
+
+const float TerrainPresets::DISTANCE_BAND = 2.0f;
+
+namespace
+{
+	//Box covering the voxels from a quarter to three quarters of every axis, its surface lies half a voxel outside of them
+	DensityGraph::NodeId AddInnerBox(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth)
+	{
+		XMFLOAT3 minimum(width / 4 - 0.5f, height / 4 - 0.5f, depth / 4 - 0.5f);
+		XMFLOAT3 maximum(width - width / 4 + 0.5f, height - height / 4 + 0.5f, depth - depth / 4 + 0.5f);
+
+		return graph.Box(
+			XMFLOAT3((minimum.x + maximum.x) * 0.5f, (minimum.y + maximum.y) * 0.5f, (minimum.z + maximum.z) * 0.5f),
+			XMFLOAT3((maximum.x - minimum.x) * 0.5f, (maximum.y - minimum.y) * 0.5f, (maximum.z - minimum.z) * 0.5f));
+	}
+
+	void BuildCube(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth)
+	{
+		graph.SetRoot(graph.Truncate(AddInnerBox(graph, width, height, depth), TerrainPresets::DISTANCE_BAND));
+	}
+
+	void BuildSphere(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth)
+	{
+		DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(width / 2.0f, height / 2.0f, depth / 2.0f);
+
+		float maxDistance = width / 2.5f;
+
+		graph.SetRoot(graph.Truncate(graph.Sphere(center, maxDistance), TerrainPresets::DISTANCE_BAND));
+	}
+
+	void BuildPillar(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth)
+	{
+		float maxDistance = width / 25.0f;
+
+		XMFLOAT3 axisStart(width / 2.0f, -static_cast<float>(height), depth / 2.0f);
+		XMFLOAT3 axisEnd(width / 2.0f, 2.0f * height, depth / 2.0f);
+
+		graph.SetRoot(graph.Truncate(graph.Capsule(axisStart, axisEnd, maxDistance), TerrainPresets::DISTANCE_BAND));
+	}
+
+	void BuildNoise(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth, float noiseScale)
+	{
+		DensityGraph::NodeId noise = graph.Scale(graph.Noise3D(noiseScale, 1.0f), XMFLOAT3(1.0f / width, 1.0f / height, 1.0f / depth));
+
+		graph.SetRoot(graph.Truncate(graph.Intersection(AddInnerBox(graph, width, height, depth), noise), TerrainPresets::DISTANCE_BAND));
+	}
+
+	void BuildBumpySphere(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth, float noiseScale)
+	{
+		DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(width / 2.0f, height / 2.0f, depth / 2.0f);
+
+		float maxDistance = width / 2.5f; // Keep it slightly smaller than cube step count
+
+		//Solid where the noise is negative
+		DensityGraph::NodeId noise = graph.Scale(graph.Noise3D(noiseScale, -1.0f), XMFLOAT3(1.0f / width, 1.0f / height, 1.0f / depth));
+
+		graph.SetRoot(graph.Truncate(graph.Intersection(graph.Sphere(center, maxDistance), noise), TerrainPresets::DISTANCE_BAND));
+	}
+
+	void BuildHelix(DensityGraph& graph, unsigned int width, unsigned int height, unsigned int depth)
+	{
+		float maxDistance = width / 5.f;
+
+		//Vertical axis through the middle, long enough to never end inside the volume
+		XMFLOAT3 axisStart(width / 2.0f, -static_cast<float>(height), depth / 2.0f);
+		XMFLOAT3 axisEnd(width / 2.0f, 2.0f * height, depth / 2.0f);
+		XMFLOAT3 center(width / 2.0f, 0.0f, depth / 2.0f);
+
+		//Pilars
+		DensityGraph::NodeId helix = graph.Helix(center, 10.0f, 1.0f / 7.0f, 0.0f, maxDistance * 0.45f);
+		helix = graph.Union(helix, graph.Helix(center, 10.0f, 1.0f / 7.0f, DirectX::XM_PI * 0.66f, maxDistance * 0.45f), maxDistance * 0.5f);
+		helix = graph.Union(helix, graph.Helix(center, 10.0f, 1.0f / 7.0f, DirectX::XM_PI * 0.66f * 2.0f, maxDistance * 0.45f), maxDistance * 0.5f);
+
+		//Water Flow Channel
+		helix = graph.Subtraction(helix, graph.Capsule(axisStart, axisEnd, maxDistance * 0.3f), maxDistance * 0.25f);
+
+		//Teraces
+		helix = graph.Add(helix, graph.Wave(XMFLOAT3(0.0f, 1.0f, 0.0f), 1.0f, 2.0f));
+
+		//Outer Bounds
+		helix = graph.Intersection(helix, graph.Capsule(axisStart, axisEnd, maxDistance * 1.5f));
+
+		graph.SetRoot(graph.Truncate(helix, TerrainPresets::DISTANCE_BAND));
+	}
+}
+
+const char* TerrainPresets::GetName(Type::Enum type)
+{
+	switch (type)
+	{
+	case Type::CUBE:
+		return "cube";
+	case Type::NOISE:
+		return "noise";
+	case Type::SPHERE:
+		return "sphere";
+	case Type::BUMPY_SPHERE:
+		return "bumpy_sphere";
+	case Type::HEIGHT_MAP:
+		return "height_map";
+	case Type::HELIX:
+		return "helix";
+	case Type::PILLAR:
+		return "pillar";
+	default:
+		return "unknown";
+	}
+}
+
+bool TerrainPresets::UsesNoiseScale(Type::Enum type)
+{
+	return type == Type::NOISE || type == Type::BUMPY_SPHERE || type == Type::HEIGHT_MAP;
+}
+
+void TerrainPresets::BuildDensityGraph(DensityGraph& graph, Type::Enum type, unsigned int width, unsigned int height, unsigned int depth, float noiseScale)
+{
+	switch (type)
+	{
+	case Type::CUBE:
+		BuildCube(graph, width, height, depth);
+		break;
+	case Type::SPHERE:
+		BuildSphere(graph, width, height, depth);
+		break;
+	case Type::PILLAR:
+		BuildPillar(graph, width, height, depth);
+		break;
+	case Type::NOISE:
+		BuildNoise(graph, width, height, depth, noiseScale);
+		break;
+	case Type::BUMPY_SPHERE:
+		BuildBumpySphere(graph, width, height, depth, noiseScale);
+		break;
+	case Type::HELIX:
+		BuildHelix(graph, width, height, depth);
+		break;
+	default:
+		break;
+	}
+}
+
+void TerrainPresets::FillHeightfield(Heightfield& heightfield, float noiseScale)
+{
+	FillHeightfieldRows(heightfield, noiseScale, 0u, heightfield.GetDepth());
+	heightfield.BuildQuadtree();
+}
+
+void TerrainPresets::FillHeightfieldRows(Heightfield& heightfield, float noiseScale, unsigned int firstRow, unsigned int rowCount)
+{
+	Noise noise;
+	unsigned int width = heightfield.GetWidth(), depth = heightfield.GetDepth();
+
+	heightfield.FillRows(firstRow, rowCount, [&](unsigned int x, unsigned int z)
+	{
+		double noiseX = static_cast<double>(x) / width * noiseScale;
+		double noiseZ = static_cast<double>(z) / depth * noiseScale;
+		return HeightMapConfig::AMPLITUDE * static_cast<float>(noise.Noise2D(noiseX, noiseZ));
+	});
+}
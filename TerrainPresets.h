@@ -0,0 +1,39 @@
+#pragma once
+#include "DensityGraph.h"
+#include "Heightfield.h"
+
+// The terrain presets the game can generate, as density graphs and heightfields.
+// Nothing here needs a device, so GeometryData and the headless benchmark build the exact same terrain.
+class TerrainPresets
+{
+public:
+	struct Type
+	{
+		enum Enum
+		{
+			CUBE,
+			NOISE,
+			SPHERE,
+			BUMPY_SPHERE,
+			HEIGHT_MAP,
+			HELIX,
+			PILLAR,
+			COUNT
+		};
+	};
+
+	// Distance fields are clamped this many voxels away from the surface so most bricks end up uniform.
+	// Two voxels still leave the central differences next to the surface unclamped.
+	static const float DISTANCE_BAND;
+
+	static const char* GetName(Type::Enum type);
+	// Whether the noise scale changes the terrain, other presets can be kept when only the scale changes
+	static bool UsesNoiseScale(Type::Enum type);
+
+	// Adds the nodes of a volume preset to the graph. HEIGHT_MAP has no volume and leaves the graph empty.
+	static void BuildDensityGraph(DensityGraph& graph, Type::Enum type, unsigned int width, unsigned int height, unsigned int depth, float noiseScale);
+	// Fills the heights of the HEIGHT_MAP preset, the heightfield decides the resolution
+	static void FillHeightfield(Heightfield& heightfield, float noiseScale);
+	// Fills rows [firstRow, firstRow + rowCount) of the preset and leaves the quadtree to the caller
+	static void FillHeightfieldRows(Heightfield& heightfield, float noiseScale, unsigned int firstRow, unsigned int rowCount);
+};
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "TimerClass.h"
+#include "Profiler.h"
 
 TimerClass::TimerClass()
 {
@@ -15,34 +16,19 @@ TimerClass::~TimerClass()
 
 bool TimerClass::Initialize()
 {
-	LARGE_INTEGER li;
-	QueryPerformanceFrequency(&li);
-
-	ticksPerMs = float(double(li.QuadPart)/1000.0);
-
-	if(ticksPerMs == 0)
-	{
-		return false;
-	}
-
-	QueryPerformanceFrequency(&li);
-	startTime = li.QuadPart;
+	startTime = Profiler::Now();
+	frameTime = 0.0f;
+	allTime = 0.0f;
 
 	return true;
 }
 
 void TimerClass::Frame()
 {
-	INT64 currentTime = 0;
-	LARGE_INTEGER li;
-	float timeDifference;
-
-	QueryPerformanceCounter(&li);
-	currentTime = li.QuadPart;
+	uint64_t currentTime = Profiler::Now();
 
-	timeDifference = static_cast<float>(currentTime - startTime);
-	frameTime = timeDifference / ticksPerMs;
-	allTime = currentTime / ticksPerMs;
+	frameTime = static_cast<float>((currentTime - startTime) / 1000000.0);
+	allTime = static_cast<float>(currentTime / 1000000.0);
 
 	startTime = currentTime;
 }
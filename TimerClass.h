@@ -1,6 +1,6 @@
 #pragma once
 
-#include <Windows.h>
+#include <cstdint>
 
 class TimerClass
 {
@@ -16,7 +16,7 @@ public:
 	float GetFrameTime();
 
 private:
-	INT64 startTime;
-	float ticksPerMs, frameTime, allTime;
-	double frequency;
+	// Profiler::Now nanoseconds, portable unlike QueryPerformanceCounter
+	uint64_t startTime;
+	float frameTime, allTime;
 };
\ No newline at end of file
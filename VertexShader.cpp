@@ -27,11 +27,7 @@ bool VertexShader::Initialize(ID3D11Device* device, WCHAR* filename, D3D11_INPUT
 	ID3DBlob* errorMessage;
 	ID3DBlob* vertexShaderBuffer;
 
-	DWORD shaderflags =
-		D3DCOMPILE_ENABLE_STRICTNESS
-	|	D3DCOMPILE_DEBUG
-	|	D3DCOMPILE_SKIP_OPTIMIZATION
-	;
+	DWORD shaderflags = ShaderUtility::COMPILE_FLAGS;
 
 	errorMessage = nullptr;
 	vertexShaderBuffer = nullptr;
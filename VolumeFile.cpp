@@ -0,0 +1,450 @@
+#include "pch.h"
+#include "VolumeFile.h"
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	const char MAGIC[4] = { 'T', 'V', 'C', 'F' };
+
+	//Brick tags inside a chunk, both are followed by the uniform value of the brick, encoded ones then by the byte count and the runs
+	const uint8_t UNIFORM_BRICK = 0;
+	const uint8_t ENCODED_BRICK = 1;
+
+	//Control bytes below 128 start c + 1 literal values, the others repeat the next value c - 127 times
+	const size_t MAX_LITERALS = 128;
+	const size_t MAX_RUN = 128;
+
+	template<typename T>
+	void Append(std::vector<char>& output, const T& value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		output.insert(output.end(), bytes, bytes + sizeof(T));
+	}
+
+	template<typename T>
+	void EncodeRuns(const T* values, size_t count, std::vector<char>& output)
+	{
+		size_t i = 0u;
+		while (i < count)
+		{
+			size_t run = 1u;
+			while (i + run < count && run < MAX_RUN && values[i + run] == values[i])
+			{
+				++run;
+			}
+
+			if (run > 1u)
+			{
+				output.push_back(static_cast<char>(127u + run));
+				Append(output, values[i]);
+				i += run;
+				continue;
+			}
+
+			//Literals until the next pair of equal values, which is cheaper as a run
+			size_t start = i;
+			while (i < count && i - start < MAX_LITERALS && (i + 1 == count || values[i + 1] != values[i]))
+			{
+				++i;
+			}
+
+			output.push_back(static_cast<char>(i - start - 1u));
+			const char* bytes = reinterpret_cast<const char*>(values + start);
+			output.insert(output.end(), bytes, bytes + (i - start) * sizeof(T));
+		}
+	}
+
+	//False if the runs do not fill exactly count values
+	bool DecodeRuns(const char* input, size_t size, size_t elementSize, char* output, size_t count)
+	{
+		size_t position = 0u, written = 0u;
+		while (written < count)
+		{
+			if (position >= size)
+			{
+				return false;
+			}
+
+			uint8_t control = static_cast<uint8_t>(input[position++]);
+			if (control < 128u)
+			{
+				size_t literals = control + 1u;
+				if (written + literals > count || size - position < literals * elementSize)
+				{
+					return false;
+				}
+
+				std::memcpy(output + written * elementSize, input + position, literals * elementSize);
+				position += literals * elementSize;
+				written += literals;
+			}
+			else
+			{
+				size_t run = control - 127u;
+				if (written + run > count || size - position < elementSize)
+				{
+					return false;
+				}
+
+				for (size_t i = 0u; i < run; ++i)
+				{
+					std::memcpy(output + (written + i) * elementSize, input + position, elementSize);
+				}
+				position += elementSize;
+				written += run;
+			}
+		}
+
+		return position == size;
+	}
+
+	//Encodes the stored voxels of a brick with the element type of the volume
+	void EncodeBrick(const SparseVolume& volume, size_t brick, std::vector<char>& output)
+	{
+		const char* data = volume.GetBrickData(brick);
+
+		switch (volume.GetFormat())
+		{
+		case DensityFormat::SNORM16:
+			EncodeRuns(reinterpret_cast<const int16_t*>(data), SparseVolume::BRICK_VOXELS, output);
+			break;
+		case DensityFormat::SNORM8:
+			EncodeRuns(reinterpret_cast<const int8_t*>(data), SparseVolume::BRICK_VOXELS, output);
+			break;
+		default:
+			EncodeRuns(reinterpret_cast<const float*>(data), SparseVolume::BRICK_VOXELS, output);
+			break;
+		}
+	}
+
+	//Bricks of a chunk in [first, last), clipped to the bricks of the volume
+	void GetChunkBricks(size_t chunk, const uint32_t chunkCount[3], const unsigned int brickCount[3], unsigned int first[3], unsigned int last[3])
+	{
+		const size_t coordinates[3] = { chunk % chunkCount[0], (chunk / chunkCount[0]) % chunkCount[1], chunk / (static_cast<size_t>(chunkCount[0]) * chunkCount[1]) };
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			first[axis] = static_cast<unsigned int>(coordinates[axis]) * VolumeFile::CHUNK_BRICKS;
+			last[axis] = std::min(first[axis] + VolumeFile::CHUNK_BRICKS, brickCount[axis]);
+		}
+	}
+
+	//Same brick order as SparseVolume::FillBricks, x fastest
+	inline size_t GetBrickIndex(const unsigned int brickCount[3], unsigned int x, unsigned int y, unsigned int z)
+	{
+		return (static_cast<size_t>(z) * brickCount[1] + y) * brickCount[0] + x;
+	}
+
+	void GetBrickCount(unsigned int width, unsigned int height, unsigned int depth, unsigned int brickCount[3])
+	{
+		brickCount[0] = (width + SparseVolume::BRICK_MASK) >> SparseVolume::BRICK_SHIFT;
+		brickCount[1] = (height + SparseVolume::BRICK_MASK) >> SparseVolume::BRICK_SHIFT;
+		brickCount[2] = (depth + SparseVolume::BRICK_MASK) >> SparseVolume::BRICK_SHIFT;
+	}
+}
+
+bool VolumeFile::Write(const std::wstring& path, const SparseVolume& volume, uint64_t& bytesWritten)
+{
+	VolumeFileReader::Header header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = FORMAT_VERSION;
+	header.width = volume.GetWidth();
+	header.height = volume.GetHeight();
+	header.depth = volume.GetDepth();
+	header.format = volume.GetFormat();
+	header.layout = volume.GetLayout();
+	header.chunkBricks = CHUNK_BRICKS;
+
+	unsigned int brickCount[3];
+	GetBrickCount(header.width, header.height, header.depth, brickCount);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		header.chunkCount[axis] = (brickCount[axis] + CHUNK_BRICKS - 1) / CHUNK_BRICKS;
+	}
+
+	size_t chunkCount = static_cast<size_t>(header.chunkCount[0]) * header.chunkCount[1] * header.chunkCount[2];
+	std::vector<std::vector<char>> payloads(chunkCount);
+	std::vector<VolumeFileReader::ChunkEntry> directory(chunkCount);
+
+	ParallelFor(chunkCount, [&](size_t chunk)
+	{
+		unsigned int first[3], last[3];
+		GetChunkBricks(chunk, header.chunkCount, brickCount, first, last);
+
+		float uniformValue = volume.GetUniformValue(GetBrickIndex(brickCount, first[0], first[1], first[2]));
+		bool uniform = true;
+		std::vector<char>& payload = payloads[chunk];
+
+		for (unsigned int z = first[2]; z < last[2]; ++z)
+		{
+			for (unsigned int y = first[1]; y < last[1]; ++y)
+			{
+				for (unsigned int x = first[0]; x < last[0]; ++x)
+				{
+					size_t brick = GetBrickIndex(brickCount, x, y, z);
+
+					if (!volume.GetBrickData(brick))
+					{
+						uniform = uniform && volume.GetUniformValue(brick) == uniformValue;
+						payload.push_back(static_cast<char>(UNIFORM_BRICK));
+						Append(payload, volume.GetUniformValue(brick));
+						continue;
+					}
+
+					uniform = false;
+					payload.push_back(static_cast<char>(ENCODED_BRICK));
+					Append(payload, volume.GetUniformValue(brick));
+
+					//Byte count of the runs goes in front of them once it is known
+					size_t sizeOffset = payload.size();
+					Append(payload, uint32_t(0));
+					EncodeBrick(volume, brick, payload);
+
+					uint32_t size = static_cast<uint32_t>(payload.size() - sizeOffset - sizeof(uint32_t));
+					std::memcpy(&payload[sizeOffset], &size, sizeof(size));
+				}
+			}
+		}
+
+		directory[chunk].uniformValue = uniformValue;
+		if (uniform)
+		{
+			payload.clear();
+			payload.shrink_to_fit();
+		}
+	});
+
+	uint64_t offset = sizeof(header);
+	for (size_t chunk = 0u; chunk < chunkCount; ++chunk)
+	{
+		directory[chunk].offset = offset;
+		directory[chunk].size = static_cast<uint32_t>(payloads[chunk].size());
+		offset += payloads[chunk].size();
+	}
+
+	//The reader uses the directory in place, so it has to be aligned
+	size_t padding = static_cast<size_t>((alignof(VolumeFileReader::ChunkEntry) - offset % alignof(VolumeFileReader::ChunkEntry)) % alignof(VolumeFileReader::ChunkEntry));
+	header.directoryOffset = offset + padding;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const std::vector<char>& payload : payloads)
+	{
+		file.write(payload.data(), payload.size());
+	}
+	const char zeros[alignof(VolumeFileReader::ChunkEntry)] = {};
+	file.write(zeros, padding);
+	file.write(reinterpret_cast<const char*>(directory.data()), directory.size() * sizeof(VolumeFileReader::ChunkEntry));
+
+	if (!file)
+	{
+		printf("Writing volume file %ls failed\n\r", path.c_str());
+		return false;
+	}
+
+	bytesWritten = header.directoryOffset + directory.size() * sizeof(VolumeFileReader::ChunkEntry);
+	return true;
+}
+
+VolumeFileReader::VolumeFileReader()
+	: m_directory(nullptr)
+{
+	std::memset(&m_header, 0, sizeof(m_header));
+	std::fill(m_brickCount, m_brickCount + 3, 0u);
+}
+
+bool VolumeFileReader::Open(const std::wstring& path)
+{
+	m_volume.reset();
+	m_touched.clear();
+
+	if (!m_file.Open(path) || m_file.GetSize() < sizeof(Header))
+	{
+		printf("Volume file %ls could not be opened\n\r", path.c_str());
+		return false;
+	}
+
+	std::memcpy(&m_header, m_file.GetData(), sizeof(Header));
+	if (std::memcmp(m_header.magic, MAGIC, sizeof(MAGIC)) != 0 || m_header.version != VolumeFile::FORMAT_VERSION || m_header.chunkBricks != VolumeFile::CHUNK_BRICKS ||
+		m_header.format > DensityFormat::SNORM8 || m_header.layout > BrickLayout::MORTON)
+	{
+		printf("Volume file %ls has an unknown format\n\r", path.c_str());
+		return false;
+	}
+
+	GetBrickCount(m_header.width, m_header.height, m_header.depth, m_brickCount);
+	size_t chunkCount = 1u;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (m_header.chunkCount[axis] != (m_brickCount[axis] + VolumeFile::CHUNK_BRICKS - 1) / VolumeFile::CHUNK_BRICKS)
+		{
+			printf("Volume file %ls has a broken header\n\r", path.c_str());
+			return false;
+		}
+		chunkCount *= m_header.chunkCount[axis];
+	}
+
+	//The directory and every chunk it points at have to lie inside the file
+	uint64_t directoryOffset = m_header.directoryOffset;
+	if (directoryOffset > m_file.GetSize() || (m_file.GetSize() - directoryOffset) / sizeof(ChunkEntry) < chunkCount || directoryOffset % alignof(ChunkEntry) != 0)
+	{
+		printf("Volume file %ls is cut short\n\r", path.c_str());
+		return false;
+	}
+
+	m_directory = reinterpret_cast<const ChunkEntry*>(m_file.GetData() + directoryOffset);
+	for (size_t chunk = 0u; chunk < chunkCount; ++chunk)
+	{
+		if (m_directory[chunk].offset > directoryOffset || m_directory[chunk].size > directoryOffset - m_directory[chunk].offset)
+		{
+			printf("Volume file %ls has a broken chunk directory\n\r", path.c_str());
+			return false;
+		}
+	}
+
+	m_volume = std::make_shared<SparseVolume>(m_header.width, m_header.height, m_header.depth, -1.0f,
+		static_cast<DensityFormat::Enum>(m_header.format), static_cast<BrickLayout::Enum>(m_header.layout));
+	m_touched.assign(chunkCount, 0);
+	return true;
+}
+
+bool VolumeFileReader::Touch(const unsigned int min[3], const unsigned int max[3])
+{
+	if (!m_volume)
+	{
+		return false;
+	}
+
+	unsigned int first[3], count[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		first[axis] = (min[axis] >> SparseVolume::BRICK_SHIFT) / VolumeFile::CHUNK_BRICKS;
+		unsigned int last = std::min((max[axis] >> SparseVolume::BRICK_SHIFT) / VolumeFile::CHUNK_BRICKS, m_header.chunkCount[axis] - 1);
+		count[axis] = last >= first[axis] ? last - first[axis] + 1 : 0u;
+	}
+
+	std::vector<size_t> chunks;
+	for (unsigned int z = first[2]; z < first[2] + count[2]; ++z)
+	{
+		for (unsigned int y = first[1]; y < first[1] + count[1]; ++y)
+		{
+			for (unsigned int x = first[0]; x < first[0] + count[0]; ++x)
+			{
+				size_t chunk = (static_cast<size_t>(z) * m_header.chunkCount[1] + y) * m_header.chunkCount[0] + x;
+				if (!m_touched[chunk])
+				{
+					chunks.push_back(chunk);
+				}
+			}
+		}
+	}
+
+	//Chunks cover disjoint bricks, so they can be written into the volume at the same time
+	std::vector<uint8_t> decoded(chunks.size());
+	ParallelFor(chunks.size(), [&](size_t i)
+	{
+		decoded[i] = DecodeChunk(chunks[i]) ? 1 : 0;
+	});
+
+	bool valid = true;
+	for (size_t i = 0u; i < chunks.size(); ++i)
+	{
+		m_touched[chunks[i]] = 1;
+		valid = valid && decoded[i] != 0;
+	}
+
+	return valid;
+}
+
+bool VolumeFileReader::TouchAll()
+{
+	const unsigned int min[3] = { 0u, 0u, 0u };
+	const unsigned int max[3] = { m_header.width - 1, m_header.height - 1, m_header.depth - 1 };
+	return Touch(min, max);
+}
+
+float VolumeFileReader::Get(unsigned int x, unsigned int y, unsigned int z)
+{
+	const unsigned int voxel[3] = { x, y, z };
+	Touch(voxel, voxel);
+	return m_volume->Get(x, y, z);
+}
+
+size_t VolumeFileReader::GetTouchedChunkCount() const
+{
+	return static_cast<size_t>(std::count(m_touched.begin(), m_touched.end(), 1));
+}
+
+bool VolumeFileReader::DecodeChunk(size_t chunk)
+{
+	const ChunkEntry& entry = m_directory[chunk];
+	unsigned int first[3], last[3];
+	GetChunkBricks(chunk, m_header.chunkCount, m_brickCount, first, last);
+
+	if (entry.size == 0)
+	{
+		for (unsigned int z = first[2]; z < last[2]; ++z)
+		{
+			for (unsigned int y = first[1]; y < last[1]; ++y)
+			{
+				for (unsigned int x = first[0]; x < last[0]; ++x)
+				{
+					m_volume->SetBrickData(GetBrickIndex(m_brickCount, x, y, z), nullptr, entry.uniformValue);
+				}
+			}
+		}
+		return true;
+	}
+
+	//Only now are the pages of the chunk read from the file
+	const char* input = m_file.GetData() + entry.offset;
+	size_t size = entry.size, position = 0u;
+	size_t elementSize = m_volume->GetElementSize();
+	std::vector<char> brickData(SparseVolume::BRICK_VOXELS * elementSize);
+
+	for (unsigned int z = first[2]; z < last[2]; ++z)
+	{
+		for (unsigned int y = first[1]; y < last[1]; ++y)
+		{
+			for (unsigned int x = first[0]; x < last[0]; ++x)
+			{
+				size_t brick = GetBrickIndex(m_brickCount, x, y, z);
+				if (size - position < 1 + sizeof(float))
+				{
+					return false;
+				}
+
+				uint8_t tag = static_cast<uint8_t>(input[position++]);
+				float uniformValue;
+				std::memcpy(&uniformValue, input + position, sizeof(uniformValue));
+				position += sizeof(uniformValue);
+
+				if (tag == UNIFORM_BRICK)
+				{
+					m_volume->SetBrickData(brick, nullptr, uniformValue);
+					continue;
+				}
+
+				uint32_t encodedSize;
+				if (size - position < sizeof(encodedSize))
+				{
+					return false;
+				}
+				std::memcpy(&encodedSize, input + position, sizeof(encodedSize));
+				position += sizeof(encodedSize);
+
+				if (tag != ENCODED_BRICK || encodedSize > size - position ||
+					!DecodeRuns(input + position, encodedSize, elementSize, brickData.data(), SparseVolume::BRICK_VOXELS))
+				{
+					return false;
+				}
+				position += encodedSize;
+
+				m_volume->SetBrickData(brick, brickData.data(), uniformValue);
+			}
+		}
+	}
+
+	return position == size;
+}
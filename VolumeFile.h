@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SparseVolume.h"
+#include "MappedFile.h"
+
+// Chunked file format for density volumes.
+// A header is followed by the compressed chunks and a directory with the offset and size of every chunk,
+// so a reader can find any chunk without touching the others. A chunk holds CHUNK_BRICKS^3 bricks,
+// chunks where every brick is uniform with the same value only take up their directory entry.
+// Other bricks are stored in the format and layout of the volume, run length encoded: truncated
+// distance fields are saturated away from the surface, so most of a brick is runs of the same value.
+class VolumeFile
+{
+public:
+	// Bumped whenever the layout of the file changes
+	static const uint32_t FORMAT_VERSION = 1;
+	// Bricks along the edge of a chunk, 32^3 voxels
+	static const unsigned int CHUNK_BRICKS = 4;
+
+	// Compresses the chunks in parallel and writes them in one pass, bytesWritten is the size of the file
+	static bool Write(const std::wstring& path, const SparseVolume& volume, uint64_t& bytesWritten);
+};
+
+// Opens a volume file without reading it. Chunks are decompressed into a sparse volume the first time
+// voxels in them are touched, the rest of the file is never paged in, so large worlds open instantly
+// and only take memory for the parts that were visited.
+// Not thread safe, touch the chunks before handing the volume to parallel readers.
+class VolumeFileReader
+{
+public:
+	VolumeFileReader();
+
+	// Maps the file and checks the header and chunk directory
+	bool Open(const std::wstring& path);
+
+	unsigned int GetWidth() const { return m_header.width; }
+	unsigned int GetHeight() const { return m_header.height; }
+	unsigned int GetDepth() const { return m_header.depth; }
+
+	// Decompresses the chunks overlapping the voxels in [min, max] that were not touched yet, in parallel.
+	// False if one of them is corrupt, it is then left uniform.
+	bool Touch(const unsigned int min[3], const unsigned int max[3]);
+	bool TouchAll();
+
+	// Touches the chunk of the voxel and reads it
+	float Get(unsigned int x, unsigned int y, unsigned int z);
+
+	// Voxels in chunks that were not touched yet read as -1, the value outside of every generated volume
+	std::shared_ptr<SparseVolume> GetVolume() const { return m_volume; }
+	size_t GetTouchedChunkCount() const;
+	size_t GetChunkCount() const { return m_touched.size(); }
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t width, height, depth;
+		uint32_t format, layout;
+		uint32_t chunkBricks;
+		uint32_t chunkCount[3];
+		uint32_t padding;
+		uint64_t directoryOffset;
+	};
+
+	// A size of 0 marks a chunk of uniform bricks that all hold uniformValue
+	struct ChunkEntry
+	{
+		uint64_t offset;
+		uint32_t size;
+		float uniformValue;
+	};
+
+private:
+	bool DecodeChunk(size_t chunk);
+
+	MappedFile m_file;
+	Header m_header;
+	const ChunkEntry* m_directory;
+	unsigned int m_brickCount[3];
+	std::shared_ptr<SparseVolume> m_volume;
+	std::vector<uint8_t> m_touched;
+};
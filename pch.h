@@ -5,6 +5,32 @@
 
 #pragma once
 
+#ifdef HEADLESS
+// Headless builds such as the benchmark only compile generation, meshing and collision code.
+// They need DirectXMath and SimpleMath but no window, device or DirectXTK library.
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <d3d11.h>
+#else
+// DirectX-Headers provide the Windows types and the d3d12.h SimpleMath expects outside of Windows
+#include <wsl/winadapter.h>
+#include <directx/d3d12.h>
+#endif
+
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <SimpleMath.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+
+#include <stdio.h>
+#else
+
 #include <WinSDKVer.h>
 #ifndef _WIN32_WINNT
 #define _WIN32_WINNT 0x0600
@@ -93,4 +119,5 @@ namespace DX
             throw com_exception(hr);
         }
     }
-}
\ No newline at end of file
+}
+#endif